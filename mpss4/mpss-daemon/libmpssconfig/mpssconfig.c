@@ -581,6 +581,7 @@ mc_setblock(const std::vector<std::string>& args, struct mic_info *mic,
 		mpss_elist& perrs, const char *cfile, int lineno)
 {
 	std::string source_path;
+	std::string base_path;
 	std::string name;
 	mpss_block_device_mode mode = mpss_block_device_mode::READ_ONLY;
 
@@ -614,6 +615,8 @@ mc_setblock(const std::vector<std::string>& args, struct mic_info *mic,
 			name = value;
 		} else if (key == "path") {
 			source_path = value;
+		} else if (key == "base") {
+			base_path = value;
 		} else if (key == "mode") {
 			if (value == "rw") {
 				mode = mpss_block_device_mode::READ_WRITE;
@@ -639,13 +642,22 @@ mc_setblock(const std::vector<std::string>& args, struct mic_info *mic,
 		return EINVAL;
 	}
 
-	if (source_path.empty() || name.empty() || !path_exists(source_path)) {
+	/* With a base image the path is an overlay mpssd creates on demand */
+	if (source_path.empty() || name.empty() ||
+	    (base_path.empty() && !path_exists(source_path))) {
 		perrs.add(PERROR, "%s: [Parse FATAL] %s line %d: BlockDevice: source or block name not defined",
 			mic->name.c_str(), cfile, lineno);
 		return EINVAL;
 	}
 
+	if (!base_path.empty() && !path_exists(base_path)) {
+		perrs.add(PERROR, "%s: [Parse FATAL] %s line %d: BlockDevice: base image %s does not exist",
+			mic->name.c_str(), cfile, lineno, base_path.c_str());
+		return EINVAL;
+	}
+
 	mic->config.blockdevs[idx].source = source_path;
+	mic->config.blockdevs[idx].base = base_path;
 	mic->config.blockdevs[idx].dest = name;
 	mic->config.blockdevs[idx].mode = mode;
 
@@ -669,6 +681,7 @@ mc_setrootimage(const std::vector<std::string>& args, struct mic_info *mic,
 		mpss_elist& perrs, const char *cfile, int lineno)
 {
 	std::string source_path = args[0];
+	std::string base_path = args.size() > 1 ? args[1] : "";
 	std::string name = BLOCK_NAME_ROOT;
 
 	int idx = mic->config.blocknum;
@@ -681,13 +694,17 @@ mc_setrootimage(const std::vector<std::string>& args, struct mic_info *mic,
 		return 0;
 	}
 
-	if (source_path.empty() || !path_exists(args[0])) {
+	/* RootFsImage <overlay> <base> serves a shared base copy-on-write */
+	if (source_path.empty() ||
+	    (base_path.empty() && !path_exists(source_path)) ||
+	    (!base_path.empty() && !path_exists(base_path))) {
 		perrs.add(PERROR, "%s: [Parse FATAL] %s line %d: RootFsImage path does not exist",
 			mic->name.c_str(), cfile, lineno);
 		return EINVAL;
 	}
 
 	mic->config.blockdevs[idx].source = source_path;
+	mic->config.blockdevs[idx].base = base_path;
 	mic->config.blockdevs[idx].dest = name;
 	mic->config.blockdevs[idx].mode = mpss_block_device_mode::READ_WRITE;
 
@@ -841,6 +858,7 @@ mpss_clear_config(struct mconfig *config)
 
 	for (int i = 0; i < BLOCK_MAX_COUNT; ++i) {
 		config->blockdevs[i].source.clear();
+		config->blockdevs[i].base.clear();
 		config->blockdevs[i].dest.clear();
 		config->blockdevs[i].options = 0;
 	}
@@ -865,8 +883,8 @@ struct tokens tokens[] = {
 	{CONFIG_CARD_MAC, 1, 1, mc_cardmac, false, false},
 	{CONFIG_KERNEL_CMDLINE, 1, 1, mc_extra, true, false},
 	{CONFIG_INIT_RAMFS, 1, 1, mc_initramfs, false, true},
-	{CONFIG_BLOCK_DEVICE, 2, 3, mc_setblock, true, false},
-	{CONFIG_ROOTFS_IMAGE, 1, 1, mc_setrootimage, false, false},
+	{CONFIG_BLOCK_DEVICE, 2, 4, mc_setblock, true, false},
+	{CONFIG_ROOTFS_IMAGE, 1, 2, mc_setrootimage, false, false},
 	{CONFIG_REPOFS_IMAGE, 1, 1, mc_setrepoimage, false, false},
 	{CONFIG_SHUTDOWN_TIMEOUT, 1, 1, mc_shutdown_to, false, false},
 	{CONFIG_BOOT_TIMEOUT, 1, 1, mc_boot_to, false, false},
@@ -174,8 +174,6 @@ struct mic_virtblk_info {
 	void            *block_dp;
 	volatile sig_atomic_t   signaled;
 	std::string     backend_file;
-	int             backend;
-	void            *backend_addr;
 	long            backend_size;
 	size_t          dp_size;
 };
@@ -227,6 +225,7 @@ enum class mpss_block_device_mode {
 struct mblock {	// BlockDevice
 	uint64_t options;
 	std::string source;
+	std::string base;	// read-only base image, source is then an overlay
 	std::string dest;
 	mpss_block_device_mode mode;
 };
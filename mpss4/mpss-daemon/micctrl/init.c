@@ -384,6 +384,9 @@ const char *block_device_desc =
 	"#             in the /dev/mapper directory\n"
 	"#     <mode>: access mode - ro (read-only) / rw (read-write)\n"
 	"#     <path>: path to the block device image file on the host\n"
+	"#     <base>: optional read-only base image shared between coprocessors;\n"
+	"#             <path> is then a sparse copy-on-write overlay created on\n"
+	"#             first use, and removing it restores the base contents\n"
 	"#     The <mode> parameter is optional; if it does not exist, ro (read-only) is used\n"
 	"#\n"
 	"# Note: Using the same block device image in read-write mode for more\n"
@@ -0,0 +1,563 @@
+/*
+ * Copyright (c) 2016, Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ */
+
+#include "blkio.h"
+
+#include <algorithm>
+#include <utility>
+
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static int
+pwrite_full(int fd, const char *buf, size_t len, off_t offset)
+{
+	while (len) {
+		ssize_t ret = pwrite(fd, buf, len, offset);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		buf += ret;
+		len -= ret;
+		offset += ret;
+	}
+	return 0;
+}
+
+/* Reads past the end of the backend file return zeroes */
+static int
+pread_full(int fd, char *buf, size_t len, off_t offset)
+{
+	while (len) {
+		ssize_t ret = pread(fd, buf, len, offset);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		if (ret == 0) {
+			memset(buf, 0, len);
+			break;
+		}
+		buf += ret;
+		len -= ret;
+		offset += ret;
+	}
+	return 0;
+}
+
+blk_backend *
+raw_blk_backend::open(const std::string& path, std::string& error)
+{
+	int fd = ::open(path.c_str(), O_RDWR);
+	if (fd < 0) {
+		error = "can't open " + path + ": " + strerror(errno);
+		return NULL;
+	}
+
+	off_t size = lseek(fd, 0, SEEK_END);
+	if (size < 0) {
+		error = "can't seek " + path + ": " + strerror(errno);
+		close(fd);
+		return NULL;
+	}
+	return new raw_blk_backend(fd, size);
+}
+
+raw_blk_backend::~raw_blk_backend()
+{
+	close(m_fd);
+}
+
+int
+raw_blk_backend::read(char *buf, size_t len, off_t offset)
+{
+	return pread_full(m_fd, buf, len, offset);
+}
+
+int
+raw_blk_backend::write(const char *buf, size_t len, off_t offset)
+{
+	return pwrite_full(m_fd, buf, len, offset);
+}
+
+int
+raw_blk_backend::flush()
+{
+	return fdatasync(m_fd) < 0 ? -errno : 0;
+}
+
+cow_blk_backend::cow_blk_backend(int base_fd, int overlay_fd, off_t base_size) :
+	m_base_fd(base_fd), m_overlay_fd(overlay_fd), m_base_size(base_size)
+{
+	memset(&m_hdr, 0, sizeof(m_hdr));
+}
+
+cow_blk_backend::~cow_blk_backend()
+{
+	flush();
+	close(m_overlay_fd);
+	close(m_base_fd);
+}
+
+blk_backend *
+cow_blk_backend::open(const std::string& base, const std::string& overlay,
+		      std::string& error)
+{
+	struct stat st;
+	int base_fd, overlay_fd, err;
+	off_t base_size;
+	cow_blk_backend *backend;
+
+	base_fd = ::open(base.c_str(), O_RDONLY);
+	if (base_fd < 0) {
+		error = "can't open base " + base + ": " + strerror(errno);
+		return NULL;
+	}
+	base_size = lseek(base_fd, 0, SEEK_END);
+	if (base_size < 0) {
+		error = "can't seek base " + base + ": " + strerror(errno);
+		close(base_fd);
+		return NULL;
+	}
+
+	overlay_fd = ::open(overlay.c_str(), O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+	if (overlay_fd < 0 || fstat(overlay_fd, &st) < 0) {
+		error = "can't open overlay " + overlay + ": " + strerror(errno);
+		if (overlay_fd >= 0)
+			close(overlay_fd);
+		close(base_fd);
+		return NULL;
+	}
+
+	backend = new cow_blk_backend(base_fd, overlay_fd, base_size);
+	err = st.st_size ? backend->load(error) : backend->create(error);
+	if (err) {
+		error = overlay + ": " + error;
+		delete backend;
+		return NULL;
+	}
+	return backend;
+}
+
+/*
+ * The card sees the base image rounded up to a whole sector, so the
+ * overlay covers that much; the tail past the base reads as zeroes.
+ */
+static uint64_t
+cow_disk_size(off_t base_size)
+{
+	return ((uint64_t)base_size + 511) & ~(uint64_t)511;
+}
+
+static uint64_t
+cow_bitmap_words(uint64_t size)
+{
+	uint64_t clusters = (size + COW_CLUSTER_SIZE - 1) / COW_CLUSTER_SIZE;
+
+	return (clusters + 63) / 64;
+}
+
+/* Lay out an empty overlay for the current base image */
+int
+cow_blk_backend::create(std::string& error)
+{
+	char block[COW_HEADER_SIZE] = {};
+	struct cow_header *hdr = (struct cow_header *)block;
+	uint64_t words = cow_bitmap_words(cow_disk_size(m_base_size));
+	int err;
+
+	m_hdr.version = COW_VERSION;
+	m_hdr.cluster_size = COW_CLUSTER_SIZE;
+	m_hdr.size = cow_disk_size(m_base_size);
+	m_hdr.bitmap_offset = COW_HEADER_SIZE;
+	m_hdr.data_offset = m_hdr.bitmap_offset + words * sizeof(uint64_t);
+	m_hdr.data_offset = (m_hdr.data_offset + COW_CLUSTER_SIZE - 1) &
+		~(uint64_t)(COW_CLUSTER_SIZE - 1);
+	m_bitmap.assign(words, 0);
+
+	memcpy(hdr->magic, COW_MAGIC, sizeof(hdr->magic));
+	hdr->version = htole32(m_hdr.version);
+	hdr->cluster_size = htole32(m_hdr.cluster_size);
+	hdr->size = htole64(m_hdr.size);
+	hdr->bitmap_offset = htole64(m_hdr.bitmap_offset);
+	hdr->data_offset = htole64(m_hdr.data_offset);
+
+	/* The bitmap and the data area start out as holes */
+	if (ftruncate(m_overlay_fd, m_hdr.data_offset + m_hdr.size) < 0) {
+		error = std::string("can't size overlay: ") + strerror(errno);
+		return -errno;
+	}
+	err = pwrite_full(m_overlay_fd, block, sizeof(block), 0);
+	if (err) {
+		error = std::string("can't write header: ") + strerror(-err);
+		return err;
+	}
+	return fdatasync(m_overlay_fd) < 0 ? -errno : 0;
+}
+
+int
+cow_blk_backend::load(std::string& error)
+{
+	struct cow_header hdr;
+	int err;
+
+	err = pread_full(m_overlay_fd, (char *)&hdr, sizeof(hdr), 0);
+	if (err) {
+		error = std::string("can't read header: ") + strerror(-err);
+		return err;
+	}
+	if (memcmp(hdr.magic, COW_MAGIC, sizeof(hdr.magic))) {
+		error = "not a copy-on-write overlay";
+		return -EINVAL;
+	}
+
+	m_hdr.version = le32toh(hdr.version);
+	m_hdr.cluster_size = le32toh(hdr.cluster_size);
+	m_hdr.size = le64toh(hdr.size);
+	m_hdr.bitmap_offset = le64toh(hdr.bitmap_offset);
+	m_hdr.data_offset = le64toh(hdr.data_offset);
+
+	if (m_hdr.version != COW_VERSION ||
+	    m_hdr.cluster_size != COW_CLUSTER_SIZE) {
+		error = "unsupported overlay version or cluster size";
+		return -EINVAL;
+	}
+	if (m_hdr.size != cow_disk_size(m_base_size)) {
+		error = "overlay was created for a base image of another size";
+		return -EINVAL;
+	}
+
+	m_bitmap.assign(cow_bitmap_words(m_hdr.size), 0);
+	err = pread_full(m_overlay_fd, (char *)m_bitmap.data(),
+			 m_bitmap.size() * sizeof(uint64_t), m_hdr.bitmap_offset);
+	if (err) {
+		error = std::string("can't read bitmap: ") + strerror(-err);
+		return err;
+	}
+	for (auto &word : m_bitmap)
+		word = le64toh(word);
+	return 0;
+}
+
+bool
+cow_blk_backend::cluster_present(uint64_t cluster)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	return m_bitmap[cluster / 64] & (1ULL << (cluster % 64));
+}
+
+/*
+ * Record a cluster as living in the overlay, after its data was written.
+ * The bitmap word reaches the disk with the next flush().
+ */
+void
+cow_blk_backend::mark_present(uint64_t cluster)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	m_bitmap[cluster / 64] |= 1ULL << (cluster % 64);
+	m_dirty.insert(cluster / 64);
+}
+
+int
+cow_blk_backend::read_base(char *buf, size_t len, off_t offset)
+{
+	return pread_full(m_base_fd, buf, len, offset);
+}
+
+/*
+ * First write to a cluster: merge the new data into the base contents and
+ * write the whole cluster to the overlay. Copy-ups are serialized so two
+ * writers touching different parts of one cluster don't undo each other.
+ */
+int
+cow_blk_backend::copy_up(uint64_t cluster, const char *buf, size_t len,
+			 off_t offset)
+{
+	std::lock_guard<std::mutex> guard(m_copy_mutex);
+	off_t start = cluster * COW_CLUSTER_SIZE;
+	size_t cluster_len = std::min<uint64_t>(COW_CLUSTER_SIZE,
+						m_hdr.size - start);
+	std::vector<char> data;
+	int err;
+
+	if (cluster_present(cluster))
+		return pwrite_full(m_overlay_fd, buf, len,
+				   m_hdr.data_offset + offset);
+
+	if (len != cluster_len) {
+		data.resize(cluster_len);
+		err = read_base(data.data(), cluster_len, start);
+		if (err)
+			return err;
+		memcpy(data.data() + (offset - start), buf, len);
+		buf = data.data();
+		len = cluster_len;
+		offset = start;
+	}
+
+	err = pwrite_full(m_overlay_fd, buf, len, m_hdr.data_offset + offset);
+	if (err)
+		return err;
+	mark_present(cluster);
+	return 0;
+}
+
+int
+cow_blk_backend::read(char *buf, size_t len, off_t offset)
+{
+	if ((uint64_t)offset + len > m_hdr.size) {
+		size_t valid = (uint64_t)offset < m_hdr.size ?
+			m_hdr.size - offset : 0;
+
+		memset(buf + valid, 0, len - valid);
+		len = valid;
+	}
+
+	while (len) {
+		uint64_t cluster = offset / COW_CLUSTER_SIZE;
+		bool present = cluster_present(cluster);
+		size_t chunk = 0;
+		int err;
+
+		/* Gather a run of clusters served from the same file */
+		do {
+			off_t end = (cluster + 1) * COW_CLUSTER_SIZE;
+
+			chunk = std::min<uint64_t>(len, end - offset);
+			cluster++;
+		} while (chunk < len &&
+			 cluster_present(cluster) == present);
+
+		if (present)
+			err = pread_full(m_overlay_fd, buf, chunk,
+					 m_hdr.data_offset + offset);
+		else
+			err = read_base(buf, chunk, offset);
+		if (err)
+			return err;
+
+		buf += chunk;
+		offset += chunk;
+		len -= chunk;
+	}
+	return 0;
+}
+
+int
+cow_blk_backend::write(const char *buf, size_t len, off_t offset)
+{
+	if ((uint64_t)offset + len > m_hdr.size)
+		return -EIO;
+
+	while (len) {
+		uint64_t cluster = offset / COW_CLUSTER_SIZE;
+		size_t chunk = std::min<uint64_t>(len,
+			(cluster + 1) * COW_CLUSTER_SIZE - offset);
+		int err;
+
+		if (cluster_present(cluster))
+			err = pwrite_full(m_overlay_fd, buf, chunk,
+					  m_hdr.data_offset + offset);
+		else
+			err = copy_up(cluster, buf, chunk, offset);
+		if (err)
+			return err;
+
+		buf += chunk;
+		offset += chunk;
+		len -= chunk;
+	}
+	return 0;
+}
+
+/*
+ * Sync the cluster data first, then the bitmap words of the clusters that
+ * were copied up before the sync. Clusters copied up meanwhile stay dirty
+ * for the next flush.
+ */
+int
+cow_blk_backend::flush()
+{
+	std::lock_guard<std::mutex> flush_guard(m_flush_mutex);
+	std::vector<std::pair<uint64_t, uint64_t>> words;
+	size_t i;
+	int err = 0;
+
+	{
+		std::lock_guard<std::mutex> guard(m_mutex);
+
+		for (auto idx : m_dirty)
+			words.push_back(std::make_pair(idx, m_bitmap[idx]));
+		m_dirty.clear();
+	}
+
+	if (fdatasync(m_overlay_fd) < 0)
+		err = -errno;
+	for (i = 0; !err && i < words.size(); i++) {
+		uint64_t word = htole64(words[i].second);
+
+		err = pwrite_full(m_overlay_fd, (const char *)&word,
+				  sizeof(word), m_hdr.bitmap_offset +
+				  words[i].first * sizeof(word));
+	}
+	if (!err && !words.empty() && fdatasync(m_overlay_fd) < 0)
+		err = -errno;
+
+	if (err) {
+		std::lock_guard<std::mutex> guard(m_mutex);
+
+		for (auto &w : words)
+			m_dirty.insert(w.first);
+	}
+	return err;
+}
+
+blk_io_engine::blk_io_engine(blk_backend *backend, int workers) :
+	m_backend(backend), m_stop(false), m_error(0)
+{
+	for (int i = 0; i < workers; i++)
+		m_workers.emplace_back(&blk_io_engine::worker, this);
+}
+
+blk_io_engine::~blk_io_engine()
+{
+	{
+		std::unique_lock<std::mutex> l(m_mutex);
+		m_done_cv.wait(l, [&] { return m_pending.empty(); });
+		m_stop = true;
+	}
+	m_work_cv.notify_all();
+	for (auto &t : m_workers)
+		t.join();
+}
+
+bool
+blk_io_engine::overlaps(const write_req &req, off_t offset, size_t len)
+{
+	return req.offset < (off_t)(offset + len) &&
+	       offset < (off_t)(req.offset + req.len);
+}
+
+/* Called with m_mutex held */
+bool
+blk_io_engine::overlaps_pending(off_t offset, size_t len)
+{
+	for (auto &req : m_pending) {
+		if (overlaps(req, offset, len))
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Called with m_mutex held. Returns the oldest write not started yet that
+ * does not overlap an older pending write, so overlapping writes land on
+ * the backend in the order the card issued them.
+ */
+std::list<blk_io_engine::write_req>::iterator
+blk_io_engine::next_runnable()
+{
+	for (auto it = m_pending.begin(); it != m_pending.end(); ++it) {
+		if (it->started)
+			continue;
+
+		bool blocked = false;
+		for (auto prev = m_pending.begin(); prev != it; ++prev) {
+			if (overlaps(*prev, it->offset, it->len)) {
+				blocked = true;
+				break;
+			}
+		}
+		if (!blocked)
+			return it;
+	}
+	return m_pending.end();
+}
+
+void
+blk_io_engine::worker()
+{
+	std::unique_lock<std::mutex> l(m_mutex);
+
+	for (;;) {
+		auto it = m_pending.end();
+
+		m_work_cv.wait(l, [&] {
+			it = next_runnable();
+			return m_stop || it != m_pending.end();
+		});
+		if (it == m_pending.end())
+			return;
+
+		it->started = true;
+		l.unlock();
+		int err = m_backend->write(it->buf, it->len, it->offset);
+		free(it->buf);
+		l.lock();
+
+		if (err && !m_error)
+			m_error = err;
+		m_pending.erase(it);
+		/* A finished write may unblock an overlapping one */
+		m_work_cv.notify_all();
+		m_done_cv.notify_all();
+	}
+}
+
+void
+blk_io_engine::submit_write(char *buf, size_t len, off_t offset)
+{
+	{
+		std::unique_lock<std::mutex> l(m_mutex);
+		m_done_cv.wait(l, [&] {
+			return m_pending.size() < BLK_IO_MAX_INFLIGHT;
+		});
+		m_pending.push_back({buf, len, offset, false});
+	}
+	m_work_cv.notify_one();
+}
+
+int
+blk_io_engine::read(char *buf, size_t len, off_t offset)
+{
+	{
+		std::unique_lock<std::mutex> l(m_mutex);
+		m_done_cv.wait(l, [&] { return !overlaps_pending(offset, len); });
+	}
+	return m_backend->read(buf, len, offset);
+}
+
+int
+blk_io_engine::flush()
+{
+	int err, ret;
+
+	{
+		std::unique_lock<std::mutex> l(m_mutex);
+		m_done_cv.wait(l, [&] { return m_pending.empty(); });
+		err = m_error;
+		m_error = 0;
+	}
+	ret = m_backend->flush();
+	return err ? err : ret;
+}
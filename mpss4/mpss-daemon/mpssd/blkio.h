@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 2016, Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#define BLK_IO_WORKERS		4
+#define BLK_IO_MAX_INFLIGHT	32
+
+/*
+ * Storage behind a virtio block device. Methods return 0 or -errno and may
+ * be called concurrently for non-overlapping ranges.
+ */
+class blk_backend {
+public:
+	virtual ~blk_backend() {}
+
+	virtual off_t size() = 0;
+	virtual int read(char *buf, size_t len, off_t offset) = 0;
+	virtual int write(const char *buf, size_t len, off_t offset) = 0;
+	virtual int flush() = 0;
+};
+
+/* A plain image file */
+class raw_blk_backend : public blk_backend {
+	int m_fd;
+	off_t m_size;
+
+	raw_blk_backend(int fd, off_t size) : m_fd(fd), m_size(size) {}
+
+public:
+	static blk_backend *open(const std::string& path, std::string& error);
+	~raw_blk_backend();
+
+	off_t size() { return m_size; }
+	int read(char *buf, size_t len, off_t offset);
+	int write(const char *buf, size_t len, off_t offset);
+	int flush();
+};
+
+#define COW_MAGIC		"MICCOW01"
+#define COW_VERSION		1
+#define COW_CLUSTER_SIZE	(64 * 1024)
+#define COW_HEADER_SIZE		4096
+
+/*
+ * On-disk header of a copy-on-write overlay, little endian. The header is
+ * followed by a bitmap with one bit per cluster of the virtual disk and by
+ * a sparse data area in which each cluster lives at data_offset plus its
+ * virtual offset, so only clusters written by the card take disk space.
+ */
+struct cow_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t cluster_size;
+	uint64_t size;
+	uint64_t bitmap_offset;
+	uint64_t data_offset;
+};
+
+/*
+ * A shared read-only base image with a per-card sparse overlay. Reads of
+ * clusters the card never wrote fall through to the base image; the first
+ * write to a cluster copies it up into the overlay. The cluster bitmap is
+ * kept in memory; flush() writes the words that changed to the overlay
+ * only once the cluster data is on disk, so a crash can lose unflushed
+ * writes but never exposes a cluster whose data did not make it.
+ */
+class cow_blk_backend : public blk_backend {
+	int m_base_fd;
+	int m_overlay_fd;
+	off_t m_base_size;
+	struct cow_header m_hdr;
+
+	std::mutex m_mutex;
+	std::mutex m_copy_mutex;
+	std::mutex m_flush_mutex;
+	std::vector<uint64_t> m_bitmap;
+	std::set<uint64_t> m_dirty;
+
+	cow_blk_backend(int base_fd, int overlay_fd, off_t base_size);
+
+	int load(std::string& error);
+	int create(std::string& error);
+	bool cluster_present(uint64_t cluster);
+	void mark_present(uint64_t cluster);
+	int read_base(char *buf, size_t len, off_t offset);
+	int copy_up(uint64_t cluster, const char *buf, size_t len, off_t offset);
+
+public:
+	static blk_backend *open(const std::string& base,
+		const std::string& overlay, std::string& error);
+	~cow_blk_backend();
+
+	off_t size() { return m_hdr.size; }
+	int read(char *buf, size_t len, off_t offset);
+	int write(const char *buf, size_t len, off_t offset);
+	int flush();
+};
+
+/*
+ * I/O engine behind a virtio block device.
+ *
+ * Writes are queued to a pool of workers and the card is told they are
+ * done as soon as they are queued, i.e. the device behaves as a write-back
+ * cache (VIRTIO_BLK_F_FLUSH). Overlapping writes are issued in submission
+ * order, reads wait for overlapping writes still in flight, and flush()
+ * waits for every queued write before flushing the backend.
+ *
+ * This has two limits, both because the VOP driver completes descriptor
+ * chains strictly in order and cannot leave one pending:
+ * - Only writes run in parallel. read() runs on the calling thread, the
+ *   vring thread for virtio-blk, so reads are served one at a time.
+ * - A failed background write cannot fail the request that issued it,
+ *   which the card already saw complete. It is reported by the next
+ *   flush() instead, as a write-back disk cache would.
+ */
+class blk_io_engine {
+	struct write_req {
+		char *buf;
+		size_t len;
+		off_t offset;
+		bool started;
+	};
+
+	std::unique_ptr<blk_backend> m_backend;
+	bool m_stop;
+	int m_error;
+
+	std::list<write_req> m_pending;
+	std::mutex m_mutex;
+	std::condition_variable m_work_cv;
+	std::condition_variable m_done_cv;
+	std::vector<std::thread> m_workers;
+
+	static bool overlaps(const write_req &req, off_t offset, size_t len);
+	bool overlaps_pending(off_t offset, size_t len);
+	std::list<write_req>::iterator next_runnable();
+	void worker();
+
+public:
+	blk_io_engine(blk_backend *backend, int workers = BLK_IO_WORKERS);
+	~blk_io_engine();
+
+	off_t size() { return m_backend->size(); }
+
+	/* Takes ownership of buf, which must come from malloc() */
+	void submit_write(char *buf, size_t len, off_t offset);
+	int read(char *buf, size_t len, off_t offset);
+	int flush();
+};
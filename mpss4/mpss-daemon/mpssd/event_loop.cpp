@@ -0,0 +1,270 @@
+/*
+ * Copyright (c) 2016, Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ */
+
+#include "event_loop.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+/* epoll data of the wakeup and stop eventfds; source ids follow */
+#define WAKE_ID 0
+#define STOP_ID 1
+
+event_loop::event_loop()
+	: m_epfd(-1)
+	, m_wake_fd(-1)
+	, m_stop_fd(-1)
+	, m_wakeups(0)
+	, m_next_id(STOP_ID + 1)
+{}
+
+event_loop::~event_loop()
+{
+	stop();
+}
+
+/* Watch an eventfd level triggered under the epoll data @id */
+static int
+add_eventfd(int epfd, uint64_t id)
+{
+	struct epoll_event ev;
+	int fd;
+
+	if ((fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+		mpssd_log(PERROR, "eventfd failed: %s", strerror(errno));
+		return -1;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u64 = id;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		mpssd_log(PERROR, "epoll_ctl failed: %s", strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int
+event_loop::start(int workers)
+{
+	if ((m_epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+		mpssd_log(PERROR, "epoll_create1 failed: %s", strerror(errno));
+		return -errno;
+	}
+
+	if ((m_wake_fd = add_eventfd(m_epfd, WAKE_ID)) < 0)
+		goto close_epoll;
+	if ((m_stop_fd = add_eventfd(m_epfd, STOP_ID)) < 0)
+		goto close_wake;
+
+	for (int i = 0; i < workers; i++)
+		m_workers.emplace_back(&event_loop::worker, this, i);
+
+	mpssd_log(PINFO, "Event loop started with %d threads", workers);
+	return 0;
+
+close_wake:
+	close(m_wake_fd);
+	m_wake_fd = -1;
+close_epoll:
+	close(m_epfd);
+	m_epfd = -1;
+	return -EINVAL;
+}
+
+void
+event_loop::stop()
+{
+	uint64_t one = 1;
+
+	if (m_epfd < 0)
+		return;
+
+	/* Never read, so it stays readable until every worker has left */
+	if (write(m_stop_fd, &one, sizeof(one)) < 0)
+		mpssd_log(PERROR, "eventfd write failed: %s", strerror(errno));
+
+	for (auto &t : m_workers)
+		t.join();
+	m_workers.clear();
+
+	mpssd_log(PINFO, "Event loop stopped after %lu wakeups", wakeups());
+
+	std::unique_lock<std::mutex> l(m_mutex);
+	m_sources.clear();
+	m_tasks.clear();
+	close(m_stop_fd);
+	close(m_wake_fd);
+	close(m_epfd);
+	m_stop_fd = -1;
+	m_wake_fd = -1;
+	m_epfd = -1;
+}
+
+uint64_t
+event_loop::add(int fd, uint32_t events, handler_fn handler)
+{
+	std::shared_ptr<source> src(new source);
+	struct epoll_event ev;
+
+	src->fd = fd;
+	src->events = events;
+	src->handler = handler;
+	src->running = false;
+	src->removed = false;
+
+	std::unique_lock<std::mutex> l(m_mutex);
+	src->id = m_next_id++;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events | EPOLLONESHOT;
+	ev.data.u64 = src->id;
+	if (epoll_ctl(m_epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		mpssd_log(PERROR, "epoll_ctl add of fd %d failed: %s", fd, strerror(errno));
+		return 0;
+	}
+	m_sources[src->id] = src;
+
+	return src->id;
+}
+
+void
+event_loop::remove(uint64_t id)
+{
+	std::unique_lock<std::mutex> l(m_mutex);
+
+	auto it = m_sources.find(id);
+	if (it == m_sources.end())
+		return;
+
+	std::shared_ptr<source> src = it->second;
+	src->removed = true;
+	epoll_ctl(m_epfd, EPOLL_CTL_DEL, src->fd, NULL);
+	m_sources.erase(it);
+
+	while (src->running && src->runner != std::this_thread::get_id())
+		m_idle_cv.wait(l);
+}
+
+void
+event_loop::post(task_fn task)
+{
+	uint64_t one = 1;
+	std::unique_lock<std::mutex> l(m_mutex);
+
+	if (m_wake_fd < 0)
+		return;
+
+	m_tasks.push_back(task);
+	if (write(m_wake_fd, &one, sizeof(one)) < 0)
+		mpssd_log(PERROR, "eventfd write failed: %s", strerror(errno));
+}
+
+/*
+ * Run one posted task. If more are queued the wakeup is passed on, so
+ * another worker runs the next one while this task may block.
+ */
+void
+event_loop::run_tasks()
+{
+	uint64_t count, one = 1;
+	task_fn task;
+	bool more;
+
+	/* Another worker may have consumed the wakeup already */
+	if (read(m_wake_fd, &count, sizeof(count)) < 0)
+		return;
+
+	{
+		std::unique_lock<std::mutex> l(m_mutex);
+		if (m_tasks.empty())
+			return;
+		task = m_tasks.front();
+		m_tasks.pop_front();
+		more = !m_tasks.empty();
+	}
+
+	if (more && write(m_wake_fd, &one, sizeof(one)) < 0)
+		mpssd_log(PERROR, "eventfd write failed: %s", strerror(errno));
+	task();
+}
+
+void
+event_loop::dispatch(uint64_t id, uint32_t events)
+{
+	std::shared_ptr<source> src;
+	struct epoll_event ev;
+
+	{
+		std::unique_lock<std::mutex> l(m_mutex);
+		auto it = m_sources.find(id);
+		if (it == m_sources.end())
+			return;
+		src = it->second;
+		src->running = true;
+		src->runner = std::this_thread::get_id();
+	}
+
+	src->handler(events);
+
+	std::unique_lock<std::mutex> l(m_mutex);
+	src->running = false;
+	if (!src->removed) {
+		memset(&ev, 0, sizeof(ev));
+		ev.events = src->events | EPOLLONESHOT;
+		ev.data.u64 = src->id;
+		if (epoll_ctl(m_epfd, EPOLL_CTL_MOD, src->fd, &ev) < 0)
+			mpssd_log(PERROR, "epoll_ctl rearm of fd %d failed: %s",
+				src->fd, strerror(errno));
+	}
+	m_idle_cv.notify_all();
+}
+
+void
+event_loop::worker(int idx)
+{
+	struct epoll_event ev;
+	std::string name = "loop" + std::to_string(idx);
+
+	set_thread_name("main", name.c_str());
+
+	while (1) {
+		int n = epoll_wait(m_epfd, &ev, 1, -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			mpssd_log(PERROR, "epoll_wait failed: %s", strerror(errno));
+			break;
+		}
+		if (n == 0)
+			continue;
+
+		m_wakeups++;
+
+		if (ev.data.u64 == STOP_ID)
+			break;
+
+		if (ev.data.u64 == WAKE_ID) {
+			run_tasks();
+			continue;
+		}
+
+		dispatch(ev.data.u64, ev.events);
+	}
+}
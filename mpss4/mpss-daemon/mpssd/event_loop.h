@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2016, Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <stdint.h>
+
+#define EVENT_LOOP_THREADS	4
+
+/*
+ * epoll based reactor shared by all cards.
+ *
+ * Every registered fd is armed one-shot, so a handler never runs on two
+ * workers at once and is re-armed when it returns. Handlers may block for
+ * a while (boot, fsck, SCIF handshakes), which is why a small pool of
+ * workers serves the loop rather than a single thread. Posted tasks are
+ * spread over the workers one at a time for the same reason. Workers
+ * sleep in epoll_wait() without a timeout; post() wakes them through an
+ * eventfd which they read. stop() uses a second eventfd which is never
+ * read, so the stop request cannot be consumed along with a task wakeup
+ * and every worker sees it.
+ */
+class event_loop {
+public:
+	typedef std::function<void(uint32_t events)> handler_fn;
+	typedef std::function<void()> task_fn;
+
+private:
+	struct source {
+		int fd;
+		uint64_t id;
+		uint32_t events;
+		handler_fn handler;
+		bool running;
+		bool removed;
+		std::thread::id runner;
+	};
+
+	int m_epfd;
+	int m_wake_fd;
+	int m_stop_fd;
+	std::atomic<unsigned long> m_wakeups;
+
+	std::mutex m_mutex;
+	std::condition_variable m_idle_cv;
+	uint64_t m_next_id;
+	std::map<uint64_t, std::shared_ptr<source>> m_sources;
+	std::list<task_fn> m_tasks;
+	std::vector<std::thread> m_workers;
+
+	void worker(int idx);
+	void dispatch(uint64_t id, uint32_t events);
+	void run_tasks();
+
+public:
+	event_loop();
+	~event_loop();
+
+	int start(int workers = EVENT_LOOP_THREADS);
+	void stop();
+
+	/* Returns a handle for remove(), or 0 on failure */
+	uint64_t add(int fd, uint32_t events, handler_fn handler);
+	/*
+	 * Waits for a handler running on another worker to return, so the
+	 * caller may close the fd and free the handler's state afterwards.
+	 * Safe to call from the source's own handler.
+	 */
+	void remove(uint64_t id);
+	/* Tasks posted once stop() has begun are dropped */
+	void post(task_fn task);
+
+	int workers() { return m_workers.size(); }
+	unsigned long wakeups() { return m_wakeups; }
+};
@@ -17,10 +17,10 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <map>
-#include <poll.h>
 #include <pwd.h>
 #include <scif.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/stat.h>
 
 #define MONITOR_START		1
@@ -37,57 +37,46 @@
 #define CRED_FAIL_MALLOC	3
 
 void
-mpssd_info::card_monitor_thread()
+mpssd_info::card_monitor_event(uint32_t events)
 {
 	unsigned int proto;
 	unsigned int jobid;
 	uint16_t stopID;
-	struct scif_pollepd pfds;
 
-	set_thread_name(name().c_str(), "monitor");
+	if (events & (EPOLLHUP | EPOLLERR)) {
+		stop_card_monitor();
+		return;
+	}
 
-	pfds.epd = m_recv_ep;
-	pfds.events = SCIF_POLLIN | SCIF_POLLERR;
-	while (1) {
-		if (scif_poll(&pfds, 1, 1000) == 0) {
-			continue;
-		}
-		if (pfds.revents & (SCIF_POLLHUP | SCIF_POLLERR)) {
-			close_scif_connection();
-			break;
+	if (scif_recv(m_recv_ep, &proto, sizeof(proto), SCIF_RECV_BLOCK) < 0) {
+		if (errno == ECONNRESET) {
+			mpssd_log(PERROR, "MIC card mpssd daemon disconnect: %s",
+				strerror(errno));
+			stop_card_monitor();
 		}
+		return;
+	}
 
-		if (scif_recv(m_recv_ep, &proto, sizeof(proto), SCIF_RECV_BLOCK) < 0) {
-			if (errno == ECONNRESET) {
-				mpssd_log(PERROR, "MIC card mpssd daemon disconnect: %s",
-					strerror(errno));
-				close_scif_connection();
-				break;
-			}
-			continue;
+	switch (proto) {
+	case REQ_CREDENTIAL_ACK:
+	case REQ_CREDENTIAL_NACK:
+		if (scif_recv(m_recv_ep, &jobid, sizeof(jobid), SCIF_RECV_BLOCK) < 0) {
+			mpssd_log(PERROR, "MIC card mpssd daemon error %s",
+				strerror(errno));
+			return;
 		}
+		g_manager.close_authentication_job(jobid);
 
-		switch (proto) {
-		case REQ_CREDENTIAL_ACK:
-		case REQ_CREDENTIAL_NACK:
-			if (scif_recv(m_recv_ep, &jobid, sizeof(jobid), SCIF_RECV_BLOCK) < 0) {
-				mpssd_log(PERROR, "MIC card mpssd daemon error %s",
-					strerror(errno));
-				continue;
-			}
-			g_manager.close_authentication_job(jobid);
+		break;
 
-			break;
-
-		case MONITOR_STOPPING:
-			if (scif_recv(m_recv_ep, &stopID, sizeof(stopID), SCIF_RECV_BLOCK) < 0) {
-				mpssd_log(PERROR, "MIC card mpssd daemon error %s", strerror(errno));
-				continue;
-			}
-			mpssd_log(PERROR, "card mpssd daemon exiting");
-			close_scif_connection();
+	case MONITOR_STOPPING:
+		if (scif_recv(m_recv_ep, &stopID, sizeof(stopID), SCIF_RECV_BLOCK) < 0) {
+			mpssd_log(PERROR, "MIC card mpssd daemon error %s", strerror(errno));
 			return;
 		}
+		mpssd_log(PERROR, "card mpssd daemon exiting");
+		stop_card_monitor();
+		return;
 	}
 }
 
@@ -156,7 +145,7 @@ mpssd_info::establish_connection(scif_epd_t recv_ep, struct scif_portID recvID)
 		return -EINVAL;
 	}
 
-	start_monitor_thread();
+	start_card_monitor();
 	msg = MONITOR_START_ACK;
 	scif_send(send_ep, &msg, sizeof(msg), SCIF_RECV_BLOCK);
 	mpssd_log(PINFO, "Monitor connection established: %s", name().c_str());
@@ -189,63 +178,30 @@ mpssd_info::send_coi_authentication_data_to_card(unsigned int jobid, char *usern
 }
 
 void
-mpssd_manager::monitor_thread()
+mpssd_manager::monitor_accept(uint32_t)
 {
 	struct mpssd_info *mpssdi;
 	struct scif_portID recvID;
-	scif_epd_t lep;
 	scif_epd_t recv_ep;
-	struct scif_pollepd pfds;
-
-	set_thread_name("main", "monitor");
 
-	if ((lep = scif_open()) < 0) {
-		mpssd_log(PINFO, "Cannot open mpssd monitor SCIF listen port: %s", strerror(errno));
+	if (scif_accept(m_monitor_lep, &recvID, &recv_ep, 0)) {
+		if (errno != EINTR && errno != EAGAIN) {
+			mpssd_log(PINFO, "Wait for card connect failed: %s", strerror(errno));
+			sleep(1);
+		}
 		return;
 	}
 
-	if (scif_bind(lep, MPSSD_MONRECV) < 0) {
-		mpssd_log(PINFO, "Cannot bind to mpssd monitor SCIF PORT: %s", strerror(errno));
-		scif_close(lep);
+	mpssd_log(PINFO, "receiving node: %d", recvID.node);
+	if ((mpssdi = get_card_by_id(recvID.node - 1)) == NULL) {
+		mpssd_log(PINFO, "Cannot configure - node %d does not seem to exist",
+			       recvID.node - 1);
+		scif_close(recv_ep);
 		return;
 	}
-
-	if (scif_listen(lep, 16) < 0) {
-		mpssd_log(PINFO, "Set Listen on mpssd monitor SCIF PORT fail: %s", strerror(errno));
-		scif_close(lep);
-		return;
+	if ((mpssdi->establish_connection(recv_ep, recvID)) != 0) {
+		mpssdi->close_scif_connection();
 	}
-
-	pfds.epd = lep;
-	pfds.events = SCIF_POLLIN | SCIF_POLLERR;
-
-	while (1) {
-		if (m_status.is_shutdown_requested()) {
-			break;
-		}
-		if (scif_poll(&pfds, 1, 1000) == 0) {
-			continue;
-		}
-
-		if (scif_accept(lep, &recvID, &recv_ep, 0)) {
-			if (errno != EINTR)
-				mpssd_log(PINFO, "Wait for card connect failed: %s", strerror(errno));
-			sleep(1);
-			continue;
-		}
-
-		mpssd_log(PINFO, "receiving node: %d", recvID.node);
-		if ((mpssdi = get_card_by_id(recvID.node - 1)) == NULL) {
-			mpssd_log(PINFO, "Cannot configure - node %d does not seem to exist",
-				       recvID.node - 1);
-			scif_close(recv_ep);
-			continue;
-		}
-		if ((mpssdi->establish_connection(recv_ep, recvID)) != 0) {
-			mpssdi->close_scif_connection();
-		}
-	}
-	scif_close(lep);
 }
 
 
@@ -359,7 +315,7 @@ mpssd_manager::find_passwd_entry(uid_t uid)
 }
 
 void
-mpssd_manager::coi_authenticate_thread()
+mpssd_manager::coi_authenticate_accept(uint32_t)
 {
 	struct mpssd_info *mpssdi;
 	struct jobs *job;
@@ -368,100 +324,66 @@ mpssd_manager::coi_authenticate_thread()
 	char *username = NULL;
 	char cookie[MPSS_COOKIE_SIZE];
 	unsigned int proto;
-	scif_epd_t lep;
 	scif_epd_t dep;
 	uid_t uid;
 	int err;
-	struct scif_pollepd pfds;
-
-	set_thread_name("main", "coiauth");
 
-	if ((lep = scif_open()) < 0) {
-		mpssd_log(PINFO, "Cannot open mpssd credentials SCIF listen port: %s",
-			       strerror(errno));
+	if (scif_accept(m_coi_lep, &portID, &dep, 0)) {
+		if (errno != EINTR && errno != EAGAIN) {
+			mpssd_log(PINFO, "Wait for credentials request fail: %s", strerror(errno));
+		}
 		return;
 	}
 
-	if (scif_bind(lep, MPSSD_CRED) < 0) {
-		mpssd_log(PINFO, "Cannot bind to mpssd credentials SCIF PORT: %s", strerror(errno));
-		scif_close(lep);
+	if ((err = scif_recv(dep, &uid, sizeof(uid), SCIF_RECV_BLOCK)) != sizeof(uid)) {
+		mpssd_log(PINFO, "Credential connect receive error %s", strerror(errno));
+		scif_close(dep);
 		return;
 	}
 
-	if (scif_listen(lep, 16) < 0) {
-		mpssd_log(PINFO, "Set Listen on mpssd credentials SCIF PORT fail: %s", strerror(errno));
-		scif_close(lep);
+	pass = find_passwd_entry(uid);
+	if (pass == NULL) {
+		mpssd_log(PERROR, "User request unknown UID %d", uid);
+		proto = CRED_FAIL_UNKNOWNUID;
+		scif_send(dep, &proto, sizeof(proto), 0);
+		scif_close(dep);
 		return;
 	}
+	username = pass->pw_name;
 
-	pfds.epd = lep;
-	pfds.events = SCIF_POLLIN | SCIF_POLLERR;
-	while (1) {
-		if (m_status.is_shutdown_requested()) {
-			break;
-		}
-		if (scif_poll(&pfds, 1, 1000) == 0) {
-			continue;
-		}
-
-		if (scif_accept(lep, &portID, &dep, 0)) {
-			if (errno != EINTR) {
-				mpssd_log(PINFO, "Wait for credentials request fail: %s", strerror(errno));
-			}
-			continue;
-		}
-
-		if ((err = scif_recv(dep, &uid, sizeof(uid), SCIF_RECV_BLOCK)) != sizeof(uid)) {
-			mpssd_log(PINFO, "Credential connect receive error %s", strerror(errno));
-			scif_close(dep);
-			continue;
-		}
-
-		pass = find_passwd_entry(uid);
-		if (pass == NULL) {
-			mpssd_log(PERROR, "User request unknown UID %d", uid);
-			proto = CRED_FAIL_UNKNOWNUID;
-			scif_send(dep, &proto, sizeof(proto), 0);
-			scif_close(dep);
-			continue;
-		}
-		username = pass->pw_name;
-
-		if (get_cookie(pass, cookie) < 0) {
-			proto = CRED_FAIL_READCOOKIE;
-			scif_send(dep, &proto, sizeof(proto), 0);
-			scif_close(dep);
-			continue;
-		}
+	if (get_cookie(pass, cookie) < 0) {
+		proto = CRED_FAIL_READCOOKIE;
+		scif_send(dep, &proto, sizeof(proto), 0);
+		scif_close(dep);
+		return;
+	}
 
-		if ((job = new(std::nothrow) jobs) == nullptr) {
-			proto = CRED_FAIL_MALLOC;
-			scif_send(dep, &proto, sizeof(proto), 0);
-			scif_close(dep);
-			continue;
-		}
-		m_job_mutex.lock();
-		job->jobid = m_nextjobid++;
-		job->dep = dep;
-		job->cnt = 0;
-
-		for (auto& iter : m_map) {
-			mpssdi = iter.second;
-			if (!mpssdi->send_coi_authentication_data_to_card(
-				job->jobid, username, cookie)) {
-				job->cnt++;
-			}
-		}
-		if (job->cnt == 0) {
-			proto = CRED_SUCCESS;
-			scif_send(job->dep, &proto, sizeof(proto), 0);
-			scif_close(job->dep);
-		} else {
-			g_manager.m_job[job->jobid] = job;
+	if ((job = new(std::nothrow) jobs) == nullptr) {
+		proto = CRED_FAIL_MALLOC;
+		scif_send(dep, &proto, sizeof(proto), 0);
+		scif_close(dep);
+		return;
+	}
+	m_job_mutex.lock();
+	job->jobid = m_nextjobid++;
+	job->dep = dep;
+	job->cnt = 0;
+
+	for (auto& iter : m_map) {
+		mpssdi = iter.second;
+		if (!mpssdi->send_coi_authentication_data_to_card(
+			job->jobid, username, cookie)) {
+			job->cnt++;
 		}
-		m_job_mutex.unlock();
 	}
-	scif_close(lep);
+	if (job->cnt == 0) {
+		proto = CRED_SUCCESS;
+		scif_send(job->dep, &proto, sizeof(proto), 0);
+		scif_close(job->dep);
+	} else {
+		g_manager.m_job[job->jobid] = job;
+	}
+	m_job_mutex.unlock();
 }
 
 void
@@ -25,7 +25,7 @@
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
-#include <poll.h>
+#include <sys/epoll.h>
 
 #define LOGFILE_NAME "/var/log/mpssd"
 
@@ -119,10 +119,15 @@ start_daemon(void)
 		exit(1);
 	}
 
+	if (g_manager.start()) {
+		fprintf(stderr, "Cannot start the event loop\n");
+		exit(1);
+	}
+
 	for (auto& mic: miclist) {
 		g_manager.add(&mic);
 	}
-	g_manager.start_authentication_threads();
+	g_manager.start_authentication();
 	g_manager.wait_and_notify_systemd();
 
 	g_manager.wait_for_stop_request();
@@ -227,6 +232,11 @@ mpssd_info::mpssd_info(mic_info* mic)
 	, m_autobooted(false)
 	, m_error(mpssd_error::NONE)
 	, m_ready_to_notify_systemd(false)
+	, m_control_active(false)
+	, m_state_fd(-1)
+	, m_state_old_id(MIC_STATE_UNKNOWN)
+	, m_state_src(0)
+	, m_card_mon_src(0)
 	, m_recv_ep(-1)
 	, m_send_ep(-1)
 {
@@ -321,6 +331,14 @@ mpssd_info::check_root_fs()
 {
 	std::string root_fs_image_path = m_mic->config.rootdev.target;
 
+	for (auto& blk : m_mic->config.blockdevs) {
+		if ((blk.options & BLOCK_OPTION_ROOT) && !blk.base.empty()) {
+			mpssd_log(PINFO, "Root file system is an overlay of '%s', skipping fsck",
+				  blk.base.c_str());
+			return;
+		}
+	}
+
 	struct stat buffer;
 	if (stat(root_fs_image_path.c_str(), &buffer) != 0) {
 		mpssd_log(PWARN, "Root file system image '%s' does not exist", root_fs_image_path.c_str());
@@ -524,76 +542,87 @@ mpssd_info::stop_condition(int mic_state)
 	return true;
 }
 
+/*
+ * Runs on the event loop once the state fd is open. The initial state is
+ * read before the fd is armed; a change in between is reported by the first
+ * epoll_wait(), as sysfs flags the fd until it is read again.
+ */
 void
-mpssd_info::control_thread()
+mpssd_info::control_init()
 {
-	set_thread_name(name().c_str(), "control");
+	mpssd_log(PINFO, "Start the %s control", name().c_str());
 
-	mpssd_log(PINFO, "Start the control thread");
+	{
+		std::unique_lock<std::mutex> l(m_control_mutex);
 
-	std::string mic_state_file = MICSYSFSDIR"/" + m_mic->name + "/" + "state";
+		/*
+		 * Execute all init procedures.
+		 */
+		execute_state_cbs(mpssd_state::CTRL_THREAD_INIT);
+		m_control_active = true;
+	}
 
-	int fd = open(mic_state_file.c_str(), O_RDONLY);
-	if (fd < 0) {
-		mpssd_log(PERROR, "Opening file %s failed: %s",
-			mic_state_file.c_str(), strerror(errno));
-		set_error(mpssd_error::NO_DEVICE);
+	control_event(0);
+
+	std::unique_lock<std::mutex> l(m_control_mutex);
+	if (!m_control_active)
 		return;
+
+	m_state_src = g_manager.loop().add(m_state_fd, EPOLLPRI | EPOLLERR,
+		std::bind(&mpssd_info::control_event, this, std::placeholders::_1));
+	if (!m_state_src) {
+		set_error(mpssd_error::NO_DEVICE);
+		m_control_active = false;
+		l.unlock();
+		execute_state_cbs(mpssd_state::CTRL_THREAD_SHUTDOWN);
+		close(m_state_fd);
+		m_state_fd = -1;
+		m_control_stopped.request_shutdown();
 	}
+}
 
-	/*
-	 * Execute all init procedures.
-	 */
-	execute_state_cbs(mpssd_state::CTRL_THREAD_INIT);
+/*
+ * Called on a state change of the card and on a stop request. Serialized by
+ * m_control_mutex, as a stop request is posted independently of the state fd.
+ */
+void
+mpssd_info::control_event(uint32_t)
+{
+	std::unique_lock<std::mutex> l(m_control_mutex);
 
-	/*
-	 * Read initial state.
-	 */
-	int state_id = get_state_id(fd);
-	int state_old_id = MIC_STATE_UNKNOWN;
+	if (!m_control_active)
+		return;
 
-	/*
-	 * Start tracking state changes.
-	 */
-	struct pollfd polld;
-	polld.fd = fd;
-	polld.events = POLLERR | POLLPRI;
+	int state_id = get_state_id(m_state_fd);
 
-	while (stop_condition(state_id)) {
-		if (state_id != state_old_id) {
+	if (stop_condition(state_id)) {
+		if (state_id != m_state_old_id) {
 			execute_state_cbs(state_id);
 
 			/* After initial state has been changed, we have to execute handler. */
-			if (state_old_id == MIC_STATE_UNKNOWN) {
+			if (m_state_old_id == MIC_STATE_UNKNOWN) {
 				execute_state_cbs(mpssd_state::CTRL_THREAD_POST_INITIAL_STATE);
 			}
-			state_old_id = state_id;
+			m_state_old_id = state_id;
 		}
-
-		int poll_status = poll(&polld, 1, 1000);
-
-		if (poll_status == 0) {
-			continue;
-		}
-
-		if (poll_status < 0) {
-			if (errno != EINTR) {
-				mpssd_log(PERROR, "poll failed: %s", strerror(errno));
-			}
-			continue;
-		}
-
-		state_id = get_state_id(fd);
+		return;
 	}
 
 	/*
 	 * Execute all shutdown procedures.
 	 */
 	execute_state_cbs(mpssd_state::CTRL_THREAD_SHUTDOWN);
+	m_control_active = false;
+	l.unlock();
 
-	close(fd);
+	/* Outside of the mutex: remove() waits for a concurrent state event */
+	g_manager.loop().remove(m_state_src);
+	m_state_src = 0;
+	close(m_state_fd);
+	m_state_fd = -1;
 
-	mpssd_log(PINFO, "Exit the control thread");
+	mpssd_log(PINFO, "Exit the %s control", name().c_str());
+	m_control_stopped.request_shutdown();
 }
 
 std::string
@@ -609,27 +638,42 @@ mpssd_info::id()
 }
 
 void
-mpssd_info::start_control_thread()
+mpssd_info::start_control()
 {
-	mpssd_log(PINFO, "Create the %s control thread", name().c_str());
-	m_control_thread = std::thread(&mpssd_info::control_thread, this);
+	mpssd_log(PINFO, "Create the %s control", name().c_str());
+
+	std::string mic_state_file = MICSYSFSDIR"/" + m_mic->name + "/" + "state";
+
+	m_state_fd = open(mic_state_file.c_str(), O_RDONLY | O_CLOEXEC);
+	if (m_state_fd < 0) {
+		mpssd_log(PERROR, "Opening file %s failed: %s",
+			mic_state_file.c_str(), strerror(errno));
+		set_error(mpssd_error::NO_DEVICE);
+		m_control_stopped.request_shutdown();
+		return;
+	}
+
+	g_manager.loop().post(std::bind(&mpssd_info::control_init, this));
 }
 
 void
-mpssd_info::request_stop_control_thread()
+mpssd_info::request_stop_control()
 {
-	mpssd_log(PINFO, "Request stop the %s control thread", name().c_str());
+	mpssd_log(PINFO, "Request stop the %s control", name().c_str());
 	m_status.request_shutdown();
+
+	/* Re-evaluate the stop condition without waiting for a state change */
+	g_manager.loop().post(std::bind(&mpssd_info::control_event, this, 0));
 }
 
 void
-mpssd_info::stop_control_thread()
+mpssd_info::stop_control()
 {
-	request_stop_control_thread();
+	request_stop_control();
 
-	mpssd_log(PINFO, "Wait for stop of the %s control thread", name().c_str());
-	m_control_thread.join();
-	mpssd_log(PINFO, "The %s control thread has been stopped", name().c_str());
+	mpssd_log(PINFO, "Wait for stop of the %s control", name().c_str());
+	m_control_stopped.wait_for_shutdown();
+	mpssd_log(PINFO, "The %s control has been stopped", name().c_str());
 }
 
 bool
@@ -639,10 +683,22 @@ mpssd_info::is_ready_to_notify_systemd()
 }
 
 void
-mpssd_info::start_monitor_thread()
+mpssd_info::start_card_monitor()
 {
-	m_card_mon_thread = std::thread(&mpssd_info::card_monitor_thread, this);
-	m_card_mon_thread.detach();
+	m_card_mon_src = g_manager.loop().add(scif_get_fd(m_recv_ep), EPOLLIN,
+		std::bind(&mpssd_info::card_monitor_event, this, std::placeholders::_1));
+	if (!m_card_mon_src)
+		mpssd_log(PERROR, "Cannot monitor card mpssd daemon: %s", name().c_str());
+}
+
+void
+mpssd_info::stop_card_monitor()
+{
+	if (m_card_mon_src) {
+		g_manager.loop().remove(m_card_mon_src);
+		m_card_mon_src = 0;
+	}
+	close_scif_connection();
 }
 
 void
@@ -659,9 +715,19 @@ mpssd_info::close_scif_connection()
 }
 
 mpssd_manager::mpssd_manager()
-	: m_nextjobid(100)
+	: m_monitor_lep(-1)
+	, m_monitor_src(0)
+	, m_coi_lep(-1)
+	, m_coi_src(0)
+	, m_nextjobid(100)
 {}
 
+int
+mpssd_manager::start()
+{
+	return m_loop.start();
+}
+
 bool
 mpssd_manager::add(mic_info* mic)
 {
@@ -686,7 +752,7 @@ mpssd_manager::add(mic_info* mic)
 
 	m_map[mic->name] =  mpssdi;
 
-	mpssdi->start_control_thread();
+	mpssdi->start_control();
 
 	return true;
 }
@@ -743,43 +809,87 @@ mpssd_manager::wait_and_notify_systemd()
 void
 mpssd_manager::stop()
 {
-	mpssd_log(PINFO, "Request stop of all cards threads");
+	mpssd_log(PINFO, "Request stop of all cards");
 	for (auto iter : m_map) {
 		mpssd_info* mpssdi = iter.second;
-		mpssdi->request_stop_control_thread();
+		mpssdi->request_stop_control();
 	}
 
-	mpssd_log(PINFO, "Wait for stop of all cards threads");
+	mpssd_log(PINFO, "Wait for stop of all cards");
 	for (auto iter : m_map) {
 		mpssd_info* mpssdi = iter.second;
-		mpssdi->stop_control_thread();
+		mpssdi->stop_control();
 	}
 
 	/*
-	 * monitor_thread is using mpssdi instance, so we can
-	 * remove it when daemon threads are not active anymore.
+	 * The monitor handlers are using mpssdi instances, so we can
+	 * remove them when the handlers are not registered anymore.
 	 */
-	stop_authentication_threads();
+	stop_authentication();
 	for (auto iter : m_map) {
 		mpssd_info* mpssdi = iter.second;
+		mpssdi->stop_card_monitor();
 		delete mpssdi;
 	}
 
-	mpssd_log(PINFO, "All cards threads have been stopped");
+	m_loop.stop();
+
+	mpssd_log(PINFO, "All cards have been stopped");
 
 	m_map.clear();
 }
 
+static scif_epd_t
+open_listen_ep(uint16_t port, const char *what)
+{
+	scif_epd_t lep;
+
+	if ((lep = scif_open()) < 0) {
+		mpssd_log(PINFO, "Cannot open mpssd %s SCIF listen port: %s", what, strerror(errno));
+		return -1;
+	}
+
+	if (scif_bind(lep, port) < 0) {
+		mpssd_log(PINFO, "Cannot bind to mpssd %s SCIF PORT: %s", what, strerror(errno));
+		scif_close(lep);
+		return -1;
+	}
+
+	if (scif_listen(lep, 16) < 0) {
+		mpssd_log(PINFO, "Set Listen on mpssd %s SCIF PORT fail: %s", what, strerror(errno));
+		scif_close(lep);
+		return -1;
+	}
+
+	return lep;
+}
+
 void
-mpssd_manager::start_authentication_threads()
+mpssd_manager::start_authentication()
 {
-	m_monitor_thread = std::thread(&mpssd_manager::monitor_thread, this);
-	m_coi_authenticate_thread = std::thread(&mpssd_manager::coi_authenticate_thread, this);
+	if ((m_monitor_lep = open_listen_ep(MPSSD_MONRECV, "monitor")) >= 0) {
+		m_monitor_src = m_loop.add(scif_get_fd(m_monitor_lep), EPOLLIN,
+			std::bind(&mpssd_manager::monitor_accept, this, std::placeholders::_1));
+	}
+
+	if ((m_coi_lep = open_listen_ep(MPSSD_CRED, "credentials")) >= 0) {
+		m_coi_src = m_loop.add(scif_get_fd(m_coi_lep), EPOLLIN,
+			std::bind(&mpssd_manager::coi_authenticate_accept, this, std::placeholders::_1));
+	}
 }
 
 void
-mpssd_manager::stop_authentication_threads()
+mpssd_manager::stop_authentication()
 {
-	m_monitor_thread.join();
-	m_coi_authenticate_thread.join();
+	if (m_monitor_lep >= 0) {
+		m_loop.remove(m_monitor_src);
+		scif_close(m_monitor_lep);
+		m_monitor_lep = -1;
+	}
+
+	if (m_coi_lep >= 0) {
+		m_loop.remove(m_coi_src);
+		scif_close(m_coi_lep);
+		m_coi_lep = -1;
+	}
 }
@@ -13,6 +13,7 @@
 
 #pragma once
 
+#include "event_loop.h"
 #include "mpsstransfer.h"
 #include "sync_utils.h"
 #include "virtio.h"
@@ -75,9 +76,6 @@ class mpssd_info {
 	mic_info* m_mic;
 	mic_device_context* m_mdc;
 
-	std::thread m_control_thread;
-	std::thread m_card_mon_thread;
-
 	bool m_autobooted;
 
 	mpssd_error m_error;
@@ -86,6 +84,16 @@ class mpssd_info {
 
 	bool m_ready_to_notify_systemd;
 
+	/* State tracking runs on the manager's event loop */
+	std::mutex m_control_mutex;
+	bool m_control_active;
+	int m_state_fd;
+	int m_state_old_id;
+	uint64_t m_state_src;
+	shutdown_status m_control_stopped;
+
+	uint64_t m_card_mon_src;
+
 	scif_epd_t	m_recv_ep;
 	scif_epd_t	m_send_ep;
 
@@ -120,8 +128,9 @@ private:
 	int get_state_id(int fd);
 
 	bool stop_condition(int mic_state);
-	void control_thread();
-	void card_monitor_thread();
+	void control_init();
+	void control_event(uint32_t events);
+	void card_monitor_event(uint32_t events);
 
 	void set_readiness_to_notify();
 	void check_autoboot();
@@ -131,10 +140,11 @@ public:
 	std::string name();
 	int id();
 
-	void start_control_thread();
-	void start_monitor_thread();
-	void request_stop_control_thread();
-	void stop_control_thread();
+	void start_control();
+	void start_card_monitor();
+	void stop_card_monitor();
+	void request_stop_control();
+	void stop_control();
 	bool is_ready_to_notify_systemd();
 
 	int establish_connection(scif_epd_t recv_ep, struct scif_portID recvID);
@@ -147,8 +157,12 @@ class mpssd_manager {
 	std::map<std::string, mpssd_info*> m_map;
 	shutdown_status m_status;
 
-	std::thread m_monitor_thread;
-	std::thread m_coi_authenticate_thread;
+	event_loop m_loop;
+
+	scif_epd_t m_monitor_lep;
+	uint64_t m_monitor_src;
+	scif_epd_t m_coi_lep;
+	uint64_t m_coi_src;
 
 	unsigned int m_nextjobid;
 	std::mutex m_job_mutex;
@@ -158,6 +172,8 @@ class mpssd_manager {
 public:
 	mpssd_manager();
 
+	int start();
+	event_loop& loop() { return m_loop; }
 	bool add(mic_info* mic);
 	mpssd_info *get_card_by_id(int micid);
 
@@ -165,12 +181,12 @@ public:
 	void wait_for_stop_request();
 	void stop();
 	void wait_and_notify_systemd();
-	void start_authentication_threads();
-	void stop_authentication_threads();
+	void start_authentication();
+	void stop_authentication();
 	void close_authentication_job(unsigned int jobid);
 
-	void monitor_thread();
-	void coi_authenticate_thread();
+	void monitor_accept(uint32_t events);
+	void coi_authenticate_accept(uint32_t events);
 };
 
 extern mpssd_manager g_manager;
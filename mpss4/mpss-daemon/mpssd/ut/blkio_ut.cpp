@@ -0,0 +1,407 @@
+/*
+ * Copyright (c) 2016, Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ */
+
+#include "../blkio.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+namespace
+{
+
+/* Four full clusters and a partial one */
+const size_t base_size = 4 * COW_CLUSTER_SIZE + 4096;
+
+char
+base_byte(off_t offset)
+{
+	return (char)(offset / 512 + 1);
+}
+
+/* A base image with a known pattern and a path for its overlay */
+class cow_blk_test : public ::testing::Test {
+protected:
+	std::string m_dir;
+	std::string m_base;
+	std::string m_overlay;
+
+	void SetUp()
+	{
+		char dir[] = "/tmp/blkio_ut.XXXXXX";
+		std::vector<char> data(base_size);
+		int fd;
+
+		ASSERT_NE(mkdtemp(dir), (char *)NULL);
+		m_dir = dir;
+		m_base = m_dir + "/base.img";
+		m_overlay = m_dir + "/overlay.cow";
+
+		for (size_t i = 0; i < base_size; i++)
+			data[i] = base_byte(i);
+		fd = ::open(m_base.c_str(), O_WRONLY | O_CREAT, 0600);
+		ASSERT_GE(fd, 0);
+		ASSERT_EQ(write(fd, data.data(), base_size), (ssize_t)base_size);
+		close(fd);
+	}
+
+	void TearDown()
+	{
+		unlink(m_overlay.c_str());
+		unlink(m_base.c_str());
+		rmdir(m_dir.c_str());
+	}
+
+	blk_backend *open_cow()
+	{
+		std::string error;
+		blk_backend *backend = cow_blk_backend::open(m_base,
+			m_overlay, error);
+
+		EXPECT_NE(backend, (blk_backend *)NULL) << error;
+		return backend;
+	}
+
+	/* The bitmap word of the first 64 clusters as stored on disk */
+	uint64_t disk_bitmap()
+	{
+		struct cow_header hdr;
+		uint64_t word = 0;
+		int fd = ::open(m_overlay.c_str(), O_RDONLY);
+
+		EXPECT_GE(fd, 0);
+		EXPECT_EQ(pread(fd, &hdr, sizeof(hdr), 0), (ssize_t)sizeof(hdr));
+		EXPECT_EQ(pread(fd, &word, sizeof(word),
+				le64toh(hdr.bitmap_offset)), (ssize_t)sizeof(word));
+		close(fd);
+		return le64toh(word);
+	}
+
+	/* Cut the base image to a size that is not a whole number of sectors */
+	void truncate_base(off_t size)
+	{
+		ASSERT_EQ(truncate(m_base.c_str(), size), 0);
+	}
+
+	void expect_base(const std::vector<char>& buf, off_t offset)
+	{
+		for (size_t i = 0; i < buf.size(); i++)
+			ASSERT_EQ(buf[i], base_byte(offset + i))
+				<< "offset " << offset + i;
+	}
+};
+
+/*
+ * An in-memory backend for the engine tests. Writes can be held at a gate
+ * and made to fail, and the backend checks that overlapping writes never
+ * run at the same time.
+ */
+class mem_blk_backend : public blk_backend {
+	std::vector<char> m_data;
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	std::vector<std::pair<off_t, size_t>> m_active;
+	bool m_gate_open;
+
+public:
+	std::atomic<int> writes_started;
+	std::atomic<int> max_active;
+	std::atomic<bool> overlap_seen;
+	std::atomic<int> flushes;
+	off_t fail_offset;
+
+	mem_blk_backend(size_t size) : m_data(size), m_gate_open(true),
+		writes_started(0), max_active(0), overlap_seen(false),
+		flushes(0), fail_offset(-1) {}
+
+	off_t size() { return m_data.size(); }
+
+	int read(char *buf, size_t len, off_t offset)
+	{
+		std::lock_guard<std::mutex> guard(m_mutex);
+
+		memcpy(buf, &m_data[offset], len);
+		return 0;
+	}
+
+	int write(const char *buf, size_t len, off_t offset)
+	{
+		{
+			std::unique_lock<std::mutex> l(m_mutex);
+
+			for (auto &a : m_active) {
+				if (a.first < (off_t)(offset + len) &&
+				    offset < (off_t)(a.first + a.second))
+					overlap_seen = true;
+			}
+			m_active.push_back(std::make_pair(offset, len));
+			if ((int)m_active.size() > max_active)
+				max_active = m_active.size();
+			writes_started++;
+			m_cv.wait(l, [&] { return m_gate_open; });
+		}
+
+		/* Give overlapping writes a chance to race */
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+		std::lock_guard<std::mutex> guard(m_mutex);
+		for (auto it = m_active.begin(); it != m_active.end(); ++it) {
+			if (it->first == offset && it->second == len) {
+				m_active.erase(it);
+				break;
+			}
+		}
+		if (offset == fail_offset)
+			return -EIO;
+		memcpy(&m_data[offset], buf, len);
+		return 0;
+	}
+
+	int flush()
+	{
+		flushes++;
+		return 0;
+	}
+
+	void close_gate()
+	{
+		std::lock_guard<std::mutex> guard(m_mutex);
+
+		m_gate_open = false;
+	}
+
+	void open_gate()
+	{
+		{
+			std::lock_guard<std::mutex> guard(m_mutex);
+
+			m_gate_open = true;
+		}
+		m_cv.notify_all();
+	}
+};
+
+char *
+filled_buf(size_t len, char c)
+{
+	char *buf = (char *)malloc(len);
+
+	memset(buf, c, len);
+	return buf;
+}
+
+} // namespace
+
+TEST_F(cow_blk_test, read_through)
+{
+	std::unique_ptr<blk_backend> cow(open_cow());
+	std::vector<char> buf(base_size);
+
+	ASSERT_TRUE(cow.get());
+	EXPECT_EQ(cow->size(), (off_t)base_size);
+	ASSERT_EQ(cow->read(buf.data(), buf.size(), 0), 0);
+	expect_base(buf, 0);
+	EXPECT_EQ(disk_bitmap(), 0ULL);
+}
+
+TEST_F(cow_blk_test, copy_up)
+{
+	std::unique_ptr<blk_backend> cow(open_cow());
+	std::vector<char> data(1024, 'x');
+	std::vector<char> buf(COW_CLUSTER_SIZE);
+	std::unique_ptr<blk_backend> base;
+	std::string error;
+	off_t start = COW_CLUSTER_SIZE;
+	off_t offset = start + 8192;
+
+	ASSERT_TRUE(cow.get());
+	ASSERT_EQ(cow->write(data.data(), data.size(), offset), 0);
+
+	/* The rest of the cluster was copied up from the base */
+	ASSERT_EQ(cow->read(buf.data(), buf.size(), start), 0);
+	for (off_t i = 0; i < COW_CLUSTER_SIZE; i++) {
+		if (start + i >= offset &&
+		    start + i < offset + (off_t)data.size())
+			ASSERT_EQ(buf[i], 'x') << "offset " << start + i;
+		else
+			ASSERT_EQ(buf[i], base_byte(start + i))
+				<< "offset " << start + i;
+	}
+
+	/* Neighbouring clusters still read through */
+	ASSERT_EQ(cow->read(buf.data(), buf.size(), 0), 0);
+	expect_base(buf, 0);
+	ASSERT_EQ(cow->read(buf.data(), buf.size(), 2 * start), 0);
+	expect_base(buf, 2 * start);
+
+	/* The base image is never written */
+	base.reset(raw_blk_backend::open(m_base, error));
+	ASSERT_TRUE(base.get()) << error;
+	ASSERT_EQ(base->read(buf.data(), buf.size(), start), 0);
+	expect_base(buf, start);
+}
+
+TEST_F(cow_blk_test, bitmap_written_on_flush)
+{
+	std::unique_ptr<blk_backend> cow(open_cow());
+	std::vector<char> data(512, 'y');
+
+	ASSERT_TRUE(cow.get());
+	ASSERT_EQ(cow->write(data.data(), data.size(), 3 * COW_CLUSTER_SIZE), 0);
+	EXPECT_EQ(disk_bitmap(), 0ULL);
+	ASSERT_EQ(cow->flush(), 0);
+	EXPECT_EQ(disk_bitmap(), 1ULL << 3);
+}
+
+TEST_F(cow_blk_test, reopen)
+{
+	std::unique_ptr<blk_backend> cow(open_cow());
+	std::vector<char> data(4096, 'z');
+	std::vector<char> buf(4096);
+	off_t tail = 4 * COW_CLUSTER_SIZE;
+
+	ASSERT_TRUE(cow.get());
+	ASSERT_EQ(cow->write(data.data(), data.size(), 4096), 0);
+	ASSERT_EQ(cow->write(data.data(), data.size(), tail), 0);
+	ASSERT_EQ(cow->flush(), 0);
+	cow.reset(open_cow());
+	ASSERT_TRUE(cow.get());
+
+	ASSERT_EQ(cow->read(buf.data(), buf.size(), 4096), 0);
+	EXPECT_EQ(buf, data);
+	ASSERT_EQ(cow->read(buf.data(), buf.size(), tail), 0);
+	EXPECT_EQ(buf, data);
+	ASSERT_EQ(cow->read(buf.data(), buf.size(), 0), 0);
+	expect_base(buf, 0);
+	ASSERT_EQ(cow->read(buf.data(), buf.size(), COW_CLUSTER_SIZE), 0);
+	expect_base(buf, COW_CLUSTER_SIZE);
+}
+
+TEST_F(cow_blk_test, unaligned_base)
+{
+	off_t size = base_size - 100;
+	off_t disk_size = base_size;
+	std::unique_ptr<blk_backend> cow;
+	std::vector<char> data(512, 'w');
+	std::vector<char> buf(512);
+
+	truncate_base(size);
+	cow.reset(open_cow());
+	ASSERT_TRUE(cow.get());
+
+	/* The card sees the last partial sector as a whole one */
+	EXPECT_EQ(cow->size(), disk_size);
+	ASSERT_EQ(cow->read(buf.data(), buf.size(), disk_size - 512), 0);
+	for (off_t i = 0; i < 512; i++) {
+		if (disk_size - 512 + i < size)
+			ASSERT_EQ(buf[i], base_byte(disk_size - 512 + i));
+		else
+			ASSERT_EQ(buf[i], 0) << "offset " << disk_size - 512 + i;
+	}
+
+	ASSERT_EQ(cow->write(data.data(), data.size(), disk_size - 512), 0);
+	ASSERT_EQ(cow->flush(), 0);
+	cow.reset(open_cow());
+	ASSERT_TRUE(cow.get());
+	ASSERT_EQ(cow->read(buf.data(), buf.size(), disk_size - 512), 0);
+	EXPECT_EQ(buf, data);
+
+	/* Still nothing past the end */
+	EXPECT_EQ(cow->write(data.data(), data.size(), disk_size), -EIO);
+}
+
+TEST(blk_io_engine, overlapping_writes_in_order)
+{
+	mem_blk_backend *mem = new mem_blk_backend(1 << 20);
+	blk_io_engine engine(mem);
+	std::vector<char> buf(8192);
+	int i;
+
+	/* Disjoint writes run in parallel, overlapping ones one at a time */
+	for (i = 0; i < 16; i++)
+		engine.submit_write(filled_buf(4096, 'a' + i), 4096,
+				    (i % 4) * 4096);
+	engine.submit_write(filled_buf(8192, 'z'), 8192, 2048);
+	ASSERT_EQ(engine.flush(), 0);
+
+	EXPECT_FALSE(mem->overlap_seen);
+	EXPECT_GT(mem->max_active, 1);
+	ASSERT_EQ(engine.read(buf.data(), buf.size(), 0), 0);
+	/* The last write of each range wins */
+	for (i = 0; i < 8192; i++) {
+		if (i >= 2048)
+			ASSERT_EQ(buf[i], 'z') << "offset " << i;
+		else
+			ASSERT_EQ(buf[i], 'a' + 12) << "offset " << i;
+	}
+}
+
+TEST(blk_io_engine, read_waits_for_pending_write)
+{
+	mem_blk_backend *mem = new mem_blk_backend(1 << 20);
+	blk_io_engine engine(mem);
+	std::vector<char> buf(4096);
+	std::future<int> overlapping;
+
+	mem->close_gate();
+	engine.submit_write(filled_buf(4096, 'p'), 4096, 8192);
+	while (!mem->writes_started)
+		std::this_thread::yield();
+
+	/* A read elsewhere is not held up by the write */
+	ASSERT_EQ(engine.read(buf.data(), buf.size(), 0), 0);
+
+	overlapping = std::async(std::launch::async, [&] {
+		return engine.read(buf.data() + 2048, 2048, 10240);
+	});
+	EXPECT_EQ(overlapping.wait_for(std::chrono::milliseconds(50)),
+		  std::future_status::timeout);
+
+	mem->open_gate();
+	ASSERT_EQ(overlapping.get(), 0);
+	EXPECT_EQ(std::vector<char>(buf.begin() + 2048, buf.end()),
+		  std::vector<char>(2048, 'p'));
+}
+
+TEST(blk_io_engine, write_error_reported_by_flush)
+{
+	mem_blk_backend *mem = new mem_blk_backend(1 << 20);
+	blk_io_engine engine(mem);
+
+	mem->fail_offset = 4096;
+	engine.submit_write(filled_buf(512, 'e'), 512, 0);
+	engine.submit_write(filled_buf(512, 'e'), 512, 4096);
+	engine.submit_write(filled_buf(512, 'e'), 512, 8192);
+	EXPECT_EQ(engine.flush(), -EIO);
+	EXPECT_EQ(mem->flushes, 1);
+
+	/* The error is reported once */
+	mem->fail_offset = -1;
+	engine.submit_write(filled_buf(512, 'f'), 512, 4096);
+	EXPECT_EQ(engine.flush(), 0);
+}
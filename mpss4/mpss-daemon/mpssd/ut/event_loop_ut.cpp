@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2016, Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ */
+
+#include "../event_loop.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <thread>
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+/* The loop only logs, the logger of mpssd is not linked in */
+void
+mpsslog(int level, const char *format, ...)
+{
+}
+
+void
+set_thread_name(const char* dev, const char* name)
+{
+}
+
+namespace
+{
+
+const int task_ms = 200;
+
+/* Counts finished tasks and lets the test wait for them */
+struct task_counter {
+	std::mutex mutex;
+	std::condition_variable cv;
+	int done = 0;
+
+	void finish()
+	{
+		std::lock_guard<std::mutex> l(mutex);
+		done++;
+		cv.notify_all();
+	}
+
+	bool wait_for(int n)
+	{
+		std::unique_lock<std::mutex> l(mutex);
+		return cv.wait_for(l, std::chrono::seconds(5),
+				   [&] { return done >= n; });
+	}
+};
+
+} // namespace
+
+TEST(event_loop, idle_loop_does_not_wake_up)
+{
+	event_loop loop;
+
+	ASSERT_EQ(loop.start(), 0);
+	usleep(1000 * 1000);
+	EXPECT_EQ(loop.wakeups(), 0UL);
+	loop.stop();
+}
+
+TEST(event_loop, blocking_tasks_run_on_separate_workers)
+{
+	event_loop loop;
+	task_counter counter;
+	auto start = std::chrono::steady_clock::now();
+	long ms;
+
+	ASSERT_EQ(loop.start(), 0);
+	for (int i = 0; i < EVENT_LOOP_THREADS; i++)
+		loop.post([&] {
+			usleep(task_ms * 1000);
+			counter.finish();
+		});
+	ASSERT_TRUE(counter.wait_for(EVENT_LOOP_THREADS));
+	ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now() - start).count();
+	loop.stop();
+
+	/* One worker running them all would take EVENT_LOOP_THREADS times as long */
+	EXPECT_LT(ms, 2 * task_ms);
+}
+
+TEST(event_loop, fd_handler_is_rearmed)
+{
+	event_loop loop;
+	task_counter counter;
+	int fds[2];
+	char c;
+
+	ASSERT_EQ(pipe(fds), 0);
+	ASSERT_EQ(loop.start(), 0);
+	uint64_t id = loop.add(fds[0], EPOLLIN, [&](uint32_t events) {
+		if (read(fds[0], &c, 1) == 1)
+			counter.finish();
+	});
+	ASSERT_NE(id, 0ULL);
+
+	for (int i = 1; i <= 3; i++) {
+		ASSERT_EQ(write(fds[1], "x", 1), 1);
+		ASSERT_TRUE(counter.wait_for(i));
+	}
+	loop.remove(id);
+	loop.stop();
+	close(fds[0]);
+	close(fds[1]);
+}
+
+TEST(event_loop, stop_while_posting)
+{
+	for (int i = 0; i < 500; i++) {
+		/* Leaked if stop() hangs, its destructor would hang too */
+		event_loop *loop = new event_loop;
+		std::atomic<bool> posting(true);
+		std::promise<void> stopped;
+		std::future<void> done = stopped.get_future();
+
+		ASSERT_EQ(loop->start(), 0);
+		std::thread poster([&] {
+			while (posting)
+				loop->post([] {});
+		});
+		std::thread stopper([&] {
+			loop->stop();
+			stopped.set_value();
+		});
+
+		bool ok = done.wait_for(std::chrono::seconds(5)) ==
+			std::future_status::ready;
+		posting = false;
+		poster.join();
+		if (!ok) {
+			stopper.detach();
+			FAIL() << "stop() hung in round " << i;
+		}
+		stopper.join();
+		delete loop;
+	}
+}
@@ -0,0 +1,29 @@
+/*
+ * Copyright (c) 2016, Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ */
+
+#pragma once
+
+/*
+ * The unit tests replace ioctl(), so a test can stand in for the driver
+ * behind the fds it hands to the code under test. Calls the current
+ * handler does not take go to the kernel.
+ */
+class fake_ioctl_handler {
+public:
+	virtual ~fake_ioctl_handler() {}
+
+	/* Returns true, with the ioctl() result in ret, if the call was taken */
+	virtual bool ioctl(int fd, unsigned long request, void *arg, int& ret) = 0;
+};
+
+extern fake_ioctl_handler *fake_ioctl;
@@ -0,0 +1,469 @@
+/*
+ * Copyright (c) 2016, Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ */
+
+#include "../virtblk.h"
+#include "fake_ioctl.h"
+
+#include <mic_ioctl.h>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+namespace
+{
+
+/* Largest request the fake card issues */
+const size_t max_req_len = 128 * 1024;
+
+/* Header, data and status descriptors per request */
+const unsigned int descs_per_req = 3;
+
+/* Requests the fake card keeps in flight */
+const unsigned int queue_depth = 32;
+
+/*
+ * A card with a virtio-blk driver behind a fake VOP device fd. Requests
+ * are laid out as the Linux driver does: a read-only header, one data
+ * descriptor and a writable status byte. MIC_VIRTIO_COPY_DESC walks the
+ * chains one at a time like the VOP driver, reading the card-readable
+ * descriptors first, and completes a chain when asked to update the used
+ * ring.
+ */
+struct fake_vblk : public fake_ioctl_handler {
+	struct slot {
+		struct virtio_blk_outhdr hdr;
+		std::vector<char> data;
+		__u8 status;
+	};
+
+	int fd;
+	std::vector<char> mem;
+	struct _mic_vring_info info;
+	struct mic_vring vr;
+	std::vector<slot> slots;
+	std::vector<unsigned int> free_slots;
+	__u16 used_seen;
+
+	/* Chain being copied, as (address, length) segments */
+	int head;
+	__u16 last_avail;
+	std::vector<std::pair<char *, size_t>> rd, wr;
+	size_t rd_pos, wr_pos, total;
+
+	/* Used ring updates that were not deferred, i.e. card interrupts */
+	unsigned long notifications;
+
+	fake_vblk() : slots(MIC_VRING_ENTRIES / descs_per_req), used_seen(0),
+		      head(-1), last_avail(0), notifications(0)
+	{
+		fd = open("/dev/null", O_RDWR);
+		mem.resize(vring_size(MIC_VRING_ENTRIES, MIC_VIRTIO_RING_ALIGN) +
+			   MIC_VIRTIO_RING_ALIGN);
+		memset(&info, 0, sizeof(info));
+		vr.va = (void *)_ALIGN_UP((unsigned long)mem.data(),
+					  MIC_VIRTIO_RING_ALIGN);
+		vr.info = &info;
+		vring_init(&vr.vr, MIC_VRING_ENTRIES, vr.va, MIC_VIRTIO_RING_ALIGN);
+		for (unsigned int i = 0; i < slots.size(); i++) {
+			slots[i].data.resize(max_req_len);
+			free_slots.push_back(slots.size() - 1 - i);
+		}
+	}
+
+	~fake_vblk()
+	{
+		close(fd);
+	}
+
+	void set_desc(unsigned int i, void *addr, size_t len, __u16 flags,
+		      unsigned int next)
+	{
+		vr.vr.desc[i].addr = htole64((unsigned long)addr);
+		vr.vr.desc[i].len = htole32(len);
+		vr.vr.desc[i].flags = htole16(flags);
+		vr.vr.desc[i].next = htole16(next);
+	}
+
+	/* Queue a request, returns its slot */
+	unsigned int submit(__u32 type, off_t offset, size_t len)
+	{
+		unsigned int s = free_slots.back();
+		unsigned int d = s * descs_per_req;
+		__u16 idx = le16toh(vr.vr.avail->idx);
+		__u16 write = type == VIRTIO_BLK_T_OUT ? 0 : VRING_DESC_F_WRITE;
+
+		free_slots.pop_back();
+		slots[s].hdr.type = htole32(type);
+		slots[s].hdr.ioprio = 0;
+		slots[s].hdr.sector = htole64(offset / SECTOR_SIZE);
+		slots[s].status = 0xff;
+		if (len) {
+			set_desc(d, &slots[s].hdr, sizeof(slots[s].hdr),
+				 VRING_DESC_F_NEXT, d + 1);
+			set_desc(d + 1, slots[s].data.data(), len,
+				 VRING_DESC_F_NEXT | write, d + 2);
+		} else {
+			set_desc(d, &slots[s].hdr, sizeof(slots[s].hdr),
+				 VRING_DESC_F_NEXT, d + 2);
+		}
+		set_desc(d + 2, &slots[s].status, 1, VRING_DESC_F_WRITE, 0);
+
+		vr.vr.avail->ring[idx % MIC_VRING_ENTRIES] = htole16(d);
+		vr.vr.avail->idx = htole16(idx + 1);
+		return s;
+	}
+
+	/* Reap completed requests, returns their slots */
+	std::vector<unsigned int> reap()
+	{
+		std::vector<unsigned int> done;
+
+		while (used_seen != le16toh(vr.vr.used->idx)) {
+			struct vring_used_elem *e =
+				&vr.vr.used->ring[used_seen++ % MIC_VRING_ENTRIES];
+			unsigned int s = le32toh(e->id) / descs_per_req;
+
+			done.push_back(s);
+			free_slots.push_back(s);
+		}
+		return done;
+	}
+
+	bool fetch()
+	{
+		unsigned int d;
+
+		if (last_avail == le16toh(vr.vr.avail->idx))
+			return false;
+		head = le16toh(vr.vr.avail->ring[last_avail++ % MIC_VRING_ENTRIES]);
+		rd.clear();
+		wr.clear();
+		rd_pos = wr_pos = total = 0;
+		for (d = head;; d = le16toh(vr.vr.desc[d].next)) {
+			struct vring_desc *desc = &vr.vr.desc[d];
+			std::pair<char *, size_t> seg(
+				(char *)(unsigned long)le64toh(desc->addr),
+				le32toh(desc->len));
+
+			if (le16toh(desc->flags) & VRING_DESC_F_WRITE)
+				wr.push_back(seg);
+			else
+				rd.push_back(seg);
+			if (!(le16toh(desc->flags) & VRING_DESC_F_NEXT))
+				break;
+		}
+		return true;
+	}
+
+	/* Moves up to len bytes between buf and the segments */
+	size_t copy_segs(std::vector<std::pair<char *, size_t>>& segs,
+			 size_t& pos, char *buf, size_t len, bool to_buf)
+	{
+		size_t done = 0, seg_off = pos, n;
+		unsigned int i;
+
+		for (i = 0; i < segs.size() && seg_off >= segs[i].second; i++)
+			seg_off -= segs[i].second;
+		for (; i < segs.size() && done < len; i++, seg_off = 0) {
+			n = std::min(len - done, segs[i].second - seg_off);
+			if (to_buf)
+				memcpy(buf + done, segs[i].first + seg_off, n);
+			else
+				memcpy(segs[i].first + seg_off, buf + done, n);
+			done += n;
+		}
+		pos += done;
+		return done;
+	}
+
+	size_t seg_len(std::vector<std::pair<char *, size_t>>& segs)
+	{
+		size_t len = 0;
+
+		for (auto &seg : segs)
+			len += seg.second;
+		return len;
+	}
+
+	bool ioctl(int fd, unsigned long request, void *arg, int& ret)
+	{
+		struct mic_copy_desc *copy = (struct mic_copy_desc *)arg;
+		unsigned int i;
+		size_t n;
+
+		if (fd != this->fd)
+			return false;
+		ret = 0;
+		if (request != MIC_VIRTIO_COPY_DESC) {
+			errno = ENOTTY;
+			ret = -1;
+			return true;
+		}
+
+		copy->out_len = 0;
+		if (head < 0 && !fetch()) {
+			errno = EAGAIN;
+			ret = -1;
+			return true;
+		}
+		for (i = 0; i < copy->iovcnt; i++) {
+			char *buf = (char *)copy->iov[i].iov_base;
+			size_t len = copy->iov[i].iov_len;
+
+			n = copy_segs(rd, rd_pos, buf, len, true);
+			n += copy_segs(wr, wr_pos, buf + n, len - n, false);
+			copy->out_len += n;
+			if (rd_pos == seg_len(rd) && wr_pos == seg_len(wr))
+				break;
+		}
+		total += copy->out_len;
+
+		if (copy->out_len && copy->update_used) {
+			__u16 idx = le16toh(vr.vr.used->idx);
+
+			vr.vr.used->ring[idx % MIC_VRING_ENTRIES].id = htole32(head);
+			vr.vr.used->ring[idx % MIC_VRING_ENTRIES].len = htole32(total);
+			vr.vr.used->idx = htole16(idx + 1);
+			if (copy->update_used != MIC_VIRTIO_USED_DEFER)
+				notifications++;
+			info.avail_idx = last_avail;
+			head = -1;
+		}
+		return true;
+	}
+};
+
+/* A device with a raw backend file, served the way virtio_block() does */
+class virtblk_test : public ::testing::Test {
+protected:
+	std::string m_dir;
+	std::string m_image;
+	std::string m_overlay;
+	fake_vblk m_card;
+	std::unique_ptr<blk_io_engine> m_engine;
+
+	void SetUp()
+	{
+		char dir[] = "/tmp/virtblk_ut.XXXXXX";
+		std::string error;
+		int fd;
+
+		ASSERT_NE(mkdtemp(dir), (char *)NULL);
+		m_dir = dir;
+		m_image = m_dir + "/disk.img";
+		m_overlay = m_dir + "/disk.cow";
+		fd = ::open(m_image.c_str(), O_WRONLY | O_CREAT, 0600);
+		ASSERT_GE(fd, 0);
+		ASSERT_EQ(ftruncate(fd, 64 << 20), 0);
+		close(fd);
+
+		blk_backend *backend = raw_blk_backend::open(m_image, error);
+		ASSERT_TRUE(backend) << error;
+		m_engine.reset(new blk_io_engine(backend));
+		fake_ioctl = &m_card;
+	}
+
+	void TearDown()
+	{
+		fake_ioctl = NULL;
+		m_engine.reset();
+		unlink(m_overlay.c_str());
+		unlink(m_image.c_str());
+		rmdir(m_dir.c_str());
+	}
+
+	/* Serve the device from a copy-on-write overlay of the image */
+	void use_overlay()
+	{
+		std::string error;
+		blk_backend *backend = cow_blk_backend::open(m_image,
+			m_overlay, error);
+
+		ASSERT_TRUE(backend) << error;
+		m_engine.reset(new blk_io_engine(backend));
+	}
+
+	/* The virtio_block() loop for one POLLIN */
+	void serve()
+	{
+		while (m_card.info.avail_idx != le16toh(m_card.vr.vr.avail->idx))
+			ASSERT_EQ(virtblk_handle_request(m_card.fd, m_engine.get(),
+							 &m_card.vr), 0);
+	}
+
+	/* Runs one request to completion and returns its status */
+	__u8 request(__u32 type, off_t offset, std::vector<char>& data)
+	{
+		unsigned int s = m_card.submit(type, offset, data.size());
+
+		if (type == VIRTIO_BLK_T_OUT)
+			memcpy(m_card.slots[s].data.data(), data.data(), data.size());
+		serve();
+		EXPECT_EQ(m_card.reap(), std::vector<unsigned int>(1, s));
+		if (type != VIRTIO_BLK_T_OUT)
+			memcpy(data.data(), m_card.slots[s].data.data(), data.size());
+		return m_card.slots[s].status;
+	}
+};
+
+double
+elapsed_s(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(
+		std::chrono::steady_clock::now() - start).count();
+}
+
+} // namespace
+
+TEST_F(virtblk_test, write_flush_read)
+{
+	std::vector<char> data(8192, 'w');
+	std::vector<char> none;
+	std::vector<char> buf(8192);
+
+	EXPECT_EQ(request(VIRTIO_BLK_T_OUT, 4096, data), VIRTIO_BLK_S_OK);
+	EXPECT_EQ(request(VIRTIO_BLK_T_FLUSH, 0, none), VIRTIO_BLK_S_OK);
+	EXPECT_EQ(request(VIRTIO_BLK_T_IN, 4096, buf), VIRTIO_BLK_S_OK);
+	EXPECT_EQ(buf, data);
+}
+
+TEST_F(virtblk_test, overlay_requests)
+{
+	std::vector<char> data(8192, 'o');
+	std::vector<char> base(4 * COW_CLUSTER_SIZE, 'b');
+	std::vector<char> none;
+	std::vector<char> buf(2 * COW_CLUSTER_SIZE);
+	off_t offset = 2 * COW_CLUSTER_SIZE - 4096;
+	int fd;
+
+	fd = ::open(m_image.c_str(), O_WRONLY);
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(pwrite(fd, base.data(), base.size(), 0), (ssize_t)base.size());
+	close(fd);
+	use_overlay();
+
+	/* A write straddling two clusters copies both up */
+	EXPECT_EQ(request(VIRTIO_BLK_T_OUT, offset, data), VIRTIO_BLK_S_OK);
+	EXPECT_EQ(request(VIRTIO_BLK_T_FLUSH, 0, none), VIRTIO_BLK_S_OK);
+	EXPECT_EQ(request(VIRTIO_BLK_T_IN, COW_CLUSTER_SIZE, buf),
+		  VIRTIO_BLK_S_OK);
+	for (size_t i = 0; i < buf.size(); i++) {
+		off_t pos = COW_CLUSTER_SIZE + i;
+		char expected = pos >= offset &&
+			pos < offset + (off_t)data.size() ? 'o' : 'b';
+
+		ASSERT_EQ(buf[i], expected) << "offset " << pos;
+	}
+
+	/* The image itself is untouched */
+	fd = ::open(m_image.c_str(), O_RDONLY);
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(pread(fd, buf.data(), buf.size(), COW_CLUSTER_SIZE),
+		  (ssize_t)buf.size());
+	close(fd);
+	EXPECT_EQ(buf, std::vector<char>(buf.size(), 'b'));
+}
+
+TEST_F(virtblk_test, unsupported_request)
+{
+	std::vector<char> none;
+
+	EXPECT_EQ(request(VIRTIO_BLK_T_SCSI_CMD, 0, none), VIRTIO_BLK_S_UNSUPP);
+}
+
+TEST_F(virtblk_test, drained_requests_notify_once)
+{
+	unsigned int i;
+
+	for (i = 0; i < queue_depth; i++)
+		m_card.submit(VIRTIO_BLK_T_OUT, i * 4096, 4096);
+	serve();
+	EXPECT_EQ(m_card.reap().size(), queue_depth);
+	EXPECT_EQ(m_card.notifications, 1UL);
+}
+
+/*
+ * fio-like jobs over the fake vring: the card keeps queue_depth requests
+ * in flight and the requests are served as virtio_block() does. Prints
+ * IOPS, bandwidth and card interrupts per request for each job. The card
+ * side costs nothing here, so this is the host side of each request.
+ */
+TEST_F(virtblk_test, fio_jobs)
+{
+	struct job {
+		const char *name;
+		__u32 type;
+		size_t bs;
+		bool random;
+		unsigned int fsync;
+	} jobs[] = {
+		{ "seqwrite", VIRTIO_BLK_T_OUT, 128 * 1024, false, 0 },
+		{ "randwrite", VIRTIO_BLK_T_OUT, 4096, true, 0 },
+		{ "randwrite fsync=32", VIRTIO_BLK_T_OUT, 4096, true, 32 },
+		{ "seqread", VIRTIO_BLK_T_IN, 128 * 1024, false, 0 },
+		{ "randread", VIRTIO_BLK_T_IN, 4096, true, 0 },
+	};
+	const size_t job_bytes = 16 << 20;
+	const off_t disk_size = 64 << 20;
+	std::mt19937 rng(1);
+
+	for (auto &j : jobs) {
+		unsigned long reqs = job_bytes / j.bs, issued = 0, done = 0;
+		unsigned long notifications = m_card.notifications;
+		std::vector<unsigned int> reaped;
+		off_t offset = 0;
+
+		auto start = std::chrono::steady_clock::now();
+		while (done < reqs) {
+			while (issued < reqs && m_card.free_slots.size() &&
+			       issued - done < queue_depth) {
+				if (j.fsync && issued && !(issued % j.fsync))
+					m_card.submit(VIRTIO_BLK_T_FLUSH, 0, 0);
+				if (j.random)
+					offset = (rng() % (disk_size / j.bs)) * j.bs;
+				m_card.submit(j.type, offset, j.bs);
+				offset = (offset + j.bs) % disk_size;
+				issued++;
+			}
+			serve();
+			reaped = m_card.reap();
+			for (auto s : reaped) {
+				ASSERT_EQ(m_card.slots[s].status, VIRTIO_BLK_S_OK);
+				if (le32toh(m_card.slots[s].hdr.type) == j.type)
+					done++;
+			}
+		}
+		std::vector<char> none;
+		ASSERT_EQ(request(VIRTIO_BLK_T_FLUSH, 0, none), VIRTIO_BLK_S_OK);
+		double s = elapsed_s(start);
+
+		printf("%-20s bs=%-6zu %8.0f IOPS %8.1f MB/s %.3f interrupts/request\n",
+		       j.name, j.bs, reqs / s, reqs * j.bs / s / (1 << 20),
+		       (double)(m_card.notifications - notifications) / reqs);
+	}
+}
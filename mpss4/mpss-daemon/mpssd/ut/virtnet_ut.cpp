@@ -0,0 +1,440 @@
+/*
+ * Copyright (c) 2016, Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ */
+
+#include "../virtnet.h"
+#include "fake_ioctl.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <endian.h>
+#include <fcntl.h>
+#include <linux/if_tun.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+namespace
+{
+
+/* An Ethernet frame of the default MTU */
+const size_t pkt_len = 1514;
+
+/* What the fake card saw of one packet copied to it */
+struct card_pkt {
+	struct virtio_net_hdr hdr;
+	size_t len;
+	uint32_t seq;
+};
+
+/*
+ * A VOP device fd with a card behind it. The card keeps its RX vring full
+ * of buffers and queues TX packets when told to. Copies are done by the
+ * MIC_VIRTIO_COPY_BATCH handler below instead of the driver, which also
+ * records the offloads set on the TAP.
+ */
+struct fake_vop : public fake_ioctl_handler {
+	int fd;
+	int tap_fd;
+	unsigned int tap_offload;
+	std::vector<char> mem[2];
+	struct _mic_vring_info info[2];
+	struct mic_vring vr[2];
+
+	unsigned long ioctls;
+	std::vector<card_pkt> received;
+	uint32_t tx_seq;
+
+	fake_vop() : tap_fd(-1), tap_offload(0), ioctls(0), tx_seq(0)
+	{
+		fd = open("/dev/null", O_RDWR);
+		for (int i = 0; i < 2; i++) {
+			mem[i].resize(vring_size(MIC_VRING_ENTRIES,
+						 MIC_VIRTIO_RING_ALIGN) +
+				      MIC_VIRTIO_RING_ALIGN);
+			memset(&info[i], 0, sizeof(info[i]));
+			vr[i].va = (void *)_ALIGN_UP((unsigned long)mem[i].data(),
+						     MIC_VIRTIO_RING_ALIGN);
+			vr[i].info = &info[i];
+			vring_init(&vr[i].vr, MIC_VRING_ENTRIES, vr[i].va,
+				   MIC_VIRTIO_RING_ALIGN);
+		}
+		/* A full RX vring */
+		vr[0].vr.avail->idx = htole16(MIC_VRING_ENTRIES);
+	}
+
+	~fake_vop()
+	{
+		close(fd);
+	}
+
+	/* The card queues count packets on its TX vring */
+	void card_send(unsigned int count)
+	{
+		vr[1].vr.avail->idx = htole16(le16toh(vr[1].vr.avail->idx) +
+					      count);
+	}
+
+	bool consume(struct mic_copy_desc *copy)
+	{
+		struct mic_vring *v = &vr[copy->vr_idx];
+		struct iovec *iov = copy->iov;
+		uint32_t seq;
+
+		if (le16toh(v->vr.avail->idx) == v->info->avail_idx)
+			return false;
+
+		if (copy->vr_idx == 0) {
+			card_pkt pkt;
+
+			memcpy(&pkt.hdr, iov[0].iov_base, sizeof(pkt.hdr));
+			pkt.len = iov[1].iov_len;
+			memcpy(&pkt.seq, iov[1].iov_base, sizeof(pkt.seq));
+			received.push_back(pkt);
+			copy->out_len = iov[0].iov_len + iov[1].iov_len;
+			/* The card refills its RX vring right away */
+			v->vr.avail->idx = htole16(le16toh(v->vr.avail->idx) + 1);
+		} else {
+			seq = tx_seq++;
+			memset(iov[0].iov_base, 0, iov[0].iov_len);
+			memset(iov[1].iov_base, 0, pkt_len);
+			memcpy(iov[1].iov_base, &seq, sizeof(seq));
+			copy->out_len = iov[0].iov_len + pkt_len;
+		}
+		v->info->avail_idx++;
+		return true;
+	}
+
+	bool ioctl(int fd, unsigned long request, void *arg, int& ret)
+	{
+		struct mic_copy_batch *batch;
+
+		if (fd == tap_fd && request == TUNSETOFFLOAD) {
+			tap_offload = (unsigned int)(unsigned long)arg;
+			ret = 0;
+			return true;
+		}
+		if (fd != this->fd)
+			return false;
+
+		if (request != MIC_VIRTIO_COPY_BATCH) {
+			errno = ENOTTY;
+			ret = -1;
+			return true;
+		}
+		ioctls++;
+		batch = (struct mic_copy_batch *)arg;
+		for (batch->done = 0; batch->done < batch->count; batch->done++) {
+			if (!consume(&batch->copy[batch->done]))
+				break;
+		}
+		ret = 0;
+		return true;
+	}
+};
+
+double
+elapsed_s(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(
+		std::chrono::steady_clock::now() - start).count();
+}
+
+/*
+ * A virtnet_queue wired to a fake card. The TAP is a SOCK_SEQPACKET
+ * socket pair, which keeps frame boundaries like a TAP does: the queue
+ * owns one end and the test plays the host network stack on the other.
+ */
+class virtnet_test : public ::testing::Test {
+protected:
+	fake_vop m_vop;
+	struct virtnet_queue m_q;
+	struct virtnet_batch m_batch;
+	int m_host_fd;
+
+	void SetUp()
+	{
+		int fds[2];
+
+		ASSERT_EQ(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds), 0);
+		ASSERT_EQ(fcntl(fds[0], F_SETFL, O_NONBLOCK), 0);
+		m_host_fd = fds[1];
+
+		m_q.mdc = NULL;
+		m_q.mic = NULL;
+		m_q.virtio_fd = m_vop.fd;
+		m_q.tap_fd = fds[0];
+		m_vop.tap_fd = fds[0];
+		m_q.tx_vr = m_vop.vr[0];
+		m_q.rx_vr = m_vop.vr[1];
+		m_q.desc = NULL;
+		m_q.stopped = false;
+		m_q.stop_fd = -1;
+		ASSERT_EQ(virtnet_batch_init(&m_batch), 0);
+		fake_ioctl = &m_vop;
+	}
+
+	void TearDown()
+	{
+		fake_ioctl = NULL;
+		free(m_batch.buf);
+		close(m_q.tap_fd);
+		close(m_host_fd);
+	}
+
+	/* What the host stack would write to the TAP */
+	void host_send(uint32_t seq, size_t len = pkt_len,
+		       const struct virtio_net_hdr *hdr = NULL)
+	{
+		struct virtio_net_hdr zero;
+		std::vector<char> data(len);
+		struct iovec iov[2];
+
+		memset(&zero, 0, sizeof(zero));
+		memcpy(data.data(), &seq, sizeof(seq));
+		iov[0].iov_base = (void *)(hdr ? hdr : &zero);
+		iov[0].iov_len = sizeof(zero);
+		iov[1].iov_base = data.data();
+		iov[1].iov_len = len;
+		ASSERT_EQ(writev(m_host_fd, iov, 2),
+			  (ssize_t)(sizeof(zero) + len));
+	}
+
+	/* Streams count frames to the card, returns the time it took */
+	double stream_to_card(uint32_t count, size_t len = pkt_len,
+			      const struct virtio_net_hdr *hdr = NULL)
+	{
+		struct pollfd pfd = { m_q.tap_fd, POLLIN, 0 };
+		size_t target = m_vop.received.size() + count;
+		auto start = std::chrono::steady_clock::now();
+
+		std::thread host([&] {
+			for (uint32_t i = 0; i < count; i++)
+				host_send(i, len, hdr);
+		});
+		while (m_vop.received.size() < target) {
+			if (poll(&pfd, 1, 5000) <= 0)
+				break;
+			virtnet_tap_to_card(&m_q, &m_batch);
+		}
+		host.join();
+		EXPECT_EQ(m_vop.received.size(), target);
+		return elapsed_s(start);
+	}
+};
+
+} // namespace
+
+TEST_F(virtnet_test, tap_to_card_batches_copies)
+{
+	for (uint32_t i = 0; i < 40; i++)
+		host_send(i);
+
+	virtnet_tap_to_card(&m_q, &m_batch);
+
+	ASSERT_EQ(m_vop.received.size(), 40U);
+	EXPECT_EQ(m_vop.ioctls, 3UL);
+	for (uint32_t i = 0; i < 40; i++) {
+		EXPECT_EQ(m_vop.received[i].seq, i);
+		EXPECT_EQ(m_vop.received[i].len, pkt_len);
+	}
+}
+
+TEST_F(virtnet_test, tap_to_card_stops_at_budget)
+{
+	for (uint32_t i = 0; i < NET_TX_BUDGET + 10; i++)
+		host_send(i);
+
+	virtnet_tap_to_card(&m_q, &m_batch);
+	EXPECT_EQ(m_vop.received.size(), (size_t)NET_TX_BUDGET);
+	virtnet_tap_to_card(&m_q, &m_batch);
+	EXPECT_EQ(m_vop.received.size(), (size_t)NET_TX_BUDGET + 10);
+}
+
+TEST_F(virtnet_test, card_to_tap)
+{
+	std::vector<char> frame(sizeof(struct virtio_net_hdr) + MAX_NET_PKT_SIZE);
+	uint32_t seq;
+
+	m_vop.card_send(20);
+	virtnet_card_to_tap(&m_q, &m_batch);
+	EXPECT_EQ(m_vop.ioctls, 2UL);
+
+	for (uint32_t i = 0; i < 20; i++) {
+		ASSERT_EQ(read(m_host_fd, frame.data(), frame.size()),
+			  (ssize_t)(sizeof(struct virtio_net_hdr) + pkt_len));
+		memcpy(&seq, frame.data() + sizeof(struct virtio_net_hdr),
+		       sizeof(seq));
+		EXPECT_EQ(seq, i);
+	}
+}
+
+/*
+ * Streams packets through the data path in both directions, with the
+ * fake card standing in for the VOP driver, and reports packets per
+ * second and packets per copy ioctl. The TAP side is a socket, so the
+ * figures bound what mpssd itself costs per packet, not what a TAP does.
+ */
+TEST_F(virtnet_test, loopback_throughput)
+{
+	const uint32_t count = 20000;
+	std::vector<char> frame(sizeof(struct virtio_net_hdr) + MAX_NET_PKT_SIZE);
+	std::chrono::steady_clock::time_point start;
+	unsigned long ioctls;
+	double s;
+
+	s = stream_to_card(count);
+	printf("tap->card: %u packets of %zu bytes, %.0f packets/s, %.2f packets per ioctl\n",
+	       count, pkt_len, count / s, (double)count / m_vop.ioctls);
+	EXPECT_GT((double)count / m_vop.ioctls, 1.0);
+
+	/* A TAP takes every frame written to it, a socket has to be drained */
+	ASSERT_EQ(fcntl(m_q.tap_fd, F_SETFL, 0), 0);
+	ioctls = m_vop.ioctls;
+	start = std::chrono::steady_clock::now();
+	std::thread reader([&] {
+		for (uint32_t i = 0; i < count; i++)
+			ASSERT_GT(read(m_host_fd, frame.data(), frame.size()), 0);
+	});
+	for (uint32_t sent = 0; sent < count; sent += MIC_VRING_ENTRIES) {
+		m_vop.card_send(std::min(count - sent,
+					 (uint32_t)MIC_VRING_ENTRIES));
+		virtnet_card_to_tap(&m_q, &m_batch);
+	}
+	reader.join();
+	s = elapsed_s(start);
+	ioctls = m_vop.ioctls - ioctls;
+	printf("card->tap: %u packets of %zu bytes, %.0f packets/s, %.2f packets per ioctl\n",
+	       count, pkt_len, count / s, (double)count / ioctls);
+	EXPECT_EQ(m_vop.tx_seq, count);
+}
+
+TEST(virtnet_offload, follows_guest_features)
+{
+	const __u32 csum = 1 << VIRTIO_NET_F_GUEST_CSUM;
+	const __u32 tso4 = 1 << VIRTIO_NET_F_GUEST_TSO4;
+	const __u32 tso6 = 1 << VIRTIO_NET_F_GUEST_TSO6;
+	const __u32 ecn = 1 << VIRTIO_NET_F_GUEST_ECN;
+
+	EXPECT_EQ(virtnet_tap_offload(0), 0U);
+	/* A guest that refuses checksum offload gets no TSO either */
+	EXPECT_EQ(virtnet_tap_offload(tso4 | tso6 | ecn), 0U);
+	EXPECT_EQ(virtnet_tap_offload(csum), (unsigned int)TUN_F_CSUM);
+	/* ECN only makes sense together with TSO */
+	EXPECT_EQ(virtnet_tap_offload(csum | ecn), (unsigned int)TUN_F_CSUM);
+	EXPECT_EQ(virtnet_tap_offload(csum | tso4),
+		  (unsigned int)(TUN_F_CSUM | TUN_F_TSO4));
+	EXPECT_EQ(virtnet_tap_offload(csum | tso4 | tso6 | ecn),
+		  (unsigned int)(TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6 |
+				 TUN_F_TSO_ECN));
+}
+
+TEST_F(virtnet_test, offload_set_from_device_page)
+{
+	struct virtnet_dev_page_t page;
+
+	memset(&page, 0, sizeof(page));
+	page.dd.num_vq = 2;
+	page.dd.feature_len = sizeof(page.host_features);
+	page.host_features = htole32((1 << VIRTIO_NET_F_GUEST_CSUM) |
+				     (1 << VIRTIO_NET_F_GUEST_TSO4) |
+				     (1 << VIRTIO_NET_F_GUEST_TSO6));
+	m_q.desc = &page.dd;
+
+	/* The card driver refused every offload */
+	m_vop.tap_offload = ~0U;
+	virtnet_set_offload(&m_q);
+	EXPECT_EQ(m_vop.tap_offload, 0U);
+
+	page.guest_acknowledgements = htole32((1 << VIRTIO_NET_F_GUEST_CSUM) |
+					      (1 << VIRTIO_NET_F_GUEST_TSO4));
+	virtnet_set_offload(&m_q);
+	EXPECT_EQ(m_vop.tap_offload, (unsigned int)(TUN_F_CSUM | TUN_F_TSO4));
+}
+
+TEST_F(virtnet_test, data_valid_never_set_on_needs_csum)
+{
+	const size_t gso_len = MAX_GSO_SIZE + ETH_H_LEN;
+	struct virtio_net_hdr gso;
+
+	memset(&gso, 0, sizeof(gso));
+	gso.flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+	gso.gso_type = VIRTIO_NET_HDR_GSO_TCPV4;
+	gso.hdr_len = 66;
+	gso.gso_size = 1448;
+	gso.csum_start = 34;
+	gso.csum_offset = 16;
+
+	/* Few enough super-frames to fit in the socket buffer */
+	for (uint32_t i = 0; i < 4; i++) {
+		if (i % 2)
+			host_send(i, gso_len, &gso);
+		else
+			host_send(i);
+	}
+	virtnet_tap_to_card(&m_q, &m_batch);
+
+	ASSERT_EQ(m_vop.received.size(), 4U);
+	for (uint32_t i = 0; i < 4; i++) {
+		const card_pkt &pkt = m_vop.received[i];
+
+		EXPECT_EQ(pkt.seq, i);
+		if (i % 2) {
+			/* The super-frame and its header arrive untouched */
+			EXPECT_EQ(pkt.len, gso_len);
+			EXPECT_EQ(pkt.hdr.flags, VIRTIO_NET_HDR_F_NEEDS_CSUM);
+			EXPECT_EQ(pkt.hdr.gso_type, VIRTIO_NET_HDR_GSO_TCPV4);
+			EXPECT_EQ(pkt.hdr.hdr_len, gso.hdr_len);
+			EXPECT_EQ(pkt.hdr.gso_size, gso.gso_size);
+			EXPECT_EQ(pkt.hdr.csum_start, gso.csum_start);
+			EXPECT_EQ(pkt.hdr.csum_offset, gso.csum_offset);
+		} else {
+			EXPECT_EQ(pkt.len, pkt_len);
+			EXPECT_EQ(pkt.hdr.flags, VIRTIO_NET_HDR_F_DATA_VALID);
+		}
+	}
+}
+
+/*
+ * Moves the same amount of data to the card as MTU sized frames and as
+ * 64 KB TSO super-frames, and reports the bandwidth of each. The fake card
+ * does not copy payloads, so this is the per-frame cost on the host side.
+ */
+TEST_F(virtnet_test, gso_throughput)
+{
+	const size_t gso_len = MAX_GSO_SIZE + ETH_H_LEN;
+	const uint32_t gso_count = 1000;
+	const uint32_t mtu_count = gso_count * gso_len / pkt_len;
+	struct virtio_net_hdr gso;
+	double mtu_s, gso_s;
+
+	memset(&gso, 0, sizeof(gso));
+	gso.flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+	gso.gso_type = VIRTIO_NET_HDR_GSO_TCPV4;
+	gso.hdr_len = 66;
+	gso.gso_size = 1448;
+
+	mtu_s = stream_to_card(mtu_count);
+	gso_s = stream_to_card(gso_count, gso_len, &gso);
+	printf("tap->card: %u frames of %zu bytes %.2f Gbit/s, %u frames of %zu bytes %.2f Gbit/s\n",
+	       mtu_count, pkt_len, mtu_count * pkt_len * 8 / mtu_s / 1e9,
+	       gso_count, gso_len, gso_count * gso_len * 8 / gso_s / 1e9);
+}
@@ -0,0 +1,227 @@
+/*
+ * Copyright (c) 2016, Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ */
+
+#include "virtblk.h"
+#include "vop_copy.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+
+/* See comments in vhost.c for explanation of next_desc() */
+static unsigned next_desc(struct vring_desc *desc)
+{
+	unsigned int next;
+
+	if (!(le16toh(desc->flags) & VRING_DESC_F_NEXT))
+		return -1U;
+	next = le16toh(desc->next);
+	return next;
+}
+
+static __u8
+header_error_check(struct vring_desc *desc)
+{
+	if (le32toh(desc->len) != sizeof(struct virtio_blk_outhdr)) {
+		mpssd_log(PERROR, "length is not sizeof(virtio_blk_outhd)");
+		return -EIO;
+	}
+	if (!(le16toh(desc->flags) & VRING_DESC_F_NEXT)) {
+		mpssd_log(PERROR, "alone");
+		return -EIO;
+	}
+	if (le16toh(desc->flags) & VRING_DESC_F_WRITE) {
+		mpssd_log(PERROR, "not read");
+		return -EIO;
+	}
+	return 0;
+}
+
+static int
+read_header(int fd, struct virtio_blk_outhdr *hdr, __u32 desc_idx)
+{
+	struct iovec iovec;
+	struct mic_copy_desc copy;
+
+	iovec.iov_len = sizeof(*hdr);
+	iovec.iov_base = hdr;
+	copy.iov = &iovec;
+	copy.iovcnt = 1;
+	copy.vr_idx = 0;  /* only one vring on virtio_block */
+	copy.update_used = false;  /* do not update used index */
+	return ioctl(fd, MIC_VIRTIO_COPY_DESC, &copy);
+}
+
+static int
+transfer_blocks(int fd, struct iovec *iovec, __u32 iovcnt)
+{
+	struct mic_copy_desc copy;
+
+	copy.iov = iovec;
+	copy.iovcnt = iovcnt;
+	copy.vr_idx = 0;  /* only one vring on virtio_block */
+	copy.update_used = false;  /* do not update used index */
+	return ioctl(fd, MIC_VIRTIO_COPY_DESC, &copy);
+}
+
+static __u8
+status_error_check(struct vring_desc *desc)
+{
+	if (le32toh(desc->len) != sizeof(__u8)) {
+		mpssd_log(PERROR, "length is not sizeof(status)");
+		return -EIO;
+	}
+	return 0;
+}
+
+/*
+ * Write the status and complete the request. With defer the driver adds
+ * it to the used ring only with the next request completed without it,
+ * so a drained set of requests costs the card one interrupt. Drivers
+ * without MIC_VIRTIO_USED_DEFER complete each request right away.
+ */
+static int
+write_status(int fd, __u8 *status, bool defer)
+{
+	struct iovec iovec;
+	struct mic_copy_desc copy;
+
+	iovec.iov_base = status;
+	iovec.iov_len = sizeof(*status);
+	copy.iov = &iovec;
+	copy.iovcnt = 1;
+	copy.vr_idx = 0;  /* only one vring on virtio_block */
+	copy.update_used = defer ? MIC_VIRTIO_USED_DEFER : 1;
+	return ioctl(fd, MIC_VIRTIO_COPY_DESC, &copy);
+}
+
+/*
+ * Serve one request chain: header, data descriptors, status. The data is
+ * staged in a host buffer so the backend is accessed with pread/pwrite.
+ * The VOP copy ioctl walks the vring one chain at a time, so each chain
+ * is completed before the next one is read: reads are served right here,
+ * and writes are completed once queued to the device's blk_io_engine.
+ */
+int
+virtblk_handle_request(int fd, blk_io_engine *engine, struct mic_vring *vring)
+{
+	struct virtio_blk_outhdr hdr;
+	struct vring_desc *desc;
+	struct iovec iovec;
+	__u16 avail_idx;
+	__u32 desc_idx;
+	__u32 type;
+	size_t len = 0;
+	off_t offset;
+	char *buf = NULL;
+	__u8 status;
+	bool more;
+	int ret;
+
+	/* read header element */
+	avail_idx = vring->info->avail_idx & (vring->vr.num - 1);
+	desc_idx = le16toh(vring->vr.avail->ring[avail_idx]);
+	desc = &vring->vr.desc[desc_idx];
+#ifdef DEBUG
+	mpssd_log(PINFO, "avail_idx=%d vring.vr.num=%d desc=%p",
+		vring->info->avail_idx, vring->vr.num, desc);
+#endif
+	status = header_error_check(desc);
+	if (status) {
+		mpssd_log(PERROR, "header_error_check status=%d %s",
+			  status, strerror(status));
+		return -EIO;
+	}
+
+	ret = read_header(fd, &hdr, desc_idx);
+	if (ret < 0) {
+		mpssd_log(PERROR, "ret=%d %s", ret, strerror(errno));
+		return ret;
+	}
+	type = le32toh(hdr.type);
+	offset = le64toh(hdr.sector) * SECTOR_SIZE;
+
+	/* buffer elements, the last descriptor holds the status */
+	for (desc = &vring->vr.desc[next_desc(desc)];
+	     le16toh(desc->flags) & VRING_DESC_F_NEXT;
+	     desc = &vring->vr.desc[next_desc(desc)])
+		len += le32toh(desc->len);
+
+	if (len) {
+		buf = (char *)malloc(len);
+		if (!buf) {
+			mpssd_log(PERROR, "can't alloc 0x%zx bytes: %s", len, strerror(ENOMEM));
+			return -ENOMEM;
+		}
+	}
+	iovec.iov_base = buf;
+	iovec.iov_len = len;
+
+	switch (type) {
+	case VIRTIO_BLK_T_IN:
+		status = engine->read(buf, len, offset) ?
+			VIRTIO_BLK_S_IOERR : VIRTIO_BLK_S_OK;
+		if (len && transfer_blocks(fd, &iovec, 1) < 0)
+			status = VIRTIO_BLK_S_IOERR;
+		break;
+	case VIRTIO_BLK_T_OUT:
+		if (transfer_blocks(fd, &iovec, 1) < 0) {
+			status = VIRTIO_BLK_S_IOERR;
+			break;
+		}
+		engine->submit_write(buf, len, offset);
+		buf = NULL;
+		status = VIRTIO_BLK_S_OK;
+		break;
+	case VIRTIO_BLK_T_FLUSH:
+		ret = engine->flush();
+		if (ret)
+			mpssd_log(PERROR, "flush failed: %s", strerror(-ret));
+		status = ret ? VIRTIO_BLK_S_IOERR : VIRTIO_BLK_S_OK;
+		break;
+	case VIRTIO_BLK_T_GET_ID:
+		/* Returning NULLs for VIRTIO_BLK_T_GET_ID. */
+		memset(buf, 0, len);
+		status = VIRTIO_BLK_S_OK;
+		if (len && transfer_blocks(fd, &iovec, 1) < 0)
+			status = VIRTIO_BLK_S_IOERR;
+		break;
+	default:
+		/*
+		  VIRTIO_BLK_T_SCSI_CMD - for virtio_scsi.
+		  VIRTIO_BLK_T_BARRIER - defined but not used in anywhere.
+		*/
+		mpssd_log(PERROR, "type %x is not supported", type);
+		status = VIRTIO_BLK_S_UNSUPP;
+		break;
+	}
+	free(buf);
+
+	/*
+	 * Write status and update used pointer, once for all the requests
+	 * the card has made available so far
+	 */
+	if (status_error_check(desc))
+		status = VIRTIO_BLK_S_IOERR;
+	more = (__u16)(vring->info->avail_idx + 1) !=
+		le16toh(ACCESS_ONCE(vring->vr.avail->idx));
+	ret = write_status(fd, &status, more);
+	if (ret < 0)
+		mpssd_log(PERROR, "write status failed: %d", ret);
+#ifdef DEBUG
+	mpssd_log(PINFO, "write status=%d on desc=%p", status, desc);
+#endif
+	return 0;
+}
@@ -12,18 +12,24 @@
  */
 
 #include "virtio.h"
+#include "virtblk.h"
+#include "virtnet.h"
+#include "vop_copy.h"
 
 #include "mpssd.h"
 #include "utils.h"
 
 #include <arpa/inet.h>
 #include <assert.h>
+#include <algorithm>
+#include <atomic>
 #include <fcntl.h>
 #include <linux/if_arp.h>
 #include <linux/if_tun.h>
 #include <linux/sockios.h>
 #include <mutex>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
@@ -35,18 +41,8 @@ extern "C" unsigned int if_nametoindex (const char *ifname);
 
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
 
-#define ACCESS_ONCE(x) (*(volatile decltype(x) *)&(x))
-
-#define GSO_ENABLED		0
-#define MAX_GSO_SIZE		(64 * 1024)
-#define ETH_H_LEN		14
-#define MAX_NET_PKT_SIZE	(_ALIGN_UP(MAX_GSO_SIZE + ETH_H_LEN, 64))
 #define MIC_DEVICE_PAGE_END	0x1000
 
-#ifndef VIRTIO_NET_HDR_F_DATA_VALID
-#define VIRTIO_NET_HDR_F_DATA_VALID	2	/* Csum is valid */
-#endif
-
 
 __thread struct mpssd_virtio_log virtio_log;
 
@@ -77,16 +73,20 @@ static struct virtnet_dev_page_t virtnet_dev_page_init()
 	value.vqconfig[0].num = htole16(MIC_VRING_ENTRIES);
 	value.vqconfig[1].num = htole16(MIC_VRING_ENTRIES);
 
-#if GSO_ENABLED
+	/*
+	 * The card may hand us partially checksummed TSO super-frames and
+	 * may accept them from us; the TAP offloads are only switched on
+	 * once the card driver acknowledges them, see virtnet_set_offload().
+	 */
 	value.host_features = htole32(
 		1 << VIRTIO_NET_F_CSUM |
-		1 << VIRTIO_NET_F_GSO |
+		1 << VIRTIO_NET_F_GUEST_CSUM |
+		1 << VIRTIO_NET_F_HOST_TSO4 |
+		1 << VIRTIO_NET_F_HOST_TSO6 |
+		1 << VIRTIO_NET_F_HOST_ECN |
 		1 << VIRTIO_NET_F_GUEST_TSO4 |
 		1 << VIRTIO_NET_F_GUEST_TSO6 |
 		1 << VIRTIO_NET_F_GUEST_ECN);
-#else
-	value.host_features = 0;
-#endif
 
 	return value;
 };
@@ -103,6 +103,8 @@ static virtblk_dev_page_t virtblk_dev_page_init(bool read_only)
 	value.host_features = htole32(1 << VIRTIO_BLK_F_SEG_MAX);
 	if (read_only)
 		value.host_features |= htole32(1 << VIRTIO_BLK_F_RO);
+	else
+		value.host_features |= htole32(1 << VIRTIO_BLK_F_FLUSH);
 	value.blk_config.seg_max = htole32(MIC_VRING_ENTRIES - 2);
 	value.blk_config.capacity = htole64(0);
 
@@ -114,12 +116,27 @@ mic_device_context::init()
 {
 	virtnet_dev_page = virtnet_dev_page_init();
 	virtcons_dev_page = virtcons_dev_page_init();
+
+	m_shutdown_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (m_shutdown_fd < 0)
+		mpssd_log(PERROR, "eventfd failed: %s", strerror(errno));
+}
+
+mic_device_context::~mic_device_context()
+{
+	if (m_shutdown_fd >= 0)
+		close(m_shutdown_fd);
 }
 
 void
 mic_device_context::shutdown()
 {
+	uint64_t one = 1;
+
 	m_ss.request_shutdown();
+	/* Never read back, so it stays readable for every virtio thread */
+	if (m_shutdown_fd >= 0 && write(m_shutdown_fd, &one, sizeof(one)) < 0)
+		mpssd_log(PERROR, "eventfd write failed: %s", strerror(errno));
 	m_vnet_thread.join();
 	m_vcon_thread.join();
 	for (auto &t : m_vblk_vector)
@@ -276,9 +293,7 @@ static int tun_alloc(struct mic_info *mic, std::string& dev)
 {
 	struct ifreq ifr;
 	int fd, err;
-#if GSO_ENABLED
-	unsigned offload;
-#endif
+
 	fd = tun_open();
 	if (fd < 0) {
 		mpssd_log(PERROR, "Could not open /dev/net/tun %s", strerror(errno));
@@ -287,6 +302,10 @@ static int tun_alloc(struct mic_info *mic, std::string& dev)
 
 	memset(&ifr, 0, sizeof(ifr));
 
+	/*
+	 * A single queue TAP: the card side exposes one virtio-net queue pair,
+	 * see virtnet_queue.
+	 */
 	ifr.ifr_flags = IFF_TAP | IFF_NO_PI | IFF_VNET_HDR;
 	snprintf(ifr.ifr_name, IFNAMSIZ, "%s", dev.c_str());
 
@@ -297,17 +316,6 @@ static int tun_alloc(struct mic_info *mic, std::string& dev)
 		return err;
 	}
 
-#if GSO_ENABLED
-	offload = TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6 | TUN_F_TSO_ECN;
-
-	err = ioctl(fd, TUNSETOFFLOAD, offload);
-	if (err < 0) {
-		mpssd_log(PERROR, "TUNSETOFFLOAD failed %s", strerror(errno));
-		close(fd);
-		return err;
-	}
-#endif
-
 	// set MAC address
 	if (!mic->config.net.host_mac.address().empty()) {
 		mpssd_log(PINFO, "Set host MAC address to %s", mic->config.net.host_mac.address().c_str());
@@ -327,6 +335,10 @@ static int tun_alloc(struct mic_info *mic, std::string& dev)
 	}
 
 done:
+	/* The tap->card worker drains the queue until EAGAIN */
+	if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0)
+		mpssd_log(PWARN, "Could not set TAP non-blocking %s", strerror(errno));
+
 	dev = ifr.ifr_name;
 	mpssd_log(PINFO, "Created TAP %s", dev.c_str());
 
@@ -422,80 +434,6 @@ static struct mic_device_desc *get_device_desc(struct mic_info *mic, int type)
 	return NULL;
 }
 
-/* See comments in vhost.c for explanation of next_desc() */
-static unsigned next_desc(struct vring_desc *desc)
-{
-	unsigned int next;
-
-	if (!(le16toh(desc->flags) & VRING_DESC_F_NEXT))
-		return -1U;
-	next = le16toh(desc->next);
-	return next;
-}
-
-/* Sum up all the IOVEC length */
-static ssize_t
-sum_iovec_len(struct mic_copy_desc *copy)
-{
-	ssize_t sum = 0;
-	unsigned int i;
-
-	for (i = 0; i < copy->iovcnt; i++)
-		sum += copy->iov[i].iov_len;
-	return sum;
-}
-
-static inline void verify_out_len(struct mic_info *mic,
-	struct mic_copy_desc *copy)
-{
-	if (copy->out_len != sum_iovec_len(copy)) {
-		mpssd_log(PERROR, "BUG copy->out_len 0x%x len 0x%zx",
-			copy->out_len, sum_iovec_len(copy));
-		assert(copy->out_len == sum_iovec_len(copy));
-	}
-}
-
-/* Display an iovec */
-static void
-disp_iovec(struct mic_info *mic, struct mic_copy_desc *copy)
-{
-	unsigned int i;
-
-	for (i = 0; i < copy->iovcnt; i++)
-		mpssd_log(PINFO, "copy->iov[%d] addr %p len 0x%zx",
-			i, copy->iov[i].iov_base, copy->iov[i].iov_len);
-}
-
-static inline __u16 read_avail_idx(struct mic_vring *vr)
-{
-	return ACCESS_ONCE(vr->info->avail_idx);
-}
-
-static inline void txrx_prepare(int type, bool tx, struct mic_vring *vr,
-				struct mic_copy_desc *copy, ssize_t len)
-{
-	copy->vr_idx = tx ? 0 : 1;
-	copy->update_used = true;
-	if (type == VIRTIO_ID_NET)
-		copy->iov[1].iov_len = len - sizeof(struct virtio_net_hdr);
-	else
-		copy->iov[0].iov_len = len;
-}
-
-/* Central API which triggers the copies */
-static int
-mic_virtio_copy(struct mic_info *mic, int fd,
-		struct mic_vring *vr, struct mic_copy_desc *copy)
-{
-	int ret;
-
-	ret = ioctl(fd, MIC_VIRTIO_COPY_DESC, copy);
-	if (ret) {
-		mpssd_log(PERROR, "errno %s ret %d", strerror(errno), ret);
-	}
-	return ret;
-}
-
 static __inline__ unsigned _vring_size(unsigned int num, unsigned long align)
 {
 	return ((sizeof(struct vring_desc) * num + sizeof(__u16) * (3 + num)
@@ -616,7 +554,7 @@ done:
 static int
 wait_for_card_driver(mic_device_context *mdc, struct mic_info *mic, int fd, int type)
 {
-	struct pollfd pollfd;
+	struct pollfd pollfd[2];
 	int err;
 	struct mic_device_desc *desc = get_device_desc(mic, type);
 	__u8 prev_status;
@@ -624,7 +562,10 @@ wait_for_card_driver(mic_device_context *mdc, struct mic_info *mic, int fd, int
 	if (!desc)
 		return ENODEV;
 	prev_status = desc->status;
-	pollfd.fd = fd;
+	pollfd[0].fd = fd;
+	pollfd[0].events = POLLIN;
+	pollfd[1].fd = mdc->shutdown_fd();
+	pollfd[1].events = POLLIN;
 	mpssd_log(PINFO, "Waiting for card driver: virtio_device %s status 0x%x",
 		get_virtio_device_name(type), desc->status);
 	while (1) {
@@ -632,21 +573,20 @@ wait_for_card_driver(mic_device_context *mdc, struct mic_info *mic, int fd, int
 			break;
 		}
 
-		pollfd.events = POLLIN;
-		pollfd.revents = 0;
-		err = poll(&pollfd, 1, 1000);
+		pollfd[0].revents = 0;
+		err = poll(pollfd, 2, mdc->poll_timeout());
 		if (err < 0) {
 			mpssd_log(PERROR, "poll failed %s", strerror(errno));
 			continue;
 		}
 
-		if (pollfd.revents) {
-			if (pollfd.revents & POLLERR) {
+		if (pollfd[0].revents) {
+			if (pollfd[0].revents & POLLERR) {
 				mpssd_log(PINFO, "POLLERR: device not initialized");
 				return ENODEV;
 			}
 
-			if (pollfd.revents & POLLHUP) {
+			if (pollfd[0].revents & POLLHUP) {
 				mpssd_log(PINFO, "POLLHUP: device not initialized");
 				return ENODEV;
 			}
@@ -657,7 +597,7 @@ wait_for_card_driver(mic_device_context *mdc, struct mic_info *mic, int fd, int
 				prev_status = desc->status;
 			}
 			if (desc->status & VIRTIO_CONFIG_S_DRIVER_OK) {
-				mpssd_log(PINFO, "poll.revents %d", pollfd.revents);
+				mpssd_log(PINFO, "poll.revents %d", pollfd[0].revents);
 				mpssd_log(PINFO, "desc-> type %d status 0x%x",
 					type, desc->status);
 				break;
@@ -700,18 +640,95 @@ add_virtio_net_device(mic_device_context *mdc, struct mic_info *mic)
 	add_virtio_device(mic, &mdc->virtnet_dev_page.dd);
 }
 
+static bool
+virtnet_need_stop(struct virtnet_queue *q)
+{
+	return q->stopped || q->mdc->need_shutdown();
+}
+
+static void
+virtnet_stop(struct virtnet_queue *q)
+{
+	uint64_t one = 1;
+
+	q->stopped = true;
+	if (q->stop_fd >= 0 && write(q->stop_fd, &one, sizeof(one)) < 0)
+		mpssd_log(PERROR, "eventfd write failed: %s", strerror(errno));
+}
+
+/* How often the tap->card worker checks whether the card driver is up */
+#define VIRTNET_DRIVER_POLL_MS 100
+
+static void
+virtnet_tap_worker(struct virtnet_queue *q)
+{
+	struct virtnet_batch batch;
+	struct pollfd tap_poll[3];
+	struct mpssd_info *mpssdi = (struct mpssd_info *)q->mic->data;
+	bool offload_set = false;
+	int err;
+
+	virtio_log.virtio_device_type = VIRTIO_ID_NET;
+	virtio_log.virtio_device_number = 1;
+	set_thread_name(mpssdi->name().c_str(), "virtnet-tx");
+
+	if (virtnet_batch_init(&batch)) {
+		virtnet_stop(q);
+		return;
+	}
+
+	tap_poll[0].fd = q->tap_fd;
+	tap_poll[0].events = POLLIN;
+	tap_poll[1].fd = q->mdc->shutdown_fd();
+	tap_poll[1].events = POLLIN;
+	tap_poll[2].fd = q->stop_fd;
+	tap_poll[2].events = POLLIN;
+
+	/*
+	 * The virtio fd is deliberately not polled here: vop_poll() consumes
+	 * the wakeup, which belongs to the card->tap worker. That worker
+	 * signals q->stop_fd when the device goes away. Until the card driver
+	 * is up the TAP is left alone and its status is re-checked
+	 * periodically instead. A card reboot resets the status and may bring
+	 * up a driver with other features, so the offloads are applied again.
+	 */
+	while (!virtnet_need_stop(q)) {
+		if (!(q->desc->status & VIRTIO_CONFIG_S_DRIVER_OK)) {
+			offload_set = false;
+			poll(tap_poll + 1, 2, VIRTNET_DRIVER_POLL_MS);
+			continue;
+		}
+
+		if (!offload_set) {
+			virtnet_set_offload(q);
+			offload_set = true;
+		}
+
+		tap_poll[0].revents = 0;
+		err = poll(tap_poll, 3, q->stop_fd < 0 ? 1000 : q->mdc->poll_timeout());
+		if (err == 0)
+			continue;
+
+		if (err < 0) {
+			mpssd_log(PERROR, "poll failed %s", strerror(errno));
+			continue;
+		}
+
+		if (tap_poll[0].revents & POLLIN)
+			virtnet_tap_to_card(q, &batch);
+	}
+	q->stopped = true;
+	free(batch.buf);
+}
+
 void
 virtio_net(mic_device_context *mdc, mic_info* mic)
 {
-	__u8 vnet_hdr[2][sizeof(struct virtio_net_hdr)];
-	__u8 vnet_buf[2][MAX_NET_PKT_SIZE] __attribute__ ((aligned(64)));
-	struct iovec vnet_iov[2][2] = {};
-	struct iovec *iov0, *iov1;
+	struct virtnet_batch batch;
 	struct mpssd_info *mpssdi = (struct mpssd_info *)mic->data;
-	struct pollfd net_poll[MAX_NET_FD];
-	struct mic_vring tx_vr, rx_vr;
-	struct mic_copy_desc copy;
-	struct mic_device_desc *desc;
+	struct pollfd net_poll[2];
+	struct virtnet_queue q;
+	std::thread tap_worker;
 	int err;
 
 	virtio_log.virtio_device_type = VIRTIO_ID_NET;
@@ -720,17 +737,13 @@ virtio_net(mic_device_context *mdc, mic_info* mic)
 
 	add_virtio_net_device(mdc, mic);
 
-	vnet_iov[0][0].iov_base = vnet_hdr[0];
-	vnet_iov[0][0].iov_len = sizeof(vnet_hdr[0]);
-	vnet_iov[0][1].iov_base = vnet_buf[0];
-	vnet_iov[0][1].iov_len = sizeof(vnet_buf[0]);
-	vnet_iov[1][0].iov_base = vnet_hdr[1];
-	vnet_iov[1][0].iov_len = sizeof(vnet_hdr[1]);
-	vnet_iov[1][1].iov_base = vnet_buf[1];
-	vnet_iov[1][1].iov_len = sizeof(vnet_buf[1]);
+	batch.buf = NULL;
 
-	iov0 = vnet_iov[0];
-	iov1 = vnet_iov[1];
+	q.mdc = mdc;
+	q.mic = mic;
+	q.virtio_fd = mpssdi->mic_net.virtio_net_fd;
+	q.stopped = false;
+	q.stop_fd = -1;
 
 	std::string if_name = "mic" + std::to_string(mic->id);
 	mpssdi->mic_net.tap_fd = tun_alloc(mic, if_name);
@@ -738,40 +751,42 @@ virtio_net(mic_device_context *mdc, mic_info* mic)
 		goto done;
 	if (tap_configure(mic, if_name))
 		goto done;
+	q.tap_fd = mpssdi->mic_net.tap_fd;
 	mpssd_log(PINFO, "Start virtio net thread");
 
-	net_poll[NET_FD_VIRTIO_NET].fd = mpssdi->mic_net.virtio_net_fd;
-	net_poll[NET_FD_VIRTIO_NET].events = POLLIN;
-	net_poll[NET_FD_TUN].fd = mpssdi->mic_net.tap_fd;
-	net_poll[NET_FD_TUN].events = POLLIN;
+	net_poll[0].fd = mpssdi->mic_net.virtio_net_fd;
+	net_poll[0].events = POLLIN;
+	net_poll[1].fd = mdc->shutdown_fd();
+	net_poll[1].events = POLLIN;
 
 	if (MAP_FAILED == init_vr(mic, mpssdi->mic_net.virtio_net_fd,
-				  VIRTIO_ID_NET, &tx_vr, &rx_vr,
+				  VIRTIO_ID_NET, &q.tx_vr, &q.rx_vr,
 				  mdc->virtnet_dev_page.dd.num_vq)) {
 		mpssd_log(PERROR, "init_vr failed %s", strerror(errno));
 		goto done;
 	}
 
-	copy.iovcnt = 2;
-	desc = get_device_desc(mic, VIRTIO_ID_NET);
+	q.desc = get_device_desc(mic, VIRTIO_ID_NET);
 
-	if (desc == NULL) {
+	if (q.desc == NULL) {
 		mpssd_log(PERROR, "no net device exist");
 		goto done;
 	}
 
-	while (1) {
-		ssize_t len;
+	if (virtnet_batch_init(&batch))
+		goto done;
 
-		if (mdc->need_shutdown()) {
-			break;
-		}
+	q.stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (q.stop_fd < 0)
+		mpssd_log(PERROR, "eventfd failed: %s", strerror(errno));
 
-		net_poll[NET_FD_VIRTIO_NET].revents = 0;
-		net_poll[NET_FD_TUN].revents = 0;
+	tap_worker = std::thread(virtnet_tap_worker, &q);
 
-		/* Start polling for data from tap and virtio net */
-		err = poll(net_poll, 2, 1000);
+	/* This thread serves the card->tap direction of the queue pair */
+	while (!virtnet_need_stop(&q)) {
+		net_poll[0].revents = 0;
+
+		err = poll(net_poll, 2, mdc->poll_timeout());
 		if (err == 0) {
 			continue;
 		}
@@ -781,15 +796,15 @@ virtio_net(mic_device_context *mdc, mic_info* mic)
 			continue;
 		}
 
-		if (net_poll[NET_FD_VIRTIO_NET].revents & POLLERR)
+		if (net_poll[0].revents & POLLERR)
 			mpssd_log(PINFO, "POLLERR occured on NET device for %s", mic->name.c_str());
 
-		if (net_poll[NET_FD_VIRTIO_NET].revents & POLLHUP) {
+		if (net_poll[0].revents & POLLHUP) {
 			mpssd_log(PINFO, "POLLHUP occured on NET device for %s", mic->name.c_str());
 			break;
 		}
 
-		if (!(desc->status & VIRTIO_CONFIG_S_DRIVER_OK)) {
+		if (!(q.desc->status & VIRTIO_CONFIG_S_DRIVER_OK)) {
 			err = wait_for_card_driver(mdc, mic,
 					mpssdi->mic_net.virtio_net_fd,
 					VIRTIO_ID_NET);
@@ -798,107 +813,16 @@ virtio_net(mic_device_context *mdc, mic_info* mic)
 					break;
 			}
 		}
-		/*
-		 * Check if there is data to be read from TUN and write to
-		 * virtio net fd if there is.
-		 */
-		if (net_poll[NET_FD_TUN].revents & POLLIN) {
-			copy.iov = iov0;
-			len = readv(net_poll[NET_FD_TUN].fd,
-				copy.iov, copy.iovcnt);
-			if (len > 0) {
-				struct virtio_net_hdr *hdr
-					= (struct virtio_net_hdr *)vnet_hdr[0];
-
-				/* Disable checksums on the card since we are on
-				   a reliable PCIe link */
-				hdr->flags |= VIRTIO_NET_HDR_F_DATA_VALID;
-#ifdef DEBUG
-				mpssd_log(PINFO, "hdr->flags 0x%x copy.out_len %d hdr->gso_type 0x%x",
-					hdr->flags, copy.out_len, hdr->gso_type);
-
-				disp_iovec(mic, &copy);
-				mpssd_log(PINFO, "read from tap 0x%lx", len);
-#endif
-				spin_for_descriptors(mdc, mic, &tx_vr);
-				txrx_prepare(VIRTIO_ID_NET, 1, &tx_vr, &copy,
-					     len);
-
-				err = mic_virtio_copy(mic,
-					mpssdi->mic_net.virtio_net_fd, &tx_vr,
-					&copy);
-				if (err < 0) {
-					mpssd_log(PINFO, "mic_virtio_copy %s", strerror(errno));
-				}
-				if (!err)
-					verify_out_len(mic, &copy);
-#ifdef DEBUG
-				disp_iovec(mic, &copy);
-				mpssd_log(PINFO, "wrote to net 0x%lx", sum_iovec_len(&copy));
-#endif
-				/* Reinitialize IOV for next run */
-				iov0[1].iov_len = MAX_NET_PKT_SIZE;
-			} else if (len < 0) {
-				disp_iovec(mic, &copy);
-				mpssd_log(PERROR, "read failed %s cnt %d sum %zd",
-					strerror(errno), copy.iovcnt, sum_iovec_len(&copy));
-			}
-		}
 
-		/*
-		 * Check if there is data to be read from virtio net and
-		 * write to TUN if there is.
-		 */
-		if (net_poll[NET_FD_VIRTIO_NET].revents & POLLIN) {
-			while (rx_vr.info->avail_idx !=
-				le16toh(rx_vr.vr.avail->idx)) {
-				copy.iov = iov1;
-				txrx_prepare(VIRTIO_ID_NET, 0, &rx_vr, &copy,
-					     MAX_NET_PKT_SIZE
-					+ sizeof(struct virtio_net_hdr));
-
-				err = mic_virtio_copy(mic,
-					mpssdi->mic_net.virtio_net_fd, &rx_vr,
-					&copy);
-				if (!err) {
-#ifdef DEBUG
-					struct virtio_net_hdr *hdr
-						= (struct virtio_net_hdr *)
-							vnet_hdr[1];
-
-					mpssd_log(PINFO, "hdr->flags 0x%x, out_len %d gso_type 0x%x",
-						hdr->flags, copy.out_len, hdr->gso_type);
-#endif
-					/* Set the correct output iov_len */
-					iov1[1].iov_len = copy.out_len -
-						sizeof(struct virtio_net_hdr);
-					verify_out_len(mic, &copy);
-#ifdef DEBUG
-					disp_iovec(mic, &copy);
-					mpssd_log(PINFO, "read from net 0x%lx", sum_iovec_len(&copy));
-#endif
-					len = writev(net_poll[NET_FD_TUN].fd,
-						copy.iov, copy.iovcnt);
-					if (len != sum_iovec_len(&copy)) {
-						mpssd_log(PERROR, "Tun write failed %s len 0x%zx read_len 0x%zx",
-							strerror(errno), len, sum_iovec_len(&copy));
-					} else {
-#ifdef DEBUG
-						disp_iovec(mic, &copy);
-						mpssd_log(PINFO, "wrote to tap 0x%lx", len);
-#endif
-					}
-				} else {
-					mpssd_log(PERROR, "mic_virtio_copy %s", strerror(errno));
-					break;
-				}
-				if (mdc->need_shutdown()) {
-					break;
-				}
-			}
-		}
+		if (net_poll[0].revents & POLLIN)
+			virtnet_card_to_tap(&q, &batch);
 	}
+	virtnet_stop(&q);
+	tap_worker.join();
+	if (q.stop_fd >= 0)
+		close(q.stop_fd);
 done:
+	free(batch.buf);
 	munmap(mpssdi->mic_net.net_dp, mpssdi->mic_net.dp_size);
 	close(mpssdi->mic_net.virtio_net_fd);
 	close(mpssdi->mic_net.tap_fd);
@@ -907,7 +831,8 @@ done:
 /* virtio_console */
 #define VIRTIO_CONSOLE_FD 0
 #define MONITOR_FD (VIRTIO_CONSOLE_FD + 1)
-#define MAX_CONSOLE_FD (MONITOR_FD + 1)  /* must be the last one + 1 */
+#define SHUTDOWN_FD (MONITOR_FD + 1)
+#define MAX_CONSOLE_FD (SHUTDOWN_FD + 1)  /* must be the last one + 1 */
 #define MAX_BUFFER_SIZE PAGE_SIZE
 #define MIC_TTY_PREFIX "/dev/ttyMIC"
 
@@ -1065,6 +990,8 @@ virtio_console(mic_device_context *mdc, mic_info* mic)
 
 	console_poll[MONITOR_FD].fd = monitor_fd;
 	console_poll[MONITOR_FD].events = POLLIN;
+	console_poll[SHUTDOWN_FD].fd = mdc->shutdown_fd();
+	console_poll[SHUTDOWN_FD].events = POLLIN;
 
 	// common setup
 	copy.iovcnt = 1;
@@ -1077,7 +1004,7 @@ virtio_console(mic_device_context *mdc, mic_info* mic)
 
 		console_poll[MONITOR_FD].revents = 0;
 		console_poll[VIRTIO_CONSOLE_FD].revents = 0;
-		err = poll(console_poll, MAX_CONSOLE_FD, 1000);
+		err = poll(console_poll, MAX_CONSOLE_FD, mdc->poll_timeout());
 
 		if (err == 0) {
 			continue;
@@ -1212,19 +1139,12 @@ set_backend_file(mic_device_context *mdc, struct mic_info *mic, int idx)
 	return true;
 }
 
-#define SECTOR_SIZE 512
 static bool
 set_backend_size(mic_device_context *mdc, struct mic_info *mic, int idx)
 {
 	struct mpssd_info *mpssdi = (struct mpssd_info *)mic->data;
 
-	mpssdi->mic_virtblk[idx].backend_size = lseek(mpssdi->mic_virtblk[idx].backend, 0,
-		SEEK_END);
-	if (mpssdi->mic_virtblk[idx].backend_size < 0) {
-		mpssd_log(PERROR, "can't seek: %s",
-			mpssdi->mic_virtblk[idx].backend_file.c_str());
-		return false;
-	}
+	mpssdi->mic_virtblk[idx].backend_size = mdc->m_vblk_engine[idx]->size();
 	mdc->virtblk_dev_page[idx].blk_config.capacity =
 		mpssdi->mic_virtblk[idx].backend_size / SECTOR_SIZE;
 	if ((mpssdi->mic_virtblk[idx].backend_size % SECTOR_SIZE) != 0)
@@ -1236,42 +1156,44 @@ set_backend_size(mic_device_context *mdc, struct mic_info *mic, int idx)
 	return true;
 }
 
+/*
+ * A block device with a base image is served copy-on-write: the shared base
+ * stays read-only and backend_file is this card's sparse overlay, created
+ * on first use. Deleting the overlay reprovisions the card.
+ */
 static bool
 open_backend(mic_device_context *mdc, struct mic_info *mic, int idx)
 {
 	struct mpssd_info *mpssdi = (struct mpssd_info *)mic->data;
+	const std::string& base = mic->config.blockdevs[idx].base;
+	blk_backend *backend;
+	std::string error;
 
 	if (!set_backend_file(mdc, mic, idx))
-		goto _error_exit;
-	mpssdi->mic_virtblk[idx].backend = open(mpssdi->mic_virtblk[idx].backend_file.c_str(), O_RDWR);
-	if (mpssdi->mic_virtblk[idx].backend < 0) {
-		mpssd_log(PERROR, "can't open: %s", mpssdi->mic_virtblk[idx].backend_file.c_str());
+		return false;
+
+	if (base.empty()) {
+		backend = raw_blk_backend::open(mpssdi->mic_virtblk[idx].backend_file, error);
+	} else {
+		mpssd_log(PINFO, "block device %d: base %s overlay %s", idx,
+			  base.c_str(), mpssdi->mic_virtblk[idx].backend_file.c_str());
+		backend = cow_blk_backend::open(base,
+			mpssdi->mic_virtblk[idx].backend_file, error);
 	}
-	if (!set_backend_size(mdc, mic, idx))
-		goto _error_close;
-	mpssdi->mic_virtblk[idx].backend_addr = mmap(NULL,
-		mpssdi->mic_virtblk[idx].backend_size,
-		PROT_READ|PROT_WRITE, MAP_SHARED,
-		mpssdi->mic_virtblk[idx].backend, 0L);
-	if (mpssdi->mic_virtblk[idx].backend_addr == MAP_FAILED) {
-		mpssd_log(PERROR, "can't map: %s %s", mpssdi->mic_virtblk[idx].backend_file.c_str(), strerror(errno));
-		goto _error_close;
+	if (!backend) {
+		mpssd_log(PERROR, "%s", error.c_str());
+		return false;
 	}
-	return true;
 
- _error_close:
-	close(mpssdi->mic_virtblk[idx].backend);
- _error_exit:
-	return false;
+	mdc->m_vblk_engine[idx].reset(new blk_io_engine(backend));
+	return set_backend_size(mdc, mic, idx);
 }
 
 static void
-close_backend(struct mic_info *mic, int idx)
+close_backend(mic_device_context *mdc, struct mic_info *mic, int idx)
 {
-	struct mpssd_info *mpssdi = (struct mpssd_info *)mic->data;
-
-	munmap(mpssdi->mic_virtblk[idx].backend_addr, mpssdi->mic_virtblk[idx].backend_size);
-	close(mpssdi->mic_virtblk[idx].backend);
+	/* Waits for queued writes to reach the backend */
+	mdc->m_vblk_engine[idx].reset();
 }
 
 static bool
@@ -1301,95 +1223,13 @@ remove_virtblk_device(mic_device_context *mdc, struct mic_info *mic, int idx)
 	close(mpssdi->mic_virtblk[idx].virtio_block_fd);
 }
 
-static __u8
-header_error_check(struct vring_desc *desc)
-{
-	if (le32toh(desc->len) != sizeof(struct virtio_blk_outhdr)) {
-		mpssd_log(PERROR, "length is not sizeof(virtio_blk_outhd)");
-		return -EIO;
-	}
-	if (!(le16toh(desc->flags) & VRING_DESC_F_NEXT)) {
-		mpssd_log(PERROR, "alone");
-		return -EIO;
-	}
-	if (le16toh(desc->flags) & VRING_DESC_F_WRITE) {
-		mpssd_log(PERROR, "not read");
-		return -EIO;
-	}
-	return 0;
-}
-
-static int
-read_header(int fd, struct virtio_blk_outhdr *hdr, __u32 desc_idx)
-{
-	struct iovec iovec;
-	struct mic_copy_desc copy;
-
-	iovec.iov_len = sizeof(*hdr);
-	iovec.iov_base = hdr;
-	copy.iov = &iovec;
-	copy.iovcnt = 1;
-	copy.vr_idx = 0;  /* only one vring on virtio_block */
-	copy.update_used = false;  /* do not update used index */
-	return ioctl(fd, MIC_VIRTIO_COPY_DESC, &copy);
-}
-
-static int
-transfer_blocks(int fd, struct iovec *iovec, __u32 iovcnt)
-{
-	struct mic_copy_desc copy;
-
-	copy.iov = iovec;
-	copy.iovcnt = iovcnt;
-	copy.vr_idx = 0;  /* only one vring on virtio_block */
-	copy.update_used = false;  /* do not update used index */
-	return ioctl(fd, MIC_VIRTIO_COPY_DESC, &copy);
-}
-
-static __u8
-status_error_check(struct vring_desc *desc)
-{
-	if (le32toh(desc->len) != sizeof(__u8)) {
-		mpssd_log(PERROR, "length is not sizeof(status)");
-		return -EIO;
-	}
-	return 0;
-}
-
-static int
-write_status(int fd, __u8 *status)
-{
-	struct iovec iovec;
-	struct mic_copy_desc copy;
-
-	iovec.iov_base = status;
-	iovec.iov_len = sizeof(*status);
-	copy.iov = &iovec;
-	copy.iovcnt = 1;
-	copy.vr_idx = 0;  /* only one vring on virtio_block */
-	copy.update_used = true; /* Update used index */
-	return ioctl(fd, MIC_VIRTIO_COPY_DESC, &copy);
-}
-
-#ifndef VIRTIO_BLK_T_GET_ID
-#define VIRTIO_BLK_T_GET_ID    8
-#endif
-
 void
 virtio_block(mic_device_context *mdc, mic_info *mic, int idx)
 {
 	struct mpssd_info *mpssdi = (struct mpssd_info *)mic->data;
 	int ret;
-	struct pollfd block_poll;
+	struct pollfd block_poll[2];
 	struct mic_vring vring;
-	__u16 avail_idx;
-	__u32 desc_idx;
-	struct vring_desc *desc;
-	struct iovec *iovec, *piov;
-	__u8 status;
-	__u32 buffer_desc_idx;
-	struct virtio_blk_outhdr hdr;
-	void *fos;
 
 	virtio_log.virtio_device_type = VIRTIO_ID_BLOCK;
 	virtio_log.virtio_device_number = idx + 1;
@@ -1402,143 +1242,57 @@ virtio_block(mic_device_context *mdc, mic_info *mic, int idx)
 		goto remove_virtblk;
 	}
 
+	block_poll[0].fd = mpssdi->mic_virtblk[idx].virtio_block_fd;
+	block_poll[0].events = POLLIN;
+	block_poll[1].fd = mdc->shutdown_fd();
+	block_poll[1].events = POLLIN;
 	for (;;) {  /* forever */
 		if (mdc->need_shutdown()) {
 			break;
 		}
 
-		iovec = (struct iovec *) malloc(sizeof(*iovec) *
-						le32toh(mdc->virtblk_dev_page[idx].blk_config.seg_max));
-		if (!iovec) {
-			mpssd_log(PERROR, "can't alloc iovec: %s", strerror(ENOMEM));
+		block_poll[0].revents = 0;
+		/* shutdown requests wake us through the shutdown fd */
+		ret = poll(block_poll, 2, mdc->poll_timeout());
+
+		if (ret == 0) {
+			continue;
+		}
+		if (ret < 0) {
+			mpssd_log(PERROR, "poll failed: %s", strerror(errno));
+			continue;
+		}
+		if (block_poll[0].revents & POLLHUP) {
+			mpssd_log(PINFO, "POLLHUP closing BLOCK device");
+			/* device not initialized already, so exiting thread
+			 * to avoid vop_poll flood */
 			goto remove_virtblk;
 		}
+		if (block_poll[0].revents & POLLERR) {
+			mpssd_log(PERROR, "POLLERR on BLOCK device %d", idx);
+			continue;
+		}
 
-		block_poll.fd = mpssdi->mic_virtblk[idx].virtio_block_fd;
-		block_poll.events = POLLIN;
-		for (mpssdi->mic_virtblk[idx].signaled = 0;
-		     !mpssdi->mic_virtblk[idx].signaled;) {
-
-			if (mdc->need_shutdown()) {
-				goto free_iovec;
-			}
-			block_poll.revents = 0;
-			/* timeout in 1 sec to see signaled */
-			ret = poll(&block_poll, 1, 1000);
-
-			if (ret == 0) {
-				continue;
-			}
-			if (ret < 0) {
-				mpssd_log(PERROR, "poll failed: %s", strerror(errno));
-				continue;
-			}
-			if (block_poll.revents & POLLHUP) {
-				mpssd_log(PINFO, "POLLHUP closing BLOCK device");
-				/* device not initialized already, so exiting thread
-				 * to avoid vop_poll flood */
-				free(iovec);
+		/* POLLIN */
+		while (vring.info->avail_idx !=
+			le16toh(vring.vr.avail->idx)) {
+			ret = virtblk_handle_request(
+				mpssdi->mic_virtblk[idx].virtio_block_fd,
+				mdc->m_vblk_engine[idx].get(), &vring);
+			if (ret == -EIO)
 				goto remove_virtblk;
-
-			}
-			if (block_poll.revents & POLLERR) {
-				mpssd_log(PERROR, "POLLERR on BLOCK device %d", idx);
-				continue;
-			}
-
-			/* POLLIN */
-			while (vring.info->avail_idx !=
-				le16toh(vring.vr.avail->idx)) {
-				/* read header element */
-				avail_idx =
-					vring.info->avail_idx &
-					(vring.vr.num - 1);
-				desc_idx = le16toh(
-					vring.vr.avail->ring[avail_idx]);
-				desc = &vring.vr.desc[desc_idx];
-#ifdef DEBUG
-				mpssd_log(PINFO, "avail_idx=%d vring.vr.num=%d desc=%p",
-					vring.info->avail_idx, vring.vr.num, desc);
-#endif
-				status = header_error_check(desc);
-				if (status) {
-					mpssd_log(PERROR, "header_error_check status=%d %s",
-						  status, strerror(status));
-					free(iovec);
-					goto remove_virtblk;
-				}
-
-				ret = read_header(
-					mpssdi->mic_virtblk[idx].virtio_block_fd,
-					&hdr, desc_idx);
-				if (ret < 0) {
-					mpssd_log(PERROR, "ret=%d %s", ret, strerror(errno));
-					break;
-				}
-				/* buffer element */
-				piov = iovec;
-				status = 0;
-				fos = (void *) ((char *) mpssdi->mic_virtblk[idx].backend_addr +
-					(hdr.sector * SECTOR_SIZE));
-				buffer_desc_idx = next_desc(desc);
-				for (desc = &vring.vr.desc[buffer_desc_idx];
-				     desc->flags & VRING_DESC_F_NEXT;
-				     desc_idx = next_desc(desc),
-					     desc = &vring.vr.desc[desc_idx]) {
-					piov->iov_len = desc->len;
-					piov->iov_base = fos;
-					piov++;
-					fos = (void *) ((char *) fos + desc->len);
-				}
-				/* Returning NULLs for VIRTIO_BLK_T_GET_ID. */
-				if (hdr.type & ~(VIRTIO_BLK_T_OUT |
-					VIRTIO_BLK_T_GET_ID)) {
-					/*
-					  VIRTIO_BLK_T_IN - does not do
-					  anything. Probably for documenting.
-					  VIRTIO_BLK_T_SCSI_CMD - for
-					  virtio_scsi.
-					  VIRTIO_BLK_T_FLUSH - turned off in
-					  config space.
-					  VIRTIO_BLK_T_BARRIER - defined but not
-					  used in anywhere.
-					*/
-					mpssd_log(PERROR, "type %x is not supported", hdr.type);
-					status = -ENOTSUP;
-
-				} else {
-					ret = transfer_blocks(
-					mpssdi->mic_virtblk[idx].virtio_block_fd,
-						iovec,
-						piov - iovec);
-					if (ret < 0 &&
-					    status != 0)
-						status = ret;
-				}
-				/* write status and update used pointer */
-				if (status != 0)
-					status = status_error_check(desc);
-				ret = write_status(
-					mpssdi->mic_virtblk[idx].virtio_block_fd,
-					&status);
-				if (ret < 0)
-					mpssd_log(PERROR, "write status failed: %d", ret);
-#ifdef DEBUG
-				mpssd_log(PINFO, "write status=%d on desc=%p", status, desc);
-#endif
-				if (mdc->need_shutdown()) {
-					break;
-				}
+			if (ret < 0)
+				break;
+			if (mdc->need_shutdown()) {
+				break;
 			}
 		}
-free_iovec:
-		free(iovec);
 	}  /* forever */
 remove_virtblk:
 	remove_virtblk_device(mdc, mic, idx);
 	mpssd_log(PINFO, "virtblk stopped for block device %d", idx);
 
-	close_backend(mic, idx);
+	close_backend(mdc, mic, idx);
 	mpssd_log(PINFO, "backend file closed for block device %d", idx);
 	mpssd_log(PINFO, "exiting thread for block device %d", idx);
 }
@@ -1562,7 +1316,7 @@ setup_virtio_block(struct mic_info* mic, mic_device_context* mdc, int idx)
 	mpssd_log(PINFO, "adding block device %d", idx);
 	if (!add_virtblk_device(mdc, mic, idx)) {
 		mpssd_log(PERROR, "can't add virblk device");
-		close_backend(mic, idx);
+		close_backend(mdc, mic, idx);
 		return false;
 	}
 
@@ -13,6 +13,7 @@
 
 #pragma once
 
+#include "blkio.h"
 #include "mpssconfig.h"
 #include "sync_utils.h"
 
@@ -27,6 +28,7 @@
 #include <linux/virtio_console.h>
 #undef class
 
+#include <memory>
 #include <thread>
 #include <vector>
 
@@ -55,6 +57,8 @@ struct virtcons_dev_page_t {
 
 class mic_device_context {
 	shutdown_status m_ss;
+	/* Becomes readable on shutdown(); polled along with each device fd */
+	int m_shutdown_fd;
 
 	void init();
 
@@ -63,6 +67,8 @@ public:
 	virtnet_dev_page_t virtnet_dev_page;
 	virtcons_dev_page_t virtcons_dev_page;
 
+	std::unique_ptr<blk_io_engine> m_vblk_engine[BLOCK_MAX_COUNT];
+
 	std::vector<std::thread> m_vblk_vector;
 	std::thread m_vnet_thread;
 	std::thread m_vcon_thread;
@@ -70,11 +76,21 @@ public:
 	mic_device_context() {
 		init();
 	}
+	~mic_device_context();
 
 	bool need_shutdown() {
 		return m_ss.is_shutdown_requested();
 	}
 
+	int shutdown_fd() {
+		return m_shutdown_fd;
+	}
+
+	/* Fall back to periodic wakeups if the eventfd could not be created */
+	int poll_timeout() {
+		return m_shutdown_fd < 0 ? 1000 : -1;
+	}
+
 	void shutdown();
 };
 
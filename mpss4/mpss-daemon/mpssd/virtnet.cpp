@@ -0,0 +1,251 @@
+/*
+ * Copyright (c) 2016, Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ */
+
+#include "virtnet.h"
+#include "vop_copy.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <linux/if_tun.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+int
+virtnet_batch_init(struct virtnet_batch *b)
+{
+	int i, err;
+
+	err = posix_memalign((void **)&b->buf, 64,
+			     NET_COPY_BATCH * MAX_NET_PKT_SIZE);
+	if (err) {
+		mpssd_log(PERROR, "batch buffer allocation failed %s",
+			  strerror(err));
+		return -1;
+	}
+
+	memset(b->hdr, 0, sizeof(b->hdr));
+	for (i = 0; i < NET_COPY_BATCH; i++) {
+		b->iov[i][0].iov_base = &b->hdr[i];
+		b->iov[i][0].iov_len = sizeof(b->hdr[i]);
+		b->iov[i][1].iov_base = b->buf + i * MAX_NET_PKT_SIZE;
+		b->iov[i][1].iov_len = MAX_NET_PKT_SIZE;
+		b->copy[i].iov = b->iov[i];
+		b->copy[i].iovcnt = 2;
+	}
+	return 0;
+}
+
+/* Number of descriptor chains the card has made available on vr */
+static unsigned int
+avail_descriptors(struct mic_vring *vr)
+{
+	return (__u16)(le16toh(ACCESS_ONCE(vr->vr.avail->idx)) -
+		       read_avail_idx(vr));
+}
+
+/* Spin till the card has some descriptors or the queue is stopped */
+static void
+spin_for_descriptors(struct virtnet_queue *q, struct mic_vring *vr)
+{
+	while (!avail_descriptors(vr)) {
+		if (q->stopped)
+			break;
+		sched_yield();
+	}
+}
+
+/*
+ * Move up to NET_TX_BUDGET packets from the TAP queue to the card. The TAP
+ * fd is non-blocking, so the loop ends early once the queue is empty and
+ * a full budget sends us back to poll(), which returns immediately.
+ * Packets are read into a batch, as many as the card has buffers for, and
+ * copied to the card with one ioctl.
+ */
+void
+virtnet_tap_to_card(struct virtnet_queue *q, struct virtnet_batch *b)
+{
+	struct mic_copy_desc *copy;
+	struct virtio_net_hdr *hdr;
+	unsigned int n, max;
+	ssize_t len;
+	int budget, done, i;
+
+	for (budget = NET_TX_BUDGET; budget > 0; budget -= n) {
+		spin_for_descriptors(q, &q->tx_vr);
+		max = std::min({ avail_descriptors(&q->tx_vr),
+				 (unsigned int)NET_COPY_BATCH,
+				 (unsigned int)budget });
+
+		for (n = 0; n < max; n++) {
+			copy = &b->copy[n];
+			hdr = &b->hdr[n];
+			len = readv(q->tap_fd, copy->iov, copy->iovcnt);
+			if (len < 0) {
+				if (errno != EAGAIN && errno != EWOULDBLOCK) {
+					disp_iovec(q->mic, copy);
+					mpssd_log(PERROR, "read failed %s cnt %d sum %zd",
+						strerror(errno), copy->iovcnt, sum_iovec_len(copy));
+				}
+				break;
+			}
+			if (!len)
+				break;
+
+			/*
+			 * Disable checksums on the card since we are on a
+			 * reliable PCIe link. Partially checksummed GSO frames
+			 * keep their csum_start/csum_offset so the card can
+			 * finish them.
+			 */
+			if (!(hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM))
+				hdr->flags |= VIRTIO_NET_HDR_F_DATA_VALID;
+#ifdef DEBUG
+			mpssd_log(PINFO, "hdr->flags 0x%x hdr->gso_type 0x%x",
+				hdr->flags, hdr->gso_type);
+
+			disp_iovec(q->mic, copy);
+			mpssd_log(PINFO, "read from tap 0x%lx", len);
+#endif
+			txrx_prepare(VIRTIO_ID_NET, 1, &q->tx_vr, copy, len);
+		}
+		if (!n)
+			break;
+
+		done = mic_virtio_copy_batch(q->mic, q->virtio_fd, &q->tx_vr,
+					     b->copy, n);
+		/*
+		 * The packets are already off the TAP queue, so whatever
+		 * the card did not take is lost; TCP will retransmit.
+		 */
+		if (done < (int)n)
+			mpssd_log(PERROR, "mic_virtio_copy_batch dropped %d of %u packets: %s",
+				  (int)n - std::max(done, 0), n,
+				  done < 0 ? strerror(errno) : "short copy");
+		for (i = 0; i < done; i++) {
+			verify_out_len(q->mic, &b->copy[i]);
+#ifdef DEBUG
+			disp_iovec(q->mic, &b->copy[i]);
+			mpssd_log(PINFO, "wrote to net 0x%lx",
+				sum_iovec_len(&b->copy[i]));
+#endif
+		}
+		/* Reinitialize IOV for next run */
+		for (i = 0; i < (int)n; i++)
+			b->iov[i][1].iov_len = MAX_NET_PKT_SIZE;
+
+		/* The TAP queue ran dry */
+		if (n < max || q->stopped)
+			break;
+	}
+}
+
+/* Drain every available card TX descriptor chain into the TAP queue. */
+void
+virtnet_card_to_tap(struct virtnet_queue *q, struct virtnet_batch *b)
+{
+	struct mic_copy_desc *copy;
+	unsigned int n, i;
+	ssize_t len;
+	int done, j;
+
+	while ((n = avail_descriptors(&q->rx_vr))) {
+		n = std::min(n, (unsigned int)NET_COPY_BATCH);
+		for (i = 0; i < n; i++)
+			txrx_prepare(VIRTIO_ID_NET, 0, &q->rx_vr, &b->copy[i],
+				     MAX_NET_PKT_SIZE + sizeof(struct virtio_net_hdr));
+
+		done = mic_virtio_copy_batch(q->mic, q->virtio_fd, &q->rx_vr,
+					     b->copy, n);
+		if (done < 0) {
+			mpssd_log(PERROR, "mic_virtio_copy_batch %s", strerror(errno));
+			break;
+		}
+		for (j = 0; j < done; j++) {
+			copy = &b->copy[j];
+#ifdef DEBUG
+			mpssd_log(PINFO, "hdr->flags 0x%x, out_len %d gso_type 0x%x",
+				b->hdr[j].flags, copy->out_len, b->hdr[j].gso_type);
+#endif
+			/* Set the correct output iov_len */
+			b->iov[j][1].iov_len = copy->out_len - sizeof(struct virtio_net_hdr);
+			verify_out_len(q->mic, copy);
+#ifdef DEBUG
+			disp_iovec(q->mic, copy);
+			mpssd_log(PINFO, "read from net 0x%lx", sum_iovec_len(copy));
+#endif
+			len = writev(q->tap_fd, copy->iov, copy->iovcnt);
+			if (len != sum_iovec_len(copy)) {
+				mpssd_log(PERROR, "Tun write failed %s len 0x%zx read_len 0x%zx",
+					strerror(errno), len, sum_iovec_len(copy));
+			} else {
+#ifdef DEBUG
+				disp_iovec(q->mic, copy);
+				mpssd_log(PINFO, "wrote to tap 0x%lx", len);
+#endif
+			}
+		}
+		if (done < (int)n || q->stopped)
+			break;
+	}
+}
+
+/*
+ * TAP offloads for the features the card driver acknowledged. TSO needs
+ * the card to accept partially checksummed frames, so nothing is offloaded
+ * without VIRTIO_NET_F_GUEST_CSUM.
+ */
+unsigned int
+virtnet_tap_offload(__u32 guest_features)
+{
+	unsigned int offload = 0;
+
+	if (guest_features & (1 << VIRTIO_NET_F_GUEST_CSUM)) {
+		offload |= TUN_F_CSUM;
+		if (guest_features & (1 << VIRTIO_NET_F_GUEST_TSO4))
+			offload |= TUN_F_TSO4;
+		if (guest_features & (1 << VIRTIO_NET_F_GUEST_TSO6))
+			offload |= TUN_F_TSO6;
+		if ((offload & (TUN_F_TSO4 | TUN_F_TSO6)) &&
+		    (guest_features & (1 << VIRTIO_NET_F_GUEST_ECN)))
+			offload |= TUN_F_TSO_ECN;
+	}
+	return offload;
+}
+
+/*
+ * Enable on the TAP exactly the offloads the card driver acknowledged, so
+ * that the TAP never hands us a GSO frame the card cannot take.
+ */
+void
+virtnet_set_offload(struct virtnet_queue *q)
+{
+	__u8 *features = mic_vq_features(q->desc);
+	__u32 guest_features;
+	unsigned int offload;
+
+	memcpy(&guest_features, features + q->desc->feature_len,
+	       sizeof(guest_features));
+	guest_features = le32toh(guest_features);
+	offload = virtnet_tap_offload(guest_features);
+
+	if (ioctl(q->tap_fd, TUNSETOFFLOAD, offload) < 0) {
+		mpssd_log(PERROR, "TUNSETOFFLOAD failed %s", strerror(errno));
+		return;
+	}
+	mpssd_log(PINFO, "guest features 0x%x, TAP offload 0x%x",
+		  guest_features, offload);
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2016, Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ */
+
+#pragma once
+
+#include "virtio.h"
+
+#include <mic_ioctl.h>
+
+#include <atomic>
+
+#include <sys/uio.h>
+
+#define MAX_GSO_SIZE		(64 * 1024)
+#define ETH_H_LEN		14
+#define MAX_NET_PKT_SIZE	(_ALIGN_UP(MAX_GSO_SIZE + ETH_H_LEN, 64))
+/* Max packets moved from the TAP to the card per poll() wakeup */
+#define NET_TX_BUDGET		64
+/* Max packets copied per MIC_VIRTIO_COPY_BATCH ioctl */
+#define NET_COPY_BATCH		16
+
+#ifndef VIRTIO_NET_HDR_F_DATA_VALID
+#define VIRTIO_NET_HDR_F_DATA_VALID	2	/* Csum is valid */
+#endif
+
+/*
+ * State shared by the two workers serving the virtio-net queue pair:
+ * the tap->card worker drains the TAP queue into the card RX vring (vr0)
+ * and the card->tap worker drains the card TX vring (vr1) into the TAP.
+ * There is a single pair per card: a second one would also need the
+ * VIRTIO_NET_F_MQ control vring, five vrings in all, and a VOP device
+ * has at most MIC_MAX_VRINGS. The data path below only looks at stopped;
+ * mdc is for the workers.
+ */
+struct virtnet_queue {
+	mic_device_context *mdc;
+	struct mic_info *mic;
+	int virtio_fd;
+	int tap_fd;
+	struct mic_vring tx_vr;
+	struct mic_vring rx_vr;
+	struct mic_device_desc *desc;
+	std::atomic<bool> stopped;
+	/* Wakes the tap worker when the card->tap worker stops */
+	int stop_fd;
+};
+
+/*
+ * A header and a packet buffer for each copy of a batch. The iovecs of
+ * copy[i] point to hdr[i] and to the i-th packet buffer.
+ */
+struct virtnet_batch {
+	struct mic_copy_desc copy[NET_COPY_BATCH];
+	struct iovec iov[NET_COPY_BATCH][2];
+	struct virtio_net_hdr hdr[NET_COPY_BATCH];
+	__u8 *buf;
+};
+
+int virtnet_batch_init(struct virtnet_batch *b);
+void virtnet_tap_to_card(struct virtnet_queue *q, struct virtnet_batch *b);
+void virtnet_card_to_tap(struct virtnet_queue *q, struct virtnet_batch *b);
+unsigned int virtnet_tap_offload(__u32 guest_features);
+void virtnet_set_offload(struct virtnet_queue *q);
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2016, Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ */
+
+#include "vop_copy.h"
+#include "utils.h"
+
+#include <assert.h>
+#include <atomic>
+#include <errno.h>
+#include <string.h>
+#include <sys/ioctl.h>
+
+/* Sum up all the IOVEC length */
+ssize_t
+sum_iovec_len(struct mic_copy_desc *copy)
+{
+	ssize_t sum = 0;
+	unsigned int i;
+
+	for (i = 0; i < copy->iovcnt; i++)
+		sum += copy->iov[i].iov_len;
+	return sum;
+}
+
+void
+verify_out_len(struct mic_info *mic, struct mic_copy_desc *copy)
+{
+	if (copy->out_len != sum_iovec_len(copy)) {
+		mpssd_log(PERROR, "BUG copy->out_len 0x%x len 0x%zx",
+			copy->out_len, sum_iovec_len(copy));
+		assert(copy->out_len == sum_iovec_len(copy));
+	}
+}
+
+/* Display an iovec */
+void
+disp_iovec(struct mic_info *mic, struct mic_copy_desc *copy)
+{
+	unsigned int i;
+
+	for (i = 0; i < copy->iovcnt; i++)
+		mpssd_log(PINFO, "copy->iov[%d] addr %p len 0x%zx",
+			i, copy->iov[i].iov_base, copy->iov[i].iov_len);
+}
+
+/* Central API which triggers the copies */
+int
+mic_virtio_copy(struct mic_info *mic, int fd,
+		struct mic_vring *vr, struct mic_copy_desc *copy)
+{
+	int ret;
+
+	ret = ioctl(fd, MIC_VIRTIO_COPY_DESC, copy);
+	if (ret) {
+		mpssd_log(PERROR, "errno %s ret %d", strerror(errno), ret);
+	}
+	return ret;
+}
+
+/* Cleared once the driver turns out not to know MIC_VIRTIO_COPY_BATCH */
+static std::atomic<bool> copy_batch_supported(true);
+
+/*
+ * Copy count descriptor chains of one vring with a single ioctl, or one
+ * ioctl per chain with an older driver. Returns the number of copies done,
+ * their out_len is valid, or -1 if none was.
+ */
+int
+mic_virtio_copy_batch(struct mic_info *mic, int fd,
+		      struct mic_vring *vr, struct mic_copy_desc *copy,
+		      unsigned int count)
+{
+	struct mic_copy_batch batch;
+	unsigned int i;
+
+	if (copy_batch_supported) {
+		batch.copy = copy;
+		batch.count = count;
+		batch.done = 0;
+		if (!ioctl(fd, MIC_VIRTIO_COPY_BATCH, &batch))
+			return batch.done;
+		if (errno != ENOTTY) {
+			mpssd_log(PERROR, "errno %s", strerror(errno));
+			return -1;
+		}
+		mpssd_log(PINFO, "no batched copies, using one ioctl per copy");
+		copy_batch_supported = false;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (mic_virtio_copy(mic, fd, vr, &copy[i]))
+			break;
+	}
+	return i ? (int)i : -1;
+}
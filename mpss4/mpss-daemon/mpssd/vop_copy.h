@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2016, Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ */
+
+#pragma once
+
+#include "virtio.h"
+
+#include <mic_ioctl.h>
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/* Descriptor copies through the VOP driver, shared by the virtio devices */
+
+#define ACCESS_ONCE(x) (*(volatile decltype(x) *)&(x))
+
+static inline __u16 read_avail_idx(struct mic_vring *vr)
+{
+	return ACCESS_ONCE(vr->info->avail_idx);
+}
+
+static inline void txrx_prepare(int type, bool tx, struct mic_vring *vr,
+				struct mic_copy_desc *copy, ssize_t len)
+{
+	copy->vr_idx = tx ? 0 : 1;
+	copy->update_used = true;
+	if (type == VIRTIO_ID_NET)
+		copy->iov[1].iov_len = len - sizeof(struct virtio_net_hdr);
+	else
+		copy->iov[0].iov_len = len;
+}
+
+ssize_t sum_iovec_len(struct mic_copy_desc *copy);
+void verify_out_len(struct mic_info *mic, struct mic_copy_desc *copy);
+void disp_iovec(struct mic_info *mic, struct mic_copy_desc *copy);
+
+int mic_virtio_copy(struct mic_info *mic, int fd,
+		    struct mic_vring *vr, struct mic_copy_desc *copy);
+int mic_virtio_copy_batch(struct mic_info *mic, int fd,
+			  struct mic_vring *vr, struct mic_copy_desc *copy,
+			  unsigned int count);
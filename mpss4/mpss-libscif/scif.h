@@ -136,6 +136,25 @@ enum {
 #define SCIF_RMA_USECACHE   (1<<1)
 #define SCIF_RMA_SYNC       (1<<2)
 #define SCIF_RMA_ORDERED    (1<<3)
+
+/* Endpoint options of scif_setsockopt()/scif_getsockopt() */
+#define SCIF_OPT_RING_SIZE	1
+#define SCIF_OPT_CQ_DEPTH	2
+#define SCIF_OPT_DMA_CHANNELS	3
+
+/* Operations of struct scif_rma_op */
+#define SCIF_RMA_OP_READFROM	0
+#define SCIF_RMA_OP_WRITETO	1
+#define SCIF_RMA_OP_VREADFROM	2
+#define SCIF_RMA_OP_VWRITETO	3
+
+/* Operations of scif_pollset_ctl() */
+#define SCIF_POLLSET_ADD	1
+#define SCIF_POLLSET_DEL	2
+#define SCIF_POLLSET_MOD	3
+
+/* Report an endpoint of a poll set once, until it is modified */
+#define SCIF_POLLONESHOT	(1U << 30)
 //! @cond (Prevent doxygen from including these)
 #ifndef _WIN32
 #define SCIF_POLLIN		POLLIN
@@ -302,6 +321,40 @@ struct scif_pollepd {
 	short revents;    /* returned events */
 };
 
+struct scif_mmsg {
+	scif_epd_t epd;   /* endpoint descriptor */
+	void *msg;        /* message buffer address */
+	int len;          /* message length */
+	int flags;        /* blocking mode flags */
+	int out_len;      /* returned bytes sent/received, or -1 */
+	int out_errno;    /* returned error if out_len is -1 */
+};
+
+struct scif_rma_op {
+	int op;           /* one of SCIF_RMA_OP_* */
+	int flags;        /* flags of the matching RMA function */
+	off_t loffset;    /* local offset, for readfrom/writeto */
+	void *addr;       /* local address, for vreadfrom/vwriteto */
+	size_t len;       /* length of range to copy */
+	off_t roffset;    /* remote offset */
+	uint64_t cookie;  /* returned in the completion of the RMA */
+};
+
+struct scif_cqe {
+	uint64_t cookie;  /* cookie of the completed RMA */
+	int status;       /* 0, or the error the RMA failed with */
+	int reserved;
+};
+
+#if !defined(__KERNEL__) && !defined(_WIN32)
+typedef int scif_pollset_t;
+
+struct scif_pollevent {
+	uint32_t events;  /* requested or returned events */
+	uint64_t data;    /* returned with the events of the endpoint */
+};
+#endif
+
 #ifdef __KERNEL__
 enum scif_event_type {
 	SCIF_NODE_ADDED = 1<<0,
@@ -1570,6 +1623,339 @@ int scif_get_fd(scif_epd_t epd);
 #endif
 #endif
 
+/**
+ * scif_setsockopt - Set an endpoint option
+ *	\param epd		endpoint descriptor
+ *	\param name		option to set
+ *	\param value		new value of the option
+ *
+ * scif_setsockopt() sets the option name of the endpoint epd to value.
+ *
+ * SCIF_OPT_RING_SIZE sets the size in bytes of the ring buffer which holds
+ * the messages received on epd. value must be a power of two from 4KB to
+ * 4MB, the default is 4KB. A larger ring only lets the peer queue more data
+ * for epd before its scif_send() waits for scif_recv() on epd; it does not
+ * speed up messages sent from epd. Set on a listening endpoint, it sizes
+ * the receive ring of the endpoints accepted on it. Set on a connecting
+ * endpoint, it sizes the receive ring of epd and is passed to the accepting
+ * peer, which allocates at least that much for its own receive ring. A
+ * smaller ring is used if the memory for a large one cannot be found. The
+ * option must be set before the endpoint connects.
+ *
+ * SCIF_OPT_CQ_DEPTH sets how many RMAs may be posted on epd with
+ * scif_rma_post() and not be reaped yet with scif_cq_reap(), from 1 to
+ * 65536, the default is 256. It must be set before the first RMA is posted.
+ *
+ * SCIF_OPT_DMA_CHANNELS sets how many DMA channels an RMA on epd may be
+ * split across, from 1 to 8, the default is 1. RMAs of 1MB or more which
+ * are not SCIF_RMA_ORDERED are split into stripes of whole pages which are
+ * transferred in parallel, and complete once every stripe has. Fewer
+ * channels are used if the card has fewer. The option may be set at any
+ * time and applies to the RMAs started afterwards.
+ *
+ *\return
+ * Upon successful completion, scif_setsockopt() returns 0;
+ * otherwise -1 is returned and errno is set to indicate the error.
+ *
+ *\par Errors:
+ *- EBADF
+ * - epd is not a valid endpoint descriptor
+ *- EBUSY
+ * - SCIF_OPT_CQ_DEPTH was set after RMAs were posted on epd
+ *- EINVAL
+ * - value is invalid
+ *- EISCONN
+ * - The endpoint is already connected or connecting
+ *- ENOPROTOOPT
+ * - name is not a known option
+ *- ENOTTY
+ * - epd is not a valid endpoint descriptor
+ */
+MICACCESSAPI
+int scif_setsockopt(scif_epd_t epd, int name, uint64_t value);
+
+/**
+ * scif_getsockopt - Get an endpoint option
+ *	\param epd		endpoint descriptor
+ *	\param name		option to get
+ *	\param value		address to place the value of the option
+ *
+ * scif_getsockopt() returns the option name of the endpoint epd at value.
+ * For a connected endpoint, SCIF_OPT_RING_SIZE returns the size of the
+ * receive ring buffer which was allocated. It may be larger than the one set
+ * if the peer asked for more, or smaller if memory was short.
+ *
+ *\return
+ * Upon successful completion, scif_getsockopt() returns 0;
+ * otherwise -1 is returned and errno is set to indicate the error.
+ *
+ *\par Errors:
+ *- EBADF
+ * - epd is not a valid endpoint descriptor
+ *- EFAULT
+ * - value is NULL
+ *- ENOPROTOOPT
+ * - name is not a known option
+ *- ENOTTY
+ * - epd is not a valid endpoint descriptor
+ */
+MICACCESSAPI
+int scif_getsockopt(scif_epd_t epd, int name, uint64_t *value);
+
+#ifndef _WIN32
+#ifndef __KERNEL__
+/**
+ * scif_send_multi - Send a batch of messages
+ *	\param msgs		array of messages
+ *	\param count		number of entries in msgs
+ *
+ * scif_send_multi() sends count messages, each as if by scif_send() with
+ * the epd, msg, len and flags of its entry in msgs, using as few system
+ * calls as possible. The messages may be sent on different endpoints and
+ * are sent in array order.
+ *
+ * The result of each message is returned in its entry: out_len is set to
+ * the number of bytes sent, or to -1 with out_errno set to one of the
+ * errors of scif_send(). A failed message does not stop the batch, but a
+ * signal does.
+ *
+ * Blocking messages should only be batched with care, since a message
+ * blocked on a full endpoint also holds up the messages which follow it.
+ *
+ *\return
+ * Upon successful completion, scif_send_multi() returns the number of
+ * messages processed, which is less than count only if a signal occurred;
+ * otherwise -1 is returned and errno is set to indicate the error.
+ *
+ *\par Errors:
+ *- EBADF
+ * - The epd of the first message is not a valid endpoint descriptor
+ *- EFAULT
+ * - msgs is not a valid address
+ *- EINTR
+ * - A signal occurred before any message was processed
+ *- ENOTTY
+ * - The epd of the first message is not a valid endpoint descriptor
+ */
+MICACCESSAPI
+int scif_send_multi(struct scif_mmsg *msgs, unsigned int count);
+
+/**
+ * scif_recv_multi - Receive a batch of messages
+ *	\param msgs		array of messages
+ *	\param count		number of entries in msgs
+ *
+ * scif_recv_multi() receives count messages, each as if by scif_recv() with
+ * the epd, msg, len and flags of its entry in msgs, using as few system
+ * calls as possible. The messages may be received on different endpoints
+ * and are received in array order.
+ *
+ * The result of each message is returned in its entry: out_len is set to
+ * the number of bytes received, or to -1 with out_errno set to one of the
+ * errors of scif_recv(). A failed message does not stop the batch, but a
+ * signal does. Non-blocking receives on endpoints reported readable by
+ * poll() are the intended use.
+ *
+ *\return
+ * Upon successful completion, scif_recv_multi() returns the number of
+ * messages processed, which is less than count only if a signal occurred;
+ * otherwise -1 is returned and errno is set to indicate the error.
+ *
+ *\par Errors:
+ *- EBADF
+ * - The epd of the first message is not a valid endpoint descriptor
+ *- EFAULT
+ * - msgs is not a valid address
+ *- EINTR
+ * - A signal occurred before any message was processed
+ *- ENOTTY
+ * - The epd of the first message is not a valid endpoint descriptor
+ */
+MICACCESSAPI
+int scif_recv_multi(struct scif_mmsg *msgs, unsigned int count);
+
+/**
+ * scif_rma_post - Start a batch of RMAs
+ *	\param epd		endpoint descriptor
+ *	\param ops		array of RMAs
+ *	\param count		number of entries in ops
+ *
+ * scif_rma_post() starts count RMAs on the connected endpoint epd without
+ * waiting for them to complete. Each is done as if by scif_readfrom(),
+ * scif_writeto(), scif_vreadfrom() or scif_vwriteto(), depending on its op,
+ * with the loffset or addr, len, roffset and flags of its entry in ops.
+ * SCIF_RMA_SYNC is ignored.
+ *
+ * Every RMA started gets exactly one completion carrying its cookie, which
+ * is returned by scif_cq_reap(). RMAs started with SCIF_RMA_USECPU have
+ * completed by the time scif_rma_post() returns. At most SCIF_OPT_CQ_DEPTH
+ * RMAs may be started and not reaped yet.
+ *
+ * Posting stops at the first RMA which fails to start.
+ *
+ *\return
+ * Upon successful completion, scif_rma_post() returns the number of RMAs
+ * started, which is less than count if one of them failed to start;
+ * otherwise -1 is returned and errno is set to indicate the error the first
+ * RMA failed with, one of those of the matching RMA function or:
+ *
+ *\par Errors:
+ *- EAGAIN
+ * - SCIF_OPT_CQ_DEPTH RMAs were started and not reaped yet
+ *- EFAULT
+ * - ops is not a valid address
+ *- EINVAL
+ * - The op of the RMA is not valid
+ */
+MICACCESSAPI
+int scif_rma_post(scif_epd_t epd, struct scif_rma_op *ops, unsigned int count);
+
+/**
+ * scif_cq_reap - Reap completions of RMAs
+ *	\param epd		endpoint descriptor
+ *	\param cqes		array the completions are returned in
+ *	\param count		number of entries in cqes
+ *	\param timeout_msecs	time to wait for a first completion
+ *
+ * scif_cq_reap() returns up to count completions of RMAs started with
+ * scif_rma_post() on epd, in the order they completed. The status of a
+ * completion is 0, or the error the RMA failed with.
+ *
+ * If no completion is available, scif_cq_reap() waits up to timeout_msecs
+ * milliseconds for one, indefinitely if it is negative and not at all if it
+ * is 0. It does not wait if no RMA is outstanding.
+ *
+ *\return
+ * Upon successful completion, scif_cq_reap() returns the number of
+ * completions returned, which may be 0; otherwise -1 is returned and errno
+ * is set to indicate the error.
+ *
+ *\par Errors:
+ *- EBADF
+ * - epd is not a valid endpoint descriptor
+ *- EFAULT
+ * - cqes is not a valid address
+ *- EINTR
+ * - A signal occurred while waiting
+ *- EINVAL
+ * - count is 0
+ *- ENOTTY
+ * - epd is not a valid endpoint descriptor
+ */
+MICACCESSAPI
+int scif_cq_reap(scif_epd_t epd, struct scif_cqe *cqes, unsigned int count,
+		 long timeout_msecs);
+
+/**
+ * scif_pollset_create - Create a poll set
+ *
+ * scif_pollset_create() creates an empty poll set. A poll set keeps a set
+ * of endpoints and the events of interest for each between waits, so that
+ * waiting for events with scif_pollset_wait() costs the number of ready
+ * endpoints rather than the number of endpoints in the set, as with
+ * scif_poll(). Poll sets are epoll instances, used in level triggered mode.
+ *
+ *\return
+ * Upon successful completion, scif_pollset_create() returns a poll set
+ * descriptor; otherwise -1 is returned and errno is set to indicate the
+ * error.
+ *
+ *\par Errors:
+ *- EMFILE
+ * - Too many file descriptors are open
+ *- ENOMEM
+ * - Not enough space
+ */
+MICACCESSAPI
+scif_pollset_t scif_pollset_create(void);
+
+/**
+ * scif_pollset_ctl - Add, modify or remove an endpoint of a poll set
+ *	\param ps		poll set descriptor
+ *	\param op		operation
+ *	\param epd		endpoint descriptor
+ *	\param event		requested events and data
+ *
+ * SCIF_POLLSET_ADD adds epd to ps with the events of interest and data of
+ * event. SCIF_POLLSET_MOD changes the events of interest and data of epd.
+ * SCIF_POLLSET_DEL removes epd from ps, event is ignored. A closed endpoint
+ * is removed from every poll set it is in.
+ *
+ * The events are those of scif_poll(). If SCIF_POLLONESHOT is set in
+ * events, the endpoint is reported once by scif_pollset_wait() and then
+ * ignored until it is modified with SCIF_POLLSET_MOD. Endpoints should be
+ * added once listening or connected.
+ *
+ *\return
+ * Upon successful completion, scif_pollset_ctl() returns 0; otherwise -1 is
+ * returned and errno is set to indicate the error.
+ *
+ *\par Errors:
+ *- EBADF
+ * - ps or epd is not a valid descriptor
+ *- EEXIST
+ * - op is SCIF_POLLSET_ADD and epd is in ps already
+ *- EINVAL
+ * - op is not valid
+ *- ENOENT
+ * - op is SCIF_POLLSET_MOD or SCIF_POLLSET_DEL and epd is not in ps
+ *- ENOMEM
+ * - Not enough space
+ */
+MICACCESSAPI
+int scif_pollset_ctl(scif_pollset_t ps, int op, scif_epd_t epd,
+		     struct scif_pollevent *event);
+
+/**
+ * scif_pollset_wait - Wait for events on the endpoints of a poll set
+ *	\param ps		poll set descriptor
+ *	\param events		array the ready endpoints are returned in
+ *	\param maxevents	length of events
+ *	\param timeout		upper limit on the time scif_pollset_wait()
+ *				will block
+ *
+ * scif_pollset_wait() returns up to maxevents endpoints of ps for which one
+ * of the requested events, SCIF_POLLERR or SCIF_POLLHUP occurred, each with
+ * the events which occurred and the data given to scif_pollset_ctl(). If
+ * none is ready, it blocks until one is or timeout milliseconds passed. A
+ * negative timeout means an infinite timeout.
+ *
+ *\return
+ * Upon successful completion, scif_pollset_wait() returns the number of
+ * endpoints returned, 0 if none was ready before the timeout; otherwise -1
+ * is returned and errno is set to indicate the error.
+ *
+ *\par Errors:
+ *- EBADF
+ * - ps is not a valid poll set descriptor
+ *- EINTR
+ * - A signal occurred before any requested event
+ *- EINVAL
+ * - maxevents is not positive
+ */
+MICACCESSAPI
+int scif_pollset_wait(scif_pollset_t ps, struct scif_pollevent *events,
+		      int maxevents, long timeout);
+
+/**
+ * scif_pollset_close - Close a poll set
+ *	\param ps		poll set descriptor
+ *
+ * scif_pollset_close() removes all the endpoints from ps and closes it.
+ *
+ *\return
+ * Upon successful completion, scif_pollset_close() returns 0; otherwise -1
+ * is returned and errno is set to indicate the error.
+ *
+ *\par Errors:
+ *- EBADF
+ * - ps is not a valid poll set descriptor
+ */
+MICACCESSAPI
+int scif_pollset_close(scif_pollset_t ps);
+#endif
+#endif
+
 #ifdef __KERNEL__
 /**
  * scif_pin_pages - Pin a set of pages
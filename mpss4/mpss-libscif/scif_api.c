@@ -15,10 +15,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <limits.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#ifndef _WIN32
+#include <sys/epoll.h>
+#endif
 #endif
 
 #include "stdio.h"
@@ -554,6 +558,240 @@ scif_get_fd(scif_epd_t epd)
 only_version(scif_get_fd, 0, 0)
 #endif
 
+MICACCESSAPI int
+scif_setsockopt(scif_epd_t epd, int name, uint64_t value)
+{
+	struct scifioctl_opt opt = {.name = name, .value = value};
+
+	if (ioctl(epd, SCIF_SETOPT, &opt) < 0)
+		return -1;
+
+	return 0;
+}
+only_version(scif_setsockopt, 0, 1)
+
+MICACCESSAPI int
+scif_getsockopt(scif_epd_t epd, int name, uint64_t *value)
+{
+	struct scifioctl_opt opt = {.name = name};
+
+	if (!value) {
+		errno = EFAULT;
+		return -1;
+	}
+
+	if (ioctl(epd, SCIF_GETOPT, &opt) < 0)
+		return -1;
+
+	*value = opt.value;
+	return 0;
+}
+only_version(scif_getsockopt, 0, 1)
+
+#ifndef _WIN32
+/* Messages passed to the driver per SCIF_SEND_MULTI/SCIF_RECV_MULTI */
+#define SCIF_MULTI_BATCH	64
+
+static int
+scif_msg_multi(unsigned long cmd, struct scif_mmsg *msgs, unsigned int count)
+{
+	struct scifioctl_mmsg req[SCIF_MULTI_BATCH];
+	struct scifioctl_multi multi;
+	unsigned int done = 0;
+	unsigned int n, i;
+
+	if (!msgs && count) {
+		errno = EFAULT;
+		return -1;
+	}
+
+	while (done < count) {
+		n = count - done;
+		if (n > SCIF_MULTI_BATCH)
+			n = SCIF_MULTI_BATCH;
+
+		for (i = 0; i < n; i++) {
+			req[i].epd = msgs[done + i].epd;
+			req[i].flags = msgs[done + i].flags;
+			req[i].msg = (__u64)(uintptr_t)msgs[done + i].msg;
+			req[i].len = msgs[done + i].len;
+			req[i].out_len = 0;
+		}
+		multi.msgs = (__u64)(uintptr_t)req;
+		multi.count = n;
+		multi.out_count = 0;
+
+		/* Any endpoint of the batch will do to reach the driver */
+		if (ioctl(req[0].epd, cmd, &multi) < 0)
+			return done ? (int)done : -1;
+
+		for (i = 0; i < (unsigned int)multi.out_count; i++) {
+			struct scif_mmsg *m = &msgs[done + i];
+
+			if (req[i].out_len < 0) {
+				m->out_len = -1;
+				m->out_errno = -req[i].out_len;
+			} else {
+				m->out_len = req[i].out_len;
+				m->out_errno = 0;
+			}
+		}
+		done += multi.out_count;
+		if ((unsigned int)multi.out_count < n)
+			break;
+	}
+
+	return done;
+}
+
+MICACCESSAPI int
+scif_send_multi(struct scif_mmsg *msgs, unsigned int count)
+{
+	return scif_msg_multi(SCIF_SEND_MULTI, msgs, count);
+}
+only_version(scif_send_multi, 0, 1)
+
+MICACCESSAPI int
+scif_recv_multi(struct scif_mmsg *msgs, unsigned int count)
+{
+	return scif_msg_multi(SCIF_RECV_MULTI, msgs, count);
+}
+only_version(scif_recv_multi, 0, 1)
+
+MICACCESSAPI int
+scif_rma_post(scif_epd_t epd, struct scif_rma_op *ops, unsigned int count)
+{
+	struct scifioctl_rma_op req[SCIF_MULTI_BATCH];
+	struct scifioctl_rma_post post;
+	unsigned int done = 0;
+	unsigned int n, i;
+
+	if (!ops && count) {
+		errno = EFAULT;
+		return -1;
+	}
+
+	while (done < count) {
+		n = count - done;
+		if (n > SCIF_MULTI_BATCH)
+			n = SCIF_MULTI_BATCH;
+
+		for (i = 0; i < n; i++) {
+			struct scif_rma_op *op = &ops[done + i];
+
+			req[i].loffset = op->loffset;
+			req[i].len = op->len;
+			req[i].roffset = op->roffset;
+			req[i].addr = (__u64)(uintptr_t)op->addr;
+			req[i].cookie = op->cookie;
+			req[i].op = op->op;
+			req[i].flags = op->flags;
+		}
+		post.ops = (__u64)(uintptr_t)req;
+		post.count = n;
+		post.out_count = 0;
+
+		if (ioctl(epd, SCIF_RMA_POST, &post) < 0)
+			return done ? (int)done : -1;
+
+		done += post.out_count;
+		if ((unsigned int)post.out_count < n)
+			break;
+	}
+
+	return done;
+}
+only_version(scif_rma_post, 0, 1)
+
+MICACCESSAPI int
+scif_cq_reap(scif_epd_t epd, struct scif_cqe *cqes, unsigned int count,
+	     long timeout_msecs)
+{
+	struct scifioctl_cq_reap reap;
+	int i;
+
+	/* struct scif_cqe is laid out as struct scifioctl_cqe */
+	if (count > SCIF_MAX_MULTI)
+		count = SCIF_MAX_MULTI;
+	if (timeout_msecs > INT_MAX)
+		timeout_msecs = INT_MAX;
+	if (timeout_msecs < 0)
+		timeout_msecs = -1;
+
+	reap.cqes = (__u64)(uintptr_t)cqes;
+	reap.count = count;
+	reap.timeout = timeout_msecs;
+	reap.out_count = 0;
+	reap.reserved = 0;
+
+	if (ioctl(epd, SCIF_CQ_REAP, &reap) < 0)
+		return -1;
+
+	for (i = 0; i < reap.out_count; i++)
+		cqes[i].status = -cqes[i].status;
+
+	return reap.out_count;
+}
+only_version(scif_cq_reap, 0, 1)
+
+/*
+ * Poll sets are epoll instances: endpoint descriptors are file descriptors
+ * and SCIF_POLLSET_* and SCIF_POLLONESHOT have the values of their epoll
+ * counterparts.
+ */
+MICACCESSAPI scif_pollset_t
+scif_pollset_create(void)
+{
+	return epoll_create1(EPOLL_CLOEXEC);
+}
+only_version(scif_pollset_create, 0, 2)
+
+MICACCESSAPI int
+scif_pollset_ctl(scif_pollset_t ps, int op, scif_epd_t epd,
+		 struct scif_pollevent *event)
+{
+	struct epoll_event ev = { 0 };
+
+	if (event) {
+		ev.events = event->events;
+		ev.data.u64 = event->data;
+	}
+	return epoll_ctl(ps, op, epd, &ev);
+}
+only_version(scif_pollset_ctl, 0, 2)
+
+MICACCESSAPI int
+scif_pollset_wait(scif_pollset_t ps, struct scif_pollevent *events,
+		  int maxevents, long timeout)
+{
+	struct epoll_event ev[SCIF_MULTI_BATCH];
+	int n, i;
+
+	/* struct epoll_event is packed on x86_64, so it is copied over */
+	if (maxevents > SCIF_MULTI_BATCH)
+		maxevents = SCIF_MULTI_BATCH;
+	if (timeout > INT_MAX)
+		timeout = INT_MAX;
+	if (timeout < 0)
+		timeout = -1;
+
+	n = epoll_wait(ps, ev, maxevents, timeout);
+	for (i = 0; i < n; i++) {
+		events[i].events = ev[i].events;
+		events[i].data = ev[i].data.u64;
+	}
+	return n;
+}
+only_version(scif_pollset_wait, 0, 2)
+
+MICACCESSAPI int
+scif_pollset_close(scif_pollset_t ps)
+{
+	return close(ps);
+}
+only_version(scif_pollset_close, 0, 2)
+#endif
+
 MICACCESSAPI int
 scif_poll(struct scif_pollepd *ufds, unsigned int nfds, long timeout_msecs)
 {
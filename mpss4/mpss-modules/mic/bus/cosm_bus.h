@@ -18,6 +18,9 @@
 
 #include <linux/version.h>
 #include <linux/completion.h>
+#include <linux/ktime.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
 #include "../scif/scif.h"
 #include "../common/mic_common.h"
 #include "../common/mic_dev.h"
@@ -46,6 +49,44 @@ struct cosm_device_config {
 	unsigned int shutdown_timeout;
 };
 
+#define COSM_TRACE_LEN		64
+#define COSM_STATE_HIST_BUCKETS	20
+
+/**
+ * struct cosm_transition - A state transition of a MIC device.
+ *
+ * @time: Time of the transition.
+ * @duration_ms: Time spent in the @from state.
+ * @from: The state left.
+ * @to: The state entered.
+ * @command: The command being processed.
+ * @msg: Message associated with the @to state.
+ */
+struct cosm_transition {
+	ktime_t time;
+	u32 duration_ms;
+	u8 from;
+	u8 to;
+	u8 command;
+	const char *msg;
+};
+
+/**
+ * struct cosm_state_time - Time spent in a state across transitions.
+ *
+ * @count: Number of times the state was left.
+ * @total_ms: Total time spent in the state.
+ * @max_ms: Longest time spent in the state.
+ * @hist: Number of stays of less than 1 ms in hist[0] and of 2^(i-1) to
+ *        2^i ms in hist[i], the last bucket also counts the longer ones.
+ */
+struct cosm_state_time {
+	unsigned long count;
+	u64 total_ms;
+	u32 max_ms;
+	unsigned long hist[COSM_STATE_HIST_BUCKETS];
+};
+
 /**
  * struct cosm_device - Representation of a COSM device.
  *
@@ -64,9 +105,17 @@ struct cosm_device_config {
  *                                   the MIC device has been received.
  * @current_command.abort: Inform whether abort the current processing command.
  * @state_changed: Completion used to notify about the MIC state change.
+ * @event_wq: Wakes up the command processing on events from the card.
+ * @events: Number of events from the card, checked by @event_wq waiters.
  * @state: The current state of the MIC device.
  * @previous_state: The previous state of the MIC device.
  * @state_msg: Message associated with the current MIC state.
+ * @state_since: Time the current state was entered.
+ * @trace_lock: Lock protecting the below transition trace and state times.
+ * @trace: Ring of the last COSM_TRACE_LEN state transitions.
+ * @trace_count: Number of state transitions recorded in @trace.
+ * @state_time: Time spent per state since the COSM device was created.
+ * @dbg_dir: Debugfs directory of the COSM device.
  * @state_flow_work: Work for processing requested command.
  * @scif_work: Work for handling per device SCIF connections.
  * @epd_mutex: Mutex for synchronizing access to the below endpoint.
@@ -107,11 +156,20 @@ struct cosm_device {
 	} current_command;
 
 	struct completion state_changed;
+	wait_queue_head_t event_wq;
+	atomic_t events;
 
 	u8 state;
 	u8 previous_state;
 	const char *state_msg;
 
+	ktime_t state_since;
+	spinlock_t trace_lock;
+	struct cosm_transition trace[COSM_TRACE_LEN];
+	unsigned long trace_count;
+	struct cosm_state_time state_time[MIC_STATE_LAST + 1];
+	struct dentry *dbg_dir;
+
 	struct work_struct state_flow_work;
 	struct work_struct scif_work;
 
@@ -0,0 +1,215 @@
+/*
+ * Intel MIC Platform Software Stack (MPSS)
+ * Copyright (c) 2016, Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * Intel MIC Coprocessor State Management (COSM) Driver.
+ */
+
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include "cosm_main.h"
+
+/* Debugfs parent dir */
+static struct dentry *cosm_dbg;
+
+static const char *cosm_command_string(u8 command)
+{
+	return command <= MIC_CMD_LAST ? cosm_commands[command].string : "?";
+}
+
+/*
+ * The last COSM_TRACE_LEN state transitions, oldest first, with the
+ * monotonic time in us and the time spent in the state left.
+ */
+static int cosm_transitions_show(struct seq_file *s, void *unused)
+{
+	struct cosm_device *cdev = s->private;
+	struct cosm_transition *trace, *t;
+	unsigned long count, i;
+
+	trace = kmalloc_array(COSM_TRACE_LEN, sizeof(*trace), GFP_KERNEL);
+	if (!trace)
+		return -ENOMEM;
+
+	spin_lock(&cdev->trace_lock);
+	memcpy(trace, cdev->trace, sizeof(cdev->trace));
+	count = cdev->trace_count;
+	spin_unlock(&cdev->trace_lock);
+
+	seq_printf(s, "%-14s %-18s %-18s %-18s %10s  %s\n", "time_us",
+		   "command", "from", "to", "in from ms", "message");
+	for (i = count > COSM_TRACE_LEN ? count - COSM_TRACE_LEN : 0;
+	     i < count; i++) {
+		t = &trace[i % COSM_TRACE_LEN];
+		seq_printf(s, "%14lld %-18s %-18s %-18s %10u  %s\n",
+			   ktime_to_us(t->time), cosm_command_string(t->command),
+			   cosm_states[t->from].string,
+			   cosm_states[t->to].string, t->duration_ms,
+			   t->msg ? t->msg : "");
+	}
+	kfree(trace);
+	return 0;
+}
+
+static int cosm_transitions_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, cosm_transitions_show, inode->i_private);
+}
+
+static const struct file_operations cosm_transitions_ops = {
+	.owner   = THIS_MODULE,
+	.open    = cosm_transitions_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = single_release
+};
+
+/* Time spent per state, with a log2 histogram of the stays in ms */
+static int cosm_state_time_show(struct seq_file *s, void *unused)
+{
+	struct cosm_device *cdev = s->private;
+	struct cosm_state_time *st, *times;
+	int state, i;
+
+	times = kmalloc_array(MIC_STATE_LAST + 1, sizeof(*times), GFP_KERNEL);
+	if (!times)
+		return -ENOMEM;
+
+	spin_lock(&cdev->trace_lock);
+	memcpy(times, cdev->state_time, sizeof(cdev->state_time));
+	spin_unlock(&cdev->trace_lock);
+
+	for (state = 0; state <= MIC_STATE_LAST; state++) {
+		st = &times[state];
+		if (!st->count)
+			continue;
+		seq_printf(s, "%s: count %lu total_ms %llu avg_ms %llu max_ms %u\n",
+			   cosm_states[state].string, st->count, st->total_ms,
+			   div64_u64(st->total_ms, st->count), st->max_ms);
+		for (i = 0; i < COSM_STATE_HIST_BUCKETS; i++) {
+			if (!st->hist[i])
+				continue;
+			if (!i)
+				seq_puts(s, "\t    < 1 ms");
+			else if (i == COSM_STATE_HIST_BUCKETS - 1)
+				seq_printf(s, "\t>= %lu ms", 1UL << (i - 1));
+			else
+				seq_printf(s, "\t< %lu ms", 1UL << i);
+			seq_printf(s, ": %lu\n", st->hist[i]);
+		}
+	}
+	kfree(times);
+	return 0;
+}
+
+static int cosm_state_time_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, cosm_state_time_show, inode->i_private);
+}
+
+static const struct file_operations cosm_state_time_ops = {
+	.owner   = THIS_MODULE,
+	.open    = cosm_state_time_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = single_release
+};
+
+/* Run a mock device through the whole life cycle of a card */
+static int cosm_state_test_show(struct seq_file *s, void *unused)
+{
+	int rc = cosm_mock_cycle(s);
+
+	seq_printf(s, "%s (rc %d)\n", rc ? "failed" : "passed", rc);
+	return 0;
+}
+
+static int cosm_state_test_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, cosm_state_test_show, inode->i_private);
+}
+
+static const struct file_operations cosm_state_test_ops = {
+	.owner   = THIS_MODULE,
+	.open    = cosm_state_test_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = single_release
+};
+
+/* Wall clock time of booting mock cards with and without start limits */
+static int cosm_boot_bench_show(struct seq_file *s, void *unused)
+{
+	int rc = cosm_mock_boot_bench(s);
+
+	if (rc)
+		seq_printf(s, "failed (rc %d)\n", rc);
+	return 0;
+}
+
+static int cosm_boot_bench_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, cosm_boot_bench_show, inode->i_private);
+}
+
+static const struct file_operations cosm_boot_bench_ops = {
+	.owner   = THIS_MODULE,
+	.open    = cosm_boot_bench_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = single_release
+};
+
+void cosm_create_debug_dir(struct cosm_device *cdev)
+{
+	char name[16];
+
+	if (!cosm_dbg)
+		return;
+
+	snprintf(name, sizeof(name), "mic%d", cdev->index);
+	cdev->dbg_dir = debugfs_create_dir(name, cosm_dbg);
+	if (!cdev->dbg_dir)
+		return;
+
+	debugfs_create_file("transitions", 0444, cdev->dbg_dir, cdev,
+			    &cosm_transitions_ops);
+	debugfs_create_file("state_time", 0444, cdev->dbg_dir, cdev,
+			    &cosm_state_time_ops);
+}
+
+void cosm_delete_debug_dir(struct cosm_device *cdev)
+{
+	debugfs_remove_recursive(cdev->dbg_dir);
+	cdev->dbg_dir = NULL;
+}
+
+void cosm_init_debugfs(void)
+{
+	cosm_dbg = debugfs_create_dir(KBUILD_MODNAME, NULL);
+	if (!cosm_dbg) {
+		pr_err("can't create debugfs dir %s", KBUILD_MODNAME);
+		return;
+	}
+
+	debugfs_create_file("state_test", 0400, cosm_dbg, NULL,
+			    &cosm_state_test_ops);
+	debugfs_create_file("boot_bench", 0400, cosm_dbg, NULL,
+			    &cosm_boot_bench_ops);
+}
+
+void cosm_exit_debugfs(void)
+{
+	debugfs_remove_recursive(cosm_dbg);
+	cosm_dbg = NULL;
+}
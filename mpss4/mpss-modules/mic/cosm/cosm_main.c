@@ -39,6 +39,22 @@ const unsigned int cosm_max_state_timeout = 3 * 60;
 /* Maximal timeout for command start completion in seconds */
 const unsigned int cosm_command_start_timeout = 30;
 
+/*
+ * Booting a card copies its images over PCIe, so booting all the cards of
+ * a host at once only makes them compete for the bus and the page cache.
+ * The commands with the throttle flag are started by at most
+ * max_parallel_start cards at a time, the others wait for a free slot.
+ * The cards then wait for their boot to complete in parallel.
+ */
+unsigned int max_parallel_start = 4;
+module_param(max_parallel_start, uint, 0644);
+MODULE_PARM_DESC(max_parallel_start,
+		 "Cards loading boot images at the same time, 0 for no limit");
+
+static DEFINE_SPINLOCK(cosm_start_lock);
+static DECLARE_WAIT_QUEUE_HEAD(cosm_start_wq);
+static unsigned int cosm_starting;
+
 
 struct cosm_state cosm_states[] = {
 	[MIC_STATE_READY] = {
@@ -107,6 +123,52 @@ is_command_allowed(u8 state, u8 command)
 }
 
 
+static bool
+cosm_start_slot_get(void)
+{
+	bool ok;
+
+	spin_lock(&cosm_start_lock);
+	ok = !max_parallel_start || cosm_starting < max_parallel_start;
+	if (ok)
+		cosm_starting++;
+	spin_unlock(&cosm_start_lock);
+	return ok;
+}
+
+static void
+cosm_start_slot_put(void)
+{
+	spin_lock(&cosm_start_lock);
+	cosm_starting--;
+	spin_unlock(&cosm_start_lock);
+	wake_up(&cosm_start_wq);
+}
+
+/*
+ * Start a command, throttled ones only once a start slot is free. Returns
+ * -ECANCELED without starting if the command is aborted meanwhile.
+ */
+static int
+cosm_invoke(struct cosm_device *cdev, struct cosm_command *command,
+	    const char **state_msg)
+{
+	bool slot = false;
+	int rc;
+
+	if (!command->throttle)
+		return command->invoke(cdev, state_msg);
+
+	wait_event(cosm_start_wq, (slot = cosm_start_slot_get()) ||
+		   cdev->current_command.abort);
+	if (!slot)
+		return -ECANCELED;
+	rc = command->invoke(cdev, state_msg);
+	cosm_start_slot_put();
+	return rc;
+}
+
+
 /******************************************************************************
  * The STOP command
  ******************************************************************************/
@@ -409,7 +471,8 @@ struct cosm_command cosm_commands[] = {
 		.complete = cosm_boot_firmware_complete,
 		.get_timeout = cosm_boot_firmware_timeout,
 		.temporal_state = MIC_STATE_BOOTING_FIRMWARE,
-		.target_state = MIC_STATE_ONLINE_FIRMWARE
+		.target_state = MIC_STATE_ONLINE_FIRMWARE,
+		.throttle = true
 	},
 	[MIC_CMD_BOOT] = {
 		.string = "boot",
@@ -417,7 +480,8 @@ struct cosm_command cosm_commands[] = {
 		.complete = cosm_boot_complete,
 		.get_timeout = cosm_boot_timeout,
 		.temporal_state = MIC_STATE_BOOTING,
-		.target_state = MIC_STATE_ONLINE
+		.target_state = MIC_STATE_ONLINE,
+		.throttle = true
 	},
 	[MIC_CMD_RESET] = {
 		.string = "reset",
@@ -516,6 +580,34 @@ cosm_update_module_lock(struct cosm_device *cdev, u8 state)
 	}
 }
 
+/* Record a transition in the trace and the time spent in the state left */
+static void
+cosm_trace_transition(struct cosm_device *cdev, u8 from, u8 to,
+		      const char *state_msg)
+{
+	struct cosm_state_time *st = &cdev->state_time[from];
+	struct cosm_transition *t;
+	ktime_t now = ktime_get();
+	u64 ms = ktime_to_ms(ktime_sub(now, cdev->state_since));
+	int bucket = ms ? min(fls64(ms), COSM_STATE_HIST_BUCKETS - 1) : 0;
+
+	spin_lock(&cdev->trace_lock);
+	t = &cdev->trace[cdev->trace_count++ % COSM_TRACE_LEN];
+	t->time = now;
+	t->duration_ms = min_t(u64, ms, U32_MAX);
+	t->from = from;
+	t->to = to;
+	t->command = cdev->current_command.id;
+	t->msg = state_msg;
+
+	st->count++;
+	st->total_ms += ms;
+	st->max_ms = max_t(u32, st->max_ms, t->duration_ms);
+	st->hist[bucket]++;
+	cdev->state_since = now;
+	spin_unlock(&cdev->trace_lock);
+}
+
 static void
 cosm_switch_to_state(struct cosm_device *cdev, u8 state, const char *state_msg)
 {
@@ -526,6 +618,8 @@ cosm_switch_to_state(struct cosm_device *cdev, u8 state, const char *state_msg)
 		return;
 	}
 
+	cosm_trace_transition(cdev, current_state, state, state_msg);
+
 	if (current_state == MIC_STATE_READY || state == MIC_STATE_ERROR)
 		cdev->config.execute_on_ready = MIC_CMD_NONE;
 
@@ -540,7 +634,23 @@ cosm_switch_to_state(struct cosm_device *cdev, u8 state, const char *state_msg)
 	cdev->state_msg = state_msg;
 
 	complete(&cdev->state_changed);
-	sysfs_notify_dirent(cdev->sysfs_node);
+	if (cdev->sysfs_node)
+		sysfs_notify_dirent(cdev->sysfs_node);
+}
+
+/**
+ * cosm_event - Wake up the processing of the current command.
+ *
+ * @cdev: COSM device.
+ *
+ * Called when something the command waits for, other than a change of
+ * the hardware state, has happened. The hardware state is polled every
+ * cosm_timeout_interval ms.
+ */
+void cosm_event(struct cosm_device *cdev)
+{
+	atomic_inc(&cdev->events);
+	wake_up(&cdev->event_wq);
 }
 
 static bool is_command_already_executed(struct cosm_device *cdev, struct cosm_command *cmd)
@@ -565,6 +675,9 @@ int cosm_set_command(struct cosm_device *cdev, u8 command)
 
 	if (cmd->flags & MIC_CMD_FLAG_ABORT_CURRENT) {
 		cdev->current_command.abort = true;
+		cosm_event(cdev);
+		/* The command may still be waiting for a start slot */
+		wake_up(&cosm_start_wq);
 		goto exec_command;
 	}
 	if (is_command_already_executed(cdev, cmd)) {
@@ -648,6 +761,7 @@ static void cosm_state_flow(struct work_struct *work)
 	const char *state_msg = NULL;
 	u8 command_id;
 	u8 state = MIC_STATE_UNKNOWN;
+	int events;
 
 	struct cosm_device *cdev = container_of(work, struct cosm_device,
 			state_flow_work);
@@ -673,7 +787,12 @@ static void cosm_state_flow(struct work_struct *work)
 		cosm_switch_to_state(cdev, command->temporal_state, NULL);
 
 	if (command->invoke) {
-		command_rc = command->invoke(cdev, &state_msg);
+		command_rc = cosm_invoke(cdev, command, &state_msg);
+		if (command_rc == -ECANCELED) {
+			/* exit without setting error state */
+			log_mic_info(cdev->index, "aborting current command");
+			return;
+		}
 		if (command_rc) {
 			state = MIC_STATE_ERROR;
 			goto command_exit;
@@ -681,6 +800,7 @@ static void cosm_state_flow(struct work_struct *work)
 	}
 
 	while (true) {
+		events = atomic_read(&cdev->events);
 		command_rc = command->complete(cdev,
 				jiffies_to_msecs(jiffies - start_time) / 1000,
 				&state_msg);
@@ -709,8 +829,10 @@ static void cosm_state_flow(struct work_struct *work)
 		}
 
 		if (command_rc == -EAGAIN) {
-			msleep(cosm_timeout_interval);
-			// TODO: use wait_event_timeout to make command processing faster
+			wait_event_timeout(cdev->event_wq,
+				atomic_read(&cdev->events) != events ||
+				cdev->current_command.abort,
+				msecs_to_jiffies(cosm_timeout_interval));
 			continue;
 		}
 
@@ -728,6 +850,40 @@ command_exit:
 }
 
 
+/**
+ * cosm_state_flow_init - Initialize the command processing of a device.
+ *
+ * @cdev: COSM device, in the MIC_STATE_UNKNOWN state afterwards.
+ */
+void cosm_state_flow_init(struct cosm_device *cdev)
+{
+	mutex_init(&cdev->config_mutex);
+	mutex_init(&cdev->command_mutex);
+	mutex_init(&cdev->epd_mutex);
+	init_waitqueue_head(&cdev->event_wq);
+	atomic_set(&cdev->events, 0);
+	spin_lock_init(&cdev->trace_lock);
+
+	INIT_WORK(&cdev->state_flow_work, cosm_state_flow);
+
+	cdev->is_module_locked = false;
+	cdev->state = MIC_STATE_UNKNOWN;
+	cdev->previous_state = MIC_STATE_UNKNOWN;
+	cdev->state_since = ktime_get();
+}
+
+/**
+ * cosm_state_flow_uninit - Stop the command processing of a device.
+ *
+ * @cdev: COSM device.
+ */
+void cosm_state_flow_uninit(struct cosm_device *cdev)
+{
+	log_mic_info(cdev->index, "cancel state_flow_work");
+	cancel_work_sync(&cdev->state_flow_work);
+	cosm_unlock_module(cdev);
+}
+
 static int cosm_driver_probe(struct cosm_device *cdev)
 {
 	int rc;
@@ -738,12 +894,9 @@ static int cosm_driver_probe(struct cosm_device *cdev)
 		if (rc)
 			goto scif_exit;
 	}
-	mutex_init(&cdev->config_mutex);
-	mutex_init(&cdev->command_mutex);
-	mutex_init(&cdev->epd_mutex);
+	cosm_state_flow_init(cdev);
 
 	INIT_WORK(&cdev->scif_work, cosm_scif_work);
-	INIT_WORK(&cdev->state_flow_work, cosm_state_flow);
 	cosm_sysfs_init(cdev);
 	cdev->sysfs_dev = device_create_with_groups(g_cosm_class,
 				cdev->dev.parent,
@@ -775,14 +928,12 @@ static int cosm_driver_probe(struct cosm_device *cdev)
 		goto hw_ops_exit;
 	}
 
-	cdev->is_module_locked = false;
 	cosm_lock_module(cdev);
 
 	cdev->config.boot_timeout = COSM_MIN_BOOT_TIMEOUT;
 	cdev->config.shutdown_timeout = COSM_MIN_SHUTDOWN_TIMEOUT;
 
-	cdev->state = MIC_STATE_UNKNOWN;
-	cdev->previous_state = MIC_STATE_UNKNOWN;
+	cosm_create_debug_dir(cdev);
 	cosm_set_command(cdev, MIC_CMD_RESET);
 
 	return 0;
@@ -798,6 +949,7 @@ scif_exit:
 
 static void cosm_driver_remove(struct cosm_device *cdev)
 {
+	cosm_delete_debug_dir(cdev);
 	cdev->hw_ops->dev_uninit(cdev);
 	sysfs_put(cdev->sysfs_node);
 	device_destroy(g_cosm_class, MKDEV(0, cdev->index));
@@ -852,6 +1004,8 @@ static int __init cosm_init(void)
 		goto exit;
 	}
 
+	cosm_init_debugfs();
+
 	ret = cosm_register_driver(&cosm_driver);
 	if (ret) {
 		pr_err("cosm server cosm_register_driver error %d", ret);
@@ -860,6 +1014,7 @@ static int __init cosm_init(void)
 	return 0;
 
 ida_destroy:
+	cosm_exit_debugfs();
 	class_destroy(g_cosm_class);
 exit:
 	return ret;
@@ -868,6 +1023,7 @@ exit:
 static void __exit cosm_exit(void)
 {
 	cosm_unregister_driver(&cosm_driver);
+	cosm_exit_debugfs();
 	class_destroy(g_cosm_class);
 }
 
@@ -24,6 +24,8 @@
 #endif
 #include "../bus/cosm_bus.h"
 
+struct seq_file;
+
 #define COSM_MIN_BOOT_TIMEOUT		90
 #define COSM_MIN_SHUTDOWN_TIMEOUT	60
 
@@ -45,13 +47,18 @@ struct cosm_command {
 	u8 temporal_state;
 	u8 target_state;
 	u8 flags;
+	bool throttle;
 };
 
 extern struct cosm_command cosm_commands[];
+extern unsigned int max_parallel_start;
 
 const char* cosm_msg_to_string(u8 msg);
 
 int cosm_set_command(struct cosm_device *cdev, u8 command);
+void cosm_event(struct cosm_device *cdev);
+void cosm_state_flow_init(struct cosm_device *cdev);
+void cosm_state_flow_uninit(struct cosm_device *cdev);
 int cosm_get_command_id(struct cosm_device *cdev, const char* string, u8 *command);
 
 #define COSM_HEARTBEAT_SEND_SEC 30
@@ -92,6 +99,8 @@ void cosm_init_debugfs(void);
 void cosm_exit_debugfs(void);
 void cosm_create_debug_dir(struct cosm_device *cdev);
 void cosm_delete_debug_dir(struct cosm_device *cdev);
+int cosm_mock_cycle(struct seq_file *s);
+int cosm_mock_boot_bench(struct seq_file *s);
 int cosm_scif_init(void);
 void cosm_scif_exit(void);
 void cosm_scif_work(struct work_struct *work);
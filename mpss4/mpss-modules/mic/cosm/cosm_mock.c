@@ -0,0 +1,348 @@
+/*
+ * Intel MIC Platform Software Stack (MPSS)
+ * Copyright (c) 2016, Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * Intel MIC Coprocessor State Management (COSM) Driver.
+ */
+
+#include <linux/completion.h>
+#include <linux/delay.h>
+#include <linux/mutex.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+#include "cosm_main.h"
+
+/*
+ * A mock COSM device for testing the state machine without a card. It is
+ * never registered on the COSM bus: the hw_ops only track the state the
+ * card would be in. Booting loads the boot image, if the mock has one,
+ * and the online message of the card is sent boot_ms later by a delayed
+ * work, through the same cosm_event(..) the SCIF server uses.
+ */
+#define COSM_MOCK_BOOT_MS	20
+#define COSM_MOCK_TIMEOUT	5
+
+#define COSM_BENCH_CARDS	8
+#define COSM_BENCH_READ_MS	300
+#define COSM_BENCH_COPY_MS	100
+#define COSM_BENCH_BOOT_MS	500
+
+/*
+ * A boot image as the card driver loads it: reading the file takes
+ * COSM_BENCH_READ_MS and reads queue up on the one disk, copying it to a
+ * card takes COSM_BENCH_COPY_MS and runs in parallel. A shared image is
+ * read by the first card and the others wait for it, like mic_fw_get();
+ * otherwise each card reads its own copy.
+ */
+struct cosm_mock_image {
+	bool shared;
+	bool read;
+	struct mutex lock;
+	struct mutex disk;
+	struct completion loaded;
+};
+
+struct cosm_mock {
+	struct cosm_device cdev;
+	int state;
+	unsigned int boot_ms;
+	struct cosm_mock_image *image;
+	struct delayed_work online_work;
+};
+
+static struct cosm_mock *to_mock(struct cosm_device *cdev)
+{
+	return container_of(cdev, struct cosm_mock, cdev);
+}
+
+static void cosm_mock_online(struct work_struct *work)
+{
+	struct cosm_mock *m = container_of(to_delayed_work(work),
+					   struct cosm_mock, online_work);
+
+	m->state = MIC_STATE_ONLINE;
+	m->cdev.current_command.received_online = true;
+	cosm_event(&m->cdev);
+}
+
+static int cosm_mock_boot_firmware(struct cosm_device *cdev)
+{
+	to_mock(cdev)->state = MIC_STATE_ONLINE_FIRMWARE;
+	return 0;
+}
+
+static void cosm_mock_load(struct cosm_mock_image *img)
+{
+	bool first = true;
+
+	if (img->shared) {
+		mutex_lock(&img->lock);
+		first = !img->read;
+		img->read = true;
+		mutex_unlock(&img->lock);
+	}
+
+	if (first) {
+		mutex_lock(&img->disk);
+		msleep(COSM_BENCH_READ_MS);
+		mutex_unlock(&img->disk);
+		complete_all(&img->loaded);
+	} else {
+		wait_for_completion(&img->loaded);
+	}
+	msleep(COSM_BENCH_COPY_MS);
+}
+
+static int cosm_mock_boot(struct cosm_device *cdev)
+{
+	struct cosm_mock *m = to_mock(cdev);
+
+	m->state = MIC_STATE_BOOTING;
+	if (m->image)
+		cosm_mock_load(m->image);
+	schedule_delayed_work(&m->online_work, msecs_to_jiffies(m->boot_ms));
+	return 0;
+}
+
+static int cosm_mock_reset(struct cosm_device *cdev)
+{
+	to_mock(cdev)->state = MIC_STATE_READY;
+	return 0;
+}
+
+static int cosm_mock_shutdown(struct cosm_device *cdev)
+{
+	to_mock(cdev)->state = MIC_STATE_SHUTDOWN;
+	return 0;
+}
+
+static int cosm_mock_detect_state(struct cosm_device *cdev)
+{
+	return to_mock(cdev)->state;
+}
+
+static void cosm_mock_cleanup(struct cosm_device *cdev)
+{
+	cancel_delayed_work_sync(&to_mock(cdev)->online_work);
+}
+
+static int cosm_mock_dev_update(struct cosm_device *cdev)
+{
+	return 0;
+}
+
+static u64 cosm_mock_max_supported_address(struct cosm_device *cdev)
+{
+	return U64_MAX;
+}
+
+static struct cosm_hw_ops cosm_mock_ops = {
+	.boot_firmware = cosm_mock_boot_firmware,
+	.boot = cosm_mock_boot,
+	.reset = cosm_mock_reset,
+	.reset_warm = cosm_mock_reset,
+	.shutdown = cosm_mock_shutdown,
+	.reset_timeout = COSM_MOCK_TIMEOUT,
+	.boot_firmware_timeout = COSM_MOCK_TIMEOUT,
+	.detect_state = cosm_mock_detect_state,
+	.cleanup = cosm_mock_cleanup,
+	.dev_update = cosm_mock_dev_update,
+	.max_supported_address = cosm_mock_max_supported_address,
+};
+
+/* Every state a card goes through, from probe to shutdown and back */
+static const struct {
+	u8 command;
+	u8 state;
+} cosm_mock_steps[] = {
+	{ MIC_CMD_RESET,		MIC_STATE_READY },
+	{ MIC_CMD_BOOT,			MIC_STATE_ONLINE },
+	{ MIC_CMD_RESET,		MIC_STATE_READY },
+	{ MIC_CMD_BOOT_FIRMWARE,	MIC_STATE_ONLINE_FIRMWARE },
+	{ MIC_CMD_RESET,		MIC_STATE_READY },
+	{ MIC_CMD_SHUTDOWN,		MIC_STATE_SHUTDOWN },
+	{ MIC_CMD_RESET,		MIC_STATE_READY },
+};
+
+static struct cosm_mock *cosm_mock_create(int index, unsigned int boot_ms)
+{
+	struct cosm_mock *m;
+	struct cosm_device *cdev;
+
+	m = kzalloc(sizeof(*m), GFP_KERNEL);
+	if (!m)
+		return NULL;
+
+	m->state = MIC_STATE_UNKNOWN;
+	m->boot_ms = boot_ms;
+	INIT_DELAYED_WORK(&m->online_work, cosm_mock_online);
+	cdev = &m->cdev;
+	cdev->index = index;
+	cdev->hw_ops = &cosm_mock_ops;
+	cdev->config.boot_timeout = COSM_MOCK_TIMEOUT;
+	cdev->config.shutdown_timeout = COSM_MOCK_TIMEOUT;
+	cosm_state_flow_init(cdev);
+	return m;
+}
+
+static void cosm_mock_destroy(struct cosm_mock *m)
+{
+	cosm_state_flow_uninit(&m->cdev);
+	cancel_delayed_work_sync(&m->online_work);
+	kfree(m);
+}
+
+/* Run a command and wait until it is done */
+static int cosm_mock_command(struct cosm_mock *m, u8 command, u8 state)
+{
+	int rc = cosm_set_command(&m->cdev, command);
+
+	if (rc)
+		return rc;
+	flush_work(&m->cdev.state_flow_work);
+	return m->cdev.state == state ? 0 : -EIO;
+}
+
+/**
+ * cosm_mock_cycle - Run a mock device through the card life cycle.
+ *
+ * @s: seq_file the time taken by each command is printed to.
+ *
+ * Returns 0 if every command took the mock device to the expected state.
+ */
+int cosm_mock_cycle(struct seq_file *s)
+{
+	struct cosm_mock *m;
+	ktime_t start, t;
+	int i, rc = 0;
+	u8 command;
+
+	m = cosm_mock_create(-1, COSM_MOCK_BOOT_MS);
+	if (!m)
+		return -ENOMEM;
+
+	start = ktime_get();
+	for (i = 0; i < ARRAY_SIZE(cosm_mock_steps); i++) {
+		command = cosm_mock_steps[i].command;
+		t = ktime_get();
+		rc = cosm_mock_command(m, command, cosm_mock_steps[i].state);
+		seq_printf(s, "%-16s -> %-16s %8lld us\n",
+			   cosm_commands[command].string,
+			   cosm_states[m->cdev.state].string,
+			   ktime_to_us(ktime_sub(ktime_get(), t)));
+		if (rc)
+			break;
+	}
+	seq_printf(s, "%d commands in %lld us\n", i,
+		   ktime_to_us(ktime_sub(ktime_get(), start)));
+
+	cosm_mock_destroy(m);
+	return rc;
+}
+
+/*
+ * Boot all the mock cards at once, with at most @parallel_start of them
+ * loading their image at a time, 0 for no limit.
+ */
+static int cosm_mock_boot_all(struct cosm_mock **m, int n,
+			      unsigned int parallel_start, bool shared, s64 *ms)
+{
+	struct cosm_mock_image *img = m[0]->image;
+	unsigned int saved = max_parallel_start;
+	ktime_t start;
+	int i, rc = 0;
+
+	img->shared = shared;
+	img->read = false;
+	reinit_completion(&img->loaded);
+
+	/* Real cards booting meanwhile see the same limit */
+	max_parallel_start = parallel_start;
+	start = ktime_get();
+	for (i = 0; i < n && !rc; i++)
+		rc = cosm_set_command(&m[i]->cdev, MIC_CMD_BOOT);
+	for (i = 0; i < n; i++) {
+		flush_work(&m[i]->cdev.state_flow_work);
+		if (!rc && m[i]->cdev.state != MIC_STATE_ONLINE)
+			rc = -EIO;
+	}
+	*ms = ktime_to_ms(ktime_sub(ktime_get(), start));
+	max_parallel_start = saved;
+
+	for (i = 0; i < n; i++) {
+		int err = cosm_mock_command(m[i], MIC_CMD_RESET,
+					    MIC_STATE_READY);
+
+		if (!rc)
+			rc = err;
+	}
+	return rc;
+}
+
+/**
+ * cosm_mock_boot_bench - Wall clock time of booting several cards.
+ *
+ * @s: seq_file the results are printed to.
+ *
+ * Boots COSM_BENCH_CARDS mock cards at once, without a limit on parallel
+ * starts and with max_parallel_start, each time with a shared boot image
+ * and with one image read per card.
+ */
+int cosm_mock_boot_bench(struct seq_file *s)
+{
+	struct cosm_mock *m[COSM_BENCH_CARDS] = { NULL };
+	struct cosm_mock_image *img;
+	unsigned int limit = max_parallel_start;
+	s64 ms[2][2];
+	int i, j, rc = -ENOMEM;
+
+	img = kzalloc(sizeof(*img), GFP_KERNEL);
+	if (!img)
+		return -ENOMEM;
+	mutex_init(&img->lock);
+	mutex_init(&img->disk);
+	init_completion(&img->loaded);
+
+	for (i = 0; i < COSM_BENCH_CARDS; i++) {
+		m[i] = cosm_mock_create(-1 - i, COSM_BENCH_BOOT_MS);
+		if (!m[i])
+			goto destroy;
+		m[i]->image = img;
+		rc = cosm_mock_command(m[i], MIC_CMD_RESET, MIC_STATE_READY);
+		if (rc)
+			goto destroy;
+	}
+
+	for (i = 0; i < 2; i++) {
+		for (j = 0; j < 2; j++) {
+			rc = cosm_mock_boot_all(m, COSM_BENCH_CARDS,
+						i ? limit : 0, j, &ms[i][j]);
+			if (rc)
+				goto destroy;
+		}
+	}
+
+	seq_printf(s, "%d cards, %d ms image read, %d ms copy, %d ms boot\n",
+		   COSM_BENCH_CARDS, COSM_BENCH_READ_MS, COSM_BENCH_COPY_MS,
+		   COSM_BENCH_BOOT_MS);
+	seq_printf(s, "%-24s %8s %8s\n", "", "per-card", "shared");
+	seq_printf(s, "%-24s %5lld ms %5lld ms\n", "unlimited starts",
+		   ms[0][0], ms[0][1]);
+	seq_printf(s, "max_parallel_start %-5u %5lld ms %5lld ms\n", limit,
+		   ms[1][0], ms[1][1]);
+destroy:
+	for (i = 0; i < COSM_BENCH_CARDS && m[i]; i++)
+		cosm_mock_destroy(m[i]);
+	kfree(img);
+	return rc;
+}
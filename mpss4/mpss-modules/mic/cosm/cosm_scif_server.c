@@ -112,6 +112,7 @@ void cosm_status_handler(struct cosm_device *cdev, u8 state)
 	switch (state) {
 	case MIC_STATE_ONLINE:
 		cdev->current_command.received_online = true;
+		cosm_event(cdev);
 		break;
 
 	case MIC_STATE_RESETTING:
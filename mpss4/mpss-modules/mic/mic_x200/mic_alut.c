@@ -15,6 +15,7 @@
  */
 #include <linux/pci.h>
 #include <linux/moduleparam.h>
+#include <linux/random.h>
 
 #include "../common/mic_dev.h"
 #include "mic_device.h"
@@ -46,6 +47,17 @@ static inline u64 mic_alut_align_high(struct mic_device *xdev, dma_addr_t pa)
 	return roundup(pa, ALUT_ENTRY_SIZE);
 }
 
+/* Point entry i at addr and move it to the matching hash chain. */
+static void mic_alut_set_entry(struct mic_device *xdev, int i, u64 addr)
+{
+	struct mic_alut *entry = &xdev->alut->entry[i];
+
+	mic_alut_set(xdev, addr, i);
+	entry->dma_addr = addr;
+	hash_del(&entry->node);
+	hash_add(xdev->alut->hash, &entry->node, addr);
+}
+
 /* Populate an ALUT entry and update the reference counts. */
 static void mic_add_alut_entry(int spt, u64 addr, int entries,
 			       struct mic_device *xdev)
@@ -55,63 +67,103 @@ static void mic_add_alut_entry(int spt, u64 addr, int entries,
 
 	for (i = spt; i < spt + entries; i++,
 		addr += ALUT_ENTRY_SIZE) {
-		if (!alut->entry[i].ref_count &&
-		    (alut->entry[i].dma_addr != addr)) {
-			mic_alut_set(xdev, addr, i);
-			alut->entry[i].dma_addr = addr;
+		if (!alut->entry[i].ref_count) {
+			if (alut->entry[i].dma_addr != addr ||
+			    hlist_unhashed(&alut->entry[i].node))
+				mic_alut_set_entry(xdev, i, addr);
+			set_bit(i, alut->busy);
 		}
 		alut->entry[i].ref_count++;
 	}
 }
 
 /*
- * Find an available MIC address in MIC ALUT address space
- * for a given DMA address and size.
+ * Find entries already pointing at dma_addr and the entries - 1 ALUT
+ * entries after it. Unused entries keep their last DMA address and stay
+ * hashed, so they are reused without reprogramming the hardware.
  */
-static dma_addr_t mic_alut_op(struct mic_device *xdev, u64 dma_addr,
-			      int entries, size_t size)
+static int mic_alut_find(struct mic_alut_info *alut, u64 dma_addr,
+			 int entries)
+{
+	struct mic_alut *entry;
+	int spt, i;
+
+	hash_for_each_possible(alut->hash, entry, node, dma_addr) {
+		if (entry->dma_addr != dma_addr)
+			continue;
+		spt = entry - alut->entry;
+		if (spt + entries > ALUT_ENTRY_COUNT)
+			continue;
+		for (i = 1; i < entries; i++)
+			if (alut->entry[spt + i].dma_addr !=
+			    dma_addr + i * ALUT_ENTRY_SIZE)
+				break;
+		if (i == entries)
+			return spt;
+	}
+	return -1;
+}
+
+/* Find entries free entries in a row, next fit from the last allocation */
+static int mic_alut_alloc(struct mic_alut_info *alut, int entries)
+{
+	unsigned long spt;
+
+	spt = bitmap_find_next_zero_area(alut->busy, ALUT_ENTRY_COUNT,
+					 alut->next_free, entries, 0);
+	if (spt >= ALUT_ENTRY_COUNT)
+		spt = bitmap_find_next_zero_area(alut->busy, ALUT_ENTRY_COUNT,
+						 0, entries, 0);
+	if (spt >= ALUT_ENTRY_COUNT)
+		return -1;
+	alut->next_free = (spt + entries) % ALUT_ENTRY_COUNT;
+	return spt;
+}
+
+static void mic_alut_hold_time(struct mic_alut_info *alut, ktime_t start)
+{
+	u64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	alut->hold_ns_total += ns;
+	if (ns > alut->hold_ns_max)
+		alut->hold_ns_max = ns;
+}
+
+/*
+ * Find available entries in MIC ALUT address space for a given DMA address
+ * and size. Returns the first entry, or -ENOSPC. Entry 0 is valid and maps
+ * MIC address 0, so the entry is returned rather than the MIC address.
+ */
+static int mic_alut_op(struct mic_device *xdev, u64 dma_addr,
+		       int entries, size_t size)
 {
 	int spt;
-	int ae = 0;
-	int i;
 	unsigned long flags;
-	dma_addr_t mic_addr = 0;
-	dma_addr_t addr = dma_addr;
 	struct mic_alut_info *alut = xdev->alut;
+	ktime_t start;
+
+	if (entries > ALUT_ENTRY_COUNT)
+		return -ENOSPC;
 
 	spin_lock_irqsave(&alut->alut_lock, flags);
+	start = ktime_get();
 
 	/* find existing entries */
-	for (i = 0; i < ALUT_ENTRY_COUNT; i++) {
-		if (alut->entry[i].dma_addr == addr) {
-			ae++;
-			addr += ALUT_ENTRY_SIZE;
-		} else if (ae) /* cannot find contiguous entries */
-			goto not_found;
-
-		if (ae == entries)
-			goto found;
-	}
-
-	/* find free entry */
-	for (ae = 0, i = 0; i < ALUT_ENTRY_COUNT; i++) {
-		ae = (alut->entry[i].ref_count == 0) ? ae + 1 : 0;
-		if (ae == entries)
-			goto found;
+	spt = mic_alut_find(alut, dma_addr, entries);
+	if (spt >= 0)
+		alut->hit_count++;
+	else
+		/* find free entries */
+		spt = mic_alut_alloc(alut, entries);
+
+	if (spt >= 0) {
+		mic_add_alut_entry(spt, dma_addr, entries, xdev);
+		alut->map_count++;
+		alut->ref_count++;
 	}
-
-not_found:
+	mic_alut_hold_time(alut, start);
 	spin_unlock_irqrestore(&alut->alut_lock, flags);
-	return mic_addr;
-
-found:
-	spt = i - entries + 1;
-	mic_addr = mic_alut_to_pa(xdev, spt);
-	mic_add_alut_entry(spt, dma_addr, entries, xdev);
-	alut->map_count++;
-	alut->ref_count++;
-	spin_unlock_irqrestore(&alut->alut_lock, flags);
-	return mic_addr;
+	return spt >= 0 ? spt : -ENOSPC;
 }
 
 /*
@@ -174,8 +226,7 @@ dma_addr_t mic_to_dma_addr(struct mic_device *xdev, dma_addr_t mic_addr)
  */
 dma_addr_t mic_map(struct mic_device *xdev, dma_addr_t dma_addr, size_t size)
 {
-	dma_addr_t mic_addr = 0;
-	int num_entries;
+	int num_entries, spt;
 	u64 alut_start;
 
 	if (!xdev->alut)
@@ -187,9 +238,11 @@ dma_addr_t mic_map(struct mic_device *xdev, dma_addr_t dma_addr, size_t size)
 	num_entries = mic_get_alut_ref_count(xdev, dma_addr, size, &alut_start);
 
 	/* Set the alut table appropriately and get an aligned address */
-	mic_addr = mic_alut_op(xdev, alut_start, num_entries, size);
+	spt = mic_alut_op(xdev, alut_start, num_entries, size);
+	if (spt < 0)
+		return 0;
 
-        return mic_addr + mic_alut_offset(xdev, dma_addr);
+	return mic_alut_to_pa(xdev, spt) + mic_alut_offset(xdev, dma_addr);
 }
 
 /**
@@ -210,6 +263,7 @@ void mic_unmap(struct mic_device *xdev, dma_addr_t mic_addr, size_t size)
 	int spt;
 	int i;
 	unsigned long flags;
+	ktime_t start;
 
 	if (!size)
 		return;
@@ -223,15 +277,19 @@ void mic_unmap(struct mic_device *xdev, dma_addr_t mic_addr, size_t size)
 	num_alut = mic_get_alut_ref_count(xdev, mic_addr, size, NULL);
 
 	spin_lock_irqsave(&alut->alut_lock, flags);
+	start = ktime_get();
 	alut->unmap_count++;
 	alut->ref_count--;
 
 	for (i = spt; i < spt + num_alut; i++) {
 		alut->entry[i].ref_count--;
-		if (alut->entry[i].ref_count < 0)
+		if (!alut->entry[i].ref_count)
+			clear_bit(i, alut->busy);
+		else if (alut->entry[i].ref_count < 0)
 			dev_warn(&xdev->pdev->dev,
 				 "ref count for entry %d is negative\n", i);
 	}
+	mic_alut_hold_time(alut, start);
 	spin_unlock_irqrestore(&alut->alut_lock, flags);
 }
 
@@ -289,6 +347,85 @@ mic_unmap_single(struct mic_device *xdev, dma_addr_t mic_addr, size_t size)
 	pci_unmap_single(pdev, dma_addr, size, PCI_DMA_BIDIRECTIONAL);
 }
 
+#define MIC_ALUT_TEST_BASE	(1ULL << 46)
+#define MIC_ALUT_TEST_ADDRS	16
+#define MIC_ALUT_TEST_SLOTS	8
+
+/* Check that the busy bitmap and hash agree with the entries */
+static int mic_alut_check(struct mic_device *xdev)
+{
+	struct mic_alut_info *alut = xdev->alut;
+	unsigned long flags;
+	int i, err = 0;
+
+	spin_lock_irqsave(&alut->alut_lock, flags);
+	for (i = 0; i < ALUT_ENTRY_COUNT; i++) {
+		if (test_bit(i, alut->busy) != (alut->entry[i].ref_count > 0) ||
+		    (alut->entry[i].ref_count > 0 &&
+		     hlist_unhashed(&alut->entry[i].node))) {
+			err = -EFAULT;
+			break;
+		}
+	}
+	spin_unlock_irqrestore(&alut->alut_lock, flags);
+	return err;
+}
+
+/**
+ * mic_alut_test - Run a randomized map/unmap storm against the ALUT.
+ *
+ * @xdev: pointer to mic_device instance.
+ * @iters: number of map or unmap operations.
+ * @ns: returns the time the storm took.
+ *
+ * Up to MIC_ALUT_TEST_SLOTS mappings of one to three entries are kept
+ * live, drawn from MIC_ALUT_TEST_ADDRS DMA addresses past the end of
+ * physical memory so that lookups hit existing entries as well as
+ * allocate free ones. The card is never told about these addresses.
+ * Every mapping is translated back and the allocator state is checked
+ * once all of them have been unmapped. Mappings which fail because the
+ * ALUT is full are skipped.
+ *
+ * returns 0 for success and -errno for error.
+ */
+int mic_alut_test(struct mic_device *xdev, int iters, u64 *ns)
+{
+	dma_addr_t dma[MIC_ALUT_TEST_SLOTS], mic[MIC_ALUT_TEST_SLOTS];
+	size_t size[MIC_ALUT_TEST_SLOTS];
+	ktime_t start;
+	int i, slot, err = 0;
+
+	if (!xdev->alut)
+		return -ENODEV;
+
+	memset(mic, 0, sizeof(mic));
+	start = ktime_get();
+	for (i = 0; i < iters && !err; i++) {
+		slot = prandom_u32() % MIC_ALUT_TEST_SLOTS;
+		if (mic[slot]) {
+			mic_unmap(xdev, mic[slot], size[slot]);
+			mic[slot] = 0;
+			continue;
+		}
+		dma[slot] = MIC_ALUT_TEST_BASE +
+			(prandom_u32() % MIC_ALUT_TEST_ADDRS) * ALUT_ENTRY_SIZE +
+			(prandom_u32() % ALUT_ENTRY_SIZE);
+		size[slot] = 1 + (prandom_u32() % (2 * ALUT_ENTRY_SIZE));
+		mic[slot] = mic_map(xdev, dma[slot], size[slot]);
+		if (mic_map_error(mic[slot]))
+			continue;
+		if (mic_to_dma_addr(xdev, mic[slot]) != dma[slot] ||
+		    mic_to_dma_addr(xdev, mic[slot] + size[slot] - 1) !=
+		    dma[slot] + size[slot] - 1)
+			err = -EFAULT;
+	}
+	for (slot = 0; slot < MIC_ALUT_TEST_SLOTS; slot++)
+		if (mic[slot])
+			mic_unmap(xdev, mic[slot], size[slot]);
+	*ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	return err ? err : mic_alut_check(xdev);
+}
+
 /**
  * mic_alut_enable - Enable ALUT
  *
@@ -389,15 +526,25 @@ int mic_alut_init(struct mic_device *xdev)
 		err = -ENOMEM;
 		goto free_alut;
 	}
+	alut->busy = kcalloc(BITS_TO_LONGS(ALUT_ENTRY_COUNT),
+			     sizeof(*alut->busy), GFP_KERNEL);
+	if (!alut->busy) {
+		err = -ENOMEM;
+		goto free_entry;
+	}
 	spin_lock_init(&alut->alut_lock);
+	hash_init(alut->hash);
 	alut->ref_count = 0;
 
 	for (i = 0; i < ALUT_ENTRY_COUNT; i++) {
 		dma_addr = i * ALUT_ENTRY_SIZE;
+		INIT_HLIST_NODE(&alut->entry[i].node);
 
 		if (i < alut->identity_map_entries) {
 			alut->entry[i].dma_addr = dma_addr;
 			alut->entry[i].ref_count = 1;
+			hash_add(alut->hash, &alut->entry[i].node, dma_addr);
+			set_bit(i, alut->busy);
 			alut->ref_count++;
 		} else {
 			alut->entry[i].dma_addr = 0;
@@ -405,13 +552,19 @@ int mic_alut_init(struct mic_device *xdev)
 		}
 
 	}
+	alut->next_free = alut->identity_map_entries % ALUT_ENTRY_COUNT;
 	alut->map_count = 0;
 	alut->unmap_count = 0;
+	alut->hit_count = 0;
+	alut->hold_ns_total = 0;
+	alut->hold_ns_max = 0;
 
 	/* init HW registers */
 	mic_alut_enable(xdev);
 	return mic_alut_restore(xdev);
 
+free_entry:
+	kfree(alut->entry);
 free_alut:
 	kfree(alut);
 	return err;
@@ -452,6 +605,7 @@ void mic_alut_uninit(struct mic_device *xdev)
 					 "ref count for entry %d is not zero\n", i);
 		}
 	}
+	kfree(alut->busy);
 	kfree(alut->entry);
 	kfree(alut);
 }
@@ -15,36 +15,55 @@
  */
 #ifndef MIC_ALUT_H
 #define MIC_ALUT_H
+
+#include <linux/hashtable.h>
+
+#define MIC_ALUT_HASH_BITS 6
+
 /**
  * struct mic_alut - MIC ALUT entry information.
  * @dma_addr: Base DMA address for this ALUT entry.
  * @ref_count: Number of active mappings for this ALUT entry in bytes.
+ * @node: Link in the DMA address hash, once dma_addr has been programmed.
  */
 struct mic_alut {
 	dma_addr_t dma_addr;
 	s64 ref_count;
 	u8 perm;
+	struct hlist_node node;
 };
 
 /**
  * struct mic_alut_info - MIC ALUT information.
  * @entry: Array of ALUT entries.
  * @alut_lock: Spin lock protecting access to ALUT data structures.
+ * @hash: ALUT entries hashed by the DMA address they point at.
+ * @busy: Bitmap of the entries with a non zero ref_count.
+ * @next_free: Entry the search for free entries starts at.
  * @info: Hardware specific ALUT information.
  * @identity_map_size: identity map size (in bytes).
  * @identity_map_entries: identity map size (in entries).
  * @ref_count: Number of active ALUT mappings (for debug).
  * @map_count: Number of ALUT mappings created (for debug).
  * @unmap_count: Number of ALUT mappings destroyed (for debug).
+ * @hit_count: Number of mappings which reused programmed entries (for debug).
+ * @hold_ns_total: Time alut_lock was held by map and unmap (for debug).
+ * @hold_ns_max: Longest time alut_lock was held by map or unmap (for debug).
  */
 struct mic_alut_info {
 	struct mic_alut *entry;
 	spinlock_t alut_lock;
+	DECLARE_HASHTABLE(hash, MIC_ALUT_HASH_BITS);
+	unsigned long *busy;
+	int next_free;
 	u64 identity_map_size;
 	u64 identity_map_entries;
 	s64 ref_count;
 	s64 map_count;
 	s64 unmap_count;
+	s64 hit_count;
+	u64 hold_ns_total;
+	u64 hold_ns_max;
 };
 
 dma_addr_t mic_map_single(struct mic_device *mdev, void *va, size_t size);
@@ -67,6 +86,7 @@ static inline bool mic_map_error(dma_addr_t mic_addr)
 	return !mic_addr;
 }
 
+int  mic_alut_test(struct mic_device *xdev, int iters, u64 *ns);
 int  mic_alut_init(struct mic_device *xdev);
 void mic_alut_uninit(struct mic_device *xdev);
 int  mic_alut_restore(struct mic_device *xdev);
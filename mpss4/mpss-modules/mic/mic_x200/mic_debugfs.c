@@ -16,6 +16,7 @@
 #include <linux/debugfs.h>
 #include <linux/pci.h>
 #include <linux/seq_file.h>
+#include <linux/math64.h>
 
 #ifdef MIC_IN_KERNEL_BUILD
 #include <linux/mic_common.h>
@@ -57,6 +58,11 @@ static int mic_alut_show(struct seq_file *s, void *pos)
 				   i, sep, sep, entry.dma_addr, sep, entry.perm,
 				   sep, alut_info->entry[i].ref_count);
 		}
+		seq_printf(s, "map %lld unmap %lld reused %lld\n",
+			   alut_info->map_count, alut_info->unmap_count,
+			   alut_info->hit_count);
+		seq_printf(s, "lock hold ns total %llu max %llu\n",
+			   alut_info->hold_ns_total, alut_info->hold_ns_max);
 		spin_unlock_irqrestore(&alut_info->alut_lock, flags);
 	} else {
 		seq_printf(s, "ALUT is not enabled\n");
@@ -69,6 +75,59 @@ static int mic_alut_show(struct seq_file *s, void *pos)
 	return 0;
 }
 
+#define MIC_ALUT_TEST_ITERS 100000
+
+static int mic_alut_test_show(struct seq_file *s, void *pos)
+{
+	struct mic_device *xdev = s->private;
+	struct mic_alut_info *alut = xdev->alut;
+	u64 ns, hold_total, hold_max, ops;
+	unsigned long flags;
+	int rc;
+
+	if (!alut) {
+		seq_puts(s, "ALUT is not enabled\n");
+		return 0;
+	}
+
+	spin_lock_irqsave(&alut->alut_lock, flags);
+	ops = alut->map_count + alut->unmap_count;
+	hold_total = alut->hold_ns_total;
+	hold_max = alut->hold_ns_max;
+	alut->hold_ns_max = 0;
+	spin_unlock_irqrestore(&alut->alut_lock, flags);
+
+	rc = mic_alut_test(xdev, MIC_ALUT_TEST_ITERS, &ns);
+
+	spin_lock_irqsave(&alut->alut_lock, flags);
+	ops = alut->map_count + alut->unmap_count - ops;
+	hold_total = alut->hold_ns_total - hold_total;
+	/* report the maximum of the storm, keep the overall one */
+	swap(hold_max, alut->hold_ns_max);
+	alut->hold_ns_max = max(alut->hold_ns_max, hold_max);
+	spin_unlock_irqrestore(&alut->alut_lock, flags);
+
+	seq_printf(s, "%s: %llu map/unmap in %llu ns\n",
+		   rc ? "FAILED" : "passed", ops, ns);
+	if (ops)
+		seq_printf(s, "lock hold ns avg %llu max %llu\n",
+			   div64_u64(hold_total, ops), hold_max);
+	return 0;
+}
+
+static int mic_alut_test_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, mic_alut_test_show, inode->i_private);
+}
+
+static const struct file_operations mic_alut_test_ops = {
+	.owner   = THIS_MODULE,
+	.open    = mic_alut_test_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = single_release
+};
+
 static int mic_alut_debug_open(struct inode *inode, struct file *file)
 {
 	return single_open(file, mic_alut_show, inode->i_private);
@@ -238,6 +297,9 @@ void mic_create_debug_dir(struct mic_device *xdev)
 	debugfs_create_file("alut", 0444, xdev->dbg_dir, xdev,
 				&mic_alut_file_ops);
 
+	debugfs_create_file("alut_test", 0400, xdev->dbg_dir, xdev,
+				&mic_alut_test_ops);
+
 	debugfs_create_file("gpio1", 0644, xdev->dbg_dir, xdev,
 				&mic_gpio1_file_ops);
 
@@ -20,6 +20,9 @@
 #include <linux/firmware.h>
 #include <linux/completion.h>
 #include <linux/delay.h>
+#include <linux/moduleparam.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
 
 #include "../common/mic_dev.h"
 #include "mic_device.h"
@@ -554,6 +557,154 @@ static int _mic_request_firmware(const struct firmware **firmware_p,
 	return request_firmware(firmware_p, name, device);
 }
 
+/*
+ * Boot images shared between the cards. The cards of a host boot the same
+ * images, usually all at once, so an image is read from the file system
+ * once and copied from the same read-only pages to every card. An unused
+ * image is kept fw_cache_sec seconds for the cards booting next and then
+ * dropped, so a later boot reads the file again and picks up any update.
+ */
+static unsigned int fw_cache_sec = 10;
+module_param(fw_cache_sec, uint, 0644);
+MODULE_PARM_DESC(fw_cache_sec,
+		 "Seconds an unused boot image is kept for other cards");
+
+/*
+ * @loaded: completed once the image was read, with @err set on failure.
+ *	A failed image is taken off the list so the next card tries again.
+ */
+struct mic_fw_image {
+	struct list_head list;
+	char *name;
+	const struct firmware *fw;
+	int err;
+	struct completion loaded;
+	int users;
+	unsigned long last_use;
+};
+
+static LIST_HEAD(mic_fw_images);
+static DEFINE_MUTEX(mic_fw_mutex);
+
+static void mic_fw_image_free(struct mic_fw_image *img)
+{
+	list_del(&img->list);
+	release_firmware(img->fw);
+	kfree(img->name);
+	kfree(img);
+}
+
+/* Drop the images unused for fw_cache_sec, called with mic_fw_mutex held */
+static bool mic_fw_expire(bool all)
+{
+	struct mic_fw_image *img, *tmp;
+	bool pending = false;
+
+	list_for_each_entry_safe(img, tmp, &mic_fw_images, list) {
+		if (img->users)
+			continue;
+		if (all || time_after_eq(jiffies, img->last_use +
+					 fw_cache_sec * HZ))
+			mic_fw_image_free(img);
+		else
+			pending = true;
+	}
+	return pending;
+}
+
+static void mic_fw_expire_work(struct work_struct *work);
+static DECLARE_DELAYED_WORK(mic_fw_work, mic_fw_expire_work);
+
+static void mic_fw_expire_work(struct work_struct *work)
+{
+	mutex_lock(&mic_fw_mutex);
+	if (mic_fw_expire(false))
+		schedule_delayed_work(&mic_fw_work, fw_cache_sec * HZ);
+	mutex_unlock(&mic_fw_mutex);
+}
+
+static void mic_fw_put(struct mic_fw_image *img)
+{
+	mutex_lock(&mic_fw_mutex);
+	img->last_use = jiffies;
+	if (!--img->users) {
+		if (fw_cache_sec && !img->err)
+			mod_delayed_work(system_wq, &mic_fw_work,
+					 fw_cache_sec * HZ);
+		else
+			mic_fw_image_free(img);
+	}
+	mutex_unlock(&mic_fw_mutex);
+}
+
+/*
+ * Return the image in file @name, read only if no card uses it already.
+ * The file is read without mic_fw_mutex held; cards asking for an image
+ * being read wait for its completion, while other images stay available.
+ */
+static struct mic_fw_image *mic_fw_get(const char *name, struct device *dev)
+{
+	const struct firmware *fw = NULL;
+	struct mic_fw_image *img;
+	int rc;
+
+	if (!name)
+		return ERR_PTR(-EINVAL);
+
+	mutex_lock(&mic_fw_mutex);
+	list_for_each_entry(img, &mic_fw_images, list) {
+		if (!strcmp(img->name, name)) {
+			img->users++;
+			mutex_unlock(&mic_fw_mutex);
+			goto wait;
+		}
+	}
+
+	img = kzalloc(sizeof(*img), GFP_KERNEL);
+	if (img)
+		img->name = kstrdup(name, GFP_KERNEL);
+	if (!img || !img->name) {
+		mutex_unlock(&mic_fw_mutex);
+		kfree(img);
+		return ERR_PTR(-ENOMEM);
+	}
+	init_completion(&img->loaded);
+	img->users = 1;
+	list_add(&img->list, &mic_fw_images);
+	mutex_unlock(&mic_fw_mutex);
+
+	rc = _mic_request_firmware(&fw, name, dev);
+
+	mutex_lock(&mic_fw_mutex);
+	img->fw = fw;
+	img->err = rc < 0 ? rc : 0;
+	if (img->err)
+		list_del_init(&img->list);
+	mutex_unlock(&mic_fw_mutex);
+	complete_all(&img->loaded);
+wait:
+	wait_for_completion(&img->loaded);
+	if (img->err) {
+		rc = img->err;
+		mic_fw_put(img);
+		return ERR_PTR(rc);
+	}
+	return img;
+}
+
+/**
+ * mic_fw_cache_exit() - Drop the cached boot images.
+ *
+ * Called at module unload, once no card boots any more.
+ */
+void mic_fw_cache_exit(void)
+{
+	cancel_delayed_work_sync(&mic_fw_work);
+	mutex_lock(&mic_fw_mutex);
+	mic_fw_expire(true);
+	mutex_unlock(&mic_fw_mutex);
+}
+
 /**
  * mic_load_firmware() - Load firmware from file.
  * @xdev: pointer to mic_device instance
@@ -566,12 +717,16 @@ static int mic_load_firmware(struct mic_device *xdev,
 			     const struct firmware **fw, const char *filename,
 			     u64 offset, u32 *fw_size)
 {
-	int rc = _mic_request_firmware(fw, filename, &xdev->pdev->dev);
-	if (rc < 0) {
+	struct mic_fw_image *img = mic_fw_get(filename, &xdev->pdev->dev);
+	int rc;
+
+	if (IS_ERR(img)) {
+		rc = PTR_ERR(img);
 		dev_err(&xdev->pdev->dev, "request_firmware failed: %d %s\n",
 			rc, filename);
 		return rc;
 	}
+	*fw = img->fw;
 
 	rc = mic_check_pci_aperture_len(xdev, offset, (*fw)->size);
 	if (!rc) {
@@ -583,7 +738,7 @@ static int mic_load_firmware(struct mic_device *xdev,
 	dev_dbg(&xdev->pdev->dev, "Loaded firmware: %s offset %llu size %u\n",
 		filename, offset, *fw_size);
 
-	release_firmware(*fw);
+	mic_fw_put(img);
 	return rc;
 }
 
@@ -207,6 +207,7 @@ void mic_send_p2p_intr(struct mic_device *xdev, int doorbell,
 u32 mic_ack_interrupt(struct mic_device *xdev);
 u64 mic_get_fw_addr(struct mic_device *xdev);
 int mic_load_fw(struct mic_device *xdev, bool efi_only);
+void mic_fw_cache_exit(void);
 bool mic_dma_filter(struct dma_chan *chan, void *param);
 void mic_alut_set(struct mic_device *xdev, dma_addr_t dma_addr, u8 index);
 struct mic_alut mic_alut_get(struct mic_device *xdev, u8 index);
@@ -437,6 +437,7 @@ cleanup_debugfs:
 static void __exit mic_x200_exit(void)
 {
 	pci_unregister_driver(&mic_driver);
+	mic_fw_cache_exit();
 	ida_destroy(&g_mic_ida);
 	mic_exit_debugfs();
 }
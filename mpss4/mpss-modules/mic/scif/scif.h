@@ -89,6 +89,14 @@ enum {
 	SCIF_RMA_ORDERED = (1 << 3)
 };
 
+/* Operations of scif_pollset_ctl() */
+#define SCIF_POLLSET_ADD	1
+#define SCIF_POLLSET_DEL	2
+#define SCIF_POLLSET_MOD	3
+
+/* Report an endpoint of a poll set once, until it is modified */
+#define SCIF_POLLONESHOT	(1U << 30)
+
 /* End of SCIF Admin Reserved Ports */
 #define SCIF_ADMIN_PORT_END	1024
 
@@ -97,6 +105,7 @@ enum {
 
 typedef struct scif_endpt *scif_epd_t;
 typedef struct scif_pinned_pages *scif_pinned_pages_t;
+typedef struct scif_pollset *scif_pollset_t;
 
 /**
  * struct scif_range - SCIF registered range used in kernel mode
@@ -130,6 +139,16 @@ struct scif_pollepd {
 	short revents;
 };
 
+/**
+ * struct scif_pollevent - SCIF endpoint event of a poll set
+ * @events: requested or returned events
+ * @data: returned with the events of the endpoint
+ */
+struct scif_pollevent {
+	u32 events;
+	u64 data;
+};
+
 /**
  * scif_peer_dev - representation of a peer SCIF device
  *
@@ -1006,6 +1025,66 @@ int scif_fence_signal(scif_epd_t epd, off_t loff, u64 lval, off_t roff,
  */
 int scif_get_node_ids(u16 *nodes, int len, u16 *self);
 
+/**
+ * scif_setsockopt() - Set an endpoint option
+ * @epd:	endpoint descriptor
+ * @name:	option to set
+ * @value:	new value of the option
+ *
+ * SCIF_OPT_RING_SIZE sets the size in bytes of the ring buffer which holds
+ * messages received on epd. value must be a power of two from 4KB to 4MB.
+ * A larger ring only lets the peer queue more data for epd before it has
+ * to wait for epd to receive; it does not speed up messages sent from epd.
+ * Set on a listening endpoint, it sizes the receive ring of the endpoints
+ * accepted on it. Set on a connecting endpoint, it sizes the receive ring
+ * of epd and is passed to the accepting peer, which allocates at least that
+ * much for its own receive ring. A smaller ring is used if the memory for a
+ * large one cannot be found. The option must be set before the endpoint
+ * connects.
+ *
+ * SCIF_OPT_CQ_DEPTH sets the number of RMAs which may be posted on epd with
+ * the SCIF_RMA_POST IOCTL and not be reaped yet, from 1 to 65536, 256 by
+ * default. It must be set before the first RMA is posted.
+ *
+ * SCIF_OPT_DMA_CHANNELS sets the number of DMA channels, from 1 to 8, an
+ * RMA on epd may be split across, 1 by default. RMAs of 1MB or more which
+ * are not SCIF_RMA_ORDERED are split into stripes of whole pages, each of
+ * which is programmed on its own DMA channel, and complete once all stripes
+ * have. Fewer channels are used if the DMA device has fewer. RMAs done with
+ * SCIF_RMA_USECPU are split the same way. The option may be set at any time
+ * and applies to RMAs started afterwards.
+ *
+ * Return:
+ * Upon successful completion, scif_setsockopt() returns 0; otherwise the
+ * negative of one of the following errors is returned.
+ *
+ * Errors:
+ * EBUSY - RMAs were posted on epd already
+ * EINVAL - value is invalid, or epd is being closed
+ * EISCONN - epd is already connected or connecting
+ * ENOPROTOOPT - name is not a known option
+ */
+int scif_setsockopt(scif_epd_t epd, int name, u64 value);
+
+/**
+ * scif_getsockopt() - Get an endpoint option
+ * @epd:	endpoint descriptor
+ * @name:	option to get
+ * @value:	address to place the value of the option
+ *
+ * For a connected endpoint, SCIF_OPT_RING_SIZE returns the size of the
+ * receive ring buffer which was allocated. It may be larger than the one
+ * set if the peer asked for more, or smaller if memory was short.
+ *
+ * Return:
+ * Upon successful completion, scif_getsockopt() returns 0; otherwise the
+ * negative of one of the following errors is returned.
+ *
+ * Errors:
+ * ENOPROTOOPT - name is not a known option
+ */
+int scif_getsockopt(scif_epd_t epd, int name, u64 *value);
+
 /**
  * scif_pin_pages() - Pin a set of pages
  * @addr:		Virtual address of range to pin
@@ -1265,6 +1344,10 @@ int scif_put_pages(struct scif_range *pages);
  * POLLHUP - The connection to the peer endpoint was disconnected.
  * POLLNVAL - The specified endpoint descriptor is invalid.
  *
+ * scif_poll() polls every endpoint in epds each time it wakes up. Threads
+ * waiting on many endpoints should use a poll set instead, see
+ * scif_pollset_create().
+ *
  * Return:
  * Upon successful completion, scif_poll() returns a non-negative value. A
  * positive value indicates the total number of endpoint descriptors that have
@@ -1280,6 +1363,86 @@ int scif_put_pages(struct scif_range *pages);
  */
 int scif_poll(struct scif_pollepd *epds, unsigned int nepds, long timeout);
 
+/**
+ * scif_pollset_create() - Create a poll set
+ *
+ * scif_pollset_create() creates an empty poll set. A poll set keeps a set
+ * of endpoints and the events of interest for each between waits, so that
+ * waiting for events with scif_pollset_wait() costs the number of ready
+ * endpoints rather than the number of endpoints in the set, as with
+ * scif_poll(). Poll sets follow the semantics of epoll in level triggered
+ * mode.
+ *
+ * Return:
+ * Upon successful completion, scif_pollset_create() returns a poll set;
+ * otherwise NULL is returned.
+ */
+scif_pollset_t scif_pollset_create(void);
+
+/**
+ * scif_pollset_destroy() - Destroy a poll set
+ * @ps:		poll set
+ *
+ * scif_pollset_destroy() removes all the endpoints from ps and frees it.
+ * No thread may be waiting on ps.
+ */
+void scif_pollset_destroy(scif_pollset_t ps);
+
+/**
+ * scif_pollset_ctl() - Add, modify or remove an endpoint of a poll set
+ * @ps:		poll set
+ * @op:		operation
+ * @epd:	endpoint descriptor
+ * @event:	requested events and data
+ *
+ * SCIF_POLLSET_ADD adds epd to ps with the events of interest and data of
+ * event. SCIF_POLLSET_MOD changes the events of interest and data of epd.
+ * SCIF_POLLSET_DEL removes epd from ps, event is ignored. A closed endpoint
+ * is removed from every poll set it is in.
+ *
+ * The events are those of scif_poll(). If SCIF_POLLONESHOT is set in
+ * events, the endpoint is reported once by scif_pollset_wait() and then
+ * ignored until it is modified with SCIF_POLLSET_MOD.
+ *
+ * Return:
+ * Upon successful completion, scif_pollset_ctl() returns 0; otherwise the
+ * negative of one of the following errors is returned.
+ *
+ * Errors:
+ * EEXIST - op is SCIF_POLLSET_ADD and epd is in ps already
+ * EINVAL - op is not valid
+ * ENOENT - op is SCIF_POLLSET_MOD or SCIF_POLLSET_DEL and epd is not in ps
+ * ENOMEM - Not enough space
+ */
+int scif_pollset_ctl(scif_pollset_t ps, int op, scif_epd_t epd,
+		     struct scif_pollevent *event);
+
+/**
+ * scif_pollset_wait() - Wait for events on the endpoints of a poll set
+ * @ps:		poll set
+ * @events:	array the ready endpoints are returned in
+ * @maxevents:	length of events
+ * @timeout:	upper limit on the time scif_pollset_wait() will block
+ *
+ * scif_pollset_wait() returns up to maxevents endpoints of ps for which one
+ * of the requested events, POLLERR or POLLHUP occurred, each with the
+ * events which occurred and the data given to scif_pollset_ctl(). If none
+ * is ready, it blocks until one is or timeout milliseconds passed. A
+ * negative timeout means an infinite timeout. Signals wake up the blocked
+ * thread as with scif_poll().
+ *
+ * Return:
+ * Upon successful completion, scif_pollset_wait() returns the number of
+ * endpoints returned, 0 if none was ready before the timeout; otherwise the
+ * negative of one of the following errors is returned.
+ *
+ * Errors:
+ * EINTR - A signal occurred before any requested event.
+ * EINVAL - maxevents is not positive.
+ */
+int scif_pollset_wait(scif_pollset_t ps, struct scif_pollevent *events,
+		      int maxevents, long timeout);
+
 /**
  * scif_client_register() - Register a SCIF client
  * @client:	client to be registered
@@ -49,8 +49,13 @@
  *
  * Intel SCIF driver.
  */
+#include <linux/log2.h>
+#include <linux/mman.h>
 #include <linux/pagemap.h>
 #include <linux/sched/signal.h>
+#include <linux/seq_file.h>
+#include <linux/sizes.h>
+#include <linux/workqueue.h>
 #ifdef MIC_IN_KERNEL_BUILD
 #include <linux/scif.h>
 #else
@@ -109,6 +114,15 @@ scif_epd_t scif_open(void)
 	spin_lock_init(&ep->lock);
 	mutex_init(&ep->sendlock);
 	mutex_init(&ep->recvlock);
+	/*
+	 * The wait queues are initialized once, poll sets keep their entries
+	 * on them across listen and connect.
+	 */
+	init_waitqueue_head(&ep->conwq);
+	init_waitqueue_head(&ep->sendwq);
+	init_waitqueue_head(&ep->recvwq);
+	init_waitqueue_head(&ep->conn_pend_wq);
+	INIT_LIST_HEAD(&ep->pollset_list);
 
 	scif_rma_ep_init(ep);
 	ep->state = SCIFEP_UNBOUND;
@@ -211,6 +225,7 @@ int scif_close(scif_epd_t epd)
 	dev_dbg(scif_info.mdev.this_device, "SCIFAPI close: ep %p %s\n",
 		ep, scif_ep_states[ep->state]);
 	might_sleep();
+	scif_pollset_ep_release(ep);
 	spin_lock(&ep->lock);
 	flush_conn = (ep->conn_async_state == ASYNC_CONN_INPROGRESS);
 	spin_unlock(&ep->lock);
@@ -261,12 +276,8 @@ int scif_close(scif_epd_t epd)
 
 		mutex_lock(&scif_info.eplock);
 
-		/* remove from listen list */
-		list_for_each_safe(pos, tmpq, &scif_info.listen) {
-			tmpep = list_entry(pos, struct scif_endpt, list);
-			if (tmpep == ep)
-				list_del(pos);
-		}
+		/* remove from listen hash */
+		hash_del_rcu(&ep->listen_node);
 		/* Remove any dangling accepts */
 		while (ep->acceptcnt) {
 			aep = list_first_entry(&ep->li_accept,
@@ -430,7 +441,6 @@ int scif_listen(scif_epd_t epd, int backlog)
 	ep->conreqcnt = 0;
 	ep->acceptcnt = 0;
 	INIT_LIST_HEAD(&ep->conlist);
-	init_waitqueue_head(&ep->conwq);
 	INIT_LIST_HEAD(&ep->li_accept);
 	spin_unlock(&ep->lock);
 
@@ -441,12 +451,102 @@ int scif_listen(scif_epd_t epd, int backlog)
 	scif_teardown_ep(ep);
 
 	mutex_lock(&scif_info.eplock);
-	list_add_tail(&ep->list, &scif_info.listen);
+	hash_add_rcu(scif_info.listen, &ep->listen_node, ep->port.port);
 	mutex_unlock(&scif_info.eplock);
 	return 0;
 }
 EXPORT_SYMBOL_GPL(scif_listen);
 
+static inline bool scif_ring_size_valid(u64 size)
+{
+	return is_power_of_2(size) && size >= SCIF_ENDPT_QP_SIZE &&
+		size <= SCIF_ENDPT_QP_MAX_SIZE;
+}
+
+int scif_setsockopt(scif_epd_t epd, int name, u64 value)
+{
+	struct scif_endpt *ep = (struct scif_endpt *)epd;
+	struct scif_qp *qp;
+
+	dev_dbg(scif_info.mdev.this_device,
+		"SCIFAPI setsockopt: ep %p %s name %d value 0x%llx\n",
+		ep, scif_ep_states[ep->state], name, value);
+
+	switch (name) {
+	case SCIF_OPT_RING_SIZE:
+		if (!scif_ring_size_valid(value))
+			return -EINVAL;
+		break;
+	case SCIF_OPT_CQ_DEPTH:
+		return scif_cq_set_depth(&ep->rma_info.cq, value);
+	case SCIF_OPT_DMA_CHANNELS:
+		if (!value || value > SCIF_MAX_STRIPES)
+			return -EINVAL;
+		mutex_lock(&ep->rma_info.rma_lock);
+		ep->rma_info.nr_stripes = value;
+		mutex_unlock(&ep->rma_info.rma_lock);
+		return 0;
+	default:
+		return -ENOPROTOOPT;
+	}
+
+	spin_lock(&ep->lock);
+	switch (ep->state) {
+	case SCIFEP_ZOMBIE:
+	case SCIFEP_CLOSING:
+	case SCIFEP_CLLISTEN:
+	case SCIFEP_DISCONNECTED:
+		spin_unlock(&ep->lock);
+		return -EINVAL;
+	case SCIFEP_CONNECTED:
+	case SCIFEP_CONNECTING:
+	case SCIFEP_MAPPING:
+		spin_unlock(&ep->lock);
+		return -EISCONN;
+	case SCIFEP_UNBOUND:
+	case SCIFEP_BOUND:
+	case SCIFEP_LISTENING:
+		break;
+	}
+
+	/* An RB left over from a failed connect is reused only if it fits */
+	qp = ep->qp_info.qp;
+	if (qp && qp->inbound_q.rb_base && qp->inbound_q.size != value) {
+		kfree(qp->inbound_q.rb_base);
+		qp->inbound_q.rb_base = NULL;
+	}
+	ep->qp_info.ring_size = value;
+	spin_unlock(&ep->lock);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(scif_setsockopt);
+
+int scif_getsockopt(scif_epd_t epd, int name, u64 *value)
+{
+	struct scif_endpt *ep = (struct scif_endpt *)epd;
+
+	switch (name) {
+	case SCIF_OPT_RING_SIZE:
+		/* The RB may have come out smaller than asked for */
+		spin_lock(&ep->lock);
+		if (ep->state == SCIFEP_CONNECTED)
+			*value = ep->qp_info.qp->inbound_q.size;
+		else
+			*value = scif_ep_ring_size(ep);
+		spin_unlock(&ep->lock);
+		return 0;
+	case SCIF_OPT_CQ_DEPTH:
+		*value = ep->rma_info.cq.depth;
+		return 0;
+	case SCIF_OPT_DMA_CHANNELS:
+		*value = ep->rma_info.nr_stripes;
+		return 0;
+	default:
+		return -ENOPROTOOPT;
+	}
+}
+EXPORT_SYMBOL_GPL(scif_getsockopt);
+
 /*
  ************************************************************************
  * SCIF connection flow:
@@ -480,6 +580,8 @@ static int scif_conn_func(struct scif_endpt *ep)
 	int err = 0;
 	struct scifmsg msg;
 	struct device *spdev;
+	struct scif_qp *qp;
+	int size;
 
 	err = scif_reserve_dma_chan(ep);
 	if (err) {
@@ -488,9 +590,22 @@ static int scif_conn_func(struct scif_endpt *ep)
 		ep->state = SCIFEP_BOUND;
 		goto connect_error_simple;
 	}
+	/* An RB left over from a failed connect is reused at its own size */
+	qp = ep->qp_info.qp;
+	if (qp->inbound_q.rb_base) {
+		size = qp->inbound_q.size;
+	} else {
+		size = scif_ep_ring_size(ep);
+		qp->inbound_q.rb_base = scif_alloc_ep_rb(&size);
+		if (!qp->inbound_q.rb_base) {
+			err = -ENOMEM;
+			ep->state = SCIFEP_BOUND;
+			goto connect_error_simple;
+		}
+	}
 	/* Initiate the first part of the endpoint QP setup */
-	err = scif_setup_qp_connect(ep->qp_info.qp, &ep->qp_info.qp_offset,
-				    SCIF_ENDPT_QP_SIZE, ep->remote_dev);
+	err = scif_setup_qp_connect(qp, &ep->qp_info.qp_offset, size,
+				    ep->remote_dev);
 	if (err) {
 		dev_err(&ep->remote_dev->sdev->dev,
 			"%s err %d qp_offset 0x%llx\n",
@@ -510,6 +625,8 @@ static int scif_conn_func(struct scif_endpt *ep)
 	msg.uop = SCIF_CNCT_REQ;
 	msg.payload[0] = (u64)ep;
 	msg.payload[1] = ep->qp_info.qp_offset;
+	msg.payload[2] = SCIF_EVENT_IDX_MAGIC;
+	msg.payload[3] = scif_ep_ring_size(ep);
 	err = _scif_nodeqp_send(ep->remote_dev, &msg);
 	if (err)
 		goto connect_error_dec;
@@ -677,9 +794,6 @@ int __scif_connect(scif_epd_t epd, struct scif_port_id *dst, bool non_block)
 			err = -EINPROGRESS;
 		} else {
 			ep->conn_port = *dst;
-			init_waitqueue_head(&ep->sendwq);
-			init_waitqueue_head(&ep->recvwq);
-			init_waitqueue_head(&ep->conwq);
 			ep->conn_async_state = 0;
 
 			if (unlikely(non_block))
@@ -695,7 +809,6 @@ int __scif_connect(scif_epd_t epd, struct scif_port_id *dst, bool non_block)
 	ep->remote_dev = &scif_dev[dst->node];
 	ep->qp_info.qp->magic = SCIFEP_MAGIC;
 	if (ep->conn_async_state == ASYNC_CONN_INPROGRESS) {
-		init_waitqueue_head(&ep->conn_pend_wq);
 		spin_lock(&scif_info.nb_connect_lock);
 		list_add_tail(&ep->conn_list, &scif_info.nb_connect_list);
 		spin_unlock(&scif_info.nb_connect_lock);
@@ -811,6 +924,7 @@ retry_connection:
 	spin_lock_init(&cep->lock);
 	mutex_init(&cep->sendlock);
 	mutex_init(&cep->recvlock);
+	INIT_LIST_HEAD(&cep->pollset_list);
 	cep->state = SCIFEP_CONNECTING;
 	cep->remote_dev = &scif_dev[peer->node];
 	cep->remote_ep = conreq->msg.payload[0];
@@ -835,13 +949,24 @@ retry_connection:
 		goto scif_accept_error_anon_inode;
 
 	cep->qp_info.qp->magic = SCIFEP_MAGIC;
+	cep->qp_info.qp->event_idx =
+		conreq->msg.payload[2] == SCIF_EVENT_IDX_MAGIC;
+	/*
+	 * Size the inbound RB at least like the connecting peer sized its
+	 * own. The setting of the listener only affects this side.
+	 */
+	cep->qp_info.ring_size = scif_ep_ring_size(lep);
+	if (cep->qp_info.qp->event_idx &&
+	    scif_ring_size_valid(conreq->msg.payload[3]))
+		cep->qp_info.ring_size = max_t(u32, cep->qp_info.ring_size,
+					       conreq->msg.payload[3]);
 	spdev = scif_get_peer_dev(cep->remote_dev);
 	if (!spdev) {
 		err = -ENODEV;
 		goto scif_accept_error_map;
 	}
 	err = scif_setup_qp_accept(cep->qp_info.qp, &cep->qp_info.qp_offset,
-				   conreq->msg.payload[1], SCIF_ENDPT_QP_SIZE,
+				   conreq->msg.payload[1], cep->qp_info.ring_size,
 				   cep->remote_dev);
 	if (err) {
 		dev_dbg(&cep->remote_dev->sdev->dev,
@@ -864,6 +989,7 @@ retry_connection:
 	msg.payload[0] = cep->remote_ep;
 	msg.payload[1] = cep->qp_info.qp_offset;
 	msg.payload[2] = (u64)cep;
+	msg.payload[3] = SCIF_EVENT_IDX_MAGIC;
 
 	err = _scif_nodeqp_send(cep->remote_dev, &msg);
 	scif_put_peer_dev(spdev);
@@ -942,6 +1068,116 @@ err_ret:
 	return ret;
 }
 
+/*
+ * Messaging notification suppression.
+ *
+ * Without it every chunk written to or read from an endpoint QP is followed
+ * by a SCIF_CLIENT_SENT or SCIF_CLIENT_RCVD node QP message, i.e. a doorbell
+ * interrupt on the peer. Instead, a side that is about to wait publishes an
+ * event offset in the peer's QP, as virtio does with used_event, and the
+ * peer only notifies when its ring pointer moves past that offset. A peer
+ * which is busy reading or writing never publishes, and a waiting peer gets
+ * a single notification until it waits again.
+ *
+ * The waiter reads the published offset back before it checks the ring
+ * again. This flushes the posted write; the completion of that read cannot
+ * pass the peer's earlier posted ring pointer update, and the peer orders
+ * its ring update before reading the event offset. So either the waiter
+ * sees the new data or the peer sees the new event offset.
+ */
+static inline bool scif_rb_need_event(u32 event, u32 new, u32 old, u32 size)
+{
+	return ((new - event - 1) & (size - 1)) < ((new - old) & (size - 1));
+}
+
+/* Called after the outbound write offset moved from @old */
+static bool scif_ep_need_sent(struct scif_qp *qp, u32 old)
+{
+	bool need = true;
+
+	if (qp->event_idx && scif_info.msg_coalesce) {
+		/* Order the ring update before reading the event offset */
+		mb();
+		need = scif_rb_need_event(ACCESS_ONCE(qp->recv_event),
+					  qp->outbound_q.current_write_offset,
+					  old, qp->outbound_q.size);
+	}
+	atomic_long_inc(need ? &scif_info.msg_stats.sent_notif :
+			&scif_info.msg_stats.sent_skip);
+	return need;
+}
+
+/* Called after the inbound read offset moved from @old */
+static bool scif_ep_need_rcvd(struct scif_qp *qp, u32 old)
+{
+	bool need = true;
+
+	if (qp->event_idx && scif_info.msg_coalesce) {
+		mb();
+		need = scif_rb_need_event(ACCESS_ONCE(qp->send_event),
+					  qp->inbound_q.current_read_offset,
+					  old, qp->inbound_q.size);
+	}
+	atomic_long_inc(need ? &scif_info.msg_stats.rcvd_notif :
+			&scif_info.msg_stats.rcvd_skip);
+	return need;
+}
+
+/*
+ * Ask for SCIF_CLIENT_SENT and return the bytes readable. Caller holds
+ * ep->lock, which keeps a node removal from unmapping the peer's QP.
+ */
+static u32 scif_ep_arm_recv(struct scif_endpt *ep)
+{
+	struct scif_qp *qp = ep->qp_info.qp;
+	u32 count = scif_rb_count(&qp->inbound_q);
+
+	if (count || !qp->event_idx || ep->state != SCIFEP_CONNECTED)
+		return count;
+	ACCESS_ONCE(qp->remote_qp->recv_event) =
+		qp->inbound_q.current_read_offset;
+	/* Flush the posted write, see above */
+	(void)ACCESS_ONCE(qp->remote_qp->recv_event);
+	mb();
+	return scif_rb_count(&qp->inbound_q);
+}
+
+/* Ask for SCIF_CLIENT_RCVD and return the bytes writable */
+static u32 scif_ep_arm_send(struct scif_endpt *ep)
+{
+	struct scif_qp *qp = ep->qp_info.qp;
+	u32 space = scif_rb_space(&qp->outbound_q);
+
+	if (space || !qp->event_idx || ep->state != SCIFEP_CONNECTED)
+		return space;
+	ACCESS_ONCE(qp->remote_qp->send_event) =
+		ACCESS_ONCE(*qp->outbound_q.read_ptr);
+	(void)ACCESS_ONCE(qp->remote_qp->send_event);
+	mb();
+	return scif_rb_space(&qp->outbound_q);
+}
+
+/* Wait conditions of the blocking send and recv */
+static bool scif_ep_send_ready(struct scif_endpt *ep)
+{
+	bool ready;
+
+	spin_lock(&ep->lock);
+	ready = SCIFEP_CONNECTED != ep->state || scif_ep_arm_send(ep) > 0;
+	spin_unlock(&ep->lock);
+	return ready;
+}
+
+static bool scif_ep_recv_ready(struct scif_endpt *ep)
+{
+	bool ready;
+
+	spin_lock(&ep->lock);
+	ready = SCIFEP_CONNECTED != ep->state || scif_ep_arm_recv(ep) > 0;
+	spin_unlock(&ep->lock);
+	return ready;
+}
+
 static int _scif_send(scif_epd_t epd, void *msg, int len, int flags)
 {
 	struct scif_endpt *ep = (struct scif_endpt *)epd;
@@ -949,6 +1185,7 @@ static int _scif_send(scif_epd_t epd, void *msg, int len, int flags)
 	int curr_xfer_len = 0, sent_len = 0, write_count;
 	int ret = 0;
 	struct scif_qp *qp;
+	u32 old;
 
 	if (flags & SCIF_SEND_BLOCK)
 		might_sleep();
@@ -960,6 +1197,7 @@ static int _scif_send(scif_epd_t epd, void *msg, int len, int flags)
 		if (write_count) {
 			/* Best effort to send as much data as possible */
 			curr_xfer_len = min(len - sent_len, write_count);
+			old = qp->outbound_q.current_write_offset;
 			ret = scif_rb_write(&qp->outbound_q, msg,
 					    curr_xfer_len);
 			if (ret < 0)
@@ -968,14 +1206,17 @@ static int _scif_send(scif_epd_t epd, void *msg, int len, int flags)
 			scif_rb_commit(&qp->outbound_q);
 			/*
 			 * Send a notification to the peer about the
-			 * produced data message.
+			 * produced data message if it is waiting for one.
 			 */
-			notif_msg.src = ep->port;
-			notif_msg.uop = SCIF_CLIENT_SENT;
-			notif_msg.payload[0] = ep->remote_ep;
-			ret = _scif_nodeqp_send(ep->remote_dev, &notif_msg);
-			if (ret)
-				break;
+			if (scif_ep_need_sent(qp, old)) {
+				notif_msg.src = ep->port;
+				notif_msg.uop = SCIF_CLIENT_SENT;
+				notif_msg.payload[0] = ep->remote_ep;
+				ret = _scif_nodeqp_send(ep->remote_dev,
+							&notif_msg);
+				if (ret)
+					break;
+			}
 			sent_len += curr_xfer_len;
 			msg = msg + curr_xfer_len;
 			continue;
@@ -987,9 +1228,7 @@ static int _scif_send(scif_epd_t epd, void *msg, int len, int flags)
 		spin_unlock(&ep->lock);
 		/* Wait for a SCIF_CLIENT_RCVD message in the Blocking case */
 		ret =
-		wait_event_interruptible(ep->sendwq,
-					 (SCIFEP_CONNECTED != ep->state) ||
-					 (scif_rb_space(&qp->outbound_q) > 0));
+		wait_event_interruptible(ep->sendwq, scif_ep_send_ready(ep));
 		spin_lock(&ep->lock);
 		if (ret) {
 			ret = -EINTR;
@@ -1013,6 +1252,7 @@ static int _scif_recv(scif_epd_t epd, void *msg, int len, int flags)
 	int curr_recv_len = 0, remaining_len = len, read_count;
 	int ret = 0;
 	struct scif_qp *qp;
+	u32 old;
 
 	if (flags & SCIF_RECV_BLOCK)
 		might_sleep();
@@ -1029,6 +1269,7 @@ static int _scif_recv(scif_epd_t epd, void *msg, int len, int flags)
 			 * important for the Non Blocking case.
 			 */
 			curr_recv_len = min(remaining_len, read_count);
+			old = qp->inbound_q.current_read_offset;
 			read_size = scif_rb_get_next(&qp->inbound_q,
 						     msg, curr_recv_len);
 			if (ep->state == SCIFEP_CONNECTED) {
@@ -1042,15 +1283,18 @@ static int _scif_recv(scif_epd_t epd, void *msg, int len, int flags)
 				/*
 				 * Send a notification to the peer about the
 				 * consumed data message only if the EP is in
-				 * SCIFEP_CONNECTED state.
+				 * SCIFEP_CONNECTED state and the peer is
+				 * waiting for one.
 				 */
-				notif_msg.src = ep->port;
-				notif_msg.uop = SCIF_CLIENT_RCVD;
-				notif_msg.payload[0] = ep->remote_ep;
-				ret = _scif_nodeqp_send(ep->remote_dev,
-							&notif_msg);
-				if (ret)
-					break;
+				if (scif_ep_need_rcvd(qp, old)) {
+					notif_msg.src = ep->port;
+					notif_msg.uop = SCIF_CLIENT_RCVD;
+					notif_msg.payload[0] = ep->remote_ep;
+					ret = _scif_nodeqp_send(ep->remote_dev,
+								&notif_msg);
+					if (ret)
+						break;
+				}
 			}
 			remaining_len -= curr_recv_len;
 			msg = msg + curr_recv_len;
@@ -1074,9 +1318,7 @@ static int _scif_recv(scif_epd_t epd, void *msg, int len, int flags)
 		 * or until other side disconnects.
 		 */
 		ret =
-		wait_event_interruptible(ep->recvwq,
-					 SCIFEP_CONNECTED != ep->state ||
-					 scif_rb_count(&qp->inbound_q) > 0);
+		wait_event_interruptible(ep->recvwq, scif_ep_recv_ready(ep));
 		spin_lock(&ep->lock);
 		if (ret) {
 			ret = -EINTR;
@@ -1092,6 +1334,24 @@ static int _scif_recv(scif_epd_t epd, void *msg, int len, int flags)
 	return ret;
 }
 
+/*
+ * Size a bounce buffer after the RB it feeds or drains. The RB of an
+ * endpoint which is not connected yet is not known, so such an endpoint
+ * gets the default.
+ */
+static int scif_user_buf_size(struct scif_endpt *ep, bool send)
+{
+	struct scif_qp *qp;
+	u32 size = 0;
+
+	spin_lock(&ep->lock);
+	qp = ep->qp_info.qp;
+	if (qp && ep->state == SCIFEP_CONNECTED)
+		size = send ? qp->outbound_q.size : qp->inbound_q.size;
+	spin_unlock(&ep->lock);
+	return clamp_t(u32, size, SCIF_ENDPT_QP_SIZE, SCIF_USER_BUF_MAX);
+}
+
 /**
  * scif_user_send() - Send data to connection queue
  * @epd: The end point returned from scif_open()
@@ -1107,9 +1367,7 @@ int scif_user_send(scif_epd_t epd, void __user *msg, int len, int flags)
 	struct scif_endpt *ep = (struct scif_endpt *)epd;
 	int err = 0;
 	int sent_len = 0;
-	char *tmp;
 	int loop_len;
-	int chunk_len = min(len, (1 << (MAX_ORDER + PAGE_SHIFT - 1)));
 
 	dev_dbg(scif_info.mdev.this_device,
 		"SCIFAPI send (U): ep %p %s\n", ep, scif_ep_states[ep->state]);
@@ -1120,35 +1378,42 @@ int scif_user_send(scif_epd_t epd, void __user *msg, int len, int flags)
 	if (err)
 		goto send_err;
 
-	tmp = kmalloc(chunk_len, GFP_KERNEL);
-	if (!tmp) {
-		err = -ENOMEM;
-		goto send_err;
-	}
 	/*
 	 * Grabbing the lock before breaking up the transfer in
 	 * multiple chunks is required to ensure that messages do
 	 * not get fragmented and reordered.
 	 */
 	mutex_lock(&ep->sendlock);
+	/*
+	 * The bounce buffer lives as long as the endpoint. The copy into
+	 * the ring happens under ep->lock, so it cannot fault on the user
+	 * buffer directly.
+	 */
+	if (!ep->send_buf) {
+		ep->send_buf_size = scif_user_buf_size(ep, true);
+		ep->send_buf = kmalloc(ep->send_buf_size, GFP_KERNEL);
+		if (!ep->send_buf) {
+			err = -ENOMEM;
+			goto send_unlock;
+		}
+	}
 	while (sent_len != len) {
 		loop_len = len - sent_len;
-		loop_len = min(chunk_len, loop_len);
-		if (copy_from_user(tmp, msg, loop_len)) {
+		loop_len = min(ep->send_buf_size, loop_len);
+		if (copy_from_user(ep->send_buf, msg, loop_len)) {
 			err = -EFAULT;
-			goto send_free_err;
+			goto send_unlock;
 		}
-		err = _scif_send(epd, tmp, loop_len, flags);
+		err = _scif_send(epd, ep->send_buf, loop_len, flags);
 		if (err < 0)
-			goto send_free_err;
+			goto send_unlock;
 		sent_len += err;
 		msg += err;
 		if (err != loop_len)
-			goto send_free_err;
+			goto send_unlock;
 	}
-send_free_err:
+send_unlock:
 	mutex_unlock(&ep->sendlock);
-	kfree(tmp);
 send_err:
 	return err < 0 ? err : sent_len;
 }
@@ -1168,9 +1433,7 @@ int scif_user_recv(scif_epd_t epd, void __user *msg, int len, int flags)
 	struct scif_endpt *ep = (struct scif_endpt *)epd;
 	int err = 0;
 	int recv_len = 0;
-	char *tmp;
 	int loop_len;
-	int chunk_len = min(len, (1 << (MAX_ORDER + PAGE_SHIFT - 1)));
 
 	dev_dbg(scif_info.mdev.this_device,
 		"SCIFAPI recv (U): ep %p %s\n", ep, scif_ep_states[ep->state]);
@@ -1181,35 +1444,37 @@ int scif_user_recv(scif_epd_t epd, void __user *msg, int len, int flags)
 	if (err)
 		goto recv_err;
 
-	tmp = kmalloc(chunk_len, GFP_KERNEL);
-	if (!tmp) {
-		err = -ENOMEM;
-		goto recv_err;
-	}
 	/*
 	 * Grabbing the lock before breaking up the transfer in
 	 * multiple chunks is required to ensure that messages do
 	 * not get fragmented and reordered.
 	 */
 	mutex_lock(&ep->recvlock);
+	if (!ep->recv_buf) {
+		ep->recv_buf_size = scif_user_buf_size(ep, false);
+		ep->recv_buf = kmalloc(ep->recv_buf_size, GFP_KERNEL);
+		if (!ep->recv_buf) {
+			err = -ENOMEM;
+			goto recv_unlock;
+		}
+	}
 	while (recv_len != len) {
 		loop_len = len - recv_len;
-		loop_len = min(chunk_len, loop_len);
-		err = _scif_recv(epd, tmp, loop_len, flags);
+		loop_len = min(ep->recv_buf_size, loop_len);
+		err = _scif_recv(epd, ep->recv_buf, loop_len, flags);
 		if (err < 0)
-			goto recv_free_err;
-		if (copy_to_user(msg, tmp, err)) {
+			goto recv_unlock;
+		if (copy_to_user(msg, ep->recv_buf, err)) {
 			err = -EFAULT;
-			goto recv_free_err;
+			goto recv_unlock;
 		}
 		recv_len += err;
 		msg += err;
 		if (err != loop_len)
-			goto recv_free_err;
+			goto recv_unlock;
 	}
-recv_free_err:
+recv_unlock:
 	mutex_unlock(&ep->recvlock);
-	kfree(tmp);
 recv_err:
 	return err < 0 ? err : recv_len;
 }
@@ -1297,6 +1562,334 @@ int scif_recv(scif_epd_t epd, void *msg, int len, int flags)
 }
 EXPORT_SYMBOL_GPL(scif_recv);
 
+#define SCIF_MSG_BENCH_BYTES	(8 << 20)
+
+static const int scif_msg_bench_sizes[] = { 64, 1024, 16384 };
+
+/*
+ * A stream of @nr messages of @len bytes from @cep to @sep. The sender
+ * runs in the caller and the receiver in a work item, each blocking as
+ * a messaging application would.
+ */
+struct scif_msg_bench {
+	struct work_struct work;
+	scif_epd_t cep;
+	scif_epd_t sep;
+	void *rbuf;
+	int len;
+	int nr;
+	int err;
+};
+
+static void scif_msg_bench_recv(struct work_struct *work)
+{
+	struct scif_msg_bench *b = container_of(work, struct scif_msg_bench,
+						work);
+	int i, err = 0;
+
+	for (i = 0; i < b->nr && err >= 0; i++)
+		err = scif_recv(b->sep, b->rbuf, b->len, SCIF_RECV_BLOCK);
+	b->err = min(err, 0);
+}
+
+/*
+ * Send the stream with @send, which returns like scif_send(). Returns the
+ * time it took in ns or -errno. On a send error the sender endpoint is
+ * closed to end the receiver's wait.
+ */
+static s64 scif_msg_bench_stream(struct scif_msg_bench *b, void *buf,
+				 int (*send)(scif_epd_t, void *, int, int))
+{
+	ktime_t start;
+	s64 ns;
+	int i, err = 0;
+
+	INIT_WORK(&b->work, scif_msg_bench_recv);
+	start = ktime_get();
+	queue_work(system_unbound_wq, &b->work);
+	for (i = 0; i < b->nr && err >= 0; i++)
+		err = send(b->cep, buf, b->len, SCIF_SEND_BLOCK);
+	if (err < 0) {
+		scif_close(b->cep);
+		b->cep = NULL;
+	}
+	flush_work(&b->work);
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	if (err < 0 || b->err)
+		return err < 0 ? err : b->err;
+	return max_t(s64, ns, 1);
+}
+
+/*
+ * Make a connected endpoint notify on every chunk, as with a peer which
+ * does not support the event index. Both ends of a connection must be
+ * switched before any message is sent.
+ */
+static void scif_msg_bench_no_event_idx(scif_epd_t epd)
+{
+	struct scif_endpt *ep = (struct scif_endpt *)epd;
+
+	spin_lock(&ep->lock);
+	ep->qp_info.qp->event_idx = false;
+	spin_unlock(&ep->lock);
+}
+
+/* Notifications per 100 messages since @sent and @rcvd were read */
+static void scif_msg_bench_notif(long sent, long rcvd, int nr,
+				 long *sent_pct, long *rcvd_pct)
+{
+	sent = atomic_long_read(&scif_info.msg_stats.sent_notif) - sent;
+	rcvd = atomic_long_read(&scif_info.msg_stats.rcvd_notif) - rcvd;
+	*sent_pct = div_s64((s64)sent * 100, nr);
+	*rcvd_pct = div_s64((s64)rcvd * 100, nr);
+}
+
+/**
+ * scif_msg_bench() - Measure messaging notifications over loopback
+ * @s: seq_file the results are printed to
+ *
+ * Streams SCIF_MSG_BENCH_BYTES in messages of each size in
+ * scif_msg_bench_sizes between a pair of loopback endpoints, once with the
+ * event index negotiated at connect time and once with it turned off on
+ * both endpoints, as against a peer without it. Prints messages per
+ * second and the SCIF_CLIENT_SENT and SCIF_CLIENT_RCVD node messages sent
+ * per 100 messages. The counters are global, so other messaging traffic
+ * on the node shows up in the counts.
+ */
+int scif_msg_bench(struct seq_file *s)
+{
+	struct scif_msg_bench b = { .cep = NULL };
+	long sent, rcvd, sent_pct, rcvd_pct;
+	void *sbuf;
+	int mode, i, err = 0;
+	s64 ns;
+
+	sbuf = kzalloc(SZ_16K, GFP_KERNEL);
+	b.rbuf = kzalloc(SZ_16K, GFP_KERNEL);
+	if (!sbuf || !b.rbuf) {
+		err = -ENOMEM;
+		goto free;
+	}
+
+	if (!scif_info.msg_coalesce)
+		seq_puts(s, "msg_coalesce is off, nothing is suppressed\n");
+	seq_printf(s, "%-9s %6s %10s %8s %8s\n", "event_idx", "size",
+		   "msgs/s", "SENT%", "RCVD%");
+	for (mode = 1; mode >= 0; mode--) {
+		err = scif_loopback_connect(&b.cep, &b.sep);
+		if (err)
+			goto close;
+		if (!mode) {
+			scif_msg_bench_no_event_idx(b.cep);
+			scif_msg_bench_no_event_idx(b.sep);
+		}
+		for (i = 0; i < ARRAY_SIZE(scif_msg_bench_sizes); i++) {
+			b.len = scif_msg_bench_sizes[i];
+			b.nr = SCIF_MSG_BENCH_BYTES / b.len;
+			sent = atomic_long_read(&scif_info.msg_stats.sent_notif);
+			rcvd = atomic_long_read(&scif_info.msg_stats.rcvd_notif);
+			ns = scif_msg_bench_stream(&b, sbuf, scif_send);
+			if (ns < 0) {
+				err = ns;
+				goto close;
+			}
+			scif_msg_bench_notif(sent, rcvd, b.nr, &sent_pct,
+					     &rcvd_pct);
+			seq_printf(s, "%-9s %6d %10lld %8ld %8ld\n",
+				   mode ? "on" : "off", b.len,
+				   div64_s64((s64)b.nr * NSEC_PER_SEC, ns),
+				   sent_pct, rcvd_pct);
+		}
+		scif_close(b.sep);
+		scif_close(b.cep);
+		b.sep = NULL;
+		b.cep = NULL;
+	}
+close:
+	if (b.sep)
+		scif_close(b.sep);
+	if (b.cep)
+		scif_close(b.cep);
+free:
+	kfree(b.rbuf);
+	kfree(sbuf);
+	return err;
+}
+
+static const int scif_user_bench_sizes[] = { 64, 512, 4096, 65536 };
+
+static int scif_user_bench_send(scif_epd_t epd, void *msg, int len, int flags)
+{
+	return scif_user_send(epd, (void __user *)msg, len, flags);
+}
+
+/* scif_user_send() as it was, with a bounce buffer allocated per call */
+static int scif_user_bench_send_alloc(scif_epd_t epd, void *msg, int len,
+				      int flags)
+{
+	struct scif_endpt *ep = (struct scif_endpt *)epd;
+	void __user *umsg = (void __user *)msg;
+	int chunk_len = min(len, (1 << (MAX_ORDER + PAGE_SHIFT - 1)));
+	int sent_len = 0, loop_len, err = 0;
+	char *tmp;
+
+	tmp = kmalloc(chunk_len, GFP_KERNEL);
+	if (!tmp)
+		return -ENOMEM;
+	mutex_lock(&ep->sendlock);
+	while (sent_len != len) {
+		loop_len = min(chunk_len, len - sent_len);
+		if (copy_from_user(tmp, umsg, loop_len)) {
+			err = -EFAULT;
+			break;
+		}
+		err = _scif_send(epd, tmp, loop_len, flags);
+		if (err < 0)
+			break;
+		sent_len += err;
+		umsg += err;
+		if (err != loop_len)
+			break;
+	}
+	mutex_unlock(&ep->sendlock);
+	kfree(tmp);
+	return err < 0 ? err : sent_len;
+}
+
+/**
+ * scif_user_bench() - Measure scif_user_send() throughput over loopback
+ * @s: seq_file the results are printed to
+ *
+ * Streams SCIF_MSG_BENCH_BYTES from a buffer mapped into the reading
+ * process, in messages of each size in scif_user_bench_sizes, through
+ * scif_user_send() with its cached bounce buffer and through the per-call
+ * allocation it replaced. The receiver reads into a kernel buffer; the
+ * recv side caches its bounce buffer the same way.
+ */
+int scif_user_bench(struct seq_file *s)
+{
+	struct scif_msg_bench b = { .cep = NULL };
+	unsigned long ubuf;
+	s64 cached_ns, alloc_ns;
+	int i, err;
+
+	ubuf = vm_mmap(NULL, 0, SZ_64K, PROT_READ | PROT_WRITE,
+		       MAP_ANONYMOUS | MAP_PRIVATE, 0);
+	if (IS_ERR_VALUE(ubuf))
+		return ubuf;
+	b.rbuf = kzalloc(SZ_64K, GFP_KERNEL);
+	if (!b.rbuf) {
+		err = -ENOMEM;
+		goto free;
+	}
+	err = scif_loopback_connect(&b.cep, &b.sep);
+	if (err)
+		goto close;
+
+	seq_printf(s, "%6s %10s %10s\n", "size", "cached", "per-call");
+	for (i = 0; i < ARRAY_SIZE(scif_user_bench_sizes); i++) {
+		b.len = scif_user_bench_sizes[i];
+		b.nr = SCIF_MSG_BENCH_BYTES / b.len;
+		cached_ns = scif_msg_bench_stream(&b, (void *)ubuf,
+						  scif_user_bench_send);
+		if (cached_ns < 0) {
+			err = cached_ns;
+			goto close;
+		}
+		alloc_ns = scif_msg_bench_stream(&b, (void *)ubuf,
+						 scif_user_bench_send_alloc);
+		if (alloc_ns < 0) {
+			err = alloc_ns;
+			goto close;
+		}
+		seq_printf(s, "%6d %5lld MB/s %5lld MB/s\n", b.len,
+			   div64_s64((s64)SCIF_MSG_BENCH_BYTES * 1000,
+				     cached_ns),
+			   div64_s64((s64)SCIF_MSG_BENCH_BYTES * 1000,
+				     alloc_ns));
+	}
+close:
+	if (b.sep)
+		scif_close(b.sep);
+	if (b.cep)
+		scif_close(b.cep);
+free:
+	kfree(b.rbuf);
+	vm_munmap(ubuf, SZ_64K);
+	return err;
+}
+
+#define SCIF_RING_BENCH_BYTES	(64 << 20)
+
+static const int scif_ring_bench_sizes[] = { SZ_1K, SZ_64K };
+
+/**
+ * scif_ring_bench() - Measure messaging throughput against ring size
+ * @s: seq_file the results are printed to
+ *
+ * Connects a pair of loopback endpoints with each SCIF_OPT_RING_SIZE from
+ * 4KB to 4MB and streams SCIF_RING_BENCH_BYTES in messages of each size
+ * in scif_ring_bench_sizes. Prints the ring size actually allocated,
+ * which may be smaller than asked for, and MB/s per message size.
+ */
+int scif_ring_bench(struct seq_file *s)
+{
+	struct scif_msg_bench b = { .cep = NULL };
+	u64 ring_size, allocated;
+	void *sbuf;
+	int i, err = 0;
+	s64 ns;
+
+	sbuf = kzalloc(SZ_64K, GFP_KERNEL);
+	b.rbuf = kzalloc(SZ_64K, GFP_KERNEL);
+	if (!sbuf || !b.rbuf) {
+		err = -ENOMEM;
+		goto free;
+	}
+
+	seq_printf(s, "%8s %8s", "ring", "got");
+	for (i = 0; i < ARRAY_SIZE(scif_ring_bench_sizes); i++)
+		seq_printf(s, " %7d B", scif_ring_bench_sizes[i]);
+	seq_puts(s, "\n");
+	for (ring_size = SCIF_ENDPT_QP_SIZE; ring_size <= SCIF_ENDPT_QP_MAX_SIZE;
+	     ring_size <<= 2) {
+		err = __scif_loopback_connect(&b.cep, &b.sep, ring_size);
+		if (err)
+			goto close;
+		err = scif_getsockopt(b.sep, SCIF_OPT_RING_SIZE, &allocated);
+		if (err)
+			goto close;
+		seq_printf(s, "%6llu K %6llu K", ring_size >> 10,
+			   allocated >> 10);
+		for (i = 0; i < ARRAY_SIZE(scif_ring_bench_sizes); i++) {
+			b.len = scif_ring_bench_sizes[i];
+			b.nr = SCIF_RING_BENCH_BYTES / b.len;
+			ns = scif_msg_bench_stream(&b, sbuf, scif_send);
+			if (ns < 0) {
+				err = ns;
+				goto close;
+			}
+			seq_printf(s, " %4lld MB/s",
+				   div64_s64((s64)SCIF_RING_BENCH_BYTES * 1000,
+					     ns));
+		}
+		seq_puts(s, "\n");
+		scif_close(b.sep);
+		scif_close(b.cep);
+		b.sep = NULL;
+		b.cep = NULL;
+	}
+close:
+	if (b.sep)
+		scif_close(b.sep);
+	if (b.cep)
+		scif_close(b.cep);
+free:
+	kfree(b.rbuf);
+	kfree(sbuf);
+	return err;
+}
+
 #if (LINUX_VERSION_CODE >= KERNEL_VERSION(3, 10, 0))
 /* Delete macros when upstreaming */
 #define pt_set_qproc_null(pt) { pt->_qproc = NULL; }
@@ -1364,12 +1957,23 @@ __scif_pollfd(struct file *f, poll_table *wait, struct scif_endpt *ep)
 			_scif_poll_wait(f, &ep->sendwq, wait, ep);
 		if (ep->state == SCIFEP_CONNECTED ||
 		    ep->state == SCIFEP_DISCONNECTED) {
-			/* Data can be read without blocking */
-			if (scif_rb_count(&ep->qp_info.qp->inbound_q))
+			/*
+			 * Data can be read without blocking. Otherwise ask
+			 * the peer for a notification.
+			 */
+			if (poll_requested_events(wait) & POLLIN) {
+				if (scif_ep_arm_recv(ep))
+					mask |= POLLIN;
+			} else if (scif_rb_count(&ep->qp_info.qp->inbound_q)) {
 				mask |= POLLIN;
+			}
 			/* Data can be written without blocking */
-			if (scif_rb_space(&ep->qp_info.qp->outbound_q))
+			if (poll_requested_events(wait) & POLLOUT) {
+				if (scif_ep_arm_send(ep))
+					mask |= POLLOUT;
+			} else if (scif_rb_space(&ep->qp_info.qp->outbound_q)) {
 				mask |= POLLOUT;
+			}
 			/* Return POLLHUP if endpoint is disconnected */
 			if (ep->state == SCIFEP_DISCONNECTED)
 				mask |= POLLHUP;
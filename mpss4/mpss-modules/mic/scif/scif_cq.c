@@ -0,0 +1,417 @@
+/*
+ * Intel MIC Platform Software Stack (MPSS)
+ * Copyright (c) 2016, Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * Intel SCIF driver.
+ */
+#include <linux/seq_file.h>
+#include <linux/sizes.h>
+#include "scif_main.h"
+
+/*
+ * RMA completion queues.
+ *
+ * RMAs posted with scif_rma_post() are started without SCIF_RMA_SYNC and
+ * followed by a DMA interrupt descriptor on the channel of the endpoint.
+ * Its callback adds a completion carrying the cookie of the RMA to the
+ * completion queue of the endpoint. RMAs done by the CPU have completed by
+ * the time scif_rma_post() returns. A slot of the ring is reserved when an
+ * RMA is posted, so the ring never overflows: posting fails with -EAGAIN
+ * while depth RMAs are in flight or not reaped yet.
+ */
+
+/*
+ * struct scif_cq_req - An RMA waiting for its DMA interrupt descriptor
+ *
+ * @ep: Endpoint the RMA was posted on
+ * @cookie: Cookie of the RMA
+ */
+struct scif_cq_req {
+	struct scif_endpt *ep;
+	u64 cookie;
+};
+
+void scif_cq_init(struct scif_cq *cq)
+{
+	mutex_init(&cq->mutex);
+	spin_lock_init(&cq->lock);
+	cq->ring = NULL;
+	cq->depth = SCIF_CQ_DEFAULT_DEPTH;
+	cq->head = 0;
+	cq->count = 0;
+	cq->reserved = 0;
+	atomic_set(&cq->inflight, 0);
+	init_waitqueue_head(&cq->wq);
+}
+
+/* Called once the endpoint can be uninitialized, no DMA callback is left */
+void scif_cq_free(struct scif_cq *cq)
+{
+	kfree(cq->ring);
+	cq->ring = NULL;
+}
+
+int scif_cq_set_depth(struct scif_cq *cq, u64 depth)
+{
+	int err = 0;
+
+	if (!depth || depth > SCIF_CQ_MAX_DEPTH)
+		return -EINVAL;
+
+	mutex_lock(&cq->mutex);
+	/* The ring is sized on first use */
+	if (cq->ring)
+		err = -EBUSY;
+	else
+		cq->depth = depth;
+	mutex_unlock(&cq->mutex);
+	return err;
+}
+
+static int scif_cq_reserve(struct scif_cq *cq)
+{
+	int err = 0;
+
+	mutex_lock(&cq->mutex);
+	if (!cq->ring) {
+		cq->ring = kcalloc(cq->depth, sizeof(*cq->ring), GFP_KERNEL);
+		if (!cq->ring) {
+			err = -ENOMEM;
+			goto unlock;
+		}
+	}
+	spin_lock_irq(&cq->lock);
+	if (cq->reserved < cq->depth)
+		cq->reserved++;
+	else
+		err = -EAGAIN;
+	spin_unlock_irq(&cq->lock);
+unlock:
+	mutex_unlock(&cq->mutex);
+	return err;
+}
+
+static void scif_cq_unreserve(struct scif_cq *cq)
+{
+	spin_lock_irq(&cq->lock);
+	cq->reserved--;
+	spin_unlock_irq(&cq->lock);
+	/* A reaper may be waiting for the last outstanding RMA */
+	wake_up_interruptible(&cq->wq);
+}
+
+/* Fill a reserved slot, may be called from a DMA callback */
+static void scif_cq_complete(struct scif_cq *cq, u64 cookie, int status)
+{
+	struct scifioctl_cqe *cqe;
+	unsigned long flags;
+
+	spin_lock_irqsave(&cq->lock, flags);
+	cqe = &cq->ring[(cq->head + cq->count) % cq->depth];
+	cqe->cookie = cookie;
+	cqe->status = status;
+	cqe->reserved = 0;
+	cq->count++;
+	spin_unlock_irqrestore(&cq->lock, flags);
+	wake_up_interruptible(&cq->wq);
+}
+
+static void scif_cq_dma_cb(void *arg)
+{
+	struct scif_cq_req *req = arg;
+	struct scif_cq *cq = &req->ep->rma_info.cq;
+
+	scif_cq_complete(cq, req->cookie, 0);
+	kfree(req);
+	/* The endpoint may be freed once this drops to zero */
+	atomic_dec(&cq->inflight);
+}
+
+/* Complete @cookie once the DMA programmed so far is done */
+static int scif_cq_arm(struct scif_endpt *ep, u64 cookie)
+{
+	struct scif_cq *cq = &ep->rma_info.cq;
+	struct scif_cq_req *req;
+	dma_cookie_t dma_cookie;
+	int err;
+
+	req = kmalloc(sizeof(*req), GFP_KERNEL);
+	if (!req)
+		return -ENOMEM;
+	req->ep = ep;
+	req->cookie = cookie;
+
+	atomic_inc(&cq->inflight);
+	err = scif_prog_dma_intr(ep, scif_cq_dma_cb, req, &dma_cookie);
+	if (err) {
+		atomic_dec(&cq->inflight);
+		kfree(req);
+	}
+	return err;
+}
+
+/**
+ * scif_rma_post:
+ * @ep: endpoint
+ * @op: RMA to start
+ *
+ * Start an RMA whose completion is reported through the completion queue
+ * of @ep. Returns 0 if the RMA was started, in which case exactly one
+ * completion with its cookie follows, and -errno otherwise.
+ */
+int scif_rma_post(struct scif_endpt *ep, struct scifioctl_rma_op *op)
+{
+	struct scif_cq *cq = &ep->rma_info.cq;
+	int flags = op->flags & ~SCIF_RMA_SYNC;
+	int err;
+
+	err = scif_verify_epd(ep);
+	if (err)
+		return err;
+
+	err = scif_cq_reserve(cq);
+	if (err)
+		return err;
+
+	switch (op->op) {
+	case SCIF_RMA_OP_READFROM:
+		err = scif_readfrom(ep, op->loffset, op->len, op->roffset,
+				    flags);
+		break;
+	case SCIF_RMA_OP_WRITETO:
+		err = scif_writeto(ep, op->loffset, op->len, op->roffset,
+				   flags);
+		break;
+	case SCIF_RMA_OP_VREADFROM:
+		err = scif_vreadfrom(ep, (void __force *)op->addr, op->len,
+				     op->roffset, flags);
+		break;
+	case SCIF_RMA_OP_VWRITETO:
+		err = scif_vwriteto(ep, (void __force *)op->addr, op->len,
+				    op->roffset, flags);
+		break;
+	default:
+		err = -EINVAL;
+		break;
+	}
+	if (err) {
+		scif_cq_unreserve(cq);
+		return err;
+	}
+
+	/* CPU copies are done already, as are mgmt node loopback ones */
+	if ((flags & SCIF_RMA_USECPU) ||
+	    (scifdev_self(ep->remote_dev) && scif_is_mgmt_node()) ||
+	    !ep->rma_info.dma_chan) {
+		scif_cq_complete(cq, op->cookie, 0);
+		return 0;
+	}
+
+	/* The interrupt descriptor only follows the channel of the endpoint */
+	err = scif_wait_stripes(ep);
+	if (err) {
+		scif_cq_complete(cq, op->cookie, err);
+		return 0;
+	}
+
+	if (scif_cq_arm(ep, op->cookie)) {
+		/* No callback, wait for the DMA here instead */
+		err = scif_drain_dma_intr(ep->remote_dev->sdev,
+					  ep->rma_info.dma_chan);
+		scif_cq_complete(cq, op->cookie, err);
+	}
+	return 0;
+}
+
+static bool scif_cq_ready(struct scif_cq *cq)
+{
+	bool ready;
+
+	spin_lock_irq(&cq->lock);
+	/* Nothing will ever complete if nothing is outstanding */
+	ready = cq->count || !cq->reserved;
+	spin_unlock_irq(&cq->lock);
+	return ready;
+}
+
+/**
+ * scif_cq_reap:
+ * @ep: endpoint
+ * @cqes: array the completions are returned in
+ * @count: number of entries in @cqes
+ * @timeout: milliseconds to wait for a first completion, 0 not to wait
+ *	     and negative to wait indefinitely
+ *
+ * Returns the number of completions returned, which is 0 if none arrived
+ * in time or no RMA is outstanding, or -errno.
+ */
+int scif_cq_reap(struct scif_endpt *ep, struct scifioctl_cqe *cqes,
+		 int count, int timeout)
+{
+	struct scif_cq *cq = &ep->rma_info.cq;
+	long left;
+	int i, n;
+
+	if (count <= 0)
+		return -EINVAL;
+
+	if (timeout) {
+		left = timeout < 0 ? MAX_SCHEDULE_TIMEOUT :
+				     msecs_to_jiffies(timeout);
+		left = wait_event_interruptible_timeout(cq->wq,
+							scif_cq_ready(cq),
+							left);
+		if (left < 0)
+			return left;
+	}
+
+	spin_lock_irq(&cq->lock);
+	n = min(count, cq->count);
+	for (i = 0; i < n; i++) {
+		cqes[i] = cq->ring[cq->head];
+		cq->head = (cq->head + 1) % cq->depth;
+	}
+	cq->count -= n;
+	cq->reserved -= n;
+	spin_unlock_irq(&cq->lock);
+	return n;
+}
+
+#define SCIF_CQ_TEST_OPS	32
+#define SCIF_CQ_TEST_OP_LEN	SZ_64K
+#define SCIF_CQ_TEST_LEN	(SCIF_CQ_TEST_OPS * SCIF_CQ_TEST_OP_LEN)
+/* Half the RMAs fit in the queue, the others wait for a reap */
+#define SCIF_CQ_TEST_DEPTH	(SCIF_CQ_TEST_OPS / 2)
+
+/* Reap at least one completion, checking each cookie is seen once */
+static int scif_cq_test_reap(struct scif_endpt *ep, bool *seen)
+{
+	struct scifioctl_cqe cqes[SCIF_CQ_TEST_DEPTH];
+	int i, n;
+
+	n = scif_cq_reap(ep, cqes, ARRAY_SIZE(cqes), 1000);
+	if (n <= 0)
+		return n ? n : -ETIMEDOUT;
+	for (i = 0; i < n; i++) {
+		if (cqes[i].status)
+			return cqes[i].status;
+		if (cqes[i].cookie >= SCIF_CQ_TEST_OPS || seen[cqes[i].cookie])
+			return -EPROTO;
+		seen[cqes[i].cookie] = true;
+	}
+	return n;
+}
+
+/* Post the copy of src to dst as SCIF_CQ_TEST_OPS RMAs and reap them */
+static int scif_cq_test_run(struct seq_file *s, scif_epd_t epd,
+			    off_t loffset, off_t roffset, int flags,
+			    const char *name, const u8 *src, u8 *dst)
+{
+	struct scif_endpt *ep = (struct scif_endpt *)epd;
+	bool seen[SCIF_CQ_TEST_OPS] = { };
+	struct scifioctl_rma_op op;
+	int i, n, done = 0, full = 0, err;
+
+	memset(dst, 0, SCIF_CQ_TEST_LEN);
+	for (i = 0; i < SCIF_CQ_TEST_OPS; i++) {
+		op.loffset = loffset + i * SCIF_CQ_TEST_OP_LEN;
+		op.roffset = roffset + i * SCIF_CQ_TEST_OP_LEN;
+		op.len = SCIF_CQ_TEST_OP_LEN;
+		op.addr = 0;
+		op.cookie = i;
+		op.op = SCIF_RMA_OP_WRITETO;
+		op.flags = flags;
+		while ((err = scif_rma_post(ep, &op)) == -EAGAIN) {
+			full++;
+			n = scif_cq_test_reap(ep, seen);
+			if (n < 0)
+				return n;
+			done += n;
+		}
+		if (err)
+			return err;
+	}
+	while (done < SCIF_CQ_TEST_OPS) {
+		n = scif_cq_test_reap(ep, seen);
+		if (n < 0)
+			return n;
+		done += n;
+	}
+	if (memcmp(src, dst, SCIF_CQ_TEST_LEN))
+		return -EIO;
+	seq_printf(s, "%s: %d RMAs completed, %d posts found the queue full, data ok\n",
+		   name, done, full);
+	return 0;
+}
+
+/**
+ * scif_cq_selftest() - Check RMA completion queues over loopback
+ * @s: seq_file the results are printed to
+ *
+ * Posts writes between two registered kernel buffers on a queue of half
+ * their number, once with SCIF_RMA_USECPU and once with DMA, and checks
+ * that every cookie completes once and the data arrived.
+ */
+int scif_cq_selftest(struct seq_file *s)
+{
+	scif_epd_t cep = NULL, sep = NULL;
+	off_t loffset = -1, roffset = -1;
+	u8 *src, *dst;
+	int i, err;
+
+	src = vmalloc(SCIF_CQ_TEST_LEN);
+	dst = vmalloc(SCIF_CQ_TEST_LEN);
+	if (!src || !dst) {
+		err = -ENOMEM;
+		goto free;
+	}
+	for (i = 0; i < SCIF_CQ_TEST_LEN; i++)
+		src[i] = i * 7 + i / PAGE_SIZE;
+
+	err = scif_loopback_connect(&cep, &sep);
+	if (err)
+		goto close;
+	err = scif_setsockopt(cep, SCIF_OPT_CQ_DEPTH, SCIF_CQ_TEST_DEPTH);
+	if (err)
+		goto close;
+	loffset = scif_register(cep, src, SCIF_CQ_TEST_LEN, 0,
+				SCIF_PROT_READ | SCIF_PROT_WRITE,
+				SCIF_MAP_KERNEL);
+	roffset = scif_register(sep, dst, SCIF_CQ_TEST_LEN, 0,
+				SCIF_PROT_READ | SCIF_PROT_WRITE,
+				SCIF_MAP_KERNEL);
+	if (loffset < 0 || roffset < 0) {
+		err = loffset < 0 ? loffset : roffset;
+		goto close;
+	}
+
+	err = scif_cq_test_run(s, cep, loffset, roffset, SCIF_RMA_USECPU,
+			       "cpu", src, dst);
+	if (err)
+		goto close;
+	if (scif_is_mgmt_node())
+		seq_puts(s, "management node loopback copies with the CPU\n");
+	err = scif_cq_test_run(s, cep, loffset, roffset, 0, "dma", src, dst);
+close:
+	if (roffset >= 0)
+		scif_unregister(sep, roffset, SCIF_CQ_TEST_LEN);
+	if (loffset >= 0)
+		scif_unregister(cep, loffset, SCIF_CQ_TEST_LEN);
+	if (sep)
+		scif_close(sep);
+	if (cep)
+		scif_close(cep);
+free:
+	vfree(dst);
+	vfree(src);
+	return err;
+}
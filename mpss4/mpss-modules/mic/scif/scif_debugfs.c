@@ -96,6 +96,322 @@ static const struct file_operations scif_dev_ops = {
 	.release = scif_dev_release
 };
 
+static int scif_msg_info(struct seq_file *s, void *unused)
+{
+	seq_printf(s, "%-16s\t%-16s\t%-16s\n", "notification", "sent", "suppressed");
+	seq_printf(s, "%-16s\t%-16ld\t%-16ld\n", "CLIENT_SENT",
+		   atomic_long_read(&scif_info.msg_stats.sent_notif),
+		   atomic_long_read(&scif_info.msg_stats.sent_skip));
+	seq_printf(s, "%-16s\t%-16ld\t%-16ld\n", "CLIENT_RCVD",
+		   atomic_long_read(&scif_info.msg_stats.rcvd_notif),
+		   atomic_long_read(&scif_info.msg_stats.rcvd_skip));
+	return 0;
+}
+
+static int scif_msg_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, scif_msg_info, inode->i_private);
+}
+
+static int scif_msg_release(struct inode *inode, struct file *file)
+{
+	return single_release(inode, file);
+}
+
+static const struct file_operations scif_msg_ops = {
+	.owner   = THIS_MODULE,
+	.open    = scif_msg_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = scif_msg_release
+};
+
+static int scif_rma_cache_info(struct seq_file *s, void *unused)
+{
+	seq_printf(s, "%-16s\t%-16s\t%-16s\t%-16s\n",
+		   "hit", "miss", "reuse", "evict");
+	seq_printf(s, "%-16ld\t%-16ld\t%-16ld\t%-16ld\n",
+		   atomic_long_read(&scif_info.tc_stats.hit),
+		   atomic_long_read(&scif_info.tc_stats.miss),
+		   atomic_long_read(&scif_info.tc_stats.reuse),
+		   atomic_long_read(&scif_info.tc_stats.evict));
+	seq_printf(s, "%-16s\t%-16s\n", "striped", "stripes");
+	seq_printf(s, "%-16ld\t%-16ld\n",
+		   atomic_long_read(&scif_info.stripe_stats.rmas),
+		   atomic_long_read(&scif_info.stripe_stats.stripes));
+	return 0;
+}
+
+static int scif_rma_cache_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, scif_rma_cache_info, inode->i_private);
+}
+
+static int scif_rma_cache_release(struct inode *inode, struct file *file)
+{
+	return single_release(inode, file);
+}
+
+static const struct file_operations scif_rma_cache_ops = {
+	.owner   = THIS_MODULE,
+	.open    = scif_rma_cache_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = scif_rma_cache_release
+};
+
+/* Stream messages over loopback with and without the event index */
+static int scif_msg_bench_info(struct seq_file *s, void *unused)
+{
+	int err = scif_msg_bench(s);
+
+	if (err)
+		seq_printf(s, "failed (err %d)\n", err);
+	return 0;
+}
+
+static int scif_msg_bench_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, scif_msg_bench_info, inode->i_private);
+}
+
+static int scif_msg_bench_release(struct inode *inode, struct file *file)
+{
+	return single_release(inode, file);
+}
+
+static const struct file_operations scif_msg_bench_ops = {
+	.owner   = THIS_MODULE,
+	.open    = scif_msg_bench_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = scif_msg_bench_release
+};
+
+/* Stream messages from a user buffer over loopback */
+static int scif_user_bench_info(struct seq_file *s, void *unused)
+{
+	int err = scif_user_bench(s);
+
+	if (err)
+		seq_printf(s, "failed (err %d)\n", err);
+	return 0;
+}
+
+static int scif_user_bench_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, scif_user_bench_info, inode->i_private);
+}
+
+static int scif_user_bench_release(struct inode *inode, struct file *file)
+{
+	return single_release(inode, file);
+}
+
+static const struct file_operations scif_user_bench_ops = {
+	.owner   = THIS_MODULE,
+	.open    = scif_user_bench_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = scif_user_bench_release
+};
+
+/* Messaging throughput over loopback against the ring size */
+static int scif_ring_bench_info(struct seq_file *s, void *unused)
+{
+	int err = scif_ring_bench(s);
+
+	if (err)
+		seq_printf(s, "failed (err %d)\n", err);
+	return 0;
+}
+
+static int scif_ring_bench_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, scif_ring_bench_info, inode->i_private);
+}
+
+static int scif_ring_bench_release(struct inode *inode, struct file *file)
+{
+	return single_release(inode, file);
+}
+
+static const struct file_operations scif_ring_bench_ops = {
+	.owner   = THIS_MODULE,
+	.open    = scif_ring_bench_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = scif_ring_bench_release
+};
+
+/* Listener lookups and connects with thousands of listeners */
+static int scif_listen_bench_info(struct seq_file *s, void *unused)
+{
+	int err = scif_listen_bench(s);
+
+	if (err)
+		seq_printf(s, "failed (err %d)\n", err);
+	return 0;
+}
+
+static int scif_listen_bench_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, scif_listen_bench_info, inode->i_private);
+}
+
+static int scif_listen_bench_release(struct inode *inode, struct file *file)
+{
+	return single_release(inode, file);
+}
+
+static const struct file_operations scif_listen_bench_ops = {
+	.owner   = THIS_MODULE,
+	.open    = scif_listen_bench_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = scif_listen_bench_release
+};
+
+/* Wait for loopback traffic with scif_poll() and with a poll set */
+static int scif_pollset_bench_info(struct seq_file *s, void *unused)
+{
+	int err = scif_pollset_bench(s);
+
+	if (err)
+		seq_printf(s, "failed (err %d)\n", err);
+	return 0;
+}
+
+static int scif_pollset_bench_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, scif_pollset_bench_info, inode->i_private);
+}
+
+static int scif_pollset_bench_release(struct inode *inode, struct file *file)
+{
+	return single_release(inode, file);
+}
+
+static const struct file_operations scif_pollset_bench_ops = {
+	.owner   = THIS_MODULE,
+	.open    = scif_pollset_bench_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = scif_pollset_bench_release
+};
+
+/* Register contiguous and scattered kernel buffers over loopback */
+static int scif_reg_bench_info(struct seq_file *s, void *unused)
+{
+	int err = scif_rma_reg_bench(s);
+
+	if (err)
+		seq_printf(s, "failed (err %d)\n", err);
+	return 0;
+}
+
+static int scif_reg_bench_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, scif_reg_bench_info, inode->i_private);
+}
+
+static int scif_reg_bench_release(struct inode *inode, struct file *file)
+{
+	return single_release(inode, file);
+}
+
+static const struct file_operations scif_reg_bench_ops = {
+	.owner   = THIS_MODULE,
+	.open    = scif_reg_bench_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = scif_reg_bench_release
+};
+
+/* Striped RMA bandwidth against transfer size over loopback */
+static int scif_stripe_bench_info(struct seq_file *s, void *unused)
+{
+	int err = scif_dma_stripe_bench(s);
+
+	if (err)
+		seq_printf(s, "failed (err %d)\n", err);
+	return 0;
+}
+
+static int scif_stripe_bench_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, scif_stripe_bench_info, inode->i_private);
+}
+
+static int scif_stripe_bench_release(struct inode *inode, struct file *file)
+{
+	return single_release(inode, file);
+}
+
+static const struct file_operations scif_stripe_bench_ops = {
+	.owner   = THIS_MODULE,
+	.open    = scif_stripe_bench_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = scif_stripe_bench_release
+};
+
+/* Post RMAs on a completion queue over loopback and reap them */
+static int scif_cq_selftest_info(struct seq_file *s, void *unused)
+{
+	int err = scif_cq_selftest(s);
+
+	if (err)
+		seq_printf(s, "failed (err %d)\n", err);
+	return 0;
+}
+
+static int scif_cq_selftest_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, scif_cq_selftest_info, inode->i_private);
+}
+
+static int scif_cq_selftest_release(struct inode *inode, struct file *file)
+{
+	return single_release(inode, file);
+}
+
+static const struct file_operations scif_cq_selftest_ops = {
+	.owner   = THIS_MODULE,
+	.open    = scif_cq_selftest_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = scif_cq_selftest_release
+};
+
+/* Look up windows among 10k registered over loopback */
+static int scif_lookup_bench_info(struct seq_file *s, void *unused)
+{
+	int err = scif_rma_lookup_bench(s);
+
+	if (err)
+		seq_printf(s, "failed (err %d)\n", err);
+	return 0;
+}
+
+static int scif_lookup_bench_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, scif_lookup_bench_info, inode->i_private);
+}
+
+static int scif_lookup_bench_release(struct inode *inode, struct file *file)
+{
+	return single_release(inode, file);
+}
+
+static const struct file_operations scif_lookup_bench_ops = {
+	.owner   = THIS_MODULE,
+	.open    = scif_lookup_bench_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = scif_lookup_bench_release
+};
+
 static void scif_display_window(struct scif_window *window, struct seq_file *s)
 {
 	int j;
@@ -148,9 +464,9 @@ static int scif_rma_info(struct seq_file *s, void *unused)
 		ep = list_entry(pos, struct scif_endpt, list);
 		seq_printf(s, "ep %p self windows\n", ep);
 		mutex_lock(&ep->rma_info.rma_lock);
-		scif_display_all_windows(&ep->rma_info.reg_list, s);
+		scif_display_all_windows(&ep->rma_info.reg_list.list, s);
 		seq_printf(s, "ep %p remote windows\n", ep);
-		scif_display_all_windows(&ep->rma_info.remote_reg_list, s);
+		scif_display_all_windows(&ep->rma_info.remote_reg_list.list, s);
 		mutex_unlock(&ep->rma_info.rma_lock);
 	}
 	mutex_unlock(&scif_info.connlock);
@@ -186,8 +502,36 @@ void __init scif_init_debugfs(void)
 
 	debugfs_create_file("scif_dev", 0444, scif_dbg, NULL, &scif_dev_ops);
 	debugfs_create_file("scif_rma", 0400, scif_dbg, NULL, &scif_rma_ops);
+	debugfs_create_file("scif_msg", 0444, scif_dbg, NULL, &scif_msg_ops);
+	debugfs_create_file("msg_bench", 0400, scif_dbg, NULL,
+			    &scif_msg_bench_ops);
+	debugfs_create_file("user_msg_bench", 0400, scif_dbg, NULL,
+			    &scif_user_bench_ops);
+	debugfs_create_file("ring_bench", 0400, scif_dbg, NULL,
+			    &scif_ring_bench_ops);
+	debugfs_create_file("listen_bench", 0400, scif_dbg, NULL,
+			    &scif_listen_bench_ops);
+	debugfs_create_file("pollset_bench", 0400, scif_dbg, NULL,
+			    &scif_pollset_bench_ops);
+	debugfs_create_file("reg_bench", 0400, scif_dbg, NULL,
+			    &scif_reg_bench_ops);
+	debugfs_create_file("stripe_bench", 0400, scif_dbg, NULL,
+			    &scif_stripe_bench_ops);
+	debugfs_create_file("cq_selftest", 0400, scif_dbg, NULL,
+			    &scif_cq_selftest_ops);
+	debugfs_create_file("lookup_bench", 0400, scif_dbg, NULL,
+			    &scif_lookup_bench_ops);
 	debugfs_create_u8("en_msg_log", 0600, scif_dbg, &scif_info.en_msg_log);
 	debugfs_create_u8("p2p_enable", 0644, scif_dbg, &scif_info.p2p_enable);
+	debugfs_create_u8("msg_coalesce", 0644, scif_dbg, &scif_info.msg_coalesce);
+	debugfs_create_file("scif_rma_cache", 0444, scif_dbg, NULL,
+			    &scif_rma_cache_ops);
+	debugfs_create_ulong("rma_tc_limit", 0644, scif_dbg,
+			     &scif_info.rma_tc_limit);
+	debugfs_create_ulong("rma_tc_proc_limit", 0644, scif_dbg,
+			     &scif_info.rma_tc_proc_limit);
+	debugfs_create_ulong("rma_stripe_min", 0644, scif_dbg,
+			     &scif_info.rma_stripe_min);
 }
 
 void scif_exit_debugfs(void)
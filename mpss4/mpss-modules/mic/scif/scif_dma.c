@@ -14,6 +14,8 @@
  * Intel SCIF driver.
  */
 #include <asm/processor.h>
+#include <linux/seq_file.h>
+#include <linux/sizes.h>
 #include "scif_main.h"
 #include "scif_map.h"
 
@@ -88,7 +90,7 @@ struct scif_copy_work {
  */
 int scif_reserve_dma_chan(struct scif_endpt *ep)
 {
-	int err = 0;
+	int err = 0, idx;
 	struct scif_dev *scifdev;
 	struct scif_hw_dev *sdev;
 	struct dma_chan *chan;
@@ -103,10 +105,12 @@ int scif_reserve_dma_chan(struct scif_endpt *ep)
 	sdev = scifdev->sdev;
 	if (!sdev->num_dma_ch)
 		return -ENODEV;
-	chan = sdev->dma_ch[scifdev->dma_ch_idx];
-	scifdev->dma_ch_idx = (scifdev->dma_ch_idx + 1) % sdev->num_dma_ch;
+	idx = scifdev->dma_ch_idx;
+	chan = sdev->dma_ch[idx];
+	scifdev->dma_ch_idx = (idx + 1) % sdev->num_dma_ch;
 	mutex_lock(&ep->rma_info.rma_lock);
 	ep->rma_info.dma_chan = chan;
+	ep->rma_info.dma_ch_idx = idx;
 	ep->rma_info.signal_pool = sdev->signal_pool;
 	mutex_unlock(&ep->rma_info.rma_lock);
 	return err;
@@ -123,27 +127,12 @@ void __scif_rma_destroy_tcw(struct scif_mmu_notif *mmn,
 			    struct scif_endpt *ep,
 			    u64 start, u64 len)
 {
-	struct list_head *item, *tmp;
-	struct scif_window *window;
-	u64 start_va, end_va;
 	u64 end = start + len;
 
 	if (end <= start)
 		return;
 
-	list_for_each_safe(item, tmp, &mmn->tc_reg_list) {
-		window = list_entry(item, struct scif_window, list);
-		ep = (struct scif_endpt *)window->ep;
-		if (!len)
-			break;
-		start_va = window->va_for_temp;
-		end_va = start_va + (window->nr_pages << PAGE_SHIFT);
-		if (start < start_va && end <= start_va)
-			break;
-		if (start >= end_va)
-			continue;
-		__scif_rma_destroy_tcw_helper(window);
-	}
+	scif_rma_list_destroy_tcw(&mmn->tc_reg_list, start, end);
 }
 
 static void scif_rma_destroy_tcw(struct scif_mmu_notif *mmn, u64 start, u64 len)
@@ -151,6 +140,7 @@ static void scif_rma_destroy_tcw(struct scif_mmu_notif *mmn, u64 start, u64 len)
 	struct scif_endpt *ep = mmn->ep;
 
 	spin_lock(&ep->rma_info.tc_lock);
+	mmn->inval_seq++;
 	__scif_rma_destroy_tcw(mmn, ep, start, len);
 	spin_unlock(&ep->rma_info.tc_lock);
 }
@@ -166,35 +156,41 @@ static void scif_rma_destroy_tcw_ep(struct scif_endpt *ep)
 	}
 }
 
-static void __scif_rma_destroy_tcw_ep(struct scif_endpt *ep)
+/*
+ * scif_rma_tc_make_room:
+ *
+ * Evict the least recently used temporary cached windows of ep until
+ * nr_pages more fit in both the endpoint and the per process budget. Only
+ * windows of the process of mmn count against its own budget, windows
+ * cached on its other endpoints are left alone. Returns false if the window
+ * should not be cached. tc_lock must be held.
+ */
+static bool scif_rma_tc_make_room(struct scif_endpt *ep,
+				  struct scif_mmu_notif *mmn, int nr_pages)
 {
-	struct list_head *item, *tmp;
-	struct scif_mmu_notif *mmn;
-
-	spin_lock(&ep->rma_info.tc_lock);
-	list_for_each_safe(item, tmp, &ep->rma_info.mmn_list) {
-		mmn = list_entry(item, struct scif_mmu_notif, list);
-		__scif_rma_destroy_tcw(mmn, ep, 0, ULONG_MAX);
-	}
-	spin_unlock(&ep->rma_info.tc_lock);
-}
+	struct scif_endpt_rma_info *rma = &ep->rma_info;
+	struct scif_window *window, *tmp;
+	bool ep_full, proc_full;
 
-static bool scif_rma_tc_can_cache(struct scif_endpt *ep, size_t cur_bytes)
-{
-	if ((cur_bytes >> PAGE_SHIFT) > scif_info.rma_tc_limit)
+	lockdep_assert_held(&rma->tc_lock);
+	if (nr_pages > scif_info.rma_tc_limit ||
+	    nr_pages > scif_info.rma_tc_proc_limit)
 		return false;
-	if ((atomic_read(&ep->rma_info.tcw_total_pages)
-			+ (cur_bytes >> PAGE_SHIFT)) >
-			scif_info.rma_tc_limit) {
-		dev_info(scif_info.mdev.this_device,
-			 "%s %d total=%d, current=%zu reached max\n",
-			 __func__, __LINE__,
-			 atomic_read(&ep->rma_info.tcw_total_pages),
-			 (1 + (cur_bytes >> PAGE_SHIFT)));
-		scif_rma_destroy_tcw_invalid();
-		__scif_rma_destroy_tcw_ep(ep);
+
+	list_for_each_entry_safe(window, tmp, &rma->tc_lru, lru) {
+		ep_full = rma->tc_pages + nr_pages > scif_info.rma_tc_limit;
+		proc_full = atomic_read(&mmn->proc->nr_pages) + nr_pages >
+				scif_info.rma_tc_proc_limit;
+		if (!ep_full && !proc_full)
+			return true;
+		if (!ep_full && scif_tcw_mmn(window)->proc != mmn->proc)
+			continue;
+		__scif_rma_destroy_tcw_helper(window);
+		atomic_long_inc(&scif_info.tc_stats.evict);
 	}
-	return true;
+	return rma->tc_pages + nr_pages <= scif_info.rma_tc_limit &&
+		atomic_read(&mmn->proc->nr_pages) + nr_pages <=
+			scif_info.rma_tc_proc_limit;
 }
 
 static void scif_mmu_notifier_release(struct mmu_notifier *mn,
@@ -255,6 +251,50 @@ static const struct mmu_notifier_ops scif_mmu_notifier_ops = {
 	.invalidate_range_start = scif_mmu_notifier_invalidate_range_start,
 	.invalidate_range_end = scif_mmu_notifier_invalidate_range_end};
 
+/*
+ * Registration cache usage is shared by all endpoints a process caches
+ * windows on. Entries are keyed by mm, which the MMU notifiers of the
+ * users keep alive.
+ */
+static struct scif_tc_proc *scif_get_tc_proc(struct mm_struct *mm)
+{
+	struct scif_tc_proc *proc, *new;
+
+	new = kzalloc(sizeof(*new), GFP_KERNEL);
+	spin_lock(&scif_info.rmalock);
+	list_for_each_entry(proc, &scif_info.tc_procs, list) {
+		if (proc->mm == mm) {
+			proc->users++;
+			goto unlock;
+		}
+	}
+	proc = new;
+	new = NULL;
+	if (proc) {
+		proc->mm = mm;
+		proc->users = 1;
+		atomic_set(&proc->nr_pages, 0);
+		list_add(&proc->list, &scif_info.tc_procs);
+	}
+unlock:
+	spin_unlock(&scif_info.rmalock);
+	kfree(new);
+	return proc;
+}
+
+static void scif_put_tc_proc(struct scif_tc_proc *proc)
+{
+	spin_lock(&scif_info.rmalock);
+	if (--proc->users) {
+		proc = NULL;
+	} else {
+		WARN_ON(atomic_read(&proc->nr_pages));
+		list_del(&proc->list);
+	}
+	spin_unlock(&scif_info.rmalock);
+	kfree(proc);
+}
+
 static void scif_ep_unregister_mmu_notifier(struct scif_endpt *ep)
 {
 	struct scif_endpt_rma_info *rma = &ep->rma_info;
@@ -266,6 +306,7 @@ static void scif_ep_unregister_mmu_notifier(struct scif_endpt *ep)
 		mmn = list_entry(item, struct scif_mmu_notif, list);
 		mmu_notifier_unregister(&mmn->ep_mmu_notifier, mmn->mm);
 		list_del(item);
+		scif_put_tc_proc(mmn->proc);
 		kfree(mmn);
 	}
 	mutex_unlock(&ep->rma_info.mmn_lock);
@@ -278,7 +319,7 @@ static void scif_init_mmu_notifier(struct scif_mmu_notif *mmn,
 	mmn->mm = mm;
 	mmn->ep_mmu_notifier.ops = &scif_mmu_notifier_ops;
 	INIT_LIST_HEAD(&mmn->list);
-	INIT_LIST_HEAD(&mmn->tc_reg_list);
+	scif_init_window_list(&mmn->tc_reg_list, true);
 }
 
 static struct scif_mmu_notif *
@@ -302,13 +343,19 @@ scif_add_mmu_notifier(struct mm_struct *mm, struct scif_endpt *ep)
 		 = kzalloc(sizeof(*mmn), GFP_KERNEL);
 
 	if (!mmn)
-		return ERR_PTR(ENOMEM);
+		return ERR_PTR(-ENOMEM);
 
 	scif_init_mmu_notifier(mmn, current->mm, ep);
+	mmn->proc = scif_get_tc_proc(current->mm);
+	if (!mmn->proc) {
+		kfree(mmn);
+		return ERR_PTR(-ENOMEM);
+	}
 	if (mmu_notifier_register(&mmn->ep_mmu_notifier,
 				  current->mm)) {
+		scif_put_tc_proc(mmn->proc);
 		kfree(mmn);
-		return ERR_PTR(EBUSY);
+		return ERR_PTR(-EBUSY);
 	}
 	list_add(&mmn->list, &ep->rma_info.mmn_list);
 	return mmn;
@@ -362,7 +409,8 @@ static bool scif_is_usecache_set(int flags)
 	return false;
 }
 
-static bool scif_rma_tc_can_cache(struct scif_endpt *ep, size_t cur_bytes)
+static bool scif_rma_tc_make_room(struct scif_endpt *ep,
+				  struct scif_mmu_notif *mmn, int nr_pages)
 {
 	return false;
 }
@@ -373,6 +421,8 @@ static bool scif_rma_tc_can_cache(struct scif_endpt *ep, size_t cur_bytes)
  * @epd: End Point Descriptor.
  * @addr: virtual address to/from which to copy
  * @len: length of range to copy
+ * @reuse: pinned pages of an overlapping cached window, may be NULL
+ * @reuse_va: virtual address the pages in @reuse start at
  * @out_offset: computed offset returned by reference.
  * @out_window: allocated registered window returned by reference.
  *
@@ -381,6 +431,7 @@ static bool scif_rma_tc_can_cache(struct scif_endpt *ep, size_t cur_bytes)
  */
 static int
 scif_register_temp(scif_epd_t epd, unsigned long addr, size_t len, int prot,
+		   struct scif_pinned_pages *reuse, unsigned long reuse_va,
 		   off_t *out_offset, struct scif_window **out_window)
 {
 	struct scif_endpt *ep = (struct scif_endpt *)epd;
@@ -390,8 +441,8 @@ scif_register_temp(scif_epd_t epd, unsigned long addr, size_t len, int prot,
 
 	aligned_len = ALIGN(len, PAGE_SIZE);
 
-	err = __scif_pin_pages((void *)(addr & PAGE_MASK),
-			       aligned_len, &prot, 0, &pinned_pages, NULL);
+	err = scif_pin_temp_pages(addr & PAGE_MASK, aligned_len, &prot,
+				  reuse, reuse_va, &pinned_pages);
 	if (err)
 		return err;
 
@@ -634,8 +685,9 @@ restart:
 		list_del_init(&window->list);
 		spin_unlock(&scif_info.rmalock);
 		if (!chan || !scifdev_alive(ep) ||
-		    !scif_drain_dma_intr(ep->remote_dev->sdev,
-					 ep->rma_info.dma_chan))
+		    (!scif_drain_dma_intr(ep->remote_dev->sdev,
+					  ep->rma_info.dma_chan) &&
+		     !scif_wait_stripes(ep)))
 		{
 			if (window->type == SCIF_WINDOW_SELF)
 				scif_destroy_window(ep, window);
@@ -676,8 +728,9 @@ restart:
 		spin_unlock(&scif_info.rmalock);
 		mutex_lock(&ep->rma_info.rma_lock);
 		if (!chan || !scifdev_alive(ep) ||
-		    !scif_drain_dma_intr(ep->remote_dev->sdev,
-					 ep->rma_info.dma_chan)) {
+		    (!scif_drain_dma_intr(ep->remote_dev->sdev,
+					  ep->rma_info.dma_chan) &&
+		     !scif_wait_stripes(ep))) {
 			atomic_sub(window->nr_pages,
 				   &ep->rma_info.tcw_total_pages);
 			scif_destroy_window(ep, window);
@@ -1674,6 +1727,139 @@ error:
 	return -ENOMEM;
 }
 
+/*
+ * scif_rma_stripe_chans:
+ *
+ * Pick the DMA channels a copy is striped across, the channel of the
+ * endpoint first followed by the next ones of the same DMA device. Copies
+ * which are short, ordered or need bounce buffers are not striped. CPU
+ * copies are split as asked for, the channels are not used then.
+ * Returns the number of stripes.
+ */
+static int scif_rma_stripe_chans(struct scif_endpt *ep,
+				 struct scif_copy_work *work, int flags,
+				 struct dma_chan **chans)
+{
+	struct scif_endpt_rma_info *rma = &ep->rma_info;
+	struct scif_hw_dev *sdev;
+	struct dma_chan *chan;
+	int nr = rma->nr_stripes, i;
+
+	chans[0] = rma->dma_chan;
+	if (nr == 1 || work->ordered || work->len < scif_info.rma_stripe_min)
+		return 1;
+	nr = min_t(size_t, nr, DIV_ROUND_UP(work->len, PAGE_SIZE));
+	if (flags & SCIF_RMA_USECPU)
+		return nr;
+	if (!chans[0] ||
+	    (!is_dma_copy_aligned(chans[0]->device, 1, 1, 1) &&
+	     ((work->src_offset ^ work->dst_offset) & (L1_CACHE_BYTES - 1))))
+		return 1;
+
+	sdev = scif_info.nodeid ? scif_dev[0].sdev : ep->remote_dev->sdev;
+	nr = min(nr, sdev->num_dma_ch);
+	for (i = 1; i < nr; i++) {
+		chan = sdev->dma_ch[(rma->dma_ch_idx + i) % sdev->num_dma_ch];
+		/* The windows are mapped for the device of the first channel */
+		if (chan->device != chans[0]->device)
+			break;
+		chans[i] = chan;
+	}
+	return i;
+}
+
+static void scif_stripe_done_cb(void *arg)
+{
+	struct scif_endpt *ep = arg;
+
+	if (atomic_dec_and_test(&ep->rma_info.stripes))
+		wake_up(&ep->rma_info.stripewq);
+}
+
+/**
+ * scif_wait_stripes:
+ * @ep: end point
+ *
+ * Wait for the stripes which striped RMAs of @ep programmed on DMA
+ * channels other than its own one. Returns 0 or -ETIMEDOUT.
+ */
+int scif_wait_stripes(struct scif_endpt *ep)
+{
+	if (!wait_event_timeout(ep->rma_info.stripewq,
+				!atomic_read(&ep->rma_info.stripes),
+				SCIF_NODE_ALIVE_TIMEOUT))
+		return -ETIMEDOUT;
+	return 0;
+}
+
+/*
+ * scif_rma_copy_stripes:
+ *
+ * Program a copy as up to SCIF_OPT_DMA_CHANNELS stripes of whole pages,
+ * each on its own DMA channel. Every stripe on a channel other than the
+ * one of the endpoint is followed by an interrupt descriptor which drops
+ * rma_info.stripes once it is done. Fences, marks, SYNC transfers and
+ * window teardown wait for that count besides draining the channel of the
+ * endpoint, so the copy itself returns without waiting. RMA lock must be
+ * held.
+ */
+static int scif_rma_copy_stripes(struct scif_endpt *ep,
+				 struct scif_copy_work *work, int flags,
+				 off_t loffset)
+{
+	struct dma_chan *chans[SCIF_MAX_STRIPES];
+	struct scif_copy_work stripe;
+	size_t stripe_len, len, done = 0;
+	dma_cookie_t cookie;
+	int nr, i, err = 0;
+
+	nr = scif_rma_stripe_chans(ep, work, flags, chans);
+	if (nr == 1) {
+		if (flags & SCIF_RMA_USECPU)
+			return scif_rma_list_cpu_copy(work);
+		return scif_rma_list_dma_copy_wrapper(ep, work, chans[0],
+						      loffset);
+	}
+
+	stripe_len = ALIGN(DIV_ROUND_UP(work->len, nr), PAGE_SIZE);
+	for (i = 0; i < nr && done < work->len; i++) {
+		len = min(stripe_len, work->len - done);
+		stripe = *work;
+		stripe.src_offset += done;
+		stripe.dst_offset += done;
+		stripe.len = len;
+		if (flags & SCIF_RMA_USECPU)
+			err = scif_rma_list_cpu_copy(&stripe);
+		else
+			err = scif_rma_list_dma_copy_wrapper(ep, &stripe,
+							     chans[i],
+							     loffset + done);
+		if (err)
+			break;
+		/* Bounce buffers complete through an interrupt descriptor */
+		if (!i)
+			work->fence_type = stripe.fence_type;
+		done += len;
+		if (!i || (flags & SCIF_RMA_USECPU))
+			continue;
+
+		atomic_inc(&ep->rma_info.stripes);
+		err = scif_prog_chan_intr(ep, chans[i], scif_stripe_done_cb,
+					  ep, &cookie);
+		if (err) {
+			atomic_dec(&ep->rma_info.stripes);
+			/* Nothing would tell when it is done, wait here */
+			err = scif_drain_dma_intr(ep->remote_dev->sdev,
+						  chans[i]);
+			if (err)
+				break;
+		}
+	}
+	atomic_long_inc(&scif_info.stripe_stats.rmas);
+	atomic_long_add(i, &scif_info.stripe_stats.stripes);
+	return err;
+}
+
 /**
  * scif_rma_copy:
  * @epd: end point descriptor.
@@ -1700,7 +1886,6 @@ static int scif_rma_copy(scif_epd_t epd, off_t loffset, unsigned long addr,
 	struct scif_copy_work copy_work;
 	bool loopback;
 	int err = 0;
-	struct dma_chan *chan;
 	struct scif_mmu_notif *mmn = NULL;
 	bool cache = false;
 	struct device *spdev;
@@ -1745,48 +1930,63 @@ static int scif_rma_copy(scif_epd_t epd, off_t loffset, unsigned long addr,
 		mutex_lock(&ep->rma_info.mmn_lock);
 		mmn = scif_find_mmu_notifier(current->mm, &ep->rma_info);
 		if (!mmn)
-			scif_add_mmu_notifier(current->mm, ep);
+			mmn = scif_add_mmu_notifier(current->mm, ep);
 		mutex_unlock(&ep->rma_info.mmn_lock);
 		if (IS_ERR(mmn)) {
 			scif_put_peer_dev(spdev);
 			return PTR_ERR(mmn);
 		}
-		cache = cache && !scif_rma_tc_can_cache(ep, len);
+		cache = !!mmn;
 	}
 	mutex_lock(&ep->rma_info.rma_lock);
 	if (addr) {
+		unsigned long inval_seq = 0;
+
 		req.out_window = &local_window;
 		req.nr_bytes = ALIGN(len + (addr & ~PAGE_MASK),
 				     PAGE_SIZE);
 		req.va_for_temp = addr & PAGE_MASK;
 		req.prot = (dir == SCIF_LOCAL_TO_REMOTE ?
 			    VM_READ : VM_WRITE | VM_READ);
+		req.reuse = NULL;
 		/* Does a valid local window exist? */
 		if (mmn) {
 			spin_lock(&ep->rma_info.tc_lock);
 			req.head = &mmn->tc_reg_list;
 			err = scif_query_tcw(ep, &req);
+			inval_seq = mmn->inval_seq;
 			spin_unlock(&ep->rma_info.tc_lock);
 		}
 		if (!mmn || err) {
 			err = scif_register_temp(epd, req.va_for_temp,
 						 req.nr_bytes, req.prot,
+						 req.reuse, req.reuse_va,
 						 &loffset, &local_window);
+			if (req.reuse)
+				scif_unpin_pages(req.reuse);
 			if (err) {
 				mutex_unlock(&ep->rma_info.rma_lock);
 				goto error;
 			}
 			if (!cache)
 				goto skip_cache;
-			atomic_inc(&ep->rma_info.tcw_refcount);
-			atomic_add_return(local_window->nr_pages,
-					  &ep->rma_info.tcw_total_pages);
-			if (mmn) {
-				spin_lock(&ep->rma_info.tc_lock);
+			/*
+			 * Make room for the new window unless the range was
+			 * invalidated while it was being pinned, in which case
+			 * it is only used for this transfer.
+			 */
+			spin_lock(&ep->rma_info.tc_lock);
+			cache = mmn->inval_seq == inval_seq &&
+				scif_rma_tc_make_room(ep, mmn,
+						      local_window->nr_pages);
+			if (cache) {
+				atomic_inc(&ep->rma_info.tcw_refcount);
+				atomic_add(local_window->nr_pages,
+					   &ep->rma_info.tcw_total_pages);
 				scif_insert_tcw(local_window,
 						&mmn->tc_reg_list);
-				spin_unlock(&ep->rma_info.tc_lock);
 			}
+			spin_unlock(&ep->rma_info.tc_lock);
 		}
 skip_cache:
 		loffset = local_window->offset +
@@ -1836,13 +2036,7 @@ skip_cache:
 		copy_work.dst_window = local_window;
 	}
 
-	if (flags & SCIF_RMA_USECPU) {
-		scif_rma_list_cpu_copy(&copy_work);
-	} else {
-		chan = ep->rma_info.dma_chan;
-		err = scif_rma_list_dma_copy_wrapper(epd, &copy_work,
-						     chan, loffset);
-	}
+	err = scif_rma_copy_stripes(ep, &copy_work, flags, loffset);
 	if (addr && !cache)
 		atomic_inc(&ep->rma_info.tw_refcount);
 
@@ -1857,6 +2051,8 @@ skip_cache:
 		else if (copy_work.fence_type == SCIF_DMA_INTR)
 			err = scif_drain_dma_intr(rdev->sdev,
 						  ep->rma_info.dma_chan);
+		if (copy_work.fence_type && !err)
+			err = scif_wait_stripes(ep);
 	}
 
 	if (addr && !cache)
@@ -1992,3 +2188,105 @@ vwriteto_err:
 	return err;
 }
 EXPORT_SYMBOL_GPL(scif_vwriteto);
+
+#define SCIF_STRIPE_BENCH_LEN	(16 * SZ_1M)
+/* Bytes copied for each size and channel count */
+#define SCIF_STRIPE_BENCH_BYTES	(256 * SZ_1M)
+
+static const int scif_stripe_bench_chans[] = { 1, 2, 4, 8 };
+
+/* SCIF_RMA_SYNC writes of @len bytes, returns MB/s or -errno */
+static long scif_stripe_bench_run(scif_epd_t epd, off_t loffset,
+				  off_t roffset, size_t len, int nr_chans)
+{
+	int rounds = max_t(int, SCIF_STRIPE_BENCH_BYTES / len, 4);
+	ktime_t start;
+	s64 ns;
+	int r, err;
+
+	err = scif_setsockopt(epd, SCIF_OPT_DMA_CHANNELS, nr_chans);
+	if (err)
+		return err;
+	start = ktime_get();
+	for (r = 0; r < rounds; r++) {
+		err = scif_writeto(epd, loffset, len, roffset, SCIF_RMA_SYNC);
+		if (err)
+			return err;
+	}
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	return div64_s64((s64)rounds * len * 1000, max_t(s64, ns, 1));
+}
+
+/**
+ * scif_dma_stripe_bench() - Measure striped RMA bandwidth over loopback
+ * @s: seq_file the results are printed to
+ *
+ * Writes between two registered kernel buffers with SCIF_OPT_DMA_CHANNELS
+ * set to 1, 2, 4 and 8 for transfer sizes from 64 KB up. Copies shorter
+ * than rma_stripe_min are never striped.
+ */
+int scif_dma_stripe_bench(struct seq_file *s)
+{
+	scif_epd_t cep = NULL, sep = NULL;
+	void *src, *dst;
+	off_t loffset = -1, roffset = -1;
+	size_t len;
+	long mbps;
+	int i, err;
+
+	src = vzalloc(SCIF_STRIPE_BENCH_LEN);
+	dst = vzalloc(SCIF_STRIPE_BENCH_LEN);
+	if (!src || !dst) {
+		err = -ENOMEM;
+		goto free;
+	}
+	err = scif_loopback_connect(&cep, &sep);
+	if (err)
+		goto close;
+	loffset = scif_register(cep, src, SCIF_STRIPE_BENCH_LEN, 0,
+				SCIF_PROT_READ | SCIF_PROT_WRITE,
+				SCIF_MAP_KERNEL);
+	roffset = scif_register(sep, dst, SCIF_STRIPE_BENCH_LEN, 0,
+				SCIF_PROT_READ | SCIF_PROT_WRITE,
+				SCIF_MAP_KERNEL);
+	if (loffset < 0 || roffset < 0) {
+		err = loffset < 0 ? loffset : roffset;
+		goto close;
+	}
+
+	if (scif_is_mgmt_node())
+		seq_puts(s, "management node loopback copies with the CPU\n");
+	seq_printf(s, "stripe_min %lu KB, MB/s by channels:\n",
+		   scif_info.rma_stripe_min >> 10);
+	seq_puts(s, "     size");
+	for (i = 0; i < ARRAY_SIZE(scif_stripe_bench_chans); i++)
+		seq_printf(s, " %7d", scif_stripe_bench_chans[i]);
+	seq_puts(s, "\n");
+	for (len = SZ_64K; len <= SCIF_STRIPE_BENCH_LEN; len <<= 2) {
+		seq_printf(s, "%7zu K", len >> 10);
+		for (i = 0; i < ARRAY_SIZE(scif_stripe_bench_chans); i++) {
+			mbps = scif_stripe_bench_run(cep, loffset, roffset,
+						     len,
+						     scif_stripe_bench_chans[i]);
+			if (mbps < 0) {
+				err = mbps;
+				goto close;
+			}
+			seq_printf(s, " %7ld", mbps);
+		}
+		seq_puts(s, "\n");
+	}
+close:
+	if (roffset >= 0)
+		scif_unregister(sep, roffset, SCIF_STRIPE_BENCH_LEN);
+	if (loffset >= 0)
+		scif_unregister(cep, loffset, SCIF_STRIPE_BENCH_LEN);
+	if (sep)
+		scif_close(sep);
+	if (cep)
+		scif_close(cep);
+free:
+	vfree(dst);
+	vfree(src);
+	return err;
+}
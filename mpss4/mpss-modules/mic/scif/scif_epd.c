@@ -49,6 +49,8 @@
  *
  * Intel SCIF driver.
  */
+#include <linux/seq_file.h>
+#include <linux/vmalloc.h>
 #include "scif_main.h"
 #include "scif_map.h"
 
@@ -73,7 +75,7 @@ void scif_cleanup_ep_qp(struct scif_endpt *ep)
 	}
 	if (qp->local_buf) {
 		scif_unmap_single(qp->local_buf, ep->remote_dev,
-				  SCIF_ENDPT_QP_SIZE);
+				  qp->inbound_q.size);
 		qp->local_buf = 0;
 	}
 }
@@ -91,6 +93,10 @@ void scif_teardown_ep(void *endpt)
 		kfree(qp);
 		ep->qp_info.qp = NULL;
 	}
+	kfree(ep->send_buf);
+	ep->send_buf = NULL;
+	kfree(ep->recv_buf);
+	ep->recv_buf = NULL;
 	spin_unlock(&ep->lock);
 }
 
@@ -112,20 +118,28 @@ void scif_add_epd_to_zombie_list(struct scif_endpt *ep, bool eplock_held)
 	schedule_work(&scif_info.misc_work);
 }
 
+/*
+ * Find the endpoint listening on a port without taking eplock, which all
+ * connection requests would serialize on otherwise. The endpoint is
+ * returned locked; checking its state under the lock catches a listener
+ * being closed concurrently.
+ */
 static struct scif_endpt *scif_find_listen_ep(u16 port)
 {
-	struct scif_endpt *ep = NULL;
-	struct list_head *pos, *tmpq;
+	struct scif_endpt *ep;
 
-	mutex_lock(&scif_info.eplock);
-	list_for_each_safe(pos, tmpq, &scif_info.listen) {
-		ep = list_entry(pos, struct scif_endpt, list);
-		if (ep->port.port == port) {
-			mutex_unlock(&scif_info.eplock);
+	rcu_read_lock();
+	hash_for_each_possible_rcu(scif_info.listen, ep, listen_node, port) {
+		if (ep->port.port != port)
+			continue;
+		spin_lock(&ep->lock);
+		if (ep->state == SCIFEP_LISTENING) {
+			rcu_read_unlock();
 			return ep;
 		}
+		spin_unlock(&ep->lock);
 	}
-	mutex_unlock(&scif_info.eplock);
+	rcu_read_unlock();
 	return NULL;
 }
 
@@ -141,7 +155,8 @@ void scif_cleanup_zombie_epd(void)
 			list_del(pos);
 			scif_info.nr_zombies--;
 			put_iova_domain(&ep->rma_info.iovad);
-			kfree(ep);
+			scif_cq_free(&ep->rma_info.cq);
+			kfree_rcu(ep, rcu);
 		}
 	}
 	mutex_unlock(&scif_info.eplock);
@@ -175,8 +190,6 @@ void scif_cnctreq(struct scif_dev *scifdev, struct scifmsg *msg)
 	if (!ep)
 		/*  Send reject due to no listening ports */
 		goto conreq_sendrej_free;
-	else
-		spin_lock(&ep->lock);
 
 	if (ep->backlog <= ep->conreqcnt) {
 		/*  Send reject due to too many pending requests */
@@ -217,6 +230,8 @@ void scif_cnctgnt(struct scif_dev *scifdev, struct scifmsg *msg)
 		ep->peer.port = msg->src.port;
 		ep->qp_info.gnt_pld = msg->payload[1];
 		ep->remote_ep = msg->payload[2];
+		ep->qp_info.qp->event_idx =
+			msg->payload[3] == SCIF_EVENT_IDX_MAGIC;
 		ep->state = SCIFEP_MAPPING;
 
 		wake_up(&ep->conwq);
@@ -385,3 +400,220 @@ void scif_clientrcvd(struct scif_dev *scifdev, struct scifmsg *msg)
 	struct scif_endpt *ep = (struct scif_endpt *)msg->payload[0];
 	wake_up_interruptible(&ep->sendwq);
 }
+
+/**
+ * __scif_loopback_connect() - Connect a pair of endpoints on this node
+ * @cep: connected endpoint returned here
+ * @sep: accepted endpoint returned here
+ * @ring_size: SCIF_OPT_RING_SIZE of the connecting endpoint, 0 for the
+ *	default
+ *
+ * Used by the debugfs benchmarks. The caller closes both endpoints, also
+ * on error, where either may have been set.
+ */
+int __scif_loopback_connect(scif_epd_t *cep, scif_epd_t *sep, u64 ring_size)
+{
+	struct scif_port_id port, peer;
+	scif_epd_t lep;
+	int err;
+
+	*cep = NULL;
+	*sep = NULL;
+	lep = scif_open();
+	if (!lep)
+		return -ENOMEM;
+	err = scif_bind(lep, 0);
+	if (err < 0)
+		goto close;
+	port.node = scif_info.nodeid;
+	port.port = err;
+	err = scif_listen(lep, 1);
+	if (err)
+		goto close;
+
+	/* Connect without blocking so that the same thread can accept */
+	*cep = scif_open();
+	if (!*cep) {
+		err = -ENOMEM;
+		goto close;
+	}
+	if (ring_size) {
+		err = scif_setsockopt(*cep, SCIF_OPT_RING_SIZE, ring_size);
+		if (err)
+			goto close;
+	}
+	err = __scif_connect(*cep, &port, true);
+	if (err != -EINPROGRESS) {
+		err = err ? err : -EIO;
+		goto close;
+	}
+	err = scif_accept(lep, &peer, sep, SCIF_ACCEPT_SYNC);
+	if (err)
+		goto close;
+	err = __scif_connect(*cep, &port, true);
+close:
+	scif_close(lep);
+	return err;
+}
+
+int scif_loopback_connect(scif_epd_t *cep, scif_epd_t *sep)
+{
+	return __scif_loopback_connect(cep, sep, 0);
+}
+
+#define SCIF_LISTEN_BENCH_EPS		4096
+#define SCIF_LISTEN_BENCH_LOOKUPS	100000
+#define SCIF_LISTEN_BENCH_CONNECTS	256
+
+struct scif_listen_bench {
+	scif_epd_t lep[SCIF_LISTEN_BENCH_EPS];
+	u16 port[SCIF_LISTEN_BENCH_EPS];
+	scif_epd_t cep[SCIF_LISTEN_BENCH_CONNECTS];
+	scif_epd_t sep[SCIF_LISTEN_BENCH_CONNECTS];
+};
+
+/* The list walk under eplock which the hash table replaced */
+static struct scif_endpt *scif_listen_bench_linear(u16 port)
+{
+	struct scif_endpt *ep, *found = NULL;
+	int bkt;
+
+	mutex_lock(&scif_info.eplock);
+	hash_for_each(scif_info.listen, bkt, ep, listen_node) {
+		if (ep->port.port == port) {
+			found = ep;
+			break;
+		}
+	}
+	mutex_unlock(&scif_info.eplock);
+	return found;
+}
+
+/* Look up random ports among the first @nr listeners, returns ns */
+static s64 scif_listen_bench_lookup(struct scif_listen_bench *b, int nr,
+				    bool linear)
+{
+	struct scif_endpt *ep;
+	ktime_t start = ktime_get();
+	u32 idx = 1;
+	int i;
+
+	for (i = 0; i < SCIF_LISTEN_BENCH_LOOKUPS; i++) {
+		idx = idx * 1103515245 + 12345;
+		if (linear) {
+			ep = scif_listen_bench_linear(b->port[(idx >> 8) % nr]);
+		} else {
+			ep = scif_find_listen_ep(b->port[(idx >> 8) % nr]);
+			if (ep)
+				spin_unlock(&ep->lock);
+		}
+		if (!ep)
+			return -ENXIO;
+	}
+	return ktime_to_ns(ktime_sub(ktime_get(), start));
+}
+
+/* Connect to random listeners among the first @nr, returns ns */
+static s64 scif_listen_bench_connect(struct scif_listen_bench *b, int nr)
+{
+	struct scif_port_id port, peer;
+	ktime_t start = ktime_get();
+	int i, l, err;
+
+	port.node = scif_info.nodeid;
+	for (i = 0; i < SCIF_LISTEN_BENCH_CONNECTS; i++) {
+		l = (i * 7919) % nr;
+		port.port = b->port[l];
+		b->cep[i] = scif_open();
+		if (!b->cep[i])
+			return -ENOMEM;
+		err = __scif_connect(b->cep[i], &port, true);
+		if (err != -EINPROGRESS)
+			return err ? err : -EIO;
+		err = scif_accept(b->lep[l], &peer, &b->sep[i],
+				  SCIF_ACCEPT_SYNC);
+		if (err)
+			return err;
+		err = __scif_connect(b->cep[i], &port, true);
+		if (err)
+			return err;
+	}
+	return ktime_to_ns(ktime_sub(ktime_get(), start));
+}
+
+static void scif_listen_bench_disconnect(struct scif_listen_bench *b)
+{
+	int i;
+
+	for (i = 0; i < SCIF_LISTEN_BENCH_CONNECTS; i++) {
+		if (b->sep[i])
+			scif_close(b->sep[i]);
+		if (b->cep[i])
+			scif_close(b->cep[i]);
+		b->sep[i] = NULL;
+		b->cep[i] = NULL;
+	}
+}
+
+/**
+ * scif_listen_bench() - Measure listener lookups and connects
+ * @s: seq_file the results are printed to
+ *
+ * Opens up to SCIF_LISTEN_BENCH_EPS listening endpoints. With 16, 256 and
+ * then all of them listening, looks up random listening ports through
+ * the hash table and with the walk over every listener it replaced, and
+ * times SCIF_LISTEN_BENCH_CONNECTS loopback connects to random listeners.
+ */
+int scif_listen_bench(struct seq_file *s)
+{
+	static const int counts[] = { 16, 256, SCIF_LISTEN_BENCH_EPS };
+	struct scif_listen_bench *b;
+	s64 hash_ns, linear_ns, connect_ns;
+	int c, nr = 0, i, err = 0;
+
+	b = vzalloc(sizeof(*b));
+	if (!b)
+		return -ENOMEM;
+
+	seq_printf(s, "%9s %12s %12s %12s\n", "listeners", "hash",
+		   "linear", "connect");
+	for (c = 0; c < ARRAY_SIZE(counts); c++) {
+		for (; nr < counts[c]; nr++) {
+			b->lep[nr] = scif_open();
+			if (!b->lep[nr]) {
+				err = -ENOMEM;
+				goto close;
+			}
+			err = scif_bind(b->lep[nr], 0);
+			if (err < 0)
+				goto close;
+			b->port[nr] = err;
+			err = scif_listen(b->lep[nr], 1);
+			if (err)
+				goto close;
+		}
+
+		hash_ns = scif_listen_bench_lookup(b, nr, false);
+		linear_ns = scif_listen_bench_lookup(b, nr, true);
+		connect_ns = scif_listen_bench_connect(b, nr);
+		scif_listen_bench_disconnect(b);
+		if (hash_ns < 0 || linear_ns < 0 || connect_ns < 0) {
+			err = hash_ns < 0 ? hash_ns :
+				linear_ns < 0 ? linear_ns : connect_ns;
+			goto close;
+		}
+		seq_printf(s, "%9d %6lld ns/op %6lld ns/op %6lld us/op\n", nr,
+			   div_s64(hash_ns, SCIF_LISTEN_BENCH_LOOKUPS),
+			   div_s64(linear_ns, SCIF_LISTEN_BENCH_LOOKUPS),
+			   div_s64(connect_ns,
+				   SCIF_LISTEN_BENCH_CONNECTS * NSEC_PER_USEC));
+	}
+close:
+	scif_listen_bench_disconnect(b);
+	for (i = 0; i < SCIF_LISTEN_BENCH_EPS; i++) {
+		if (b->lep[i])
+			scif_close(b->lep[i]);
+	}
+	vfree(b);
+	return err;
+}
@@ -63,6 +63,8 @@
 
 #define SCIF_EPLOCK_HELD true
 
+struct seq_file;
+
 enum scif_epd_state {
 	SCIFEP_UNBOUND,
 	SCIFEP_BOUND,
@@ -87,8 +89,26 @@ struct scif_conreq {
 	struct list_head list;
 };
 
-/* Size of the RB for the Endpoint QP */
+/* Default size of the RB for the Endpoint QP */
 #define SCIF_ENDPT_QP_SIZE 0x1000
+/* Largest RB which may be requested through SCIF_OPT_RING_SIZE */
+#define SCIF_ENDPT_QP_MAX_SIZE 0x400000
+
+/*
+ * Passed in spare SCIF_CNCT_REQ/SCIF_CNCT_GNT payload words by nodes which
+ * publish event offsets in the endpoint QP. Older nodes leave those words
+ * uninitialized, hence a magic value rather than a flag. Such nodes also
+ * pass the requested RB size in the last SCIF_CNCT_REQ payload word.
+ */
+#define SCIF_EVENT_IDX_MAGIC 0x5c1fe1d05c1fe1d0ULL
+
+/*
+ * Upper bound of the bounce buffers of scif_user_send()/scif_user_recv().
+ * The buffers are sized after the RB they feed, which never holds more than
+ * its own size, but a 4MB RB does not need a 4MB bounce buffer to be kept
+ * busy.
+ */
+#define SCIF_USER_BUF_MAX 0x10000
 
 /* Maximum backlog for listening endpoint */
 #define SCIF_MAX_BACKLOG 1024
@@ -100,11 +120,15 @@ struct scif_conreq {
  * @qp_offset - DMA address of the QP
  * @gnt_pld - Payload in a SCIF_CNCT_GNT message containing the
  * physical address of the remote_qp.
+ * @ring_size - Size of the inbound RB set through SCIF_OPT_RING_SIZE,
+ * 0 for SCIF_ENDPT_QP_SIZE. Kept across scif_teardown_ep() so that
+ * endpoints accepted on a listening endpoint inherit it.
  */
 struct scif_endpt_qp_info {
 	struct scif_qp *qp;
 	dma_addr_t qp_offset;
 	dma_addr_t gnt_pld;
+	u32 ring_size;
 };
 
 /*
@@ -128,7 +152,14 @@ struct scif_endpt_qp_info {
  * @recvwq: waitqueue used during message receipt
  * @sendlock: Synchronize ordering of messages sent
  * @recvlock: Synchronize ordering of messages received
- * @list: link to list of various endpoints like connected, listening etc
+ * @send_buf: Bounce buffer of scif_user_send(), protected by sendlock
+ * @recv_buf: Bounce buffer of scif_user_recv(), protected by recvlock
+ * @send_buf_size: Size of send_buf
+ * @recv_buf_size: Size of recv_buf
+ * @list: link to list of various endpoints like connected, zombie etc
+ * @listen_node: link in the scif_info.listen hash table
+ * @rcu: deferred free, listening endpoints are looked up under RCU. Kept
+ *       ahead of rma_info for kfree_rcu().
  * @li_accept: pending ACCEPTREG
  * @acceptcnt: pending ACCEPTREG cnt
  * @liacceptlist: link to listen accept
@@ -143,6 +174,7 @@ struct scif_endpt_qp_info {
  * @rma_info: Information for triggering SCIF RMA and DMA operations
  * @mmu_list: link to list of MMU notifier cleanup work
  * @anon: anonymous file for use in kernel mode scif poll
+ * @pollset_list: poll set items of the endpoint
  */
 struct scif_endpt {
 	enum scif_epd_state state;
@@ -162,7 +194,13 @@ struct scif_endpt {
 	wait_queue_head_t recvwq;
 	struct mutex sendlock;
 	struct mutex recvlock;
+	void *send_buf;
+	void *recv_buf;
+	int send_buf_size;
+	int recv_buf_size;
 	struct list_head list;
+	struct hlist_node listen_node;
+	struct rcu_head rcu;
 	struct list_head li_accept;
 	int acceptcnt;
 	struct list_head liacceptlist;
@@ -176,6 +214,7 @@ struct scif_endpt {
 	struct scif_endpt_rma_info rma_info;
 	struct list_head mmu_list;
 	struct file *anon;
+	struct list_head pollset_list;
 };
 
 static inline int scifdev_alive(struct scif_endpt *ep)
@@ -204,6 +243,13 @@ static inline int scif_verify_epd(struct scif_endpt *ep)
 	return 0;
 }
 
+/* Size of the inbound RB allocated when the endpoint connects or accepts */
+static inline int scif_ep_ring_size(struct scif_endpt *ep)
+{
+	return ep->qp_info.ring_size ? ep->qp_info.ring_size :
+		SCIF_ENDPT_QP_SIZE;
+}
+
 static inline int scif_anon_inode_getfile(scif_epd_t epd)
 {
 	epd->anon = anon_inode_getfile("scif", &scif_anon_fops, NULL, 0);
@@ -243,11 +289,26 @@ void scif_discnt_ack(struct scif_dev *scifdev, struct scifmsg *msg);
 void scif_clientsend(struct scif_dev *scifdev, struct scifmsg *msg);
 void scif_clientrcvd(struct scif_dev *scifdev, struct scifmsg *msg);
 int __scif_connect(scif_epd_t epd, struct scif_port_id *dst, bool non_block);
+int __scif_loopback_connect(scif_epd_t *cep, scif_epd_t *sep, u64 ring_size);
+int scif_loopback_connect(scif_epd_t *cep, scif_epd_t *sep);
 int __scif_flush(scif_epd_t epd);
 int scif_mmap(struct vm_area_struct *vma, scif_epd_t epd);
 unsigned int __scif_pollfd(struct file *f, poll_table *wait,
 			   struct scif_endpt *ep);
+void scif_pollset_ep_release(struct scif_endpt *ep);
+int scif_msg_bench(struct seq_file *s);
+int scif_user_bench(struct seq_file *s);
+int scif_ring_bench(struct seq_file *s);
+int scif_listen_bench(struct seq_file *s);
+int scif_pollset_bench(struct seq_file *s);
+int scif_rma_reg_bench(struct seq_file *s);
+int scif_dma_stripe_bench(struct seq_file *s);
+int scif_cq_selftest(struct seq_file *s);
+int scif_rma_lookup_bench(struct seq_file *s);
 int __scif_pin_pages(void *addr, size_t len, int *out_prot,
 		     int map_flags, scif_pinned_pages_t *pages,
 		     struct scif_window *window);
+int scif_pin_temp_pages(unsigned long addr, size_t len, int *out_prot,
+			struct scif_pinned_pages *reuse,
+			unsigned long reuse_va, scif_pinned_pages_t *pages);
 #endif /* SCIF_EPD_H */
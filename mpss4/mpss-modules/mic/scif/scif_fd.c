@@ -112,6 +112,129 @@ static __always_inline void scif_err_debug(int err, const char *str)
 		dev_dbg(scif_info.mdev.this_device, "%s err %d\n", str, err);
 }
 
+static int scif_fdmsg(struct scifioctl_mmsg *msg, bool send)
+{
+	struct file *f = fget(msg->epd);
+	int err;
+
+	if (!f)
+		return -EBADF;
+	if (f->f_op != &scif_fops) {
+		err = -ENOTTY;
+		goto fput;
+	}
+	if (send)
+		err = scif_user_send(f->private_data, (void __user *)msg->msg,
+				     msg->len, msg->flags);
+	else
+		err = scif_user_recv(f->private_data, (void __user *)msg->msg,
+				     msg->len, msg->flags);
+fput:
+	fput(f);
+	return err;
+}
+
+/*
+ * Send or receive a batch of messages, on any number of endpoints, in one
+ * system call. A failed message does not stop the batch; its error is
+ * reported in its out_len. Only a signal does, in which case out_count
+ * tells how many messages were processed.
+ */
+static int scif_fdmsg_multi(struct scifioctl_multi __user *argp, bool send)
+{
+	struct scifioctl_mmsg __user *umsg;
+	struct scifioctl_multi req;
+	struct scifioctl_mmsg msg;
+	int i, err;
+
+	if (copy_from_user(&req, argp, sizeof(req)))
+		return -EFAULT;
+	if (req.count < 0 || req.count > SCIF_MAX_MULTI)
+		return -EINVAL;
+
+	umsg = (struct scifioctl_mmsg __user *)req.msgs;
+	for (i = 0; i < req.count; i++) {
+		if (copy_from_user(&msg, &umsg[i], sizeof(msg)))
+			return -EFAULT;
+		err = scif_fdmsg(&msg, send);
+		/* Blocking sends and receives return -EINTR on a signal */
+		if (err == -EINTR || err == -ERESTARTSYS) {
+			if (!i)
+				return err;
+			break;
+		}
+		if (put_user(err, &umsg[i].out_len))
+			return -EFAULT;
+	}
+	if (put_user(i, &argp->out_count))
+		return -EFAULT;
+	return 0;
+}
+
+/*
+ * Post a batch of RMAs. Posting stops at the first RMA which fails to
+ * start; its error is returned unless earlier RMAs were posted, which
+ * out_count tells.
+ */
+static int scif_fdrma_post(struct scif_endpt *ep,
+			   struct scifioctl_rma_post __user *argp)
+{
+	struct scifioctl_rma_op __user *uop;
+	struct scifioctl_rma_post req;
+	struct scifioctl_rma_op op;
+	int i, err = 0;
+
+	if (copy_from_user(&req, argp, sizeof(req)))
+		return -EFAULT;
+	if (req.count < 0 || req.count > SCIF_MAX_MULTI)
+		return -EINVAL;
+
+	uop = (struct scifioctl_rma_op __user *)req.ops;
+	for (i = 0; i < req.count; i++) {
+		if (copy_from_user(&op, &uop[i], sizeof(op))) {
+			err = -EFAULT;
+			break;
+		}
+		err = scif_rma_post(ep, &op);
+		if (err)
+			break;
+	}
+	if (err && !i)
+		return err;
+	if (put_user(i, &argp->out_count))
+		return -EFAULT;
+	return 0;
+}
+
+static int scif_fdcq_reap(struct scif_endpt *ep,
+			  struct scifioctl_cq_reap __user *argp)
+{
+	struct scifioctl_cqe *cqes;
+	struct scifioctl_cq_reap req;
+	int n, err = 0;
+
+	if (copy_from_user(&req, argp, sizeof(req)))
+		return -EFAULT;
+	if (req.count <= 0 || req.count > SCIF_MAX_MULTI || req.reserved)
+		return -EINVAL;
+
+	cqes = kmalloc_array(req.count, sizeof(*cqes), GFP_KERNEL);
+	if (!cqes)
+		return -ENOMEM;
+	n = scif_cq_reap(ep, cqes, req.count, req.timeout);
+	if (n < 0) {
+		err = n;
+		goto free;
+	}
+	/* Reaped completions are gone, a fault here loses them */
+	if (copy_to_user((void __user *)req.cqes, cqes, n * sizeof(*cqes)) ||
+	    put_user(n, &argp->out_count))
+		err = -EFAULT;
+free:
+	kfree(cqes);
+	return err;
+}
+
 static long scif_fdioctl(struct file *f, unsigned int cmd, unsigned long arg)
 {
 	struct scif_endpt *priv = f->private_data;
@@ -494,6 +617,58 @@ fence_signal_err:
 		scif_err_debug(err, "scif_fence_signal");
 		return err;
 	}
+	case SCIF_SETOPT:
+	{
+		struct scif_endpt *priv = f->private_data;
+		struct scifioctl_opt opt;
+
+		if (copy_from_user(&opt, argp, sizeof(opt))) {
+			err = -EFAULT;
+			goto setopt_err;
+		}
+		if (opt.reserved) {
+			err = -EINVAL;
+			goto setopt_err;
+		}
+		err = scif_setsockopt(priv, opt.name, opt.value);
+setopt_err:
+		scif_err_debug(err, "scif_setsockopt");
+		return err;
+	}
+	case SCIF_GETOPT:
+	{
+		struct scif_endpt *priv = f->private_data;
+		struct scifioctl_opt opt;
+
+		if (copy_from_user(&opt, argp, sizeof(opt))) {
+			err = -EFAULT;
+			goto getopt_err;
+		}
+		err = scif_getsockopt(priv, opt.name, &opt.value);
+		if (err)
+			goto getopt_err;
+		if (copy_to_user(argp, &opt, sizeof(opt)))
+			err = -EFAULT;
+getopt_err:
+		scif_err_debug(err, "scif_getsockopt");
+		return err;
+	}
+	case SCIF_SEND_MULTI:
+		err = scif_fdmsg_multi(argp, true);
+		scif_err_debug(err, "scif_send_multi");
+		return err;
+	case SCIF_RECV_MULTI:
+		err = scif_fdmsg_multi(argp, false);
+		scif_err_debug(err, "scif_recv_multi");
+		return err;
+	case SCIF_RMA_POST:
+		err = scif_fdrma_post(priv, argp);
+		scif_err_debug(err, "scif_rma_post");
+		return err;
+	case SCIF_CQ_REAP:
+		err = scif_fdcq_reap(priv, argp);
+		scif_err_debug(err, "scif_cq_reap");
+		return err;
 	}
 	return -EINVAL;
 }
@@ -305,6 +305,11 @@ int scif_prog_signal(scif_epd_t epd, off_t offset, u64 val,
 	dma_addr_t dst_dma_addr;
 	int err;
 
+	/* The signal DMA is only ordered after the channel of the endpoint */
+	err = scif_wait_stripes(ep);
+	if (err)
+		return err;
+
 	mutex_lock(&ep->rma_info.rma_lock);
 	req.out_window = &window;
 	req.offset = offset;
@@ -364,6 +369,13 @@ static int _scif_fence_wait(scif_epd_t epd, int mark)
 		err = -ETIMEDOUT;
 	else if (err > 0)
 		err = 0;
+	/*
+	 * The mark only orders the channel of the endpoint. Stripes on the
+	 * other channels are waited for here, which also covers stripes
+	 * started after the mark.
+	 */
+	if (!err)
+		err = scif_wait_stripes(ep);
 	return err;
 }
 
@@ -589,15 +601,20 @@ static void scif_fence_mark_cb(void *arg)
 }
 
 /*
- * _scif_fence_mark:
+ * scif_prog_chan_intr:
  *
- * @epd - endpoint descriptor
- * Set up a mark for this endpoint and return the value of the mark.
+ * @ep - endpoint
+ * @chan - DMA channel
+ * @cb - callback
+ * @arg - argument of the callback
+ * @out_cookie - DMA cookie of the interrupt descriptor
+ * Program an interrupt descriptor calling @cb once all DMA programmed so
+ * far on @chan is done.
  */
-int _scif_fence_mark(scif_epd_t epd, int *mark)
+int scif_prog_chan_intr(struct scif_endpt *ep, struct dma_chan *chan,
+			dma_async_tx_callback cb, void *arg,
+			dma_cookie_t *out_cookie)
 {
-	struct scif_endpt *ep = (struct scif_endpt *)epd;
-	struct dma_chan *chan = ep->rma_info.dma_chan;
 	struct dma_device *ddev = chan->device;
 	struct dma_async_tx_descriptor *tx;
 	bool x100 = !is_dma_copy_aligned(chan->device, 1, 1, 1);
@@ -630,20 +647,54 @@ int _scif_fence_mark(scif_epd_t epd, int *mark)
 			__func__, __LINE__, err);
 		return err;
 	}
-	tx->callback = scif_fence_mark_cb;
-	tx->callback_param = ep;
-	*mark = cookie = scif_dma_submit(tx);
+	tx->callback = cb;
+	tx->callback_param = arg;
+	*out_cookie = cookie = scif_dma_submit(tx);
 	if (dma_submit_error(cookie)) {
 		err = (int)cookie;
 		dev_err(&ep->remote_dev->sdev->dev, "%s %d err %d\n",
 			__func__, __LINE__, err);
 		return err;
 	}
-	atomic_inc(&ep->rma_info.fence_refcount);
 	dma_async_issue_pending(chan);
 	return 0;
 }
 
+/*
+ * scif_prog_dma_intr:
+ *
+ * Same as scif_prog_chan_intr() for the DMA channel of the endpoint.
+ */
+int scif_prog_dma_intr(struct scif_endpt *ep, dma_async_tx_callback cb,
+		       void *arg, dma_cookie_t *out_cookie)
+{
+	return scif_prog_chan_intr(ep, ep->rma_info.dma_chan, cb, arg,
+				   out_cookie);
+}
+
+/*
+ * _scif_fence_mark:
+ *
+ * @epd - endpoint descriptor
+ * Set up a mark for this endpoint and return the value of the mark.
+ */
+int _scif_fence_mark(scif_epd_t epd, int *mark)
+{
+	struct scif_endpt *ep = (struct scif_endpt *)epd;
+	dma_cookie_t cookie;
+	int err;
+
+	/* Taken before the callback can possibly run */
+	atomic_inc(&ep->rma_info.fence_refcount);
+	err = scif_prog_dma_intr(ep, scif_fence_mark_cb, ep, &cookie);
+	if (err) {
+		atomic_dec(&ep->rma_info.fence_refcount);
+		return err;
+	}
+	*mark = cookie;
+	return 0;
+}
+
 #define SCIF_LOOPB_MAGIC_MARK 0xdead
 
 int scif_fence_mark(scif_epd_t epd, int flags, int *mark)
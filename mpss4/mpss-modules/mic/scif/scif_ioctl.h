@@ -188,6 +188,124 @@ struct scifioctl_node_ids {
 	__s32	len;
 };
 
+/**
+ * struct scifioctl_mmsg - one message of a SCIF_SEND_MULTI/SCIF_RECV_MULTI
+ * IOCTL
+ * @epd:	file descriptor of the endpoint
+ * @flags:	flags
+ * @msg:	message buffer address
+ * @len:	message length
+ * @out_len:	number of bytes sent/received, or the negative error
+ */
+struct scifioctl_mmsg {
+	__s32	epd;
+	__s32	flags;
+	__u64	msg;
+	__s32	len;
+	__s32	out_len;
+};
+
+/* Largest count of a SCIF_SEND_MULTI/SCIF_RECV_MULTI IOCTL */
+#define SCIF_MAX_MULTI		1024
+
+/**
+ * struct scifioctl_multi - used for SCIF_SEND_MULTI/SCIF_RECV_MULTI IOCTL
+ * @msgs:	address of an array of struct scifioctl_mmsg
+ * @count:	number of entries in msgs
+ * @out_count:	number of entries processed
+ */
+struct scifioctl_multi {
+	__u64	msgs;
+	__s32	count;
+	__s32	out_count;
+};
+
+/* Options of SCIF_SETOPT/SCIF_GETOPT */
+#define SCIF_OPT_RING_SIZE	1
+#define SCIF_OPT_CQ_DEPTH	2
+#define SCIF_OPT_DMA_CHANNELS	3
+
+/**
+ * struct scifioctl_opt - used for SCIF_SETOPT/SCIF_GETOPT IOCTL
+ * @name:	option, one of SCIF_OPT_*
+ * @reserved:	must be zero
+ * @value:	option value
+ */
+struct scifioctl_opt {
+	__s32	name;
+	__s32	reserved;
+	__u64	value;
+};
+
+/* Operations of struct scifioctl_rma_op */
+#define SCIF_RMA_OP_READFROM	0
+#define SCIF_RMA_OP_WRITETO	1
+#define SCIF_RMA_OP_VREADFROM	2
+#define SCIF_RMA_OP_VWRITETO	3
+
+/**
+ * struct scifioctl_rma_op - one RMA of a SCIF_RMA_POST IOCTL
+ * @loffset:	offset in local registered address space, for
+ *		SCIF_RMA_OP_READFROM and SCIF_RMA_OP_WRITETO
+ * @len:	length of range to copy
+ * @roffset:	offset in remote registered address space
+ * @addr:	user virtual address, for SCIF_RMA_OP_VREADFROM and
+ *		SCIF_RMA_OP_VWRITETO
+ * @cookie:	returned in the completion of this RMA
+ * @op:		operation, one of SCIF_RMA_OP_*
+ * @flags:	flags as for the matching copy IOCTL
+ */
+struct scifioctl_rma_op {
+	__s64	loffset;
+	__u64	len;
+	__s64	roffset;
+	__u64	addr;
+	__u64	cookie;
+	__s32	op;
+	__s32	flags;
+};
+
+/**
+ * struct scifioctl_rma_post - used for SCIF_RMA_POST IOCTL
+ * @ops:	address of an array of struct scifioctl_rma_op
+ * @count:	number of entries in ops
+ * @out_count:	number of RMAs posted
+ */
+struct scifioctl_rma_post {
+	__u64	ops;
+	__s32	count;
+	__s32	out_count;
+};
+
+/**
+ * struct scifioctl_cqe - RMA completion returned by SCIF_CQ_REAP
+ * @cookie:	cookie of the RMA
+ * @status:	0 or the negative error the RMA failed with
+ * @reserved:	zero
+ */
+struct scifioctl_cqe {
+	__u64	cookie;
+	__s32	status;
+	__s32	reserved;
+};
+
+/**
+ * struct scifioctl_cq_reap - used for SCIF_CQ_REAP IOCTL
+ * @cqes:	address of an array of struct scifioctl_cqe
+ * @count:	number of entries in cqes
+ * @timeout:	milliseconds to wait for a completion, 0 not to wait and
+ *		-1 to wait indefinitely
+ * @out_count:	number of completions returned
+ * @reserved:	must be zero, keeps the size the same for 32-bit callers
+ */
+struct scifioctl_cq_reap {
+	__u64	cqes;
+	__s32	count;
+	__s32	timeout;
+	__s32	out_count;
+	__s32	reserved;
+};
+
 #define SCIF_BIND		_IOWR('s', 1, __u64)
 #define SCIF_LISTEN		_IOW('s', 2, __s32)
 #define SCIF_CONNECT		_IOWR('s', 3, struct scifioctl_connect)
@@ -205,5 +323,11 @@ struct scifioctl_node_ids {
 #define SCIF_FENCE_MARK		_IOWR('s', 15, struct scifioctl_fence_mark)
 #define SCIF_FENCE_WAIT		_IOWR('s', 16, __s32)
 #define SCIF_FENCE_SIGNAL	_IOWR('s', 17, struct scifioctl_fence_signal)
+#define SCIF_SETOPT		_IOW('s', 18, struct scifioctl_opt)
+#define SCIF_GETOPT		_IOWR('s', 19, struct scifioctl_opt)
+#define SCIF_SEND_MULTI		_IOWR('s', 20, struct scifioctl_multi)
+#define SCIF_RECV_MULTI		_IOWR('s', 21, struct scifioctl_multi)
+#define SCIF_RMA_POST		_IOWR('s', 22, struct scifioctl_rma_post)
+#define SCIF_CQ_REAP		_IOWR('s', 23, struct scifioctl_cq_reap)
 
 #endif /* SCIF_IOCTL_H */
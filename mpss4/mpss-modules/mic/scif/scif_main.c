@@ -330,19 +330,23 @@ static int _scif_init(void)
 	INIT_LIST_HEAD(&scif_info.ports_in_use);
 #endif
 	INIT_LIST_HEAD(&scif_info.uaccept);
-	INIT_LIST_HEAD(&scif_info.listen);
+	hash_init(scif_info.listen);
 	INIT_LIST_HEAD(&scif_info.zombie);
 	INIT_LIST_HEAD(&scif_info.connected);
 	INIT_LIST_HEAD(&scif_info.disconnected);
 	INIT_LIST_HEAD(&scif_info.rma);
 	INIT_LIST_HEAD(&scif_info.rma_tc);
 	INIT_LIST_HEAD(&scif_info.mmu_notif_cleanup);
+	INIT_LIST_HEAD(&scif_info.tc_procs);
 	INIT_LIST_HEAD(&scif_info.fence);
 	INIT_LIST_HEAD(&scif_info.nb_connect_list);
 	init_waitqueue_head(&scif_info.exitwq);
 	scif_info.rma_tc_limit = SCIF_RMA_TEMP_CACHE_LIMIT;
+	scif_info.rma_tc_proc_limit = SCIF_RMA_TEMP_CACHE_PROC_LIMIT;
+	scif_info.rma_stripe_min = SCIF_RMA_STRIPE_MIN;
 	scif_info.en_msg_log = 0;
 	scif_info.p2p_enable = 1;
+	scif_info.msg_coalesce = 1;
 	rc = scif_setup_scifdev();
 	if (rc)
 		goto error;
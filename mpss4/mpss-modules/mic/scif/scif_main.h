@@ -59,6 +59,7 @@
 #include <linux/iova.h>
 #include <linux/anon_inodes.h>
 #include <linux/file.h>
+#include <linux/hashtable.h>
 #include <linux/vmalloc.h>
 #include <linux/version.h>
 #include <linux/delay.h>
@@ -78,6 +79,10 @@
 
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4,14,0)
 #define ACCESS_ONCE(x) (*(volatile typeof(x) *)&(x))
+#else
+/* Interval trees are rooted in a plain rb_root before 4.14 */
+#define rb_root_cached rb_root
+#define RB_ROOT_CACHED RB_ROOT
 #endif
 
 #include "../common/mic_dev.h"
@@ -88,6 +93,9 @@
 #define SCIF_NODE_ALIVE_TIMEOUT (SCIF_DEFAULT_WATCHDOG_TO * HZ)
 #define SCIF_DMA_TIMEOUT (3 * HZ)
 #define SCIF_RMA_TEMP_CACHE_LIMIT 0x20000
+#define SCIF_RMA_TEMP_CACHE_PROC_LIMIT 0x40000
+#define SCIF_RMA_STRIPE_MIN (1024 * 1024)
+#define SCIF_LISTEN_HASH_BITS 8
 
 #define scif_log(func, index, fmt, ...) \
 	func("[%7u] scif%d: %s:%u " fmt "\n", task_pid_nr(current), \
@@ -125,7 +133,7 @@ enum scif_msg_state {
  * @port_list: List of ports in use
 #endif
  * @uaccept: List of user acceptreq waiting for acceptreg
- * @listen: List of listening end points
+ * @listen: Listening end points, hashed by port
  * @zombie: List of zombie end points with pending RMA's
  * @connected: List of end points in connected state
  * @disconnected: List of end points in disconnected state
@@ -134,6 +142,8 @@ enum scif_msg_state {
  * @conflock: Lock to synchronize SCIF node configuration changes
  * @en_msg_log: Enable debug message logging
  * @p2p_enable: Enable P2P SCIF network
+ * @msg_coalesce: Suppress messaging notifications the peer did not ask for
+ * @msg_stats: Messaging notifications sent and suppressed, for debugfs
  * @mdev: The MISC device
  * @conn_work: Work for workqueue handling all connections
  * @exitwq: Wait queue for waiting for an EXIT node QP message response
@@ -148,7 +158,13 @@ enum scif_msg_state {
  * @fence: List of remote fence requests
  * @mmu_notif_work: Work for registration caching MMU notifier workqueue
  * @mmu_notif_cleanup: List of temporary cached windows for reg cache
- * @rma_tc_limit: RMA temporary cache limit
+ * @rma_tc_limit: RMA temporary cache limit per endpoint, in pages
+ * @rma_tc_proc_limit: RMA temporary cache limit per process, in pages
+ * @tc_procs: Registration cache usage of processes, protected by rmalock
+ * @tc_stats: Registration cache hits, misses, partial overlaps whose pages
+ *	      were reused and evictions, for debugfs
+ * @rma_stripe_min: Smallest RMA striped across several DMA channels
+ * @stripe_stats: RMAs striped and stripes programmed, for debugfs
  */
 struct scif_info {
 	u8 nodeid;
@@ -163,7 +179,7 @@ struct scif_info {
 	struct list_head ports_in_use;
 #endif
 	struct list_head uaccept;
-	struct list_head listen;
+	DECLARE_HASHTABLE(listen, SCIF_LISTEN_HASH_BITS);
 	struct list_head zombie;
 	struct list_head connected;
 	struct list_head disconnected;
@@ -172,6 +188,13 @@ struct scif_info {
 	struct mutex conflock;
 	u8 en_msg_log;
 	u8 p2p_enable;
+	u8 msg_coalesce;
+	struct {
+		atomic_long_t sent_notif;
+		atomic_long_t sent_skip;
+		atomic_long_t rcvd_notif;
+		atomic_long_t rcvd_skip;
+	} msg_stats;
 	struct miscdevice mdev;
 	struct work_struct conn_work;
 	wait_queue_head_t exitwq;
@@ -187,6 +210,19 @@ struct scif_info {
 	struct work_struct mmu_notif_work;
 	struct list_head mmu_notif_cleanup;
 	unsigned long rma_tc_limit;
+	unsigned long rma_tc_proc_limit;
+	struct list_head tc_procs;
+	struct {
+		atomic_long_t hit;
+		atomic_long_t miss;
+		atomic_long_t reuse;
+		atomic_long_t evict;
+	} tc_stats;
+	unsigned long rma_stripe_min;
+	struct {
+		atomic_long_t rmas;
+		atomic_long_t stripes;
+	} stripe_stats;
 };
 
 /*
@@ -127,10 +127,10 @@ static void __scif_cleanup_rma_for_zombies(struct scif_endpt *ep)
 	struct list_head *pos, *tmp;
 	struct scif_window *window;
 
-	list_for_each_safe(pos, tmp, &ep->rma_info.remote_reg_list) {
+	list_for_each_safe(pos, tmp, &ep->rma_info.remote_reg_list.list) {
 		window = list_entry(pos, struct scif_window, list);
 		atomic_inc(&ep->rma_info.tw_refcount);
-		list_del_init(&window->list);
+		scif_delete_window(window);
 		scif_destroy_remote_window(window, ep->remote_dev);
 	}
 }
@@ -332,10 +332,11 @@ int scif_put_pages(struct scif_range *pages)
 	/* Initiate window destruction when SCIF_UNREGISTER message
 	 * is sent and there are no remote mappings */
 	if (window->unreg_state == SCIF_UNREG_ACCEPTED) {
-		list_del(&window->list);
+		scif_delete_window(window);
 		mutex_unlock(&ep->rma_info.rma_lock);
 		scif_drain_dma_intr(ep->remote_dev->sdev,
 				    ep->rma_info.dma_chan);
+		scif_wait_stripes(ep);
 		/* Inform the peer about this window being destroyed. */
 		msg.uop = SCIF_DELETE_WINDOW;
 		msg.src = ep->port;
@@ -372,7 +373,7 @@ static int scif_rma_list_mmap(struct scif_window *start_window, s64 offset,
 	struct scif_window *window = start_window;
 	int loop_nr_pages, nr_pages_left = nr_pages;
 	struct scif_endpt *ep = (struct scif_endpt *)start_window->ep;
-	struct list_head *head = &ep->rma_info.remote_reg_list;
+	struct list_head *head = &ep->rma_info.remote_reg_list.list;
 	int i, err = 0;
 	dma_addr_t phys_addr;
 	struct scif_window_iter src_win_iter;
@@ -414,7 +415,7 @@ static int scif_rma_list_mmap(struct scif_window *start_window, s64 offset,
 	loop_offset = offset;
 	nr_pages_left = nr_pages;
 	window = start_window;
-	head = &ep->rma_info.remote_reg_list;
+	head = &ep->rma_info.remote_reg_list.list;
 	list_for_each_entry_from(window, head, list) {
 		end_offset = window->offset +
 			(window->nr_pages << PAGE_SHIFT);
@@ -451,7 +452,7 @@ static void scif_rma_list_munmap(struct scif_window *start_window,
 	s64 loop_offset = offset, end_offset;
 	int loop_nr_pages, nr_pages_left = nr_pages;
 	struct scif_endpt *ep = (struct scif_endpt *)start_window->ep;
-	struct list_head *head = &ep->rma_info.remote_reg_list;
+	struct list_head *head = &ep->rma_info.remote_reg_list.list;
 	struct scif_window *window = start_window, *_window;
 
 	loop_offset = offset;
@@ -468,6 +469,7 @@ static void scif_rma_list_munmap(struct scif_window *start_window,
 			struct scif_dev *rdev = ep->remote_dev;
 			scif_drain_dma_intr(rdev->sdev,
 					    ep->rma_info.dma_chan);
+			scif_wait_stripes(ep);
 			msg.uop = SCIF_DELETE_WINDOW;
 			msg.src = ep->port;
 			/* Inform the peer about this munmap */
@@ -475,7 +477,7 @@ static void scif_rma_list_munmap(struct scif_window *start_window,
 			msg.payload[1] = window->peer_window;
 			/* No error handling for Notification messages. */
 			scif_nodeqp_send(ep->remote_dev, &msg);
-			list_del(&window->list);
+			scif_delete_window(window);
 			/* Destroy this window from the peer's registered AS */
 			scif_destroy_remote_window(window, rdev);
 		}
@@ -100,9 +100,32 @@
  * 10) The SCIF hardware device for which a remove callback was received is now
  *	disconnected from the SCIF network.
  */
+/*
+ * scif_alloc_ep_rb:
+ *
+ * Allocate the inbound RB of an endpoint, of up to *size bytes. The peer
+ * maps the RB in one piece, so it must be physically contiguous and cannot
+ * come from vmalloc. Instead of failing the connection when a large ring
+ * cannot be had, the size is halved down to SCIF_ENDPT_QP_SIZE. The peer
+ * reads the size of the RB from the QP.
+ */
+void *scif_alloc_ep_rb(int *size)
+{
+	void *rb;
+
+	while (*size > SCIF_ENDPT_QP_SIZE) {
+		rb = kzalloc(*size, GFP_KERNEL | __GFP_NOWARN | __GFP_NORETRY);
+		if (rb)
+			return rb;
+		*size >>= 1;
+	}
+	return kzalloc(*size, GFP_KERNEL);
+}
+
 /*
  * Initializes "local" data structures for the QP. Allocates the QP
- * ring buffer (rb) and initializes the "in bound" queue.
+ * ring buffer (rb) unless the caller did, and initializes the "in bound"
+ * queue.
  */
 int scif_setup_qp_connect(struct scif_qp *qp, dma_addr_t *qp_offset,
 			  int local_size, struct scif_dev *scifdev)
@@ -150,6 +173,7 @@ unmap:
 	qp->local_buf = 0;
 kfree:
 	kfree(local_q);
+	qp->inbound_q.rb_base = NULL;
 	return err;
 }
 
@@ -192,7 +216,7 @@ int scif_setup_qp_accept(struct scif_qp *qp, dma_addr_t *qp_offset,
 		     &qp->remote_qp->local_write,
 		     remote_q,
 		     get_count_order(remote_size));
-	local_q = kzalloc(local_size, GFP_KERNEL);
+	local_q = scif_alloc_ep_rb(&local_size);
 	if (!local_q) {
 		err = -ENOMEM;
 		goto iounmap_1;
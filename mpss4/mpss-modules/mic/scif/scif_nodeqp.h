@@ -95,6 +95,13 @@
 #define SCIF_SIG_NACK 38 /* SCIF Remote Fence Remote Signal Failure */
 #define SCIF_MAX_MSG SCIF_SIG_NACK
 
+/*
+ * SCIF_ALLOC_REQ carries the contiguous chunk count of the window in the
+ * low 32 bits of payload[3], tagged with this value in the high 32 bits.
+ * Older peers leave payload[3] uninitialized.
+ */
+#define SCIF_ALLOC_CHUNKS_MAGIC 0x5c1fc4a7ULL
+
 /*
  * struct scifmsg - Node QP message format
  *
@@ -119,11 +126,13 @@ struct scifmsg {
  * size: Size of the buffer
  * state: Current state
  * allocwq: wait queue for status
+ * nr_chunks: Number of contiguous chunks the peer makes room for
  */
 struct scif_allocmsg {
 	dma_addr_t phys_addr;
 	unsigned long vaddr;
 	size_t size;
+	int nr_chunks;
 	enum scif_msg_state state;
 	wait_queue_head_t allocwq;
 };
@@ -146,6 +155,13 @@ struct scif_allocmsg {
  * @local_qp: DMA address of the local queue pair data structure
  * @remote_buf: DMA address of remote ring buffer
  * @qp_state: QP state i.e. online or offline used for P2P
+ * @recv_event: Written by the peer: outbound offset past which the peer
+ *	wants a SCIF_CLIENT_SENT message
+ * @send_event: Written by the peer: inbound read offset past which the
+ *	peer wants a SCIF_CLIENT_RCVD message
+ * @event_idx: Both sides publish recv_event/send_event, negotiated at
+ *	connect time. The event fields sit in front of the spinlocks so that
+ *	their offsets do not depend on the kernel configuration
  * @send_lock: synchronize access to outbound queue
  * @recv_lock: Synchronize access to inbound queue
  */
@@ -164,6 +180,9 @@ struct scif_qp {
 	u32 qp_state;
 #define SCIF_QP_OFFLINE 0xdead
 #define SCIF_QP_ONLINE 0xc0de
+	u32 recv_event;
+	u32 send_event;
+	bool event_idx;
 	spinlock_t send_lock;
 	spinlock_t recv_lock;
 };
@@ -184,6 +203,7 @@ int _scif_nodeqp_send(struct scif_dev *scifdev, struct scifmsg *msg);
 void scif_nodeqp_intrhandler(struct scif_dev *scifdev, struct scif_qp *qp);
 int scif_setup_qp(struct scif_dev *scifdev);
 int scif_qp_response(phys_addr_t phys, struct scif_dev *dev);
+void *scif_alloc_ep_rb(int *size);
 int scif_setup_qp_connect(struct scif_qp *qp, dma_addr_t *qp_offset,
 			  int local_size, struct scif_dev *scifdev);
 int scif_setup_qp_accept(struct scif_qp *qp, dma_addr_t *qp_offset,
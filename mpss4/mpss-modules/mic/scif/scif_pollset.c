@@ -0,0 +1,610 @@
+/*
+ * Intel MIC Platform Software Stack (MPSS)
+ * Copyright (c) 2016, Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * Intel SCIF driver.
+ */
+#include <linux/seq_file.h>
+#include "scif_main.h"
+
+/*
+ * Poll sets.
+ *
+ * scif_poll() registers a waiter on every endpoint and polls all of them
+ * each time it wakes up. A poll set keeps its endpoints registered between
+ * waits instead: the wait queue callbacks of an endpoint put it on the
+ * ready list of the set, and scif_pollset_wait() only polls the endpoints
+ * on that list, so a wait costs the number of ready endpoints rather than
+ * the number of endpoints in the set.
+ *
+ * The set is level triggered like epoll: an endpoint reported ready stays
+ * on the ready list and is polled again by the next wait, which drops it
+ * if it is not ready any more. Edge triggering is not offered since the
+ * peer is only asked to notify new data when the endpoint is polled.
+ *
+ * Locking: scif_pollset_mutex protects the pollset lists of the endpoints
+ * and is taken before the mutex of a set, which protects the items of the
+ * set and is held while they are polled. The spinlock of the set protects
+ * its ready list, it is taken by the wait queue callbacks.
+ */
+#define SCIF_POLLSET_HASH_BITS	8
+/* conn_pend_wq, conwq, recvwq and sendwq */
+#define SCIF_POLLSET_NWAIT	4
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 13, 0)
+#define wait_queue_entry_t wait_queue_t
+#endif
+
+static DEFINE_MUTEX(scif_pollset_mutex);
+
+struct scif_pollset {
+	struct mutex mtx;
+	spinlock_t lock;
+	struct list_head ready;
+	wait_queue_head_t wq;
+	DECLARE_HASHTABLE(items, SCIF_POLLSET_HASH_BITS);
+};
+
+/*
+ * struct scif_pollwait - Entry of a poll set item on an endpoint wait queue
+ *
+ * @wait: Wait queue entry
+ * @whead: Wait queue of the endpoint
+ * @item: Item the entry belongs to
+ */
+struct scif_pollwait {
+	wait_queue_entry_t wait;
+	wait_queue_head_t *whead;
+	struct scif_pollitem *item;
+};
+
+/*
+ * struct scif_pollitem - An endpoint in a poll set
+ *
+ * @hash: Link in the hash table of the set, keyed by endpoint
+ * @ep_link: Link in the pollset list of the endpoint
+ * @rdlink: Link in the ready list of the set, empty when not on it
+ * @ps: Poll set
+ * @ep: Endpoint
+ * @pt: Poll table registering the wait queues of the endpoint
+ * @events: Requested events, only SCIF_POLLONESHOT once reported if set
+ * @data: Returned with the events of the endpoint
+ * @nwait: Wait queues registered
+ * @wait: Entries on the wait queues
+ */
+struct scif_pollitem {
+	struct hlist_node hash;
+	struct list_head ep_link;
+	struct list_head rdlink;
+	struct scif_pollset *ps;
+	struct scif_endpt *ep;
+	poll_table pt;
+	u32 events;
+	u64 data;
+	int nwait;
+	struct scif_pollwait wait[SCIF_POLLSET_NWAIT];
+};
+
+static inline bool scif_pollitem_enabled(struct scif_pollitem *item)
+{
+	return item->events & ~SCIF_POLLONESHOT;
+}
+
+static int scif_pollset_wakeup(wait_queue_entry_t *wait, unsigned int mode,
+			       int sync, void *key)
+{
+	struct scif_pollitem *item =
+		container_of(wait, struct scif_pollwait, wait)->item;
+	struct scif_pollset *ps = item->ps;
+	unsigned long flags;
+
+	spin_lock_irqsave(&ps->lock, flags);
+	if (scif_pollitem_enabled(item) && list_empty(&item->rdlink)) {
+		list_add_tail(&item->rdlink, &ps->ready);
+		wake_up(&ps->wq);
+	}
+	spin_unlock_irqrestore(&ps->lock, flags);
+	return 1;
+}
+
+/* poll_wait(..) callback, each wait queue of the endpoint is added once */
+static void scif_pollset_queue(struct file *f, wait_queue_head_t *whead,
+			       poll_table *pt)
+{
+	struct scif_pollitem *item = container_of(pt, struct scif_pollitem, pt);
+	struct scif_pollwait *pw;
+	int i;
+
+	for (i = 0; i < item->nwait; i++)
+		if (item->wait[i].whead == whead)
+			return;
+	if (WARN_ON_ONCE(item->nwait == SCIF_POLLSET_NWAIT))
+		return;
+
+	pw = &item->wait[item->nwait++];
+	init_waitqueue_func_entry(&pw->wait, scif_pollset_wakeup);
+	pw->whead = whead;
+	pw->item = item;
+	add_wait_queue(whead, &pw->wait);
+}
+
+/* Poll the endpoint of an item, called with the mutex of the set held */
+static unsigned int scif_pollitem_poll(struct scif_pollitem *item)
+{
+	unsigned int events = item->events | POLLERR | POLLHUP;
+
+	if (!scif_pollitem_enabled(item))
+		return 0;
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(3, 10, 0))
+	item->pt._key = events;
+#else
+	item->pt.key = events;
+#endif
+	return __scif_pollfd(item->ep->anon, &item->pt, item->ep) & events;
+}
+
+static void scif_pollitem_set_ready(struct scif_pollitem *item)
+{
+	struct scif_pollset *ps = item->ps;
+
+	spin_lock_irq(&ps->lock);
+	if (list_empty(&item->rdlink)) {
+		list_add_tail(&item->rdlink, &ps->ready);
+		wake_up(&ps->wq);
+	}
+	spin_unlock_irq(&ps->lock);
+}
+
+static struct scif_pollitem *scif_pollitem_find(struct scif_pollset *ps,
+						struct scif_endpt *ep)
+{
+	struct scif_pollitem *item;
+
+	hash_for_each_possible(ps->items, item, hash, (unsigned long)ep)
+		if (item->ep == ep)
+			return item;
+	return NULL;
+}
+
+/*
+ * Unregister an item from its endpoint and free it, called with
+ * scif_pollset_mutex and the mutex of the set held
+ */
+static void scif_pollitem_remove(struct scif_pollitem *item)
+{
+	struct scif_pollset *ps = item->ps;
+	int i;
+
+	for (i = 0; i < item->nwait; i++)
+		remove_wait_queue(item->wait[i].whead, &item->wait[i].wait);
+
+	spin_lock_irq(&ps->lock);
+	if (!list_empty(&item->rdlink))
+		list_del(&item->rdlink);
+	spin_unlock_irq(&ps->lock);
+
+	hash_del(&item->hash);
+	list_del(&item->ep_link);
+	kfree(item);
+}
+
+/**
+ * scif_pollset_create() - Create an empty poll set
+ *
+ * Returns the poll set or NULL if it could not be allocated.
+ */
+scif_pollset_t scif_pollset_create(void)
+{
+	struct scif_pollset *ps;
+
+	ps = kzalloc(sizeof(*ps), GFP_KERNEL);
+	if (!ps)
+		return NULL;
+
+	mutex_init(&ps->mtx);
+	spin_lock_init(&ps->lock);
+	INIT_LIST_HEAD(&ps->ready);
+	init_waitqueue_head(&ps->wq);
+	hash_init(ps->items);
+	return ps;
+}
+EXPORT_SYMBOL_GPL(scif_pollset_create);
+
+/**
+ * scif_pollset_destroy() - Remove all endpoints from a poll set and free it
+ * @ps: Poll set
+ *
+ * No thread may wait on @ps any more.
+ */
+void scif_pollset_destroy(scif_pollset_t ps)
+{
+	struct scif_pollitem *item;
+	struct hlist_node *tmp;
+	int bkt;
+
+	mutex_lock(&scif_pollset_mutex);
+	mutex_lock(&ps->mtx);
+	hash_for_each_safe(ps->items, bkt, tmp, item, hash)
+		scif_pollitem_remove(item);
+	mutex_unlock(&ps->mtx);
+	mutex_unlock(&scif_pollset_mutex);
+	kfree(ps);
+}
+EXPORT_SYMBOL_GPL(scif_pollset_destroy);
+
+static int scif_pollset_add(struct scif_pollset *ps, struct scif_endpt *ep,
+			    struct scif_pollevent *event)
+{
+	struct scif_pollitem *item;
+
+	if (scif_pollitem_find(ps, ep))
+		return -EEXIST;
+
+	item = kzalloc(sizeof(*item), GFP_KERNEL);
+	if (!item)
+		return -ENOMEM;
+
+	INIT_LIST_HEAD(&item->rdlink);
+	init_poll_funcptr(&item->pt, scif_pollset_queue);
+	item->ps = ps;
+	item->ep = ep;
+	item->events = event->events;
+	item->data = event->data;
+	hash_add(ps->items, &item->hash, (unsigned long)ep);
+	list_add(&item->ep_link, &ep->pollset_list);
+
+	if (scif_pollitem_poll(item))
+		scif_pollitem_set_ready(item);
+	return 0;
+}
+
+static int scif_pollset_mod(struct scif_pollset *ps, struct scif_endpt *ep,
+			    struct scif_pollevent *event)
+{
+	struct scif_pollitem *item = scif_pollitem_find(ps, ep);
+
+	if (!item)
+		return -ENOENT;
+
+	spin_lock_irq(&ps->lock);
+	item->events = event->events;
+	item->data = event->data;
+	spin_unlock_irq(&ps->lock);
+
+	if (scif_pollitem_poll(item))
+		scif_pollitem_set_ready(item);
+	return 0;
+}
+
+/**
+ * scif_pollset_ctl() - Add, modify or remove an endpoint of a poll set
+ * @ps: Poll set
+ * @op: SCIF_POLLSET_ADD, SCIF_POLLSET_MOD or SCIF_POLLSET_DEL
+ * @epd: Endpoint
+ * @event: Requested events and data, ignored by SCIF_POLLSET_DEL
+ *
+ * Returns 0 on success, -EEXIST if @epd is added twice, -ENOENT if @epd is
+ * modified or removed but not in @ps, -EINVAL for an invalid @op and
+ * -ENOMEM if the endpoint could not be added.
+ */
+int scif_pollset_ctl(scif_pollset_t ps, int op, scif_epd_t epd,
+		     struct scif_pollevent *event)
+{
+	struct scif_endpt *ep = (struct scif_endpt *)epd;
+	struct scif_pollitem *item;
+	int err = 0;
+
+	switch (op) {
+	case SCIF_POLLSET_ADD:
+	case SCIF_POLLSET_DEL:
+		mutex_lock(&scif_pollset_mutex);
+		mutex_lock(&ps->mtx);
+		if (op == SCIF_POLLSET_ADD) {
+			err = scif_pollset_add(ps, ep, event);
+		} else {
+			item = scif_pollitem_find(ps, ep);
+			if (item)
+				scif_pollitem_remove(item);
+			else
+				err = -ENOENT;
+		}
+		mutex_unlock(&ps->mtx);
+		mutex_unlock(&scif_pollset_mutex);
+		break;
+	case SCIF_POLLSET_MOD:
+		mutex_lock(&ps->mtx);
+		err = scif_pollset_mod(ps, ep, event);
+		mutex_unlock(&ps->mtx);
+		break;
+	default:
+		err = -EINVAL;
+	}
+	return err;
+}
+EXPORT_SYMBOL_GPL(scif_pollset_ctl);
+
+/*
+ * Poll the endpoints on the ready list, called with the mutex of the set
+ * held. An item is taken off the list before it is polled, so a wakeup
+ * while it is polled puts it back for the next round.
+ */
+static int scif_pollset_harvest(struct scif_pollset *ps,
+				struct scif_pollevent *events, int maxevents)
+{
+	struct scif_pollitem *item;
+	LIST_HEAD(txlist);
+	unsigned int mask;
+	int count = 0;
+
+	spin_lock_irq(&ps->lock);
+	list_splice_init(&ps->ready, &txlist);
+	spin_unlock_irq(&ps->lock);
+
+	while (count < maxevents) {
+		spin_lock_irq(&ps->lock);
+		item = list_first_entry_or_null(&txlist, struct scif_pollitem,
+						rdlink);
+		if (item)
+			list_del_init(&item->rdlink);
+		spin_unlock_irq(&ps->lock);
+		if (!item)
+			break;
+
+		mask = scif_pollitem_poll(item);
+		if (!mask)
+			continue;
+
+		events[count].events = mask;
+		events[count].data = item->data;
+		count++;
+
+		if (item->events & SCIF_POLLONESHOT) {
+			spin_lock_irq(&ps->lock);
+			item->events = SCIF_POLLONESHOT;
+			spin_unlock_irq(&ps->lock);
+		} else {
+			scif_pollitem_set_ready(item);
+		}
+	}
+
+	/* Whatever was not polled is reported first by the next wait */
+	spin_lock_irq(&ps->lock);
+	list_splice(&txlist, &ps->ready);
+	spin_unlock_irq(&ps->lock);
+	return count;
+}
+
+/**
+ * scif_pollset_wait() - Wait for events on the endpoints of a poll set
+ * @ps: Poll set
+ * @events: Array the ready endpoints are returned in
+ * @maxevents: Length of @events
+ * @timeout_msecs: Timeout in msecs, -ve implies infinite timeout
+ *
+ * Returns the number of ready endpoints, 0 on timeout, -EINTR if a signal
+ * is pending and -EINVAL if @maxevents is not positive.
+ */
+int scif_pollset_wait(scif_pollset_t ps, struct scif_pollevent *events,
+		      int maxevents, long timeout_msecs)
+{
+	long timeout = timeout_msecs < 0 ? MAX_SCHEDULE_TIMEOUT :
+		msecs_to_jiffies(timeout_msecs);
+	long rc;
+	int count;
+
+	if (maxevents <= 0)
+		return -EINVAL;
+
+	while (1) {
+		mutex_lock(&ps->mtx);
+		count = scif_pollset_harvest(ps, events, maxevents);
+		mutex_unlock(&ps->mtx);
+		if (count || !timeout)
+			return count;
+
+		rc = wait_event_interruptible_timeout(ps->wq,
+					!list_empty_careful(&ps->ready),
+					timeout);
+		if (rc < 0)
+			return -EINTR;
+		/* Poll once more after a timeout, like epoll */
+		timeout = rc;
+	}
+}
+EXPORT_SYMBOL_GPL(scif_pollset_wait);
+
+/**
+ * scif_pollset_ep_release() - Remove a closing endpoint from its poll sets
+ * @ep: Endpoint
+ */
+void scif_pollset_ep_release(struct scif_endpt *ep)
+{
+	struct scif_pollitem *item;
+	struct scif_pollset *ps;
+
+	if (list_empty(&ep->pollset_list))
+		return;
+
+	mutex_lock(&scif_pollset_mutex);
+	while (!list_empty(&ep->pollset_list)) {
+		item = list_first_entry(&ep->pollset_list,
+					struct scif_pollitem, ep_link);
+		ps = item->ps;
+		mutex_lock(&ps->mtx);
+		scif_pollitem_remove(item);
+		mutex_unlock(&ps->mtx);
+	}
+	mutex_unlock(&scif_pollset_mutex);
+}
+
+#define SCIF_POLLSET_BENCH_EPS		1024
+#define SCIF_POLLSET_BENCH_ROUNDS	1000
+#define SCIF_POLLSET_BENCH_TIMEOUT	1000
+
+struct scif_pollset_bench {
+	scif_epd_t lep;
+	scif_epd_t cep[SCIF_POLLSET_BENCH_EPS];
+	scif_epd_t sep[SCIF_POLLSET_BENCH_EPS];
+	struct scif_pollepd pfd[SCIF_POLLSET_BENCH_EPS];
+};
+
+/* Connect SCIF_POLLSET_BENCH_EPS endpoint pairs over loopback */
+static int scif_pollset_bench_connect(struct scif_pollset_bench *b)
+{
+	struct scif_port_id port, peer;
+	int i, err;
+
+	b->lep = scif_open();
+	if (!b->lep)
+		return -ENOMEM;
+	err = scif_bind(b->lep, 0);
+	if (err < 0)
+		return err;
+	port.node = scif_info.nodeid;
+	port.port = err;
+	err = scif_listen(b->lep, 1);
+	if (err)
+		return err;
+
+	/* Connect without blocking so that the same thread can accept */
+	for (i = 0; i < SCIF_POLLSET_BENCH_EPS; i++) {
+		b->cep[i] = scif_open();
+		if (!b->cep[i])
+			return -ENOMEM;
+		err = __scif_connect(b->cep[i], &port, true);
+		if (err != -EINPROGRESS)
+			return err ? err : -EIO;
+		err = scif_accept(b->lep, &peer, &b->sep[i], SCIF_ACCEPT_SYNC);
+		if (err)
+			return err;
+		err = __scif_connect(b->cep[i], &port, true);
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
+/* Send a byte to one endpoint after the other and wait for each */
+static int scif_pollset_bench_run(struct scif_pollset_bench *b,
+				  scif_pollset_t ps, s64 *ns)
+{
+	struct scif_pollevent event;
+	ktime_t start = ktime_get();
+	int r, i, ready, err;
+	char c = 0;
+
+	for (r = 0; r < SCIF_POLLSET_BENCH_ROUNDS; r++) {
+		i = (r * 7919) % SCIF_POLLSET_BENCH_EPS;
+		err = scif_send(b->cep[i], &c, 1, SCIF_SEND_BLOCK);
+		if (err < 0)
+			return err;
+
+		if (ps) {
+			err = scif_pollset_wait(ps, &event, 1,
+						SCIF_POLLSET_BENCH_TIMEOUT);
+			ready = err > 0 ? event.data : -1;
+		} else {
+			err = scif_poll(b->pfd, SCIF_POLLSET_BENCH_EPS,
+					SCIF_POLLSET_BENCH_TIMEOUT);
+			for (ready = 0; err > 0 &&
+			     ready < SCIF_POLLSET_BENCH_EPS; ready++)
+				if (b->pfd[ready].revents)
+					break;
+		}
+		if (err < 0)
+			return err;
+		if (err != 1 || ready != i)
+			return -EIO;
+
+		err = scif_recv(b->sep[i], &c, 1, SCIF_RECV_BLOCK);
+		if (err < 0)
+			return err;
+	}
+	*ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	return 0;
+}
+
+/**
+ * scif_pollset_bench() - Compare scif_poll() to a poll set
+ * @s: seq_file the results are printed to
+ *
+ * Connects SCIF_POLLSET_BENCH_EPS endpoint pairs over loopback and, for
+ * SCIF_POLLSET_BENCH_ROUNDS rounds, sends a byte on one of them and waits
+ * for it on all the accepted endpoints, once with scif_poll() and once
+ * with a poll set.
+ */
+int scif_pollset_bench(struct seq_file *s)
+{
+	struct scif_pollset_bench *b;
+	struct scif_pollevent event;
+	s64 poll_ns, pollset_ns;
+	scif_pollset_t ps = NULL;
+	ktime_t start;
+	int i, err;
+
+	b = vzalloc(sizeof(*b));
+	if (!b)
+		return -ENOMEM;
+
+	start = ktime_get();
+	err = scif_pollset_bench_connect(b);
+	if (err)
+		goto close;
+	seq_printf(s, "%d loopback connections in %lld ms\n",
+		   SCIF_POLLSET_BENCH_EPS,
+		   ktime_to_ms(ktime_sub(ktime_get(), start)));
+
+	for (i = 0; i < SCIF_POLLSET_BENCH_EPS; i++) {
+		b->pfd[i].epd = b->sep[i];
+		b->pfd[i].events = POLLIN;
+	}
+	err = scif_pollset_bench_run(b, NULL, &poll_ns);
+	if (err)
+		goto close;
+
+	ps = scif_pollset_create();
+	if (!ps) {
+		err = -ENOMEM;
+		goto close;
+	}
+	start = ktime_get();
+	for (i = 0; i < SCIF_POLLSET_BENCH_EPS; i++) {
+		event.events = POLLIN;
+		event.data = i;
+		err = scif_pollset_ctl(ps, SCIF_POLLSET_ADD, b->sep[i], &event);
+		if (err)
+			goto close;
+	}
+	seq_printf(s, "pollset add    %8lld us\n",
+		   ktime_to_us(ktime_sub(ktime_get(), start)));
+	err = scif_pollset_bench_run(b, ps, &pollset_ns);
+	if (err)
+		goto close;
+
+	seq_printf(s, "scif_poll      %8lld ns/wakeup\n",
+		   div_s64(poll_ns, SCIF_POLLSET_BENCH_ROUNDS));
+	seq_printf(s, "scif_pollset   %8lld ns/wakeup\n",
+		   div_s64(pollset_ns, SCIF_POLLSET_BENCH_ROUNDS));
+close:
+	if (ps)
+		scif_pollset_destroy(ps);
+	for (i = 0; i < SCIF_POLLSET_BENCH_EPS; i++) {
+		if (b->sep[i])
+			scif_close(b->sep[i]);
+		if (b->cep[i])
+			scif_close(b->cep[i]);
+	}
+	if (b->lep)
+		scif_close(b->lep);
+	vfree(b);
+	return err;
+}
@@ -21,6 +21,8 @@
 #endif
 #include <linux/moduleparam.h>
 #include <linux/pagemap.h>
+#include <linux/seq_file.h>
+#include <linux/sizes.h>
 #if RHEL_RELEASE_CODE > RHEL_RELEASE_VERSION(7, 3)
 #include <linux/sched.h>
 #include <linux/sched/mm.h>
@@ -158,18 +160,25 @@ void scif_rma_ep_init(struct scif_endpt *ep)
 #endif
 	spin_lock_init(&rma->tc_lock);
 	mutex_init(&rma->mmn_lock);
-	INIT_LIST_HEAD(&rma->reg_list);
-	INIT_LIST_HEAD(&rma->remote_reg_list);
+	scif_init_window_list(&rma->reg_list, false);
+	scif_init_window_list(&rma->remote_reg_list, false);
 	atomic_set(&rma->tw_refcount, 0);
 	atomic_set(&rma->tcw_refcount, 0);
 	atomic_set(&rma->tcw_total_pages, 0);
+	INIT_LIST_HEAD(&rma->tc_lru);
+	rma->tc_pages = 0;
 	atomic_set(&rma->fence_refcount, 0);
 
 	rma->async_list_del = 0;
 	rma->dma_chan = NULL;
+	rma->dma_ch_idx = 0;
+	rma->nr_stripes = 1;
 	INIT_LIST_HEAD(&rma->mmn_list);
 	INIT_LIST_HEAD(&rma->vma_list);
 	init_waitqueue_head(&rma->markwq);
+	atomic_set(&rma->stripes, 0);
+	init_waitqueue_head(&rma->stripewq);
+	scif_cq_init(&rma->cq);
 }
 
 /**
@@ -184,12 +193,14 @@ int scif_rma_ep_can_uninit(struct scif_endpt *ep)
 
 	mutex_lock(&ep->rma_info.rma_lock);
 	/* Destroy RMA Info only if both lists are empty */
-	if (list_empty(&ep->rma_info.reg_list) &&
-	    list_empty(&ep->rma_info.remote_reg_list) &&
+	if (list_empty(&ep->rma_info.reg_list.list) &&
+	    list_empty(&ep->rma_info.remote_reg_list.list) &&
 	    list_empty(&ep->rma_info.mmn_list) &&
 	    !atomic_read(&ep->rma_info.tw_refcount) &&
 	    !atomic_read(&ep->rma_info.tcw_refcount) &&
-	    !atomic_read(&ep->rma_info.fence_refcount))
+	    !atomic_read(&ep->rma_info.fence_refcount) &&
+	    !atomic_read(&ep->rma_info.stripes) &&
+	    !atomic_read(&ep->rma_info.cq.inflight))
 		ret = 1;
 	mutex_unlock(&ep->rma_info.rma_lock);
 	return ret;
@@ -285,6 +296,7 @@ struct scif_window *scif_create_window(struct scif_endpt *ep, int nr_pages,
 	window->reg_state = OP_IDLE;
 	init_waitqueue_head(&window->regwq);
 	INIT_LIST_HEAD(&window->list);
+	INIT_LIST_HEAD(&window->lru);
 	window->type = SCIF_WINDOW_SELF;
 	window->temp = temp;
 	window->mapped_pages = 0;
@@ -526,7 +538,7 @@ static int scif_create_remote_lookup(struct scif_dev *remote_dev,
 				     struct scif_window *window)
 {
 	int i, j, err = 0;
-	int nr_pages = window->nr_pages;
+	int nr_chunks = window->max_chunks;
 	bool dma_phys_is_vmalloc, num_pages_is_vmalloc;
 
 	might_sleep();
@@ -536,9 +548,8 @@ static int scif_create_remote_lookup(struct scif_dev *remote_dev,
 	if (err)
 		goto error_window;
 
-	/* Compute the number of lookup entries. 21 == 2MB Shift */
-	window->nr_lookup = ALIGN(nr_pages * PAGE_SIZE,
-					((2) * 1024 * 1024)) >> 21;
+	/* One lookup entry per page of chunk addresses */
+	window->nr_lookup = DIV_ROUND_UP(nr_chunks, SCIF_NR_ADDR_IN_PAGE);
 
 	window->dma_addr_lookup.lookup =
 		scif_alloc_coherent(&window->dma_addr_lookup.offset,
@@ -564,7 +575,7 @@ static int scif_create_remote_lookup(struct scif_dev *remote_dev,
 	num_pages_is_vmalloc = is_vmalloc_addr(&window->num_pages[0]);
 
 	/* Now map each of the pages containing physical addresses */
-	for (i = 0, j = 0; i < nr_pages; i += SCIF_NR_ADDR_IN_PAGE, j++) {
+	for (i = 0, j = 0; i < nr_chunks; i += SCIF_NR_ADDR_IN_PAGE, j++) {
 		err = scif_map_page(&window->dma_addr_lookup.lookup[j],
 				    dma_phys_is_vmalloc ?
 				    vmalloc_to_page(&window->dma_addr[i]) :
@@ -602,7 +613,7 @@ static void scif_destroy_remote_lookup(struct scif_dev *remote_dev,
 		struct scif_rma_lookup *lup = &window->dma_addr_lookup;
 		struct scif_rma_lookup *npup = &window->num_pages_lookup;
 
-		for (i = 0, j = 0; i < window->nr_pages;
+		for (i = 0, j = 0; i < window->max_chunks;
 			i += SCIF_NR_ADDR_IN_PAGE, j++) {
 			if (lup->lookup && lup->lookup[j])
 				scif_unmap_page(lup->lookup[j],
@@ -632,11 +643,13 @@ static void scif_destroy_remote_lookup(struct scif_dev *remote_dev,
  * scif_create_remote_window:
  * @ep: end point
  * @nr_pages: number of pages in window
+ * @nr_chunks: most contiguous chunks the window is made of
  *
  * Allocate and prepare a remote registration window.
  */
 static struct scif_window *
-scif_create_remote_window(struct scif_dev *scifdev, int nr_pages)
+scif_create_remote_window(struct scif_dev *scifdev, int nr_pages,
+			  int nr_chunks)
 {
 	struct scif_window *window;
 
@@ -647,12 +660,13 @@ scif_create_remote_window(struct scif_dev *scifdev, int nr_pages)
 
 	window->magic = SCIFEP_MAGIC;
 	window->nr_pages = nr_pages;
+	window->max_chunks = nr_chunks;
 
-	window->dma_addr = scif_zalloc(nr_pages * sizeof(*window->dma_addr));
+	window->dma_addr = scif_zalloc(nr_chunks * sizeof(*window->dma_addr));
 	if (!window->dma_addr)
 		goto error_window;
 
-	window->num_pages = scif_zalloc(nr_pages *
+	window->num_pages = scif_zalloc(nr_chunks *
 					sizeof(*window->num_pages));
 	if (!window->num_pages)
 		goto error_window;
@@ -662,6 +676,7 @@ scif_create_remote_window(struct scif_dev *scifdev, int nr_pages)
 
 	window->type = SCIF_WINDOW_PEER;
 	INIT_LIST_HEAD(&window->list);
+	INIT_LIST_HEAD(&window->lru);
 	return window;
 error_window:
 	scif_destroy_remote_window(window, scifdev);
@@ -680,9 +695,9 @@ void
 scif_destroy_remote_window(struct scif_window *window, struct scif_dev *remote_dev)
 {
 	scif_destroy_remote_lookup(remote_dev, window);
-	scif_free(window->dma_addr, window->nr_pages *
+	scif_free(window->dma_addr, window->max_chunks *
 		  sizeof(*window->dma_addr));
-	scif_free(window->num_pages, window->nr_pages *
+	scif_free(window->num_pages, window->max_chunks *
 		  sizeof(*window->num_pages));
 	window->magic = 0;
 	scif_free(window, sizeof(*window));
@@ -700,7 +715,8 @@ static int scif_dma_map(struct scif_dev *remote_dev,
 			  struct scif_window *window)
 {
 	struct scatterlist *sg;
-	int i, err;
+	dma_addr_t last_da;
+	int i, j, nents, err;
 	int idx = remote_dev->dma_ch_idx;
 	scif_pinned_pages_t pin = window->pinned_pages;
 
@@ -708,33 +724,32 @@ static int scif_dma_map(struct scif_dev *remote_dev,
 	if (!window->st)
 		return -ENOMEM;
 
-	err = sg_alloc_table(window->st, window->nr_pages, GFP_KERNEL);
+	/* Physically contiguous pages, huge pages say, share one entry */
+	err = sg_alloc_table_from_pages(window->st, pin->pages,
+					window->nr_pages, 0,
+					window->nr_pages << PAGE_SHIFT,
+					GFP_KERNEL);
 	if (err)
 		return err;
 
-	for_each_sg(window->st->sgl, sg, window->st->nents, i)
-		sg_set_page(sg, pin->pages[i], PAGE_SIZE, 0x0);
-
-	err = dma_map_sg(remote_dev->sdev->dma_ch[idx]->device->dev,
-			window->st->sgl, window->st->nents, DMA_BIDIRECTIONAL);
-	if (!err)
+	nents = dma_map_sg(remote_dev->sdev->dma_ch[idx]->device->dev,
+			   window->st->sgl, window->st->nents,
+			   DMA_BIDIRECTIONAL);
+	if (!nents)
 		return -ENOMEM;
 	/* Detect contiguous ranges of DMA mappings */
-	sg = window->st->sgl;
-	for (i = 0; sg; i++) {
-		dma_addr_t last_da;
-
-		window->dma_addr[i] = sg_dma_address(sg);
-		window->num_pages[i] = sg_dma_len(sg) >> PAGE_SHIFT;
-		last_da = sg_dma_address(sg) + sg_dma_len(sg);
-		while ((sg = sg_next(sg)) && sg_dma_address(sg) == last_da) {
-			window->num_pages[i] +=
-				(sg_dma_len(sg) >> PAGE_SHIFT);
-			last_da = window->dma_addr[i] +
-				sg_dma_len(sg);
+	i = -1;
+	last_da = 0;
+	for_each_sg(window->st->sgl, sg, nents, j) {
+		if (i < 0 || sg_dma_address(sg) != last_da) {
+			i++;
+			window->dma_addr[i] = sg_dma_address(sg);
+			window->num_pages[i] = 0;
 		}
-		window->nr_contig_chunks++;
+		window->num_pages[i] += sg_dma_len(sg) >> PAGE_SHIFT;
+		last_da = sg_dma_address(sg) + sg_dma_len(sg);
 	}
+	window->nr_contig_chunks = i + 1;
 	return 0;
 }
 
@@ -831,6 +846,25 @@ int scif_unregister_window(struct scif_window *window)
 	return err;
 }
 
+/*
+ * scif_nr_contig_chunks:
+ * @window: self registration window
+ *
+ * Count the physically contiguous runs of pages backing a window. Huge
+ * pages make for long runs. Neither scif_map_window() nor an IOMMU split
+ * a run, so this bounds the number of chunks of the window.
+ */
+static int scif_nr_contig_chunks(struct scif_window *window)
+{
+	struct page **pages = window->pinned_pages->pages;
+	int i, nr_chunks = 1;
+
+	for (i = 1; i < window->nr_pages; i++)
+		if (page_to_pfn(pages[i]) != page_to_pfn(pages[i - 1]) + 1)
+			nr_chunks++;
+	return nr_chunks;
+}
+
 /**
  * scif_send_alloc_request:
  * @ep: end point
@@ -846,12 +880,15 @@ static int scif_send_alloc_request(struct scif_endpt *ep,
 
 	/* Set up the Alloc Handle */
 	alloc->state = OP_IN_PROGRESS;
+	alloc->nr_chunks = scif_nr_contig_chunks(window);
 	init_waitqueue_head(&alloc->allocwq);
 
 	/* Send out an allocation request */
 	msg.uop = SCIF_ALLOC_REQ;
+	msg.payload[0] = 0;
 	msg.payload[1] = window->nr_pages;
 	msg.payload[2] = (u64)&window->alloc_handle;
+	msg.payload[3] = SCIF_ALLOC_CHUNKS_MAGIC << 32 | alloc->nr_chunks;
 	return _scif_nodeqp_send(ep->remote_dev, &msg);
 }
 
@@ -876,6 +913,9 @@ static int scif_prep_remote_window(struct scif_endpt *ep,
 	int err, map_err;
 
 	map_err = scif_map_window(ep->remote_dev, window);
+	/* The peer only made room for that many chunks */
+	if (!map_err && window->nr_contig_chunks > alloc->nr_chunks)
+		map_err = -E2BIG;
 	if (map_err)
 		dev_err(&ep->remote_dev->sdev->dev,
 			"%s %d map_err %d\n", __func__, __LINE__, map_err);
@@ -1146,8 +1186,15 @@ void scif_alloc_req(struct scif_dev *scifdev, struct scifmsg *msg)
 	int err;
 	struct scif_window *window = NULL;
 	int nr_pages = msg->payload[1];
-
-	window = scif_create_remote_window(scifdev, nr_pages);
+	int nr_chunks = nr_pages;
+	u64 chunks = msg->payload[3];
+
+	/* Peers which do not tag a chunk count get one chunk per page */
+	if (upper_32_bits(chunks) == SCIF_ALLOC_CHUNKS_MAGIC &&
+	    lower_32_bits(chunks) &&
+	    lower_32_bits(chunks) <= (u32)nr_pages)
+		nr_chunks = lower_32_bits(chunks);
+	window = scif_create_remote_window(scifdev, nr_pages, nr_chunks);
 	if (!window) {
 		err = -ENOMEM;
 		goto error;
@@ -1306,9 +1353,10 @@ void scif_recv_unreg(struct scif_dev *scifdev, struct scifmsg *msg)
 			msg->uop = SCIF_DELETE_WINDOW;
 			atomic_inc(&ep->rma_info.tw_refcount);
 			ep->rma_info.async_list_del = 1;
-			list_del_init(&window->list);
+			scif_delete_window(window);
 			scif_drain_dma_intr(ep->remote_dev->sdev,
 			    ep->rma_info.dma_chan);
+			scif_wait_stripes(ep);
 			scif_nodeqp_send(ep->remote_dev, msg);
 			scif_queue_for_cleanup(window, &scif_info.rma);
 		} else {
@@ -1377,13 +1425,14 @@ void scif_recv_del_window(struct scif_dev *scifdev, struct scifmsg *msg)
 	mutex_lock(&ep->rma_info.rma_lock);
 	window->unreg_state = SCIF_UNREG_ACCEPTED;
 	atomic_inc(&ep->rma_info.tw_refcount);
-	list_del_init(&window->list);
+	scif_delete_window(window);
 	scif_free_window_offset(ep, window, window->offset);
 	mutex_unlock(&ep->rma_info.rma_lock);
 	if ((!!(window->pinned_pages->map_flags & SCIF_MAP_KERNEL)) &&
 	    scifdev_alive(ep)) {
 		scif_drain_dma_intr(ep->remote_dev->sdev,
 				    ep->rma_info.dma_chan);
+		scif_wait_stripes(ep);
 	} else if (window->pid) {
 		mm = __scif_get_pid_mm(window->pid);
 		if (mm) {
@@ -1537,6 +1586,76 @@ error_unmap:
 	return err;
 }
 
+/**
+ * scif_pin_temp_pages:
+ * @addr: page aligned start of the range
+ * @len: page aligned length of the range
+ * @out_prot: protection requested, updated as by __scif_pin_pages()
+ * @reuse: pinned pages of a cached window overlapping the range, or NULL
+ * @reuse_va: virtual address the pages in @reuse start at
+ * @pages: pinned pages returned by reference
+ *
+ * Pin the pages backing a temporary window. The part of the range @reuse
+ * already holds only gets an extra page reference, get_user_pages_fast()
+ * is limited to the head and tail outside of it. The caller has checked
+ * that @reuse was pinned with the protection it needs.
+ */
+int scif_pin_temp_pages(unsigned long addr, size_t len, int *out_prot,
+			struct scif_pinned_pages *reuse,
+			unsigned long reuse_va, scif_pinned_pages_t *pages)
+{
+	struct scif_pinned_pages *pinned_pages;
+	unsigned long start, end;
+	int nr_pages, first, last, i, write;
+	int prot;
+
+	if (!reuse)
+		goto pin_all;
+
+	start = max(addr, reuse_va);
+	end = min(addr + len, reuse_va + (reuse->nr_pages << PAGE_SHIFT));
+	if (start >= end)
+		goto pin_all;
+
+	prot = reuse->prot;
+	write = !!(prot & SCIF_PROT_WRITE);
+	nr_pages = len >> PAGE_SHIFT;
+	first = (start - addr) >> PAGE_SHIFT;
+	last = (end - addr) >> PAGE_SHIFT;
+
+	pinned_pages = scif_create_pinned_pages(nr_pages, prot);
+	if (!pinned_pages)
+		return -ENOMEM;
+	pinned_pages->nr_pages = nr_pages;
+
+	if (first && get_user_pages_fast(addr, first, write,
+					 pinned_pages->pages) != first)
+		goto rollback;
+	if (last < nr_pages &&
+	    get_user_pages_fast(addr + ((u64)last << PAGE_SHIFT),
+				nr_pages - last, write,
+				pinned_pages->pages + last) != nr_pages - last)
+		goto rollback;
+
+	for (i = first; i < last; i++) {
+		pinned_pages->pages[i] =
+			reuse->pages[((start - reuse_va) >> PAGE_SHIFT) +
+				     i - first];
+		get_page(pinned_pages->pages[i]);
+	}
+
+	pinned_pages->map_flags = 0;
+	atomic_set(&pinned_pages->ref_count, 1);
+	*out_prot = prot;
+	*pages = pinned_pages;
+	return 0;
+rollback:
+	/* Release whatever got pinned and retry the plain way */
+	scif_destroy_pinned_pages(pinned_pages);
+pin_all:
+	return __scif_pin_pages((void *)addr, len, out_prot, 0, pages, NULL);
+}
+
 int scif_pin_pages(void *addr, size_t len, int prot,
 		   int map_flags, scif_pinned_pages_t *pages)
 {
@@ -1733,7 +1852,7 @@ get_offset:
 		/* Validate whether this window/offset still exists on reg_list,
 		 * if so, wait until it is removed */
 		s64 end_offset;
-		struct list_head *head = &ep->rma_info.reg_list;
+		struct list_head *head = &ep->rma_info.reg_list.list;
 		struct list_head *item;
 
 		mutex_lock(&ep->rma_info.rma_lock);
@@ -1787,13 +1906,6 @@ get_offset:
 
 	window->nr_pages = len >> PAGE_SHIFT;
 
-	err = scif_send_alloc_request(ep, window);
-	if (err) {
-		scif_destroy_incomplete_window(ep, window);
-		scif_put_peer_dev(spdev);
-		return err;
-	}
-
 	/* Pin down the pages */
 	err = __scif_pin_pages(addr, len, &prot,
 			       map_flags & SCIF_MAP_KERNEL,
@@ -1806,6 +1918,11 @@ get_offset:
 	window->pinned_pages = pinned_pages;
 	window->prot = pinned_pages->prot;
 
+	/* The request carries the chunk count of the pinned pages */
+	err = scif_send_alloc_request(ep, window);
+	if (err)
+		goto error_unmap;
+
 	/* Prepare the remote registration window */
 	err = scif_prep_remote_window(ep, window);
 	if (err) {
@@ -1880,3 +1997,89 @@ scif_unregister(scif_epd_t epd, off_t offset, size_t len)
 	return err;
 }
 EXPORT_SYMBOL_GPL(scif_unregister);
+
+#define SCIF_REG_BENCH_LEN	SZ_2M
+#define SCIF_REG_BENCH_ROUNDS	100
+
+/* Register and unregister @addr SCIF_REG_BENCH_ROUNDS times */
+static int scif_rma_reg_bench_run(scif_epd_t epd, void *addr,
+				  s64 *reg_ns, s64 *unreg_ns)
+{
+	ktime_t start;
+	off_t offset;
+	int r, err;
+
+	*reg_ns = 0;
+	*unreg_ns = 0;
+	for (r = 0; r < SCIF_REG_BENCH_ROUNDS; r++) {
+		start = ktime_get();
+		offset = scif_register(epd, addr, SCIF_REG_BENCH_LEN, 0,
+				       SCIF_PROT_READ | SCIF_PROT_WRITE,
+				       SCIF_MAP_KERNEL);
+		if (offset < 0)
+			return offset;
+		*reg_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+
+		start = ktime_get();
+		err = scif_unregister(epd, offset, SCIF_REG_BENCH_LEN);
+		if (err)
+			return err;
+		*unreg_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+	}
+	return 0;
+}
+
+/**
+ * scif_rma_reg_bench() - Measure registration latency over loopback
+ * @s: seq_file the results are printed to
+ *
+ * Registers a physically contiguous buffer, which the peer window holds
+ * in a single chunk, and a vmalloc buffer of the same size, which usually
+ * needs one chunk per page.
+ */
+int scif_rma_reg_bench(struct seq_file *s)
+{
+	scif_epd_t cep, sep;
+	struct page *page;
+	void *scattered;
+	s64 reg_ns, unreg_ns;
+	int err;
+
+	page = alloc_pages(GFP_KERNEL | __GFP_NOWARN,
+			   get_order(SCIF_REG_BENCH_LEN));
+	scattered = vmalloc(SCIF_REG_BENCH_LEN);
+	if (!page || !scattered) {
+		err = -ENOMEM;
+		goto free;
+	}
+	err = scif_loopback_connect(&cep, &sep);
+	if (err)
+		goto close;
+
+	err = scif_rma_reg_bench_run(cep, page_address(page),
+				     &reg_ns, &unreg_ns);
+	if (err)
+		goto close;
+	seq_printf(s, "contiguous %u KB: register %8lld ns unregister %8lld ns\n",
+		   SCIF_REG_BENCH_LEN >> 10,
+		   div_s64(reg_ns, SCIF_REG_BENCH_ROUNDS),
+		   div_s64(unreg_ns, SCIF_REG_BENCH_ROUNDS));
+
+	err = scif_rma_reg_bench_run(cep, scattered, &reg_ns, &unreg_ns);
+	if (err)
+		goto close;
+	seq_printf(s, "vmalloc    %u KB: register %8lld ns unregister %8lld ns\n",
+		   SCIF_REG_BENCH_LEN >> 10,
+		   div_s64(reg_ns, SCIF_REG_BENCH_ROUNDS),
+		   div_s64(unreg_ns, SCIF_REG_BENCH_ROUNDS));
+close:
+	if (sep)
+		scif_close(sep);
+	if (cep)
+		scif_close(cep);
+free:
+	vfree(scattered);
+	if (page)
+		__free_pages(page, get_order(SCIF_REG_BENCH_LEN));
+	return err;
+}
@@ -76,6 +76,13 @@
 #define SCIF_KMEM_UNALIGNED_BUF_SIZE (SCIF_MAX_UNALIGNED_BUF_SIZE + \
 				      (L1_CACHE_BYTES << 1))
 
+/* Depth of an RMA completion queue unless set with SCIF_OPT_CQ_DEPTH */
+#define SCIF_CQ_DEFAULT_DEPTH		256
+#define SCIF_CQ_MAX_DEPTH		0x10000
+
+/* Most DMA channels an RMA may be striped across, see SCIF_OPT_DMA_CHANNELS */
+#define SCIF_MAX_STRIPES		8
+
 #define SCIF_IOVA_START_PFN		(1)
 #ifndef MIC_IN_KERNEL_BUILD
 #define SCIF_IOVA_PFN(addr) ((addr) >> PAGE_SHIFT)
@@ -83,6 +90,46 @@
 #define SCIF_DMA_63BIT_PFN SCIF_IOVA_PFN(DMA_BIT_MASK(63))
 #endif
 
+/*
+ * struct scif_window_list - Registration windows of an endpoint
+ *
+ * @list: Windows sorted by offset, or by va_for_temp for temporary cached
+ *	  windows, for walking ranges which span contiguous windows
+ * @tree: Interval tree over the same windows and key, for finding the
+ *	  first window of a range without walking the list
+ * @tcw: True if the windows are keyed by va_for_temp
+ */
+struct scif_window_list {
+	struct list_head list;
+	struct rb_root_cached tree;
+	bool tcw;
+};
+
+/*
+ * struct scif_cq - RMA completion queue of an endpoint
+ *
+ * @mutex: Serializes allocation of the ring against depth changes
+ * @lock: Protects the ring, also taken from DMA callbacks
+ * @ring: Completions not reaped yet, allocated on first use
+ * @depth: Number of entries of the ring
+ * @head: Index of the oldest completion
+ * @count: Number of completions in the ring
+ * @reserved: Slots taken by completions and by RMAs still in flight
+ * @inflight: RMAs whose DMA callback has not run yet
+ * @wq: Waiters for completions
+ */
+struct scif_cq {
+	struct mutex mutex;
+	spinlock_t lock;
+	struct scifioctl_cqe *ring;
+	int depth;
+	int head;
+	int count;
+	int reserved;
+	atomic_t inflight;
+	wait_queue_head_t wq;
+};
+
 /*
  * struct scif_endpt_rma_info - Per Endpoint Remote Memory Access Information
  *
@@ -91,26 +138,36 @@
  * @iovad: Offset generator
  * @rma_lock: Synchronizes access to self/remote list and also protects the
  *	      window from being destroyed while RMAs are in progress.
- * @tc_lock: Synchronizes access to temporary cached windows list
- *	     for SCIF Registration Caching.
+ * @tc_lock: Guards the temporary cached windows of SCIF Registration
+ *	     Caching: the tc_reg_list of every MMU notifier on mmn_list,
+ *	     tc_lru and tc_pages. The RMA lock is not needed for them.
  * @mmn_lock: Synchronizes access to the list of MMU notifiers registered
  * @tw_refcount: Keeps track of number of outstanding temporary registered
  *		 windows created by scif_vreadfrom/scif_vwriteto which have
  *		 not been destroyed.
  * @tcw_refcount: Same as tw_refcount but for temporary cached windows
  * @tcw_total_pages: Same as tcw_refcount but in terms of pages pinned
+ * @tc_lru: Temporary cached windows, least recently used first
+ * @tc_pages: Pages held by the windows on tc_lru
  * @mmn_list: MMU notifier so that we can destroy the windows when required
  * @fence_refcount: Keeps track of number of outstanding remote fence
  *		    requests which have been received by the peer.
  * @dma_chan: DMA channel used for all DMA transfers for this endpoint.
+ * @dma_ch_idx: Index of dma_chan among the channels of its SCIF device
+ * @nr_stripes: Number of DMA channels a large RMA may be striped across,
+ *		set through SCIF_OPT_DMA_CHANNELS
  * @signal_pool: DMA pool used for scheduling scif_fence_signal DMA's
  * @async_list_del: Detect asynchronous list entry deletion
  * @vma_list: List of vmas with remote memory mappings
  * @markwq: Wait queue used for scif_fence_mark/scif_fence_wait
+ * @stripes: Stripes of striped RMAs still in flight on channels other
+ *	     than dma_chan
+ * @stripewq: Wait queue used for stripes to drop to zero
+ * @cq: Completion queue of RMAs posted with SCIF_RMA_POST
 */
 struct scif_endpt_rma_info {
-	struct list_head reg_list;
-	struct list_head remote_reg_list;
+	struct scif_window_list reg_list;
+	struct scif_window_list remote_reg_list;
 	struct iova_domain iovad;
 	struct mutex rma_lock;
 	spinlock_t tc_lock;
@@ -118,13 +175,20 @@ struct scif_endpt_rma_info {
 	atomic_t tw_refcount;
 	atomic_t tcw_refcount;
 	atomic_t tcw_total_pages;
+	struct list_head tc_lru;
+	int tc_pages;
 	struct list_head mmn_list;
 	atomic_t fence_refcount;
 	struct dma_chan	*dma_chan;
+	int dma_ch_idx;
+	int nr_stripes;
 	struct dma_pool	*signal_pool;
 	int async_list_del;
 	struct list_head vma_list;
 	wait_queue_head_t markwq;
+	atomic_t stripes;
+	wait_queue_head_t stripewq;
+	struct scif_cq cq;
 };
 
 /*
@@ -222,6 +286,8 @@ enum scif_unreg_state {
 /*
  * struct scif_window - Registration Window for Self and Remote
  *
+ * @tree_node: link in the interval tree of the window list. First, so that
+ *	       it is aligned in spite of __packed
  * @nr_pages: Number of pages which is defined as a s64 instead of an int
  * to avoid sign extension with buffers >= 2GB
  * @nr_contig_chunks: Number of contiguous physical chunks
@@ -233,6 +299,10 @@ enum scif_unreg_state {
  * @ep: Pointer to EP. Useful for passing EP around with messages to
 	avoid expensive list traversals.
  * @list: link to list of windows for the endpoint
+ * @tree_last: last byte of the subtree, maintained by the interval tree
+ * @wlist: window list this window is on, NULL if none
+ * @lru: link in the registration cache LRU of the endpoint, temporary
+ *	 cached windows only
  * @type: self or peer window
  * @peer_window: Pointer to peer window. Useful for sending messages to peer
  *		 without requiring an extra list traversal
@@ -246,6 +316,7 @@ enum scif_unreg_state {
  * @reg_state: Registration state
  * @dma_addr_lookup: Lookup for physical addresses used for DMA
  * @nr_lookup: Number of entries in lookup
+ * @max_chunks: Number of entries in dma_addr and num_pages of a peer window
  * @mapped_offset: Offset used to map the window by the peer
  * @dma_addr: Array of physical addresses used for Mgmt node & MIC initiated DMA
  * @num_pages: Array specifying number of pages for each physical address
@@ -253,6 +324,7 @@ enum scif_unreg_state {
  * @unreg_state: Unregister state
  */
 struct scif_window {
+	struct rb_node tree_node;
 	s64 nr_pages;
 	int nr_contig_chunks;
 	int prot;
@@ -262,6 +334,9 @@ struct scif_window {
 	int dma_mark;
 	u64 ep;
 	struct list_head list;
+	u64 tree_last;
+	struct scif_window_list *wlist;
+	struct list_head lru;
 	enum scif_window_type type;
 	u64 peer_window;
 	bool offset_freed;
@@ -279,6 +354,7 @@ struct scif_window {
 			struct scif_rma_lookup dma_addr_lookup;
 			struct scif_rma_lookup num_pages_lookup;
 			int nr_lookup;
+			int max_chunks;
 			dma_addr_t mapped_offset;
 		} __packed;
 	} __packed;
@@ -288,25 +364,52 @@ struct scif_window {
 	enum scif_unreg_state unreg_state;
 } __packed;
 
+/*
+ * scif_tc_proc - Registration cache usage of a process
+ *
+ * @mm: memory descriptor of the process
+ * @nr_pages: Pages held in the registration caches of all its endpoints
+ * @users: Number of MMU notifiers referring to this entry
+ * @list: link to scif_info.tc_procs
+ */
+struct scif_tc_proc {
+	struct mm_struct *mm;
+	atomic_t nr_pages;
+	int users;
+	struct list_head list;
+};
+
 /*
  * scif_mmu_notif - SCIF mmu notifier information
  *
  * @mmu_notifier ep_mmu_notifier: MMU notifier operations
- * @tc_reg_list: List of temp registration windows for self
+ * @tc_reg_list: List of temp registration windows for self, guarded by
+ *	ep->rma_info.tc_lock
  * @mm: memory descriptor for the task_struct which initiated the RMA
  * @ep: SCIF endpoint
  * @list: link to list of MMU notifier information
+ * @proc: Registration cache usage of the process owning mm
+ * @inval_seq: Bumped under tc_lock on every invalidation, so that a window
+ *	       pinned across one is not cached
  */
 struct scif_mmu_notif {
 #ifdef CONFIG_MMU_NOTIFIER
 	struct mmu_notifier ep_mmu_notifier;
 #endif
-	struct list_head tc_reg_list;
+	struct scif_window_list tc_reg_list;
 	struct mm_struct *mm;
 	struct scif_endpt *ep;
 	struct list_head list;
+	struct scif_tc_proc *proc;
+	unsigned long inval_seq;
 };
 
+/* The MMU notifier whose cache a temporary cached window is on */
+static inline struct scif_mmu_notif *scif_tcw_mmn(struct scif_window *window)
+{
+	return container_of(window->wlist, struct scif_mmu_notif, tc_reg_list);
+}
+
 enum scif_rma_dir {
 	SCIF_LOCAL_TO_REMOTE,
 	SCIF_REMOTE_TO_LOCAL
@@ -347,6 +450,21 @@ void scif_cleanup_rma_for_zombies(int node);
 int scif_reserve_dma_chan(struct scif_endpt *ep);
 /* Setup a DMA mark for an endpoint */
 int _scif_fence_mark(scif_epd_t epd, int *mark);
+/* Call back once the DMA programmed so far for an endpoint is done */
+int scif_prog_dma_intr(struct scif_endpt *ep, dma_async_tx_callback cb,
+		       void *arg, dma_cookie_t *out_cookie);
+int scif_prog_chan_intr(struct scif_endpt *ep, struct dma_chan *chan,
+			dma_async_tx_callback cb, void *arg,
+			dma_cookie_t *out_cookie);
+/* Wait for the stripes of striped RMAs on the other DMA channels */
+int scif_wait_stripes(struct scif_endpt *ep);
+/* RMA completion queues */
+void scif_cq_init(struct scif_cq *cq);
+void scif_cq_free(struct scif_cq *cq);
+int scif_cq_set_depth(struct scif_cq *cq, u64 depth);
+int scif_rma_post(struct scif_endpt *ep, struct scifioctl_rma_op *op);
+int scif_cq_reap(struct scif_endpt *ep, struct scifioctl_cqe *cqes,
+		 int count, int timeout);
 int scif_prog_signal(scif_epd_t epd, off_t offset, u64 val,
 		     enum scif_window_type type);
 void scif_alloc_req(struct scif_dev *scifdev, struct scifmsg *msg);
@@ -434,6 +552,9 @@ static inline void scif_free(void *addr, size_t size)
 		free_pages((unsigned long)addr, get_order(align));
 }
 
+/* Remove a window from its window list. RMA lock must be held. */
+void scif_delete_window(struct scif_window *window);
+
 static inline void
 scif_queue_for_cleanup(struct scif_window *window, struct list_head *list)
 {
@@ -444,7 +565,7 @@ scif_queue_for_cleanup(struct scif_window *window, struct list_head *list)
 			 &window->list, window->list.prev,
 			 window->list.prev, list)) {
 		/* Prevent list corruption */
-		list_del_init(&window->list);
+		scif_delete_window(window);
 	}
 
 	list_add_tail(&window->list, list);
@@ -455,7 +576,7 @@ scif_queue_for_cleanup(struct scif_window *window, struct list_head *list)
 
 static inline void __scif_rma_destroy_tcw_helper(struct scif_window *window)
 {
-	list_del_init(&window->list);
+	scif_delete_window(window);
 	scif_queue_for_cleanup(window, &scif_info.rma_tc);
 }
 
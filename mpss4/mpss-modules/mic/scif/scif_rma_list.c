@@ -52,42 +52,100 @@
 #include "scif_main.h"
 #include <linux/mmu_notifier.h>
 #include <linux/highmem.h>
+#include <linux/seq_file.h>
 
-#ifndef MIC_IN_KERNEL_BUILD
-#ifndef list_last_entry
-#define list_last_entry(ptr, type, member) \
-	list_entry((ptr)->prev, type, member)
-#endif
-#endif
+#include <linux/interval_tree_generic.h>
+
+static inline u64 scif_window_end(struct scif_window *window, u64 start)
+{
+	return start + (window->nr_pages << PAGE_SHIFT) - 1;
+}
+
+#define SCIF_WIN_START(window) ((u64)(window)->offset)
+#define SCIF_WIN_LAST(window) scif_window_end(window, SCIF_WIN_START(window))
+#define SCIF_TCW_START(window) ((u64)(window)->va_for_temp)
+#define SCIF_TCW_LAST(window) scif_window_end(window, SCIF_TCW_START(window))
+
+INTERVAL_TREE_DEFINE(struct scif_window, tree_node, u64, tree_last,
+		     SCIF_WIN_START, SCIF_WIN_LAST, static, scif_win_tree)
+INTERVAL_TREE_DEFINE(struct scif_window, tree_node, u64, tree_last,
+		     SCIF_TCW_START, SCIF_TCW_LAST, static, scif_tcw_tree)
+
+void scif_init_window_list(struct scif_window_list *head, bool tcw)
+{
+	INIT_LIST_HEAD(&head->list);
+	head->tree = RB_ROOT_CACHED;
+	head->tcw = tcw;
+}
 
 /*
- * scif_insert_tcw:
+ * Link a window which was just added to the tree into the list, right
+ * before its successor in the tree. Windows with equal keys go after the
+ * existing ones, as they did when the list was searched linearly.
+ */
+static void scif_link_window(struct scif_window *window,
+			     struct scif_window_list *head)
+{
+	struct rb_node *next = rb_next(&window->tree_node);
+
+	if (next)
+		list_add_tail(&window->list,
+			      &rb_entry(next, struct scif_window,
+					tree_node)->list);
+	else
+		list_add_tail(&window->list, &head->list);
+	window->wlist = head;
+}
+
+/*
+ * scif_delete_window:
  *
- * Insert a temp window to the temp registration list sorted by va_for_temp.
- * RMA lock must be held.
+ * Remove a window from the list it was inserted on, if any.
+ * RMA lock must be held, except for a temp cached window, whose list is
+ * guarded by the tc_lock of its endpoint instead.
  */
-void scif_insert_tcw(struct scif_window *window, struct list_head *head)
+void scif_delete_window(struct scif_window *window)
 {
-	struct scif_window *curr = NULL;
-	struct scif_window *prev = list_entry(head, struct scif_window, list);
-	struct list_head *item;
+	struct scif_window_list *head = window->wlist;
 
-	INIT_LIST_HEAD(&window->list);
-	/* Compare with tail and if the entry is new tail add it to the end */
-	if (!list_empty(head)) {
-		curr = list_entry(head->prev, struct scif_window, list);
-		if (curr->va_for_temp < window->va_for_temp) {
-			list_add_tail(&window->list, head);
-			return;
+	if (head) {
+		if (head->tcw) {
+			struct scif_mmu_notif *mmn = scif_tcw_mmn(window);
+
+			lockdep_assert_held(&mmn->ep->rma_info.tc_lock);
+			scif_tcw_tree_remove(window, &head->tree);
+			list_del_init(&window->lru);
+			mmn->ep->rma_info.tc_pages -= window->nr_pages;
+			atomic_sub(window->nr_pages, &mmn->proc->nr_pages);
+		} else {
+			scif_win_tree_remove(window, &head->tree);
 		}
+		window->wlist = NULL;
 	}
-	list_for_each(item, head) {
-		curr = list_entry(item, struct scif_window, list);
-		if (curr->va_for_temp > window->va_for_temp)
-			break;
-		prev = curr;
-	}
-	list_add(&window->list, &prev->list);
+	list_del_init(&window->list);
+}
+
+/*
+ * scif_insert_tcw:
+ *
+ * Insert a temp window to the temp registration list sorted by va_for_temp,
+ * as the most recently used window of the endpoint.
+ * tc_lock must be held.
+ */
+void scif_insert_tcw(struct scif_window *window,
+		     struct scif_window_list *head)
+{
+	struct scif_mmu_notif *mmn = container_of(head, struct scif_mmu_notif,
+						  tc_reg_list);
+
+	lockdep_assert_held(&mmn->ep->rma_info.tc_lock);
+	INIT_LIST_HEAD(&window->list);
+	scif_tcw_tree_insert(window, &head->tree);
+	scif_link_window(window, head);
+
+	list_add_tail(&window->lru, &mmn->ep->rma_info.tc_lru);
+	mmn->ep->rma_info.tc_pages += window->nr_pages;
+	atomic_add(window->nr_pages, &mmn->proc->nr_pages);
 }
 
 /*
@@ -96,84 +154,105 @@ void scif_insert_tcw(struct scif_window *window, struct list_head *head)
  * Insert a window to the self registration list sorted by offset.
  * RMA lock must be held.
  */
-void scif_insert_window(struct scif_window *window, struct list_head *head)
+void scif_insert_window(struct scif_window *window,
+			struct scif_window_list *head)
 {
-	struct scif_window *curr = NULL, *prev = NULL;
-	struct list_head *item;
-
 	INIT_LIST_HEAD(&window->list);
-	list_for_each(item, head) {
-		curr = list_entry(item, struct scif_window, list);
-		if (curr->offset > window->offset)
-			break;
-		prev = curr;
-	}
-	if (!prev)
-		list_add(&window->list, head);
-	else
-		list_add(&window->list, &prev->list);
+	scif_win_tree_insert(window, &head->tree);
+	scif_link_window(window, head);
 }
 
 /*
  * scif_query_tcw:
  *
- * Query the temp cached registration list of ep for an overlapping window
- * in case of permission mismatch, destroy the previous window. if permissions
- * match and overlap is partial, destroy the window but return the new range
- * RMA lock must be held.
+ * Query the temp cached registration list of ep for an overlapping window.
+ * A window covering the request is a hit and becomes the most recently used
+ * one. In case of permission mismatch, destroy the previous window. If
+ * permissions match and overlap is partial, grow the request to cover the
+ * window too while that fits in the cache, and hand its pinned pages back
+ * through req->reuse so that only the rest of the range has to be pinned.
+ * The window itself is destroyed, the new one replaces it.
+ * tc_lock must be held.
  */
 int scif_query_tcw(struct scif_endpt *ep, struct scif_rma_req *req)
 {
-	struct list_head *item, *temp, *head = req->head;
 	struct scif_window *window;
 	u64 start_va_window, start_va_req = req->va_for_temp;
 	u64 end_va_window, end_va_req = start_va_req + req->nr_bytes;
+	u64 start_va, end_va;
 
+	lockdep_assert_held(&ep->rma_info.tc_lock);
+	req->reuse = NULL;
 	if (!req->nr_bytes)
 		return -EINVAL;
 	/*
-	 * Avoid traversing the entire list to find out that there
-	 * is no entry that matches
+	 * The lowest window which overlaps the request or starts right at
+	 * its end, the first one a walk of the sorted list would stop at.
 	 */
-	if (!list_empty(head)) {
-		window = list_last_entry(head, struct scif_window, list);
-		end_va_window = window->va_for_temp +
-			(window->nr_pages << PAGE_SHIFT);
-		if (start_va_req > end_va_window)
-			return -ENXIO;
-	}
-	list_for_each_safe(item, temp, head) {
-		window = list_entry(item, struct scif_window, list);
-		start_va_window = window->va_for_temp;
-		end_va_window = window->va_for_temp +
-			(window->nr_pages << PAGE_SHIFT);
-		if (start_va_req < start_va_window &&
-		    end_va_req < start_va_window)
-			break;
-		if (start_va_req >= end_va_window)
-			continue;
-		if ((window->prot & req->prot) == req->prot) {
-			if (start_va_req >= start_va_window &&
-			    end_va_req <= end_va_window) {
-				*req->out_window = window;
-				return 0;
-			}
-			/* expand window */
-			if (start_va_req < start_va_window) {
-				req->nr_bytes +=
-					start_va_window - start_va_req;
-				req->va_for_temp = start_va_window;
-			}
-			if (end_va_req >= end_va_window)
-				req->nr_bytes += end_va_window - end_va_req;
+	window = scif_tcw_tree_iter_first(&req->head->tree, start_va_req,
+					  end_va_req);
+	if (!window)
+		goto miss;
+
+	start_va_window = window->va_for_temp;
+	end_va_window = window->va_for_temp +
+		(window->nr_pages << PAGE_SHIFT);
+	/* Only adjacent to the request, leave it alone */
+	if (end_va_req == start_va_window)
+		goto miss;
+	if ((window->prot & req->prot) == req->prot) {
+		if (start_va_req >= start_va_window &&
+		    end_va_req <= end_va_window) {
+			list_move_tail(&window->lru, &ep->rma_info.tc_lru);
+			atomic_long_inc(&scif_info.tc_stats.hit);
+			*req->out_window = window;
+			return 0;
 		}
-		/* Destroy the old window to create a new one */
-		__scif_rma_destroy_tcw_helper(window);
-		break;
+		/* expand window */
+		start_va = min(start_va_req, start_va_window);
+		end_va = max(end_va_req, end_va_window);
+		if (((end_va - start_va) >> PAGE_SHIFT) <=
+		    scif_info.rma_tc_limit) {
+			req->va_for_temp = start_va;
+			req->nr_bytes = end_va - start_va;
+		}
+		/* The pages stay pinned until the caller drops this ref */
+		atomic_inc(&window->pinned_pages->ref_count);
+		req->reuse = window->pinned_pages;
+		req->reuse_va = start_va_window;
+		atomic_long_inc(&scif_info.tc_stats.reuse);
 	}
+	/* Destroy the old window to create a new one */
+	__scif_rma_destroy_tcw_helper(window);
+miss:
+	atomic_long_inc(&scif_info.tc_stats.miss);
 	return -ENXIO;
 }
 
+/*
+ * scif_rma_list_destroy_tcw:
+ *
+ * Destroy the temp cached windows overlapping [start, end).
+ * The tc_lock of the endpoint owning head must be held. It is the lock
+ * which guards head->tree, so the windows are removed through
+ * scif_delete_window() without the RMA lock.
+ */
+void scif_rma_list_destroy_tcw(struct scif_window_list *head,
+			       u64 start, u64 end)
+{
+	struct scif_mmu_notif *mmn = container_of(head, struct scif_mmu_notif,
+						  tc_reg_list);
+	struct scif_window *window, *next;
+
+	lockdep_assert_held(&mmn->ep->rma_info.tc_lock);
+	window = scif_tcw_tree_iter_first(&head->tree, start, end - 1);
+	while (window) {
+		next = scif_tcw_tree_iter_next(window, start, end - 1);
+		__scif_rma_destroy_tcw_helper(window);
+		window = next;
+	}
+}
+
 /*
  * scif_query_window:
  *
@@ -183,7 +262,6 @@ int scif_query_tcw(struct scif_endpt *ep, struct scif_rma_req *req)
  */
 int scif_query_window(struct scif_rma_req *req)
 {
-	struct list_head *item;
 	struct scif_window *window;
 	s64 end_offset, offset = req->offset;
 	u64 tmp_min, nr_bytes_left = req->nr_bytes;
@@ -191,8 +269,12 @@ int scif_query_window(struct scif_rma_req *req)
 	if (!req->nr_bytes)
 		return -EINVAL;
 
-	list_for_each(item, req->head) {
-		window = list_entry(item, struct scif_window, list);
+	/* Skip the windows which end before offset */
+	window = scif_win_tree_iter_first(&req->head->tree, offset, ULLONG_MAX);
+	if (!window)
+		goto enxio;
+
+	list_for_each_entry_from(window, &req->head->list, list) {
 		end_offset = window->offset +
 			(window->nr_pages << PAGE_SHIFT);
 		/* Offset not found! */
@@ -228,6 +310,7 @@ int scif_query_window(struct scif_rma_req *req)
 		if (req->type == SCIF_WINDOW_SINGLE)
 			break;
 	}
+enxio:
 	dev_err(scif_info.mdev.this_device,
 		"%s %d ENXIO\n", __func__, __LINE__);
 	return -ENXIO;
@@ -244,15 +327,17 @@ int scif_rma_list_unregister(scif_epd_t epd,
 				s64 offset, int nr_pages)
 {
 	struct scif_endpt *ep = (struct scif_endpt *)epd;
-	struct list_head *head = &ep->rma_info.reg_list;
-	struct list_head *item;
+	struct scif_window_list *head = &ep->rma_info.reg_list;
 	s64 end_offset;
 	int err = 0;
 	struct scif_window *window;
 	s64 end_req_offset = offset + ((s64)nr_pages << PAGE_SHIFT);
 
-	list_for_each(item, head) {
-		window = list_entry(item, struct scif_window, list);
+	window = scif_win_tree_iter_first(&head->tree, offset, ULLONG_MAX);
+	if (!window)
+		return 0;
+
+	list_for_each_entry_from(window, &head->list, list) {
 		if (window->offset >= end_req_offset)
 			break;
 
@@ -298,7 +383,7 @@ void scif_unmap_all_windows(scif_epd_t epd)
 	struct list_head *item, *tmp;
 	struct scif_window *window;
 	struct scif_endpt *ep = (struct scif_endpt *)epd;
-	struct list_head *head = &ep->rma_info.reg_list;
+	struct list_head *head = &ep->rma_info.reg_list.list;
 
 	mutex_lock(&ep->rma_info.rma_lock);
 	list_for_each_safe(item, tmp, head) {
@@ -320,7 +405,7 @@ int scif_unregister_all_windows(scif_epd_t epd)
 	struct list_head *item, *tmp;
 	struct scif_window *window;
 	struct scif_endpt *ep = (struct scif_endpt *)epd;
-	struct list_head *head = &ep->rma_info.reg_list;
+	struct list_head *head = &ep->rma_info.reg_list.list;
 	int err = 0;
 
 	mutex_lock(&ep->rma_info.rma_lock);
@@ -351,3 +436,117 @@ retry:
 	}
 	return err;
 }
+
+#define SCIF_LOOKUP_BENCH_WINDOWS	10000
+#define SCIF_LOOKUP_BENCH_LOOKUPS	100000
+
+/* The linear search scif_query_window() did before the interval tree */
+static struct scif_window *scif_lookup_bench_linear(struct scif_window_list *head,
+						    s64 offset)
+{
+	struct scif_window *window;
+
+	list_for_each_entry(window, &head->list, list) {
+		if (offset < window->offset)
+			break;
+		if (offset < window->offset + (window->nr_pages << PAGE_SHIFT))
+			return window;
+	}
+	return NULL;
+}
+
+/*
+ * Look up the window of a pseudo random one of @offsets
+ * SCIF_LOOKUP_BENCH_LOOKUPS times, returns the time taken in ns or -errno.
+ */
+static s64 scif_lookup_bench_run(struct scif_endpt *ep, const off_t *offsets,
+				 bool linear)
+{
+	struct scif_window *window;
+	struct scif_rma_req req;
+	u32 idx = 1;
+	ktime_t start;
+	int i, err = 0;
+
+	req.out_window = &window;
+	req.nr_bytes = PAGE_SIZE;
+	req.prot = VM_READ;
+	req.type = SCIF_WINDOW_PARTIAL;
+	req.head = &ep->rma_info.reg_list;
+
+	mutex_lock(&ep->rma_info.rma_lock);
+	start = ktime_get();
+	for (i = 0; i < SCIF_LOOKUP_BENCH_LOOKUPS && !err; i++) {
+		idx = idx * 1103515245 + 12345;
+		req.offset = offsets[(idx >> 8) % SCIF_LOOKUP_BENCH_WINDOWS];
+		if (linear) {
+			window = scif_lookup_bench_linear(req.head, req.offset);
+			if (!window)
+				err = -ENXIO;
+		} else {
+			err = scif_query_window(&req);
+		}
+	}
+	mutex_unlock(&ep->rma_info.rma_lock);
+	return err ? err : ktime_to_ns(ktime_sub(ktime_get(), start));
+}
+
+/**
+ * scif_rma_lookup_bench() - Measure window lookups among 10k windows
+ * @s: seq_file the results are printed to
+ *
+ * Registers one page SCIF_LOOKUP_BENCH_WINDOWS times over loopback and
+ * looks up random windows through the interval tree and with the linear
+ * list walk it replaced.
+ */
+int scif_rma_lookup_bench(struct seq_file *s)
+{
+	scif_epd_t cep = NULL, sep = NULL;
+	unsigned long page;
+	off_t *offsets;
+	s64 tree_ns, linear_ns;
+	int i, nr = 0, err;
+
+	page = get_zeroed_page(GFP_KERNEL);
+	offsets = vmalloc(SCIF_LOOKUP_BENCH_WINDOWS * sizeof(*offsets));
+	if (!page || !offsets) {
+		err = -ENOMEM;
+		goto free;
+	}
+	err = scif_loopback_connect(&cep, &sep);
+	if (err)
+		goto close;
+	for (nr = 0; nr < SCIF_LOOKUP_BENCH_WINDOWS; nr++) {
+		offsets[nr] = scif_register(cep, (void *)page, PAGE_SIZE, 0,
+					    SCIF_PROT_READ, SCIF_MAP_KERNEL);
+		if (offsets[nr] < 0) {
+			err = offsets[nr];
+			goto close;
+		}
+	}
+
+	tree_ns = scif_lookup_bench_run(cep, offsets, false);
+	linear_ns = scif_lookup_bench_run(cep, offsets, true);
+	if (tree_ns < 0 || linear_ns < 0) {
+		err = tree_ns < 0 ? tree_ns : linear_ns;
+		goto close;
+	}
+	seq_printf(s, "%d windows, %d lookups\n", SCIF_LOOKUP_BENCH_WINDOWS,
+		   SCIF_LOOKUP_BENCH_LOOKUPS);
+	seq_printf(s, "interval tree %8lld ns/lookup\n",
+		   div_s64(tree_ns, SCIF_LOOKUP_BENCH_LOOKUPS));
+	seq_printf(s, "linear list   %8lld ns/lookup\n",
+		   div_s64(linear_ns, SCIF_LOOKUP_BENCH_LOOKUPS));
+close:
+	for (i = 0; i < nr; i++)
+		scif_unregister(cep, offsets[i], PAGE_SIZE);
+	if (sep)
+		scif_close(sep);
+	if (cep)
+		scif_close(cep);
+free:
+	vfree(offsets);
+	if (page)
+		free_page(page);
+	return err;
+}
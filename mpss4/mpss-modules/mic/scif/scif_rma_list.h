@@ -60,8 +60,11 @@
  * @nr_bytes: number of bytes
  * @prot: protection requested i.e. read or write or both
  * @type: Specify single, partial or multiple windows
- * @head: Head of list on which to search
+ * @head: Window list on which to search
  * @va_for_temp: VA for searching temporary cached windows
+ * @reuse: Pinned pages of a partially overlapping cached window, returned
+ *	   with an extra reference by scif_query_tcw()
+ * @reuse_va: VA the pages in reuse start at
  */
 struct scif_rma_req {
 	struct scif_window **out_window;
@@ -72,13 +75,17 @@ struct scif_rma_req {
 	size_t nr_bytes;
 	int prot;
 	enum scif_window_type type;
-	struct list_head *head;
+	struct scif_window_list *head;
+	struct scif_pinned_pages *reuse;
+	unsigned long reuse_va;
 };
 
+void scif_init_window_list(struct scif_window_list *head, bool tcw);
 /* Insert */
-void scif_insert_window(struct scif_window *window, struct list_head *head);
+void scif_insert_window(struct scif_window *window,
+			struct scif_window_list *head);
 void scif_insert_tcw(struct scif_window *window,
-		     struct list_head *head);
+		     struct scif_window_list *head);
 /* Query */
 int scif_query_window(struct scif_rma_req *request);
 int scif_query_tcw(struct scif_endpt *ep, struct scif_rma_req *request);
@@ -87,4 +94,7 @@ int scif_unregister_all_windows(scif_epd_t epd);
 void scif_unmap_all_windows(scif_epd_t epd);
 /* Traverse list and unregister */
 int scif_rma_list_unregister(scif_epd_t epd, s64 offset, int nr_pages);
+/* Destroy the temporary cached windows overlapping a VA range */
+void scif_rma_list_destroy_tcw(struct scif_window_list *head,
+			       u64 start, u64 end);
 #endif /* SCIF_RMA_LIST_H */
@@ -25,6 +25,9 @@
  * @iovcnt: Number of IOVEC structures in iov.
  * @vr_idx: The vring index.
  * @update_used: A non zero value results in used index being updated.
+ *	With MIC_VIRTIO_USED_DEFER the chain is added to the used ring only
+ *	together with the next chain completed without it, or when the
+ *	device is polled, so a set of chains costs one card notification.
  * @out_len: The aggregate of the total length written to or read from
  *	the virtio device.
  */
@@ -40,6 +43,27 @@ struct mic_copy_desc {
 	__u32 out_len;
 };
 
+/*
+ * mic_copy_batch - A batch of MIC virtio descriptor copies.
+ *
+ * @copy: An array of count mic_copy_desc, all for the same vring.
+ * @count: Number of entries in copy, at most MIC_VIRTIO_COPY_BATCH_MAX.
+ * @done: Number of entries copied. Their out_len is valid and the used
+ *	index has been updated for those with update_used set.
+ */
+struct mic_copy_batch {
+#ifdef __KERNEL__
+	struct mic_copy_desc __user *copy;
+#else
+	struct mic_copy_desc *copy;
+#endif
+	__u32 count;
+	__u32 done;
+};
+
+#define MIC_VIRTIO_COPY_BATCH_MAX 64
+#define MIC_VIRTIO_USED_DEFER 2
+
 /*
  * Add a new virtio device
  * The (struct mic_device_desc *) pointer points to a device page entry
@@ -59,5 +83,11 @@ struct mic_copy_desc {
  */
 #define MIC_VIRTIO_COPY_DESC	_IOWR('s', 2, struct mic_copy_desc *)
 
+/*
+ * Copy a batch of descriptor chains of one vring. The used ring is
+ * updated and the card notified once for the whole batch.
+ */
+#define MIC_VIRTIO_COPY_BATCH	_IOWR('s', 3, struct mic_copy_batch *)
+
 
 #endif
@@ -20,6 +20,9 @@
 #include <linux/virtio_config.h>
 #include <linux/virtio.h>
 #include <linux/miscdevice.h>
+#include <linux/mmu_notifier.h>
+#include <linux/scatterlist.h>
+#include <linux/kref.h>
 
 #ifdef MIC_IN_KERNEL_BUILD
 #include <linux/mic_common.h>
@@ -72,6 +75,76 @@ struct vop_info {
 	struct miscdevice miscdev;
 };
 
+#define VOP_MAX_BOUNCE_DEPTH 8
+
+/**
+ * struct vop_bounce - Ring of bounce buffers for DMA to and from user space.
+ *
+ * @depth: Number of buffers, the DMA of one overlaps the user copy of
+ * the others.
+ * @buf: Kernel buffers of VOP_INT_DMA_BUF_SIZE bytes.
+ * @da: DMA addresses of @buf.
+ */
+struct vop_bounce {
+	int depth;
+	void *buf[VOP_MAX_BOUNCE_DEPTH];
+	dma_addr_t da[VOP_MAX_BOUNCE_DEPTH];
+};
+
+/**
+ * struct vop_pinned - User pages pinned and mapped for zero copy DMA.
+ *
+ * @list: Entry in the LRU list of a pin cache.
+ * @kref: Held by the pin cache and by every transfer using the pages.
+ * @start: Page aligned user address of the first page.
+ * @nr_pages: Number of pages pinned.
+ * @write: The pages were pinned for writing.
+ * @pages: The pinned pages.
+ * @st: The pages as mapped for @dev.
+ * @dev: The DMA device the pages are mapped for.
+ */
+struct vop_pinned {
+	struct list_head list;
+	struct kref kref;
+	unsigned long start;
+	int nr_pages;
+	bool write;
+	struct page **pages;
+	struct sg_table st;
+	struct device *dev;
+};
+
+/**
+ * struct vop_pin_cache - Recently used pinned user buffers.
+ *
+ * @lock: Protects the LRU list, the counters and @seq.
+ * @lru: Pinned ranges, most recently used first.
+ * @nr_pages: Number of pages cached.
+ * @seq: Bumped by every invalidation.
+ * @mm: Address space the cached ranges belong to.
+ * @mn: MMU notifier dropping ranges unmapped from @mm.
+ * @dev: The DMA device pages are mapped for.
+ * @hits: Debug stats for transfers which found their pages cached.
+ * @misses: Debug stats for transfers which had to pin their pages.
+ * @evictions: Debug stats for ranges dropped to make room.
+ * @invalidations: Debug stats for ranges dropped by the MMU notifier.
+ */
+struct vop_pin_cache {
+	spinlock_t lock;
+	struct list_head lru;
+	int nr_pages;
+	unsigned long seq;
+	struct mm_struct *mm;
+#ifdef CONFIG_MMU_NOTIFIER
+	struct mmu_notifier mn;
+#endif
+	struct device *dev;
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long evictions;
+	unsigned long invalidations;
+};
+
 /**
  * struct vop_vringh - Virtio ring host information.
  *
@@ -81,9 +154,11 @@ struct vop_info {
  * @wiov: The VRINGH write kernel IOV.
  * @head: The VRINGH head index address passed to vringh_getdesc_kern(..).
  * @vr_mutex: Mutex for synchronizing access to the VRING.
- * @buf: Temporary kernel buffer used to copy in/out data
+ * @bounce: Temporary kernel buffers used to copy in/out data
  * from/to the card via DMA.
- * @buf_da: dma address of buf.
+ * @pins: User buffers pinned for zero copy DMA.
+ * @used: Completed chains not yet added to the used ring, one per entry.
+ * @nr_used: Number of chains in used.
  * @vdev: Back pointer to VOP virtio device for vringh_notify(..).
  */
 struct vop_vringh {
@@ -93,8 +168,10 @@ struct vop_vringh {
 	struct vringh_kiov wiov;
 	u16 head;
 	struct mutex vr_mutex;
-	void *buf;
-	dma_addr_t buf_da;
+	struct vop_bounce bounce;
+	struct vop_pin_cache pins;
+	struct vring_used_elem *used;
+	u32 nr_used;
 	struct vop_vdev *vdev;
 };
 
@@ -111,6 +188,15 @@ struct vop_vringh {
  * using DMA.
  * @in_bytes_dma - Debug stats for number of bytes copied from card to host
  * using DMA.
+ * @out_bytes_zcopy - Debug stats for number of bytes DMAed from host to card
+ * straight out of pinned user pages.
+ * @in_bytes_zcopy - Debug stats for number of bytes DMAed from card to host
+ * straight into pinned user pages.
+ * @dma_wait_ns - Debug stats for time spent waiting for bounce buffer DMAs.
+ * @user_copy_ns - Debug stats for time spent copying between bounce
+ * buffers and user space.
+ * @copy_ioctls - Debug stats for number of copy ioctls.
+ * @copy_descs - Debug stats for number of descriptor copies done by them.
  * @tx_len_unaligned - Debug stats for number of bytes copied to the card where
  * the transfer length did not have the required DMA alignment.
  * @tx_dst_unaligned - Debug stats for number of bytes copied where the
@@ -126,6 +212,7 @@ struct vop_vringh {
  * @vdev_mutex: Mutex synchronizing virtio device injection,
  *              removal and data transfers.
  * @deleted: The virtio device has been deleted.
+ * @cpu_copy: Copy with the CPU even if DMA is enabled, for benchmarks.
  */
 struct vop_vdev {
 	int virtio_id;
@@ -136,6 +223,12 @@ struct vop_vdev {
 	unsigned long in_bytes;
 	unsigned long out_bytes_dma;
 	unsigned long in_bytes_dma;
+	unsigned long out_bytes_zcopy;
+	unsigned long in_bytes_zcopy;
+	u64 dma_wait_ns;
+	u64 user_copy_ns;
+	unsigned long copy_ioctls;
+	unsigned long copy_descs;
 	unsigned long tx_len_unaligned;
 	unsigned long tx_dst_unaligned;
 	unsigned long rx_dst_unaligned;
@@ -149,8 +242,11 @@ struct vop_vdev {
 	struct vop_info *vi;
 	struct mutex vdev_mutex;
 	bool deleted;
+	bool cpu_copy;
 };
 
+struct seq_file;
+
 extern struct mutex vop_mutex;
 
 /* Helper API to check if a virtio device is running */
@@ -170,6 +266,13 @@ void vop_delete_debug_dir(struct vop_info *vi);
 void __init vop_init_debugfs(void);
 void vop_exit_debugfs(void);
 int vop_init(struct vop_info *vi);
+int vop_zcopy_bench(struct vop_info *vi, struct seq_file *s);
+int vop_batch_bench(struct vop_info *vi, struct seq_file *s);
+void vop_pin_cache_init(struct vop_pin_cache *pc, struct device *dev);
+void vop_pin_cache_destroy(struct vop_pin_cache *pc);
+struct vop_pinned *vop_pin_user(struct vop_pin_cache *pc, unsigned long addr,
+				size_t len, bool write);
+void vop_pin_put(struct vop_pinned *pin);
 void vop_uninit(struct vop_info *vi);
 
 #endif
@@ -146,10 +146,16 @@ static int vop_vdev_info_show(struct seq_file *s, void *unused)
 
 		seq_printf(s, "VDEV \n\ttype %d\n\tstate %s\n\tin_bytes %ld\n"
 			   "\tout_bytes %ld\n\tin_bytes_dma %ld\n"
-			   "\tout_bytes_dma %ld\n",
+			   "\tout_bytes_dma %ld\n\tin_bytes_zcopy %ld\n"
+			   "\tout_bytes_zcopy %ld\n\tdma_wait_ns %llu\n"
+			   "\tuser_copy_ns %llu\n\tcopy_ioctls %ld\n"
+			   "\tcopy_descs %ld\n",
 			   vdev->virtio_id, vop_vdevup(vdev) ? "UP" : "DOWN",
 			   vdev->in_bytes, vdev->out_bytes,
-			   vdev->in_bytes_dma, vdev->out_bytes_dma);
+			   vdev->in_bytes_dma, vdev->out_bytes_dma,
+			   vdev->in_bytes_zcopy, vdev->out_bytes_zcopy,
+			   vdev->dma_wait_ns, vdev->user_copy_ns,
+			   vdev->copy_ioctls, vdev->copy_descs);
 
 		for (i = 0; i < MIC_MAX_VRINGS; i++) {
 			struct vring_desc *desc;
@@ -168,6 +174,13 @@ static int vop_vdev_info_show(struct seq_file *s, void *unused)
 			seq_printf(s, " vring %d, avail_idx %d\n",
 				   i, vvr->vring.info->avail_idx);
 
+			seq_printf(s, "\t" "pins  %d, pages %d, hits %lu,",
+				   i, vvr->pins.nr_pages, vvr->pins.hits);
+			seq_printf(s, " misses %lu, evictions %lu,",
+				   vvr->pins.misses, vvr->pins.evictions);
+			seq_printf(s, " invalidations %lu\n",
+				   vvr->pins.invalidations);
+
 			seq_printf(s, "\t" "vrh   %d, weak_barriers %d,",
 				   i, vrh->weak_barriers);
 			seq_printf(s, " last_avail_idx %d, last_used_idx %d,",
@@ -230,6 +243,52 @@ static const struct file_operations vdev_info_ops = {
 	.release = single_release
 };
 
+#ifdef CONFIG_INTEL_MIC_HOST
+static int vop_zcopy_bench_show(struct seq_file *s, void *unused)
+{
+	int err = vop_zcopy_bench(s->private, s);
+
+	if (err)
+		seq_printf(s, "benchmark failed, err %d\n", err);
+	return 0;
+}
+
+static int vop_zcopy_bench_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, vop_zcopy_bench_show, inode->i_private);
+}
+
+static const struct file_operations zcopy_bench_ops = {
+	.owner   = THIS_MODULE,
+	.open    = vop_zcopy_bench_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = single_release
+};
+
+static int vop_batch_bench_show(struct seq_file *s, void *unused)
+{
+	int err = vop_batch_bench(s->private, s);
+
+	if (err)
+		seq_printf(s, "benchmark failed, err %d\n", err);
+	return 0;
+}
+
+static int vop_batch_bench_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, vop_batch_bench_show, inode->i_private);
+}
+
+static const struct file_operations batch_bench_ops = {
+	.owner   = THIS_MODULE,
+	.open    = vop_batch_bench_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = single_release
+};
+#endif
+
 void vop_create_debug_dir(struct vop_info *vi)
 {
 	char name[16];
@@ -248,6 +307,14 @@ void vop_create_debug_dir(struct vop_info *vi)
 	if (vi->vpdev->dnode)
 		debugfs_create_file("vdev_info", 0444, vi->dbg,
 				    vi, &vdev_info_ops);
+#ifdef CONFIG_INTEL_MIC_HOST
+	if (vi->vpdev->dnode && vi->dma_ch) {
+		debugfs_create_file("zcopy_bench", 0400, vi->dbg,
+				    vi, &zcopy_bench_ops);
+		debugfs_create_file("batch_bench", 0400, vi->dbg,
+				    vi, &batch_bench_ops);
+	}
+#endif
 }
 
 void vop_delete_debug_dir(struct vop_info *vi)
@@ -19,6 +19,8 @@
 #include <linux/dma-mapping.h>
 #include <linux/iommu.h>
 #include <linux/moduleparam.h>
+#include <linux/mman.h>
+#include <linux/seq_file.h>
 
 #ifdef MIC_IN_KERNEL_BUILD
 #include <linux/mic_common.h>
@@ -33,12 +35,24 @@
 // TODO: remove this param before upstreaming
 static bool disable_dma = 0;
 
+/* Copies of at least this many bytes DMA straight to or from user pages */
+static unsigned int zcopy_min = 1024;
+
+/* Bounce buffers per VRING, at most VOP_MAX_BOUNCE_DEPTH */
+static unsigned int bounce_depth = 2;
+
 /* Helper API to obtain the VOP PCIe device */
 static inline struct device *vop_dev(struct vop_vdev *vdev)
 {
 	return vdev->vpdev->dev.parent;
 }
 
+/* Helper API to check if copies of a virtio device may use DMA */
+static inline bool vop_use_dma(struct vop_vdev *vdev)
+{
+	return !disable_dma && !vdev->cpu_copy;
+}
+
 /* Helper API to check if a virtio device is initialized */
 static inline int vop_vdev_get_status(struct vop_vdev *vdev)
 {
@@ -83,6 +97,10 @@ static void vop_virtio_init_post(struct vop_vdev *vdev)
 			vpdev,
 			le64_to_cpu(vqconfig[i].used_address),
 			used_size);
+		/* Deferred completions belong to the old rings */
+		mutex_lock(&vdev->vvr[i].vr_mutex);
+		vdev->vvr[i].nr_used = 0;
+		mutex_unlock(&vdev->vvr[i].vr_mutex);
 	}
 
 	vdev->dc->used_address_updated = 0;
@@ -190,6 +208,37 @@ static void vop_init_device_ctrl(struct vop_vdev *vdev,
 	vdev->dc = dc;
 }
 
+static void vop_bounce_free(struct device *dev, struct vop_bounce *b)
+{
+	int i;
+
+	for (i = 0; i < b->depth; i++) {
+		if (b->buf[i])
+			dma_free_coherent(dev, VOP_INT_DMA_BUF_SIZE,
+					  b->buf[i], b->da[i]);
+		b->buf[i] = NULL;
+	}
+	b->depth = 0;
+}
+
+static int vop_bounce_alloc(struct device *dev, struct vop_bounce *b,
+			    int depth)
+{
+	int i;
+
+	b->depth = clamp_t(int, depth, 1, VOP_MAX_BOUNCE_DEPTH);
+	for (i = 0; i < b->depth; i++) {
+		b->buf[i] = dma_alloc_coherent(dev, VOP_INT_DMA_BUF_SIZE,
+					       &b->da[i],
+					       GFP_KERNEL | __GFP_ZERO);
+		if (!b->buf[i]) {
+			vop_bounce_free(dev, b);
+			return -ENOMEM;
+		}
+	}
+	return 0;
+}
+
 static int vop_virtio_add_device(struct vop_vdev *vdev,
 				 struct mic_device_desc *argp)
 {
@@ -261,6 +310,11 @@ static int vop_virtio_add_device(struct vop_vdev *vdev,
 				    "can't create vringh, err %d", ret);
 			goto err;
 		}
+		vvr->used = kmalloc_array(num, sizeof(*vvr->used), GFP_KERNEL);
+		if (!vvr->used) {
+			ret = -ENOMEM;
+			goto err;
+		}
 		vringh_kiov_init(&vvr->riov, NULL, 0);
 		vringh_kiov_init(&vvr->wiov, NULL, 0);
 		vvr->head = USHRT_MAX;
@@ -269,15 +323,13 @@ static int vop_virtio_add_device(struct vop_vdev *vdev,
 		log_mic_dbg(vop_get_id(vdev->vpdev),
 			    "index %d va %p info %p vr_size 0x%x",
 			i, vr->va, vr->info, vr_size);
-		vvr->buf = dma_alloc_coherent(dma_dev,
-				VOP_INT_DMA_BUF_SIZE, &vvr->buf_da,
-				GFP_KERNEL|__GFP_ZERO);
-		if (!vvr->buf) {
-			ret = -ENOMEM;
+		ret = vop_bounce_alloc(dma_dev, &vvr->bounce, bounce_depth);
+		if (ret) {
 			log_mic_err(vop_get_id(vdev->vpdev),
 				    "dma allocation failed, err %d", ret);
 			goto err;
 		}
+		vop_pin_cache_init(&vvr->pins, dma_dev);
 	}
 
 	snprintf(irqname, sizeof(irqname), "vop%dvirtio%d", vpdev->index,
@@ -320,10 +372,9 @@ err:
 		struct vop_vringh *vvr = &vdev->vvr[j];
 		struct mic_vring *vr = &vvr->vring;
 
-		if (vvr->buf) {
-			dma_free_coherent(dma_dev,
-				VOP_INT_DMA_BUF_SIZE, vvr->buf, vvr->buf_da);
-		}
+		vop_bounce_free(dma_dev, &vvr->bounce);
+		kfree(vvr->used);
+		vvr->used = NULL;
 
 		if (vr->va) {
 			dma_free_coherent(dma_dev, (size_t)vr->len, (void*)vr->va,
@@ -397,14 +448,12 @@ static void vop_virtio_del_device(struct vop_vdev *vdev)
 	vqconfig = mic_vq_config(vdev->dd);
 	for (i = 0; i < vdev->dd->num_vq; i++) {
 		struct vop_vringh *vvr = &vdev->vvr[i];
-		if (vvr->buf) {
-			dma_free_coherent(dma_dev,
-					  VOP_INT_DMA_BUF_SIZE, vvr->buf,
-					  vvr->buf_da);
-			vvr->buf = NULL;
-		}
+		vop_bounce_free(dma_dev, &vvr->bounce);
+		vop_pin_cache_destroy(&vvr->pins);
 		vringh_kiov_cleanup(&vvr->riov);
 		vringh_kiov_cleanup(&vvr->wiov);
+		kfree(vvr->used);
+		vvr->used = NULL;
 		if (vvr->vring.va) {
 			dma_free_coherent(dma_dev, (size_t)vvr->vring.len,
 					  vvr->vring.va,
@@ -424,59 +473,6 @@ static void vop_virtio_del_device(struct vop_vdev *vdev)
 	vdev->dd->type = -1;
 }
 
-/*
- * vop_sync_dma - Wrapper for synchronous DMAs.
- *
- * @dev - The address of the pointer to the device instance used
- * for DMA registration.
- * @dst - destination DMA address.
- * @src - source DMA address.
- * @len - size of the transfer.
- *
- * Return DMA_SUCCESS on success
- */
-static int vop_sync_dma(struct vop_vdev *vdev, dma_addr_t dst, dma_addr_t src,
-			size_t len)
-{
-	int err = 0;
-	struct dma_device *ddev;
-	struct dma_async_tx_descriptor *tx;
-	struct vop_info *vi = vdev->vpdev->priv;
-	struct dma_chan *vop_ch = vi->dma_ch;
-
-	if (!vop_ch) {
-		err = -EBUSY;
-		log_mic_err(vop_get_id(vdev->vpdev),
-			    "dma channel not available, err %d", err);
-		goto error;
-	}
-	ddev = vop_ch->device;
-	tx = ddev->device_prep_dma_memcpy(vop_ch, dst, src, len,
-		DMA_PREP_FENCE);
-	if (!tx) {
-		err = -ENOMEM;
-		log_mic_err(vop_get_id(vdev->vpdev),
-			    "can't prepare dma memory, err %d", err);
-		goto error;
-	} else {
-		dma_cookie_t cookie;
-
-		cookie = tx->tx_submit(tx);
-		if (dma_submit_error(cookie)) {
-			err = -ENOMEM;
-			log_mic_err(vop_get_id(vdev->vpdev),
-				    "can't submit error, err %d", err);
-			goto error;
-		}
-		err = dma_sync_wait(vop_ch, cookie);
-	}
-error:
-	if (err)
-		log_mic_err(vop_get_id(vdev->vpdev),
-			    "error occurred, err %d", err);
-	return err;
-}
-
 /**
  *  vop_setsg - Initialize a scatterlist array
  *  @pa: physical memory address
@@ -578,6 +574,129 @@ static void vop_dma_unmap(struct vop_vdev *vdev, struct scatterlist *sg,
 }
 
 
+/* Start a DMA without waiting for it */
+static int vop_submit_dma(struct vop_info *vi, dma_addr_t dst,
+			  dma_addr_t src, size_t len, dma_cookie_t *cookie)
+{
+	struct dma_chan *vop_ch = vi->dma_ch;
+	struct dma_async_tx_descriptor *tx;
+
+	tx = vop_ch->device->device_prep_dma_memcpy(vop_ch, dst, src, len,
+						    DMA_PREP_FENCE);
+	if (!tx)
+		return -ENOMEM;
+	*cookie = tx->tx_submit(tx);
+	if (dma_submit_error(*cookie))
+		return -ENOMEM;
+	dma_async_issue_pending(vop_ch);
+	return 0;
+}
+
+static int vop_wait_dma(struct vop_info *vi, dma_cookie_t cookie,
+			u64 *wait_ns)
+{
+	ktime_t start = ktime_get();
+	int err = dma_sync_wait(vi->dma_ch, cookie) ? -EIO : 0;
+
+	*wait_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+	return err;
+}
+
+/*
+ * Copy len bytes of card memory at da, less the first skip bytes, to
+ * ubuf through the bounce ring. The DMAs of the next depth - 1 chunks
+ * are in flight while a chunk is copied to user space.
+ */
+static int vop_bounce_to_user(struct vop_info *vi, struct vop_bounce *b,
+			      void __user *ubuf, dma_addr_t da, size_t len,
+			      size_t skip, size_t align, u64 *wait_ns,
+			      u64 *copy_ns)
+{
+	dma_cookie_t cookie[VOP_MAX_BOUNCE_DEPTH];
+	size_t nr = DIV_ROUND_UP(len, VOP_INT_DMA_BUF_SIZE);
+	size_t k, issued = 0, off, first, partlen;
+	ktime_t start;
+	int slot, err = 0;
+
+	for (k = 0; k < nr; k++) {
+		for (; issued < nr && issued < k + b->depth; issued++) {
+			off = issued * VOP_INT_DMA_BUF_SIZE;
+			partlen = min_t(size_t, len - off,
+					VOP_INT_DMA_BUF_SIZE);
+			slot = issued % b->depth;
+			err = vop_submit_dma(vi, b->da[slot], da + off,
+					     ALIGN(partlen, align),
+					     &cookie[slot]);
+			if (err)
+				goto drain;
+		}
+		slot = k % b->depth;
+		err = vop_wait_dma(vi, cookie[slot], wait_ns);
+		if (err)
+			goto drain;
+		off = k * VOP_INT_DMA_BUF_SIZE;
+		partlen = min_t(size_t, len - off, VOP_INT_DMA_BUF_SIZE);
+		first = k ? 0 : skip;
+		start = ktime_get();
+		if (copy_to_user(ubuf + off + first - skip,
+				 b->buf[slot] + first, partlen - first))
+			err = -EFAULT;
+		*copy_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+		if (err)
+			goto drain;
+	}
+	return 0;
+drain:
+	/* The buffers may not be reused before the DMAs into them are done */
+	if (issued)
+		dma_sync_wait(vi->dma_ch, cookie[(issued - 1) % b->depth]);
+	return err;
+}
+
+/*
+ * Copy len bytes from ubuf to card memory at da through the bounce ring.
+ * A chunk is copied from user space while the DMAs of the previous
+ * depth - 1 chunks are in flight.
+ */
+static int vop_bounce_from_user(struct vop_info *vi, struct vop_bounce *b,
+				void __user *ubuf, dma_addr_t da, size_t len,
+				size_t align, u64 *wait_ns, u64 *copy_ns)
+{
+	dma_cookie_t cookie[VOP_MAX_BOUNCE_DEPTH];
+	size_t nr = DIV_ROUND_UP(len, VOP_INT_DMA_BUF_SIZE);
+	size_t k, off, partlen;
+	ktime_t start;
+	int slot, ret, err = 0;
+
+	for (k = 0; k < nr; k++) {
+		slot = k % b->depth;
+		if (k >= b->depth) {
+			err = vop_wait_dma(vi, cookie[slot], wait_ns);
+			if (err)
+				break;
+		}
+		off = k * VOP_INT_DMA_BUF_SIZE;
+		partlen = min_t(size_t, len - off, VOP_INT_DMA_BUF_SIZE);
+		start = ktime_get();
+		if (copy_from_user(b->buf[slot], ubuf + off, partlen))
+			err = -EFAULT;
+		*copy_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+		if (err)
+			break;
+		err = vop_submit_dma(vi, da + off, b->da[slot],
+				     ALIGN(partlen, align), &cookie[slot]);
+		if (err)
+			break;
+	}
+	/* The channel completes in order, wait for the last chunk */
+	if (k) {
+		ret = vop_wait_dma(vi, cookie[(k - 1) % b->depth], wait_ns);
+		if (!err)
+			err = ret;
+	}
+	return err;
+}
+
 /*
  * Initiates the copies across the PCIe bus from card memory to a user
  * space buffer. When transfers are done using DMA, source/destination
@@ -594,12 +713,12 @@ static int vop_virtio_copy_to_user(struct vop_vdev *vdev, void __user *ubuf,
 	struct vop_info *vi = vdev->vpdev->priv;
 	size_t dma_alignment = 1 << vi->dma_ch->device->copy_align;
 	bool x200 = is_dma_copy_aligned(vi->dma_ch->device, 1, 1, 1);
-	size_t dma_offset, partlen;
+	size_t dma_offset;
 	size_t num_pages = 0;
 	struct scatterlist *sg;
 	int err;
 
-	if (disable_dma) {
+	if (!vop_use_dma(vdev)) {
 		if (copy_to_user(ubuf, (void __force *)dbuf, len)) {
 			err = -EFAULT;
 			log_mic_err(vop_get_id(vdev->vpdev),
@@ -629,34 +748,19 @@ static int vop_virtio_copy_to_user(struct vop_vdev *vdev, void __user *ubuf,
 				    "dma map failure, err %d", err);
 		}
 	}
-	while (len) {
-		partlen = min_t(size_t, len, VOP_INT_DMA_BUF_SIZE);
-		err = vop_sync_dma(vdev, vvr->buf_da, daddr,
-				   ALIGN(partlen, dma_alignment));
-		if (err) {
-			log_mic_err(vop_get_id(vdev->vpdev),
-				    "dma sync transfer failure, err %d", err);
-			goto err;
-		}
-		if (copy_to_user(ubuf, vvr->buf + dma_offset,
-				 partlen - dma_offset)) {
-			err = -EFAULT;
-			log_mic_err(vop_get_id(vdev->vpdev),
-				    "copy to user failed, length %#zx, err %d",
-				    partlen - dma_offset, err);
-			goto err;
-		}
-		daddr += partlen;
-		ubuf += partlen;
-		dbuf += partlen;
-		vdev->in_bytes_dma += partlen;
-		vdev->in_bytes += partlen;
-		len -= partlen;
-		dma_offset = 0;
+	err = vop_bounce_to_user(vi, &vvr->bounce, ubuf, daddr, len,
+				 dma_offset, dma_alignment,
+				 &vdev->dma_wait_ns, &vdev->user_copy_ns);
+	if (err) {
+		log_mic_err(vop_get_id(vdev->vpdev),
+			    "dma transfer to user failed, length %#zx, err %d",
+			    len, err);
+		goto err;
 	}
-	err = 0;
+	vdev->in_bytes_dma += len;
+	vdev->in_bytes += len;
 err:
-	if (x200 && !disable_dma) {
+	if (x200 && vop_use_dma(vdev)) {
 		vop_dma_unmap(vdev, sg, num_pages);
 	}
 	vpdev->hw_ops->iounmap(vpdev, dbuf);
@@ -680,8 +784,8 @@ static int vop_virtio_copy_from_user(struct vop_vdev *vdev, void __user *ubuf,
 	size_t dma_alignment = 1 << vi->dma_ch->device->copy_align;
 	bool x200 = is_dma_copy_aligned(vi->dma_ch->device, 1, 1, 1);
 	struct scatterlist *sg;
-	size_t partlen, num_pages = 0;
-	bool dma = !disable_dma;
+	size_t num_pages = 0;
+	bool dma = vop_use_dma(vdev);
 	int err = 0;
 
 	if (daddr & (dma_alignment - 1)) {
@@ -709,30 +813,18 @@ static int vop_virtio_copy_from_user(struct vop_vdev *vdev, void __user *ubuf,
 				    "dma map failed, err %d", err);
 		}
 	}
-	while (len) {
-		partlen = min_t(size_t, len, VOP_INT_DMA_BUF_SIZE);
-
-		if (copy_from_user(vvr->buf, ubuf, partlen)) {
-			err = -EFAULT;
-			log_mic_err(vop_get_id(vdev->vpdev),
-				    "copy from user failure, "
-				    "length %#zx, err %d", partlen, err);
-			goto err;
-		}
-		err = vop_sync_dma(vdev, daddr, vvr->buf_da,
-				   ALIGN(partlen, dma_alignment));
-		if (err) {
-			log_mic_err(vop_get_id(vdev->vpdev),
-				    "dma sync transfer failed, err %d", err);
-			goto err;
-		}
-		daddr += partlen;
-		ubuf += partlen;
-		dbuf += partlen;
-		vdev->out_bytes_dma += partlen;
-		vdev->out_bytes += partlen;
-		len -= partlen;
+	err = vop_bounce_from_user(vi, &vvr->bounce, ubuf, daddr, len,
+				   dma_alignment, &vdev->dma_wait_ns,
+				   &vdev->user_copy_ns);
+	if (err) {
+		log_mic_err(vop_get_id(vdev->vpdev),
+			    "dma transfer from user failed, "
+			    "length %#zx, err %d", len, err);
+		goto err;
 	}
+	vdev->out_bytes_dma += len;
+	vdev->out_bytes += len;
+	goto err;
 memcpy:
 	/*
 	 * We are copying to IO below and should ideally use something
@@ -754,6 +846,112 @@ err:
 	return err;
 }
 
+/*
+ * DMA between len bytes of the pinned user pages at uaddr and da, one
+ * memcpy per mapped segment, and wait for the last one. The channel
+ * completes in order, so that covers them all.
+ */
+static int vop_dma_pinned(struct vop_info *vi, struct vop_pinned *pin,
+			  unsigned long uaddr, dma_addr_t da, size_t len,
+			  bool read)
+{
+	struct dma_chan *vop_ch = vi->dma_ch;
+	struct dma_async_tx_descriptor *tx;
+	dma_cookie_t cookie, last = 0;
+	size_t skip = uaddr - pin->start;
+	struct scatterlist *sg;
+	size_t partlen;
+	dma_addr_t ua;
+	int i, err = 0;
+
+	for_each_sg(pin->st.sgl, sg, pin->st.nents, i) {
+		if (!len)
+			break;
+		if (skip >= sg_dma_len(sg)) {
+			skip -= sg_dma_len(sg);
+			continue;
+		}
+		ua = sg_dma_address(sg) + skip;
+		partlen = min_t(size_t, len, sg_dma_len(sg) - skip);
+		skip = 0;
+		len -= partlen;
+		tx = vop_ch->device->device_prep_dma_memcpy(vop_ch,
+				read ? ua : da, read ? da : ua, partlen,
+				len ? 0 : DMA_PREP_FENCE);
+		if (!tx) {
+			err = -ENOMEM;
+			break;
+		}
+		cookie = tx->tx_submit(tx);
+		if (dma_submit_error(cookie)) {
+			err = -ENOMEM;
+			break;
+		}
+		last = cookie;
+		da += partlen;
+	}
+	/* The pages may be unpinned once this returns, even on error */
+	if (last && dma_sync_wait(vop_ch, last) && !err)
+		err = -EIO;
+	if (err)
+		log_mic_err(vop_get_id(vi->vpdev),
+			    "zero copy dma failed, err %d", err);
+	return err;
+}
+
+/*
+ * Zero copy transfer between a user buffer and card memory. The user
+ * pages are pinned and mapped through the pin cache of the VRING and the
+ * DMA engine copies straight to or from them, instead of through the
+ * bounce buffer. Returns non zero if the transfer has to take the bounce
+ * buffer path, which copies the whole buffer again.
+ */
+static int vop_virtio_zcopy(struct vop_vdev *vdev, void __user *ubuf,
+			    size_t len, u64 daddr, int vr_idx, bool read)
+{
+	struct vop_info *vi = vdev->vpdev->priv;
+	struct dma_device *ddev = vi->dma_ch->device;
+	bool x200 = is_dma_copy_aligned(ddev, 1, 1, 1);
+	unsigned long uaddr = (unsigned long)ubuf;
+	struct scatterlist *sg = NULL;
+	struct vop_pinned *pin;
+	size_t num_pages = 0;
+	dma_addr_t da = daddr;
+	int err;
+
+	if (!vop_use_dma(vdev) || !zcopy_min || len < zcopy_min ||
+	    !is_dma_copy_aligned(ddev, uaddr, daddr, len))
+		return -EINVAL;
+
+	pin = vop_pin_user(&vdev->vvr[vr_idx].pins, uaddr, len, read);
+	if (IS_ERR(pin))
+		return PTR_ERR(pin);
+	/* See vop_virtio_copy_to_user(..) for the x200 aperture offset */
+	if (x200) {
+		num_pages = (daddr + len)/PAGE_SIZE - daddr/PAGE_SIZE + 1;
+		err = vop_dma_map(vdev, &sg, daddr, &da, num_pages, len);
+		if (err)
+			goto put;
+	}
+	err = vop_dma_pinned(vi, pin, uaddr, da, len, read);
+	if (x200)
+		vop_dma_unmap(vdev, sg, num_pages);
+	if (err)
+		goto put;
+	if (read) {
+		vdev->in_bytes_zcopy += len;
+		vdev->in_bytes_dma += len;
+		vdev->in_bytes += len;
+	} else {
+		vdev->out_bytes_zcopy += len;
+		vdev->out_bytes_dma += len;
+		vdev->out_bytes += len;
+	}
+put:
+	vop_pin_put(pin);
+	return err;
+}
+
 #define MIC_VRINGH_READ true
 
 /* Determine the total number of bytes consumed in a VRINGH KIOV */
@@ -785,7 +983,10 @@ static int vop_vringh_copy(struct vop_vdev *vdev, struct vringh_kiov *iov,
 		struct kvec *kiov = &iov->iov[iov->i];
 
 		partlen = min(kiov->iov_len, len);
-		if (read)
+		if (!vop_virtio_zcopy(vdev, ubuf, partlen,
+				      (u64)kiov->iov_base, vr_idx, read))
+			ret = 0;
+		else if (read)
 			ret = vop_virtio_copy_to_user(vdev, ubuf, partlen,
 						      (u64)kiov->iov_base,
 						      kiov->iov_len,
@@ -819,11 +1020,24 @@ static int vop_vringh_copy(struct vop_vdev *vdev, struct vringh_kiov *iov,
 	return ret;
 }
 
+/* Add the completed chains to the used ring and notify the card once */
+static void vop_vringh_flush_used(struct vop_vringh *vvr)
+{
+	if (!vvr->nr_used)
+		return;
+	vringh_complete_multi_kern(&vvr->vrh, vvr->used, vvr->nr_used);
+	vringh_notify(&vvr->vrh);
+	vvr->nr_used = 0;
+}
+
 /*
  * Use the standard VRINGH infrastructure in the kernel to fetch new
- * descriptors, initiate the copies and update the used ring.
+ * descriptors, initiate the copies and collect the completed chain for
+ * the used ring. *flush is set if the caller has to update the used ring,
+ * i.e. the chain was completed and its completion not deferred.
  */
-static int _vop_virtio_copy(struct vop_vdev *vdev, struct mic_copy_desc *copy)
+static int _vop_virtio_copy(struct vop_vdev *vdev, struct mic_copy_desc *copy,
+			    bool *flush)
 {
 	int ret = 0;
 	u32 iovcnt = copy->iovcnt;
@@ -897,8 +1111,9 @@ static int _vop_virtio_copy(struct vop_vdev *vdev, struct mic_copy_desc *copy)
 			break;
 	}
 	/*
-	 * Update the used ring if a descriptor was available and some data was
-	 * copied in/out and the user asked for a used ring update.
+	 * Complete the chain if a descriptor was available and some data was
+	 * copied in/out and the user asked for a used ring update. Chains
+	 * are collected in vvr->used and added to the used ring together.
 	 */
 	if (*head != USHRT_MAX && copy->out_len && copy->update_used) {
 		u32 total = 0;
@@ -906,9 +1121,12 @@ static int _vop_virtio_copy(struct vop_vdev *vdev, struct mic_copy_desc *copy)
 		/* Determine the total data consumed */
 		total += vop_vringh_iov_consumed(riov);
 		total += vop_vringh_iov_consumed(wiov);
-		vringh_complete_kern(vrh, *head, total);
+		vvr->used[vvr->nr_used].id = cpu_to_vringh32(vrh, *head);
+		vvr->used[vvr->nr_used].len = cpu_to_vringh32(vrh, total);
+		vvr->nr_used++;
+		if (copy->update_used != MIC_VIRTIO_USED_DEFER)
+			*flush = true;
 		*head = USHRT_MAX;
-		vringh_notify(vrh);
 
 		vringh_kiov_cleanup(riov);
 		vringh_kiov_cleanup(wiov);
@@ -938,6 +1156,7 @@ static int vop_virtio_copy_desc(struct vop_vdev *vdev,
 {
 	int err;
 	struct vop_vringh *vvr = &vdev->vvr[copy->vr_idx];
+	bool flush = false;
 
 	err = vop_verify_copy_args(vdev, copy);
 	if (err)
@@ -948,16 +1167,85 @@ static int vop_virtio_copy_desc(struct vop_vdev *vdev,
 		err = -ENODEV;
 		goto err;
 	}
-	err = _vop_virtio_copy(vdev, copy);
+	err = _vop_virtio_copy(vdev, copy, &flush);
 	if (err) {
 		log_mic_err(vop_get_id(vdev->vpdev),
 			    "virtio copy failure, err %d", err);
 	}
+	if (flush)
+		vop_vringh_flush_used(vvr);
 err:
 	mutex_unlock(&vvr->vr_mutex);
+	vdev->copy_ioctls++;
+	vdev->copy_descs++;
 	return err;
 }
 
+/*
+ * Copy a batch of descriptor chains of one VRING. The VRING is locked
+ * once for the whole batch and the chains the user asked to complete are
+ * added to the used ring together, followed by a single notification of
+ * the card, once the data of every chain has been copied. The out_len of
+ * each copy is written back as soon as it is done.
+ */
+static int vop_virtio_copy_batch(struct vop_vdev *vdev,
+				 struct mic_copy_batch *batch)
+{
+	struct mic_copy_desc __user *ucopy = batch->copy;
+	struct mic_copy_desc copy;
+	struct vop_vringh *vvr = NULL;
+	bool flush = false;
+	int vr_idx = -1;
+	int err = 0;
+
+	batch->done = 0;
+	if (!batch->count || batch->count > MIC_VIRTIO_COPY_BATCH_MAX)
+		return -EINVAL;
+
+	for (; batch->done < batch->count; batch->done++, ucopy++) {
+		if (copy_from_user(&copy, ucopy, sizeof(copy))) {
+			err = -EFAULT;
+			break;
+		}
+		if (vr_idx < 0) {
+			err = vop_verify_copy_args(vdev, &copy);
+			if (err)
+				break;
+			vr_idx = copy.vr_idx;
+			vvr = &vdev->vvr[vr_idx];
+			mutex_lock(&vvr->vr_mutex);
+			if (!vop_vdevup(vdev)) {
+				err = -ENODEV;
+				break;
+			}
+		} else if (copy.vr_idx != vr_idx) {
+			err = -EINVAL;
+			break;
+		}
+		err = _vop_virtio_copy(vdev, &copy, &flush);
+		if (err)
+			break;
+		if (copy_to_user(&ucopy->out_len, &copy.out_len,
+				 sizeof(copy.out_len))) {
+			err = -EFAULT;
+			break;
+		}
+	}
+	if (flush)
+		vop_vringh_flush_used(vvr);
+	if (vr_idx >= 0)
+		mutex_unlock(&vvr->vr_mutex);
+
+	if (err)
+		log_mic_err(vop_get_id(vdev->vpdev),
+			    "virtio copy batch failure at %u of %u, err %d",
+			    batch->done, batch->count, err);
+	vdev->copy_ioctls++;
+	vdev->copy_descs += batch->done;
+	/* Like a short write, only report an error if nothing was copied */
+	return batch->done ? 0 : err;
+}
+
 static int vop_open(struct inode *inode, struct file *f)
 {
 	struct vop_vdev *vdev;
@@ -1105,6 +1393,44 @@ _unlock_ret:
 		mutex_unlock(&vdev->vdev_mutex);
 		return ret;
 	}
+	case MIC_VIRTIO_COPY_BATCH:
+	{
+		struct mic_copy_batch batch;
+
+		mutex_lock(&vdev->vdev_mutex);
+		ret = vop_vdev_get_status(vdev);
+		if (ret) {
+			log_mic_host_dbg("device descriptor "
+					 "not initialized, err %d", ret);
+			goto _unlock_batch;
+		}
+
+		if (copy_from_user(&batch, argp, sizeof(batch))) {
+			log_mic_err(vop_get_id(vdev->vpdev),
+				    "can't copy copy_batch from user, "
+				    "length %#lx, err %d",
+				    sizeof(batch), -EFAULT);
+			ret = -EFAULT;
+			goto _unlock_batch;
+		}
+
+		ret = vop_virtio_copy_batch(vdev, &batch);
+		if (ret < 0)
+			goto _unlock_batch;
+
+		if (copy_to_user(
+			&((struct mic_copy_batch __user *)argp)->done,
+			&batch.done, sizeof(batch.done))) {
+			log_mic_err(vop_get_id(vdev->vpdev),
+				    "can't copy copy_batch to user, "
+				    "length %#lx, err %d",
+				    sizeof(batch.done), -EFAULT);
+			ret = -EFAULT;
+		}
+_unlock_batch:
+		mutex_unlock(&vdev->vdev_mutex);
+		return ret;
+	}
 	default:
 		return -ENOIOCTLCMD;
 	};
@@ -1121,7 +1447,7 @@ static unsigned int vop_poll(struct file *f, poll_table *wait)
 {
 	struct vop_vdev *vdev = f->private_data;
 	int mask = 0;
-	int err;
+	int err, i;
 
 	if (!vdev) {
 		log_mic_host_err("vop_poll ERROR: vdev is NULL");
@@ -1144,6 +1470,15 @@ static unsigned int vop_poll(struct file *f, poll_table *wait)
 		mask = POLLIN | POLLOUT;
 		vdev->poll_wake = 0;
 	}
+
+	/* User space is done for now, complete the deferred chains */
+	for (i = 0; i < vdev->dd->num_vq && vop_vdevup(vdev); i++) {
+		struct vop_vringh *vvr = &vdev->vvr[i];
+
+		mutex_lock(&vvr->vr_mutex);
+		vop_vringh_flush_used(vvr);
+		mutex_unlock(&vvr->vr_mutex);
+	}
 	goto unlock;
 
 error:
@@ -1265,6 +1600,366 @@ static const struct file_operations vop_fops = {
 	.owner = THIS_MODULE,
 };
 
+/*
+ * Loopback benchmark of the copy paths, without a card: a coherent buffer
+ * of the DMA device stands in for card memory and an anonymous mapping of
+ * the reading process for the mpssd buffer. Each path copies
+ * VOP_ZCOPY_BENCH_SIZE bytes VOP_ZCOPY_BENCH_ITERS times in each
+ * direction: the CPU path used with disable_dma, a single bounce buffer,
+ * a ring of bounce_depth bounce buffers and the zero copy path through a
+ * pin cache.
+ */
+#define VOP_ZCOPY_BENCH_SIZE	(4 * VOP_INT_DMA_BUF_SIZE)
+#define VOP_ZCOPY_BENCH_ITERS	256
+
+enum {
+	VOP_BENCH_CPU,
+	VOP_BENCH_BOUNCE,
+	VOP_BENCH_RING,
+	VOP_BENCH_ZCOPY,
+	VOP_BENCH_PATHS
+};
+
+struct vop_bench {
+	void __user *ubuf;
+	void *card;
+	dma_addr_t card_da;
+	struct vop_bounce bounce[2];
+	struct vop_pin_cache pins;
+	u64 wait_ns[VOP_BENCH_PATHS];
+	u64 copy_ns[VOP_BENCH_PATHS];
+};
+
+static int vop_bench_copy(struct vop_info *vi, struct vop_bench *vb,
+			  int path, bool read)
+{
+	size_t len = VOP_ZCOPY_BENCH_SIZE;
+	struct vop_bounce *b;
+	struct vop_pinned *pin;
+	int err;
+
+	switch (path) {
+	case VOP_BENCH_CPU:
+		if (read)
+			return copy_to_user(vb->ubuf, vb->card, len) ?
+				-EFAULT : 0;
+		return copy_from_user(vb->card, vb->ubuf, len) ? -EFAULT : 0;
+	case VOP_BENCH_BOUNCE:
+	case VOP_BENCH_RING:
+		b = &vb->bounce[path - VOP_BENCH_BOUNCE];
+		if (read)
+			return vop_bounce_to_user(vi, b, vb->ubuf, vb->card_da,
+						  len, 0, 1,
+						  &vb->wait_ns[path],
+						  &vb->copy_ns[path]);
+		return vop_bounce_from_user(vi, b, vb->ubuf, vb->card_da,
+					    len, 1, &vb->wait_ns[path],
+					    &vb->copy_ns[path]);
+	default:
+		pin = vop_pin_user(&vb->pins, (unsigned long)vb->ubuf, len,
+				   read);
+		if (IS_ERR(pin))
+			return PTR_ERR(pin);
+		err = vop_dma_pinned(vi, pin, (unsigned long)vb->ubuf,
+				     vb->card_da, len, read);
+		vop_pin_put(pin);
+		return err;
+	}
+}
+
+int vop_zcopy_bench(struct vop_info *vi, struct seq_file *s)
+{
+	static const char * const names[] = {
+		"cpu", "bounce", "ring", "zcopy"
+	};
+	struct device *dev = vi->dma_ch->device->dev;
+	size_t len = VOP_ZCOPY_BENCH_SIZE;
+	u64 ns[VOP_BENCH_PATHS][2];
+	struct vop_bench *vb;
+	unsigned long ubuf;
+	int path, dir, i, err = -ENOMEM;
+	ktime_t start;
+
+	vb = kzalloc(sizeof(*vb), GFP_KERNEL);
+	if (!vb)
+		return -ENOMEM;
+	vb->card = dma_alloc_coherent(dev, len, &vb->card_da, GFP_KERNEL);
+	if (!vb->card ||
+	    vop_bounce_alloc(dev, &vb->bounce[0], 1) ||
+	    vop_bounce_alloc(dev, &vb->bounce[1], bounce_depth))
+		goto free;
+	ubuf = vm_mmap(NULL, 0, len, PROT_READ | PROT_WRITE,
+		       MAP_ANONYMOUS | MAP_PRIVATE, 0);
+	if (IS_ERR_VALUE(ubuf)) {
+		err = (int)ubuf;
+		goto free;
+	}
+	vb->ubuf = (void __user *)ubuf;
+	vop_pin_cache_init(&vb->pins, dev);
+
+	for (path = 0; path < VOP_BENCH_PATHS; path++) {
+		for (dir = 0; dir < 2; dir++) {
+			start = ktime_get();
+			for (i = 0; i < VOP_ZCOPY_BENCH_ITERS; i++) {
+				err = vop_bench_copy(vi, vb, path, !dir);
+				if (err)
+					goto unmap;
+			}
+			ns[path][dir] = max_t(u64, 1, ktime_to_ns(
+					ktime_sub(ktime_get(), start)));
+		}
+	}
+
+	seq_printf(s, "%d copies of %zu bytes, ring depth %d\n",
+		   VOP_ZCOPY_BENCH_ITERS, len, vb->bounce[1].depth);
+	seq_puts(s, "path    card to host MB/s  host to card MB/s"
+		 "  dma wait ms  user copy ms\n");
+	for (path = 0; path < VOP_BENCH_PATHS; path++)
+		seq_printf(s, "%-7s %17llu  %17llu  %11llu  %12llu\n",
+			   names[path],
+			   div64_u64((u64)len * VOP_ZCOPY_BENCH_ITERS * 1000,
+				     ns[path][0]),
+			   div64_u64((u64)len * VOP_ZCOPY_BENCH_ITERS * 1000,
+				     ns[path][1]),
+			   div64_u64(vb->wait_ns[path], NSEC_PER_MSEC),
+			   div64_u64(vb->copy_ns[path], NSEC_PER_MSEC));
+	seq_printf(s, "pin cache hits %lu misses %lu\n",
+		   vb->pins.hits, vb->pins.misses);
+unmap:
+	vop_pin_cache_destroy(&vb->pins);
+	vm_munmap(ubuf, len);
+free:
+	vop_bounce_free(dev, &vb->bounce[1]);
+	vop_bounce_free(dev, &vb->bounce[0]);
+	if (vb->card)
+		dma_free_coherent(dev, len, vb->card, vb->card_da);
+	kfree(vb);
+	return err;
+}
+
+/*
+ * Loopback benchmark of the copy ioctls on the CPU copy path, without a
+ * card: a vring in host memory stands in for the TX vring of a card,
+ * which mpssd drains into the TAP device, and VOP_BATCH_BENCH_PKTS
+ * packets are copied out of it into an anonymous mapping of the reading
+ * process, with one MIC_VIRTIO_COPY_DESC per packet and with
+ * MIC_VIRTIO_COPY_BATCH of increasing sizes. The time is that of the
+ * ioctl handlers; the system call entry a batch saves is not included.
+ */
+#define VOP_BATCH_BENCH_RING	256
+#define VOP_BATCH_BENCH_PKT	1514
+#define VOP_BATCH_BENCH_PKTS	(64 * 1024)
+
+struct vop_batch_bench {
+	struct vop_device vpdev;
+	struct vop_vdev vdev;
+	struct mic_device_ctrl dc;
+	struct _mic_vring_info info;
+	struct mic_device_desc *dd;
+	void *ring;
+	char *pkts;
+	struct mic_copy_desc __user *ucopy;
+};
+
+/* The descriptors hold kernel addresses, which need no mapping */
+static void __iomem *vop_batch_bench_ioremap(struct vop_device *vpdev,
+					     dma_addr_t pa, size_t len)
+{
+	return (void __iomem *)(uintptr_t)pa;
+}
+
+static void vop_batch_bench_iounmap(struct vop_device *vpdev,
+				    void __iomem *va)
+{
+}
+
+static struct vop_hw_ops vop_batch_bench_ops = {
+	.ioremap = vop_batch_bench_ioremap,
+	.iounmap = vop_batch_bench_iounmap,
+};
+
+/* Make the next n descriptors of the ring available, as the card does */
+static void vop_batch_bench_post(struct vop_vringh *vvr, unsigned int n)
+{
+	struct vring *vr = &vvr->vring.vr;
+	struct vringh *vrh = &vvr->vrh;
+	u16 idx = vringh16_to_cpu(vrh, vr->avail->idx);
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		vr->avail->ring[(u16)(idx + i) % vr->num] =
+			cpu_to_vringh16(vrh, (u16)(idx + i) % vr->num);
+	smp_wmb();
+	vr->avail->idx = cpu_to_vringh16(vrh, idx + n);
+}
+
+/* Copy n packets with one ioctl handler call, or one per packet if !batch */
+static int vop_batch_bench_copy(struct vop_batch_bench *vb, unsigned int n,
+				bool batch)
+{
+	struct vop_vdev *vdev = &vb->vdev;
+	struct mic_copy_batch mcb;
+	struct mic_copy_desc copy;
+	unsigned int i;
+	int err = 0;
+
+	vop_batch_bench_post(&vdev->vvr[0], n);
+	if (batch) {
+		mcb.copy = vb->ucopy;
+		mcb.count = n;
+		mutex_lock(&vdev->vdev_mutex);
+		err = vop_virtio_copy_batch(vdev, &mcb);
+		mutex_unlock(&vdev->vdev_mutex);
+		return err ? err : (mcb.done == n ? 0 : -EIO);
+	}
+
+	for (i = 0; i < n && !err; i++) {
+		mutex_lock(&vdev->vdev_mutex);
+		if (copy_from_user(&copy, &vb->ucopy[i], sizeof(copy)))
+			err = -EFAULT;
+		else
+			err = vop_virtio_copy_desc(vdev, &copy);
+		if (!err && put_user(copy.out_len, &vb->ucopy[i].out_len))
+			err = -EFAULT;
+		mutex_unlock(&vdev->vdev_mutex);
+	}
+	return err;
+}
+
+static int vop_batch_bench_init(struct vop_info *vi,
+				struct vop_batch_bench *vb, unsigned long ubuf)
+{
+	struct mic_copy_desc __user *ucopy;
+	struct iovec __user *uiov;
+	struct vop_vdev *vdev = &vb->vdev;
+	struct vop_vringh *vvr = &vdev->vvr[0];
+	struct mic_vring *vr = &vvr->vring;
+	struct mic_copy_desc copy = {};
+	struct iovec iov;
+	char __user *upkts;
+	int i, err;
+
+	vb->vpdev.priv = vi;
+	vb->vpdev.hw_ops = &vop_batch_bench_ops;
+	vb->vpdev.dma_ch = vi->dma_ch;
+	vb->vpdev.index = vop_get_id(vi->vpdev);
+	vb->dd->num_vq = 1;
+	vb->dd->status = 1;
+	vb->dc.h2c_vdev_db = -1;
+
+	vdev->vpdev = &vb->vpdev;
+	vdev->vi = vi;
+	vdev->dd = vb->dd;
+	vdev->dc = &vb->dc;
+	vdev->cpu_copy = true;
+	mutex_init(&vdev->vdev_mutex);
+
+	vring_init(&vr->vr, VOP_BATCH_BENCH_RING, vb->ring,
+		   MIC_VIRTIO_RING_ALIGN);
+	vr->va = vb->ring;
+	vr->info = &vb->info;
+	err = vringh_init_kern(&vvr->vrh, 0, VOP_BATCH_BENCH_RING, false,
+			       vr->vr.desc, vr->vr.avail, vr->vr.used);
+	if (err)
+		return err;
+	vvr->used = kmalloc_array(VOP_BATCH_BENCH_RING, sizeof(*vvr->used),
+				  GFP_KERNEL);
+	if (!vvr->used)
+		return -ENOMEM;
+	mutex_init(&vvr->vr_mutex);
+	vringh_kiov_init(&vvr->riov, NULL, 0);
+	vringh_kiov_init(&vvr->wiov, NULL, 0);
+	vvr->head = USHRT_MAX;
+	vvr->vdev = vdev;
+
+	for (i = 0; i < VOP_BATCH_BENCH_RING; i++) {
+		vr->vr.desc[i].addr = cpu_to_vringh64(&vvr->vrh,
+			(u64)(uintptr_t)(vb->pkts + i * VOP_BATCH_BENCH_PKT));
+		vr->vr.desc[i].len = cpu_to_vringh32(&vvr->vrh,
+						     VOP_BATCH_BENCH_PKT);
+	}
+
+	/* Copy descriptors, then their iovecs, then the packet buffers */
+	ucopy = (struct mic_copy_desc __user *)ubuf;
+	uiov = (struct iovec __user *)(ucopy + MIC_VIRTIO_COPY_BATCH_MAX);
+	upkts = (char __user *)(uiov + MIC_VIRTIO_COPY_BATCH_MAX);
+	for (i = 0; i < MIC_VIRTIO_COPY_BATCH_MAX; i++) {
+		iov.iov_base = upkts + i * VOP_BATCH_BENCH_PKT;
+		iov.iov_len = VOP_BATCH_BENCH_PKT;
+		copy.iov = &uiov[i];
+		copy.iovcnt = 1;
+		copy.update_used = 1;
+		if (copy_to_user(&uiov[i], &iov, sizeof(iov)) ||
+		    copy_to_user(&ucopy[i], &copy, sizeof(copy)))
+			return -EFAULT;
+	}
+	vb->ucopy = ucopy;
+	return 0;
+}
+
+int vop_batch_bench(struct vop_info *vi, struct seq_file *s)
+{
+	static const unsigned int sizes[] = {
+		0, 1, 4, 16, MIC_VIRTIO_COPY_BATCH_MAX
+	};
+	size_t ulen = MIC_VIRTIO_COPY_BATCH_MAX * (sizeof(struct mic_copy_desc)
+			+ sizeof(struct iovec) + VOP_BATCH_BENCH_PKT);
+	struct vop_batch_bench *vb;
+	unsigned long ubuf = 0;
+	unsigned int i, n, pkts;
+	int err = -ENOMEM;
+	ktime_t start;
+	u64 ns;
+
+	vb = kzalloc(sizeof(*vb), GFP_KERNEL);
+	if (!vb)
+		return -ENOMEM;
+	vb->dd = kzalloc(sizeof(*vb->dd), GFP_KERNEL);
+	vb->ring = kzalloc(vring_size(VOP_BATCH_BENCH_RING,
+				      MIC_VIRTIO_RING_ALIGN), GFP_KERNEL);
+	vb->pkts = vzalloc(VOP_BATCH_BENCH_RING * VOP_BATCH_BENCH_PKT);
+	if (!vb->dd || !vb->ring || !vb->pkts)
+		goto free;
+	ubuf = vm_mmap(NULL, 0, ulen, PROT_READ | PROT_WRITE,
+		       MAP_ANONYMOUS | MAP_PRIVATE, 0);
+	if (IS_ERR_VALUE(ubuf)) {
+		err = (int)ubuf;
+		ubuf = 0;
+		goto free;
+	}
+	err = vop_batch_bench_init(vi, vb, ubuf);
+	if (err)
+		goto free;
+
+	seq_printf(s, "%d packets of %d bytes, cpu copy\n",
+		   VOP_BATCH_BENCH_PKTS, VOP_BATCH_BENCH_PKT);
+	seq_puts(s, "ioctl        packets/call  ns/packet\n");
+	for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+		n = sizes[i] ? sizes[i] : 1;
+		start = ktime_get();
+		for (pkts = 0; pkts < VOP_BATCH_BENCH_PKTS; pkts += n) {
+			err = vop_batch_bench_copy(vb, n, sizes[i]);
+			if (err)
+				goto free;
+		}
+		ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+		seq_printf(s, "%-12s %12u  %9llu\n",
+			   sizes[i] ? "COPY_BATCH" : "COPY_DESC", n,
+			   div64_u64(ns, VOP_BATCH_BENCH_PKTS));
+	}
+free:
+	vringh_kiov_cleanup(&vb->vdev.vvr[0].riov);
+	vringh_kiov_cleanup(&vb->vdev.vvr[0].wiov);
+	kfree(vb->vdev.vvr[0].used);
+	if (ubuf)
+		vm_munmap(ubuf, ulen);
+	vfree(vb->pkts);
+	kfree(vb->ring);
+	kfree(vb->dd);
+	kfree(vb);
+	return err;
+}
+
 int vop_init(struct vop_info *vi)
 {
 	int rc;
@@ -1318,3 +2013,9 @@ void vop_uninit(struct vop_info *vi)
 
 module_param(disable_dma, bool, 0644);
 MODULE_PARM_DESC(disable_dma, "Disable DMA engine for all transfers");
+module_param(bounce_depth, uint, 0644);
+MODULE_PARM_DESC(bounce_depth,
+		 "Bounce buffers per VRING, DMA to one overlaps the user copy of the others");
+module_param(zcopy_min, uint, 0644);
+MODULE_PARM_DESC(zcopy_min,
+		 "Smallest copy DMAed without a bounce buffer, 0 to disable");
@@ -0,0 +1,316 @@
+/*
+ * Intel MIC Platform Software Stack (MPSS)
+ * Copyright (c) 2016, Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * Intel Virtio Over PCIe (VOP) driver.
+ */
+#include <linux/version.h>
+#include <linux/sched.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/dma-mapping.h>
+#include <linux/moduleparam.h>
+
+#include "vop.h"
+
+/*
+ * Pin cache for zero copy transfers.
+ *
+ * mpssd copies in and out of the same few buffers over and over, so the
+ * user pages pinned and mapped for a transfer are kept for the next one.
+ * Ranges are cached per VRING, least recently used first out, and dropped
+ * as soon as the MMU notifier reports that the range is unmapped or
+ * remapped. A range pinned while an invalidation ran is used once and not
+ * cached.
+ */
+static int pin_cache_pages = 1024;
+module_param(pin_cache_pages, int, 0644);
+MODULE_PARM_DESC(pin_cache_pages,
+		 "Pages of user buffers kept pinned per VRING for zero copy");
+
+static void vop_pinned_release(struct kref *kref)
+{
+	struct vop_pinned *pin = container_of(kref, struct vop_pinned, kref);
+	int i;
+
+	dma_unmap_sg(pin->dev, pin->st.sgl, pin->st.orig_nents,
+		     DMA_BIDIRECTIONAL);
+	sg_free_table(&pin->st);
+	for (i = 0; i < pin->nr_pages; i++) {
+		if (pin->write)
+			set_page_dirty_lock(pin->pages[i]);
+		put_page(pin->pages[i]);
+	}
+	kfree(pin->pages);
+	kfree(pin);
+}
+
+/**
+ * vop_pin_put - Drop a reference taken by vop_pin_user(..).
+ *
+ * @pin: pinned range.
+ */
+void vop_pin_put(struct vop_pinned *pin)
+{
+	kref_put(&pin->kref, vop_pinned_release);
+}
+
+/* Unlink the cached ranges overlapping start to end and drop them */
+static void vop_pin_invalidate(struct vop_pin_cache *pc, unsigned long start,
+			       unsigned long end)
+{
+	struct vop_pinned *pin, *tmp;
+	LIST_HEAD(dead);
+
+	spin_lock(&pc->lock);
+	pc->seq++;
+	list_for_each_entry_safe(pin, tmp, &pc->lru, list) {
+		if (pin->start >= end ||
+		    pin->start + ((unsigned long)pin->nr_pages << PAGE_SHIFT) <=
+		    start)
+			continue;
+		list_move(&pin->list, &dead);
+		pc->nr_pages -= pin->nr_pages;
+		pc->invalidations++;
+	}
+	spin_unlock(&pc->lock);
+
+	list_for_each_entry_safe(pin, tmp, &dead, list) {
+		list_del(&pin->list);
+		vop_pin_put(pin);
+	}
+}
+
+#ifdef CONFIG_MMU_NOTIFIER
+static void vop_mmu_notifier_release(struct mmu_notifier *mn,
+				     struct mm_struct *mm)
+{
+	struct vop_pin_cache *pc = container_of(mn, struct vop_pin_cache, mn);
+
+	vop_pin_invalidate(pc, 0, ULONG_MAX);
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,14,0)
+static void vop_mmu_notifier_invalidate_page(struct mmu_notifier *mn,
+					     struct mm_struct *mm,
+					     unsigned long address)
+{
+	struct vop_pin_cache *pc = container_of(mn, struct vop_pin_cache, mn);
+
+	vop_pin_invalidate(pc, address, address + PAGE_SIZE);
+}
+#endif
+
+static void vop_mmu_notifier_invalidate_range_start(struct mmu_notifier *mn,
+						    struct mm_struct *mm,
+						    unsigned long start,
+						    unsigned long end)
+{
+	struct vop_pin_cache *pc = container_of(mn, struct vop_pin_cache, mn);
+
+	vop_pin_invalidate(pc, start, end);
+}
+
+static void vop_mmu_notifier_invalidate_range_end(struct mmu_notifier *mn,
+						  struct mm_struct *mm,
+						  unsigned long start,
+						  unsigned long end)
+{
+}
+
+static const struct mmu_notifier_ops vop_mmu_notifier_ops = {
+	.release = vop_mmu_notifier_release,
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,14,0)
+	.invalidate_page = vop_mmu_notifier_invalidate_page,
+#endif
+	.invalidate_range_start = vop_mmu_notifier_invalidate_range_start,
+	.invalidate_range_end = vop_mmu_notifier_invalidate_range_end,
+};
+
+/* Ranges are only cached for the first process which pins through pc */
+static bool vop_pin_cache_attach(struct vop_pin_cache *pc)
+{
+	if (pc->mm)
+		return pc->mm == current->mm;
+	if (!pin_cache_pages)
+		return false;
+	pc->mn.ops = &vop_mmu_notifier_ops;
+	if (mmu_notifier_register(&pc->mn, current->mm))
+		return false;
+	pc->mm = current->mm;
+	return true;
+}
+#else
+static bool vop_pin_cache_attach(struct vop_pin_cache *pc)
+{
+	return false;
+}
+#endif
+
+/**
+ * vop_pin_cache_init - Initialize a pin cache.
+ *
+ * @pc: pin cache.
+ * @dev: device the pinned pages are mapped for.
+ */
+void vop_pin_cache_init(struct vop_pin_cache *pc, struct device *dev)
+{
+	memset(pc, 0, sizeof(*pc));
+	spin_lock_init(&pc->lock);
+	INIT_LIST_HEAD(&pc->lru);
+	pc->dev = dev;
+}
+
+/**
+ * vop_pin_cache_destroy - Unpin all cached ranges.
+ *
+ * @pc: pin cache.
+ *
+ * No transfer may use @pc any more.
+ */
+void vop_pin_cache_destroy(struct vop_pin_cache *pc)
+{
+	vop_pin_invalidate(pc, 0, ULONG_MAX);
+#ifdef CONFIG_MMU_NOTIFIER
+	if (pc->mm) {
+		mmu_notifier_unregister(&pc->mn, pc->mm);
+		pc->mm = NULL;
+	}
+#endif
+}
+
+static struct vop_pinned *vop_pin_lookup(struct vop_pin_cache *pc,
+					 unsigned long start, int nr_pages,
+					 bool write)
+{
+	struct vop_pinned *pin;
+
+	list_for_each_entry(pin, &pc->lru, list) {
+		if (pin->start <= start &&
+		    pin->start + ((unsigned long)pin->nr_pages << PAGE_SHIFT) >=
+		    start + ((unsigned long)nr_pages << PAGE_SHIFT) &&
+		    (pin->write || !write)) {
+			list_move(&pin->list, &pc->lru);
+			kref_get(&pin->kref);
+			return pin;
+		}
+	}
+	return NULL;
+}
+
+static struct vop_pinned *vop_pin_create(struct device *dev,
+					 unsigned long start, int nr_pages,
+					 bool write)
+{
+	struct vop_pinned *pin;
+	int pinned, i, err = -ENOMEM;
+
+	pin = kzalloc(sizeof(*pin), GFP_KERNEL);
+	if (!pin)
+		return ERR_PTR(-ENOMEM);
+	pin->pages = kmalloc_array(nr_pages, sizeof(*pin->pages), GFP_KERNEL);
+	if (!pin->pages)
+		goto free_pin;
+
+	pinned = get_user_pages_fast(start, nr_pages, write, pin->pages);
+	if (pinned != nr_pages) {
+		err = pinned < 0 ? pinned : -EFAULT;
+		goto put_pages;
+	}
+	err = sg_alloc_table_from_pages(&pin->st, pin->pages, nr_pages, 0,
+					(unsigned long)nr_pages << PAGE_SHIFT,
+					GFP_KERNEL);
+	if (err)
+		goto put_pages;
+	if (!dma_map_sg(dev, pin->st.sgl, pin->st.orig_nents,
+			DMA_BIDIRECTIONAL)) {
+		err = -ENOMEM;
+		goto free_table;
+	}
+	kref_init(&pin->kref);
+	INIT_LIST_HEAD(&pin->list);
+	pin->start = start;
+	pin->nr_pages = nr_pages;
+	pin->write = write;
+	pin->dev = dev;
+	return pin;
+free_table:
+	sg_free_table(&pin->st);
+put_pages:
+	for (i = 0; i < pinned; i++)
+		put_page(pin->pages[i]);
+	kfree(pin->pages);
+free_pin:
+	kfree(pin);
+	return ERR_PTR(err);
+}
+
+/**
+ * vop_pin_user - Pin and map the user pages backing a buffer.
+ *
+ * @pc: pin cache.
+ * @addr: user address.
+ * @len: length of the buffer.
+ * @write: the pages will be written to.
+ *
+ * Returns the pinned range covering @addr to @addr + @len with a
+ * reference held, to be dropped with vop_pin_put(..), or an ERR_PTR.
+ */
+struct vop_pinned *vop_pin_user(struct vop_pin_cache *pc, unsigned long addr,
+				size_t len, bool write)
+{
+	unsigned long start = addr & PAGE_MASK;
+	int nr_pages = (PAGE_ALIGN(addr + len) - start) >> PAGE_SHIFT;
+	struct vop_pinned *pin, *victim, *tmp;
+	bool cache = vop_pin_cache_attach(pc);
+	unsigned long seq;
+	LIST_HEAD(dead);
+
+	if (cache) {
+		spin_lock(&pc->lock);
+		pin = vop_pin_lookup(pc, start, nr_pages, write);
+		seq = pc->seq;
+		if (pin)
+			pc->hits++;
+		else
+			pc->misses++;
+		spin_unlock(&pc->lock);
+		if (pin)
+			return pin;
+	}
+
+	pin = vop_pin_create(pc->dev, start, nr_pages, write);
+	if (IS_ERR(pin) || !cache || nr_pages > pin_cache_pages)
+		return pin;
+
+	spin_lock(&pc->lock);
+	/* The range may have been remapped since it was looked up */
+	if (pc->seq == seq) {
+		while (pc->nr_pages + nr_pages > pin_cache_pages) {
+			victim = list_last_entry(&pc->lru, struct vop_pinned,
+						 list);
+			list_move(&victim->list, &dead);
+			pc->nr_pages -= victim->nr_pages;
+			pc->evictions++;
+		}
+		kref_get(&pin->kref);
+		list_add(&pin->list, &pc->lru);
+		pc->nr_pages += nr_pages;
+	}
+	spin_unlock(&pc->lock);
+
+	list_for_each_entry_safe(victim, tmp, &dead, list) {
+		list_del(&victim->list);
+		vop_pin_put(victim);
+	}
+	return pin;
+}
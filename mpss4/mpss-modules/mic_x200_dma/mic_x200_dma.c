@@ -53,8 +53,14 @@
 #include <linux/slab.h>
 #include <linux/delay.h>
 #include <linux/pci.h>
+#include <linux/platform_device.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
 #include <linux/interrupt.h>
+#include <linux/hrtimer.h>
+#include <linux/workqueue.h>
 #include <linux/vmalloc.h>
+#include <linux/scatterlist.h>
 #include <linux/freezer.h>
 #include <linux/version.h>
 #include <linux/seq_file.h>
@@ -75,6 +81,8 @@
 #define MIC_DMA_ALIGN_BYTES	(1 << MIC_DMA_ALIGN_SHIFT)
 #define MIC_DMA_POLL_TIMEOUT	500000
 #define MIC_DMA_ABORT_TO_MS	3000
+/* Period of the completion poll timer in polled mode, unless set */
+#define MIC_DMA_POLL_USECS	20
 
 /* DMA Descriptor related flags */
 #define MIC_DMA_DESC_VALID		(1UL << 31)
@@ -190,6 +198,20 @@ struct mic_dma_desc {
  * @dbg_flush: flag used for "flush" DMA's from debugfs
  * @abort_tail: descriptor ring position at which last abort occurred
  * @abort_counter: number of aborts at the last position in desc ring
+ * @slave_src: device address of DMA_DEV_TO_MEM scatterlist transfers
+ * @slave_dst: device address of DMA_MEM_TO_DEV scatterlist transfers
+ * @intr_coalesce_count: interrupts requested per interrupt raised
+ * @intr_coalesce_usecs: longest a completion waits for the poll timer when
+ *			 its interrupt was not raised, 0 to raise them all
+ * @poll_mode: raise no completion interrupt, completions are found by
+ *	       tx_status(..) and the poll timer
+ * @intr_deferred: interrupts not raised since the last one which was
+ * @poll_timer: fires to reap completions whose interrupt was not raised
+ * @poll_work: reaps completions for poll_timer, callbacks may sleep
+ * @poll_armed: bit 0 is set while poll_timer is queued
+ * @stats: interrupts requested and raised, poll timer expiries,
+ *	   transfers completed and prep calls which found the ring full,
+ *	   for debugfs
  */
 struct mic_dma_chan {
 	int ch_num;
@@ -206,14 +228,51 @@ struct mic_dma_chan {
 	bool dbg_flush;
 	u32 abort_tail;
 	u32 abort_counter;
+	dma_addr_t slave_src;
+	dma_addr_t slave_dst;
+	u32 intr_coalesce_count;
+	u32 intr_coalesce_usecs;
+	u8 poll_mode;
+	u32 intr_deferred;
+	struct hrtimer poll_timer;
+	struct work_struct poll_work;
+	unsigned long poll_armed;
+	struct {
+		u64 intr_req;
+		u64 intr;
+		u64 polls;
+		u64 completed;
+		u64 ring_full;
+	} stats;
+};
+
+struct mic_dma_device;
+struct mic_dma_sw_engine;
+
+/*
+ * mic_dma_hw_ops - Access to the DMA engine behind a mic_dma_device
+ *
+ * @reg_read: read a 32 bit register
+ * @reg_write: write a 32 bit register
+ * @setup_irq: start delivering interrupts to mic_dma_intr_handler(..)
+ * @free_irq: stop delivering interrupts
+ */
+struct mic_dma_hw_ops {
+	u32 (*reg_read)(struct mic_dma_device *mic_dma_dev, u32 offset);
+	void (*reg_write)(struct mic_dma_device *mic_dma_dev, u32 offset,
+			  u32 value);
+	int (*setup_irq)(struct mic_dma_device *mic_dma_dev);
+	void (*free_irq)(struct mic_dma_device *mic_dma_dev);
 };
 
 /*
  * mic_dma_device - Per MIC X200 DMA device driver specific data structures
  *
- * @pdev: PCIe device
+ * @pdev: PCIe device, NULL for a software engine
  * @dma_dev: underlying dma device
+ * @hw_ops: hardware or software engine access
  * @reg_base: virtual address of the mmio space
+ * @sw: software engine state
  * @mic_chan: Array of MIC X200 DMA channels
  * @max_xfer_size: maximum transfer size per dma descriptor
  * @dbg_dir: debugfs directory
@@ -221,7 +280,9 @@ struct mic_dma_chan {
 struct mic_dma_device {
 	struct pci_dev *pdev;
 	struct dma_device dma_dev;
+	const struct mic_dma_hw_ops *hw_ops;
 	void __iomem *reg_base;
+	struct mic_dma_sw_engine *sw;
 	struct mic_dma_chan mic_chan;
 	size_t max_xfer_size;
 	struct dentry *dbg_dir;
@@ -246,13 +307,13 @@ static inline struct device *mic_dma_ch_to_device(struct mic_dma_chan *ch)
 
 static inline u32 mic_dma_reg_read(struct mic_dma_device *pdma, u32 offset)
 {
-	return ioread32(pdma->reg_base + offset);
+	return pdma->hw_ops->reg_read(pdma, offset);
 }
 
 static inline void mic_dma_reg_write(struct mic_dma_device *pdma,
 			   u32 offset, u32 value)
 {
-	iowrite32(value, pdma->reg_base + offset);
+	pdma->hw_ops->reg_write(pdma, offset, value);
 }
 
 static inline u32 mic_dma_ch_reg_read(struct mic_dma_chan *ch, u32 offset)
@@ -324,7 +385,7 @@ static inline void mic_dma_debug_destroy(void)
 
 
 /* high-water mark for pushing dma descriptors */
-static int mic_dma_pending_level = 16;
+static u32 mic_dma_pending_level = 16;
 
 
 static inline u32 mic_dma_ring_inc(u32 val)
@@ -465,6 +526,7 @@ static void mic_dma_cleanup(struct mic_dma_chan *ch)
 
 		tx = &ch->tx_array[last_tail];
 		if (tx->cookie) {
+			ch->stats.completed++;
 			dma_cookie_complete(tx);
 			if (tx->callback) {
 				tx->callback(tx->callback_param);
@@ -520,7 +582,8 @@ static int mic_dma_chan_init(struct mic_dma_chan *ch)
 	 * b) Can the reset added back and performance settings be
 	 *    restored by the driver.
 	 */
-	pci_reset_function(mic_dma_dev->pdev);
+	if (mic_dma_dev->pdev)
+		pci_reset_function(mic_dma_dev->pdev);
 #endif
 	rc = mic_dma_alloc_desc_ring(ch);
 	if (rc)
@@ -586,6 +649,9 @@ static void mic_dma_free_chan_resources(struct dma_chan *ch)
 
 	mic_dma_chan_mask_intr(mic_ch);
 	mic_dma_disable_chan(mic_ch);
+	hrtimer_cancel(&mic_ch->poll_timer);
+	cancel_work_sync(&mic_ch->poll_work);
+	clear_bit(0, &mic_ch->poll_armed);
 	mic_dma_cleanup(mic_ch);
 	mic_dma_free_desc_ring(mic_ch);
 	mic_dma_debug_destroy();
@@ -655,17 +721,36 @@ static void mic_dma_fence_intr_desc(struct mic_dma_chan *ch, int flags)
 	mic_dma_inc_head(ch);
 }
 
+static void mic_dma_fill_memcpy_desc(struct mic_dma_chan *ch, dma_addr_t src,
+				     dma_addr_t dst, size_t len)
+{
+	size_t current_transfer_len;
+	size_t max_xfer_size = to_mic_dma_dev(ch)->max_xfer_size;
+
+	while (len > 0) {
+		current_transfer_len = min(len, max_xfer_size);
+		/*
+		 * Set flags to 0 here, we don't want memcpy descriptors to
+		 * generate interrupts, a separate descriptor will be programmed
+		 * for fence/interrupt during submit, after a callback is
+		 * guaranteed to have been assigned
+		 */
+		mic_dma_memcpy_desc(&ch->desc_ring[ch->head],
+				    src, dst, current_transfer_len, 0);
+		mic_dma_desc_debug(ch, &ch->desc_ring[ch->head], 0);
+		mic_dma_inc_head(ch);
+		len -= current_transfer_len;
+		dst = dst + current_transfer_len;
+		src = src + current_transfer_len;
+	}
+}
+
 static int mic_dma_prog_memcpy_desc(struct mic_dma_chan *ch, dma_addr_t src,
 				    dma_addr_t dst, size_t len, int flags)
 {
 	struct device *dev = mic_dma_ch_to_device(ch);
-	size_t current_transfer_len;
-	size_t max_xfer_size = to_mic_dma_dev(ch)->max_xfer_size;
-	int num_desc = len / max_xfer_size;
-	int ret;
+	int num_desc = DIV_ROUND_UP(len, to_mic_dma_dev(ch)->max_xfer_size);
 
-	if (len % max_xfer_size)
-		num_desc++;
 	/*
 	 * A single additional descriptor is programmed for fence/interrupt
 	 * during submit(..)
@@ -681,22 +766,7 @@ static int mic_dma_prog_memcpy_desc(struct mic_dma_chan *ch, dma_addr_t src,
 	if (mic_dma_ring_count(ch->head, ch->last_tail) < num_desc)
 		return -EBUSY;
 
-	while (len > 0) {
-		current_transfer_len = min(len, max_xfer_size);
-		/*
-		 * Set flags to 0 here, we don't want memcpy descriptors to
-		 * generate interrupts, a separate descriptor will be programmed
-		 * for fence/interrupt during submit, after a callback is
-		 * guaranteed to have been assigned
-		 */
-		mic_dma_memcpy_desc(&ch->desc_ring[ch->head],
-				    src, dst, current_transfer_len, 0);
-		mic_dma_desc_debug(ch, &ch->desc_ring[ch->head], ret);
-		mic_dma_inc_head(ch);
-		len -= current_transfer_len;
-		dst = dst + current_transfer_len;
-		src = src + current_transfer_len;
-	}
+	mic_dma_fill_memcpy_desc(ch, src, dst, len);
 	return 0;
 }
 
@@ -751,10 +821,70 @@ static inline void mic_dma_issue_pending(struct dma_chan *ch)
 static inline void mic_dma_update_pending(struct mic_dma_chan *ch)
 {
 	if (mic_dma_ring_count(ch->head, ch->last_tail)
-		> mic_dma_pending_level)
+		> (int)mic_dma_pending_level)
 		mic_dma_issue_pending(&ch->chan);
 }
 
+static u64 mic_dma_poll_ns(struct mic_dma_chan *ch)
+{
+	u32 usecs = ACCESS_ONCE(ch->intr_coalesce_usecs);
+
+	return (u64)(usecs ? usecs : MIC_DMA_POLL_USECS) * NSEC_PER_USEC;
+}
+
+static void mic_dma_poll_work(struct work_struct *work)
+{
+	mic_dma_cleanup(container_of(work, struct mic_dma_chan, poll_work));
+}
+
+static void mic_dma_arm_poll_timer(struct mic_dma_chan *ch)
+{
+	if (!test_and_set_bit(0, &ch->poll_armed))
+		hrtimer_start(&ch->poll_timer, ns_to_ktime(mic_dma_poll_ns(ch)),
+			      HRTIMER_MODE_REL);
+}
+
+static enum hrtimer_restart mic_dma_poll_timer_fn(struct hrtimer *timer)
+{
+	struct mic_dma_chan *ch = container_of(timer, struct mic_dma_chan,
+					       poll_timer);
+
+	ch->stats.polls++;
+	queue_work(system_highpri_wq, &ch->poll_work);
+	clear_bit(0, &ch->poll_armed);
+	smp_mb__after_atomic();
+	/* Keep polling until the ring drains */
+	if (ACCESS_ONCE(ch->last_tail) != ACCESS_ONCE(ch->head) &&
+	    !test_and_set_bit(0, &ch->poll_armed)) {
+		hrtimer_forward_now(timer, ns_to_ktime(mic_dma_poll_ns(ch)));
+		return HRTIMER_RESTART;
+	}
+	return HRTIMER_NORESTART;
+}
+
+/*
+ * Interrupt moderation: only every intr_coalesce_count-th descriptor which
+ * asks for an interrupt raises one, which also completes the transfers
+ * programmed before it. The others are left to the poll timer, which
+ * fires at most intr_coalesce_usecs later. In polled mode no interrupt is
+ * raised at all. Called with prep_lock held.
+ */
+static int mic_dma_moderate_intr(struct mic_dma_chan *ch, int flags)
+{
+	if (!(flags & DMA_PREP_INTERRUPT))
+		return flags;
+
+	ch->stats.intr_req++;
+	if (!ch->poll_mode &&
+	    (!ch->intr_coalesce_usecs ||
+	     ++ch->intr_deferred >= ch->intr_coalesce_count)) {
+		ch->intr_deferred = 0;
+		return flags;
+	}
+	mic_dma_arm_poll_timer(ch);
+	return flags & ~DMA_PREP_INTERRUPT;
+}
+
 static dma_cookie_t mic_dma_tx_submit_unlock(struct dma_async_tx_descriptor *tx)
 {
 	struct mic_dma_chan *mic_ch = to_mic_dma_chan(tx->chan);
@@ -773,7 +903,8 @@ static dma_cookie_t mic_dma_tx_submit_unlock(struct dma_async_tx_descriptor *tx)
 	 * cookie has been assigned
 	 */
 	if (tx->flags) {
-		mic_dma_fence_intr_desc(mic_ch, tx->flags);
+		mic_dma_fence_intr_desc(mic_ch,
+					mic_dma_moderate_intr(mic_ch, tx->flags));
 		tx->flags = 0;
 	}
 
@@ -814,6 +945,8 @@ retry:
 		mic_dma_cleanup(mic_ch);
 		result = mic_dma_do_dma(mic_ch, flags, dma_src, dma_dest, len);
 	}
+	if (result == -EBUSY)
+		mic_ch->stats.ring_full++;
 	if ((result == -EBUSY) && time_before(jiffies, timeout)) {
 		spin_unlock(&mic_ch->prep_lock);
 		usleep_range(1000, 2000);
@@ -833,6 +966,86 @@ mic_dma_prep_interrupt_lock(struct dma_chan *ch, unsigned long flags)
 	return mic_dma_prep_memcpy_lock(ch, 0, 0, 0, flags);
 }
 
+static int mic_dma_slave_config(struct dma_chan *ch,
+				struct dma_slave_config *config)
+{
+	struct mic_dma_chan *mic_ch = to_mic_dma_chan(ch);
+
+	spin_lock(&mic_ch->prep_lock);
+	mic_ch->slave_src = config->src_addr;
+	mic_ch->slave_dst = config->dst_addr;
+	spin_unlock(&mic_ch->prep_lock);
+	return 0;
+}
+
+/*
+ * Copy a scatterlist to or from the address set with dmaengine_slave_config.
+ * Unlike a FIFO the device address advances with the transfer, so this
+ * gathers the scatterlist into, or scatters it from, a contiguous range
+ * such as a chunk of a SCIF window behind the aperture. All descriptors
+ * are programmed under a single acquisition of prep_lock and a single
+ * fence/interrupt descriptor follows them, so the whole list completes
+ * with one callback.
+ */
+static struct dma_async_tx_descriptor *
+mic_dma_prep_slave_sg_lock(struct dma_chan *ch, struct scatterlist *sgl,
+			   unsigned int sg_len,
+			   enum dma_transfer_direction dir,
+			   unsigned long flags, void *context)
+{
+	struct mic_dma_chan *mic_ch = to_mic_dma_chan(ch);
+	struct device *dev = mic_dma_ch_to_device(mic_ch);
+	size_t max_xfer_size = to_mic_dma_dev(mic_ch)->max_xfer_size;
+	unsigned long timeout = jiffies +
+				msecs_to_jiffies(mic_dma_ring_timeout_ms);
+	struct scatterlist *sg;
+	dma_addr_t dev_addr;
+	int i, num_desc = 0;
+
+	if (dir != DMA_MEM_TO_DEV && dir != DMA_DEV_TO_MEM)
+		return NULL;
+
+	for_each_sg(sgl, sg, sg_len, i)
+		num_desc += DIV_ROUND_UP(sg_dma_len(sg), max_xfer_size);
+	if (flags)
+		num_desc++;
+	if (!num_desc || num_desc >= MIC_DMA_DESC_RX_SIZE) {
+		dev_err(dev, "%s bad scatterlist: %d descriptors\n",
+			__func__, num_desc);
+		return NULL;
+	}
+
+retry:
+	spin_lock(&mic_ch->prep_lock);
+	if (mic_dma_ring_count(mic_ch->head, mic_ch->last_tail) < num_desc)
+		mic_dma_cleanup(mic_ch);
+	if (mic_dma_ring_count(mic_ch->head, mic_ch->last_tail) < num_desc) {
+		mic_ch->stats.ring_full++;
+		spin_unlock(&mic_ch->prep_lock);
+		if (time_before(jiffies, timeout)) {
+			usleep_range(1000, 2000);
+			mic_dma_cleanup(mic_ch);
+			goto retry;
+		}
+		dev_err(dev, "Error enqueueing dma, error=%d\n", -EBUSY);
+		return NULL;
+	}
+
+	dev_addr = dir == DMA_MEM_TO_DEV ? mic_ch->slave_dst :
+					   mic_ch->slave_src;
+	for_each_sg(sgl, sg, sg_len, i) {
+		if (dir == DMA_MEM_TO_DEV)
+			mic_dma_fill_memcpy_desc(mic_ch, sg_dma_address(sg),
+						 dev_addr, sg_dma_len(sg));
+		else
+			mic_dma_fill_memcpy_desc(mic_ch, dev_addr,
+						 sg_dma_address(sg),
+						 sg_dma_len(sg));
+		dev_addr += sg_dma_len(sg);
+	}
+	return allocate_tx(mic_ch, flags);
+}
+
 static irqreturn_t mic_dma_thread_fn(int irq, void *data)
 {
 	struct mic_dma_device *mic_dma_dev = ((struct mic_dma_device *)data);
@@ -956,6 +1169,8 @@ static irqreturn_t mic_dma_intr_handler(int irq, void *data)
 
 	reg = mic_dma_ack_interrupt(&mic_dma_dev->mic_chan);
 	wake_thread = !!(reg & MIC_DMA_DESC_DONE_INTR_STATUS);
+	if (wake_thread)
+		ch->stats.intr++;
 	error = !!(reg & MIC_DMA_ERROR_STATUS);
 	if (error)
 		dev_info(dev, "%s error status 0x%x\n", __func__, reg);
@@ -1005,6 +1220,244 @@ static inline void mic_dma_free_irq(struct mic_dma_device *mic_dma_dev)
 		pci_disable_msi(pdev);
 }
 
+static u32 mic_dma_pci_reg_read(struct mic_dma_device *mic_dma_dev, u32 offset)
+{
+	return ioread32(mic_dma_dev->reg_base + offset);
+}
+
+static void mic_dma_pci_reg_write(struct mic_dma_device *mic_dma_dev,
+				  u32 offset, u32 value)
+{
+	iowrite32(value, mic_dma_dev->reg_base + offset);
+}
+
+static const struct mic_dma_hw_ops mic_dma_pci_ops = {
+	.reg_read = mic_dma_pci_reg_read,
+	.reg_write = mic_dma_pci_reg_write,
+	.setup_irq = mic_dma_setup_irq,
+	.free_irq = mic_dma_free_irq,
+};
+
+/*
+ * Software DMA engine.
+ *
+ * A kthread which consumes the descriptor ring the way the hardware does,
+ * so the ring, fence/interrupt descriptors, the notify_hw handshake and
+ * cleanup can be exercised and benchmarked without a card. The registers
+ * the driver uses are emulated: status bits are write one to clear, the
+ * engine stops on an invalid descriptor and sets DESC_INVLD_STATUS, and
+ * completed descriptors get their valid bit cleared. Interrupts are
+ * delivered by calling the interrupt handler and thread from the kthread.
+ * Descriptor addresses must be direct mapped RAM, which they are for the
+ * platform devices the engines are created on.
+ */
+#define MIC_DMA_SW_NR_REGS	(0x300 / sizeof(u32))
+#define MIC_DMA_SW_MAX		8
+#define MIC_DMA_SW_CTRL_W1C	(MIC_DMA_CTRL_HEADER_LOG | \
+				 MIC_DMA_CTRL_STATUS_BITS)
+
+/*
+ * mic_dma_sw_engine - Software DMA engine state
+ *
+ * @pdev: platform device standing in for the PCIe function
+ * @thread: kthread consuming descriptors
+ * @wq: the kthread waits here for the engine to be started
+ * @lock: protects regs and busy
+ * @regs: emulated registers
+ * @busy: a descriptor is being copied, delays ABORT_DONE_STATUS
+ */
+struct mic_dma_sw_engine {
+	struct platform_device *pdev;
+	struct task_struct *thread;
+	wait_queue_head_t wq;
+	spinlock_t lock;
+	u32 regs[MIC_DMA_SW_NR_REGS];
+	bool busy;
+};
+
+static unsigned int sw_engines;
+module_param(sw_engines, uint, 0444);
+MODULE_PARM_DESC(sw_engines, "Number of software DMA engines to create");
+
+static struct mic_dma_device *mic_dma_sw_devs[MIC_DMA_SW_MAX];
+
+static inline u32 *mic_dma_sw_reg(struct mic_dma_sw_engine *sw, u32 offset)
+{
+	return &sw->regs[offset / sizeof(u32)];
+}
+
+static bool mic_dma_sw_runnable(struct mic_dma_sw_engine *sw)
+{
+	u32 ctrl = *mic_dma_sw_reg(sw, MIC_DMA_CTRL_STATUS);
+
+	return (ctrl & MIC_DMA_CTRL_START) &&
+		!(ctrl & (MIC_DMA_CTRL_ABORT | MIC_DMA_CTRL_DESC_INVLD_STATUS));
+}
+
+static u32 mic_dma_sw_reg_read(struct mic_dma_device *mic_dma_dev, u32 offset)
+{
+	struct mic_dma_sw_engine *sw = mic_dma_dev->sw;
+	u32 val;
+
+	if (offset >= sizeof(sw->regs))
+		return 0;
+	spin_lock(&sw->lock);
+	val = *mic_dma_sw_reg(sw, offset);
+	spin_unlock(&sw->lock);
+	return val;
+}
+
+static void mic_dma_sw_reg_write(struct mic_dma_device *mic_dma_dev,
+				 u32 offset, u32 value)
+{
+	struct mic_dma_sw_engine *sw = mic_dma_dev->sw;
+	u32 *reg;
+
+	if (offset >= sizeof(sw->regs))
+		return;
+	spin_lock(&sw->lock);
+	reg = mic_dma_sw_reg(sw, offset);
+	switch (offset) {
+	case MIC_DMA_CTRL_STATUS:
+		*reg = (value & ~MIC_DMA_SW_CTRL_W1C) |
+			(*reg & ~value & MIC_DMA_SW_CTRL_W1C);
+		if ((value & MIC_DMA_CTRL_ABORT) && !sw->busy)
+			*reg |= MIC_DMA_CTRL_ABORT_DONE_STATUS;
+		break;
+	case MIC_DMA_INTR_CTRL_STATUS:
+		*reg = (value & ~MIC_DMA_ALL_INTR_STATUS) |
+			(*reg & ~value & MIC_DMA_ALL_INTR_STATUS);
+		break;
+	default:
+		*reg = value;
+		break;
+	}
+	spin_unlock(&sw->lock);
+	wake_up(&sw->wq);
+}
+
+/* Flag an interrupt, returns true if it is to be delivered */
+static bool mic_dma_sw_set_intr(struct mic_dma_sw_engine *sw, u32 status)
+{
+	u32 *intr = mic_dma_sw_reg(sw, MIC_DMA_INTR_CTRL_STATUS);
+
+	/* Masked channels raise nothing */
+	if (!(*intr & MIC_DMA_ALL_INTR_EN))
+		return false;
+	*intr |= status;
+	return true;
+}
+
+static void mic_dma_sw_raise(struct mic_dma_device *mic_dma_dev)
+{
+	if (mic_dma_intr_handler(0, mic_dma_dev) == IRQ_WAKE_THREAD)
+		mic_dma_thread_fn(0, mic_dma_dev);
+}
+
+/* Process the descriptor at NEXT_DESC_ADDR, returns true to interrupt */
+static bool mic_dma_sw_step(struct mic_dma_device *mic_dma_dev)
+{
+	struct mic_dma_sw_engine *sw = mic_dma_dev->sw;
+	struct mic_dma_chan *ch = &mic_dma_dev->mic_chan;
+	u32 base, next, idx, nr;
+	struct mic_dma_desc *desc;
+	dma_addr_t src, dst;
+	u64 qw0, qw1, size;
+	bool intr = false;
+
+	spin_lock(&sw->lock);
+	if (!mic_dma_sw_runnable(sw) || !ch->desc_ring) {
+		spin_unlock(&sw->lock);
+		return false;
+	}
+	base = *mic_dma_sw_reg(sw, MIC_DMA_DESC_RING_ADDR_LOW);
+	nr = *mic_dma_sw_reg(sw, MIC_DMA_DESC_RING_SIZE);
+	next = *mic_dma_sw_reg(sw, MIC_DMA_NEXT_DESC_ADDR_LOW);
+	idx = ((next - base) / sizeof(*desc)) % (nr ? nr : 1);
+	desc = &ch->desc_ring[idx];
+	qw0 = ACCESS_ONCE(desc->qw0);
+	if (!(qw0 & MIC_DMA_DESC_VALID)) {
+		/* Stop until software clears DESC_INVLD_STATUS */
+		*mic_dma_sw_reg(sw, MIC_DMA_CTRL_STATUS) |=
+			MIC_DMA_CTRL_DESC_INVLD_STATUS;
+		intr = mic_dma_sw_set_intr(sw, MIC_DMA_INVLD_DESC_INTR_STATUS);
+		spin_unlock(&sw->lock);
+		return intr;
+	}
+	/* Pairs with the wmb() between the QW1 and QW0 updates */
+	rmb();
+	qw1 = ACCESS_ONCE(desc->qw1);
+	sw->busy = true;
+	spin_unlock(&sw->lock);
+
+	src = ((qw0 >> 48) << 32) | (qw1 >> MIC_DMA_DESC_SRC_LOW_SHIFT);
+	dst = (qw0 & MIC_DMA_DESC_BITS_32_TO_47) |
+		(qw1 & MIC_DMA_DESC_LOW_MASK);
+	size = qw0 & MIC_DMA_DESC_SIZE_MASK;
+	if (size)
+		memcpy(phys_to_virt(dst), phys_to_virt(src), size);
+
+	spin_lock(&sw->lock);
+	sw->busy = false;
+	if (!mic_dma_sw_runnable(sw)) {
+		/* Aborted, the descriptor is not written back */
+		if (*mic_dma_sw_reg(sw, MIC_DMA_CTRL_STATUS) &
+		    MIC_DMA_CTRL_ABORT)
+			*mic_dma_sw_reg(sw, MIC_DMA_CTRL_STATUS) |=
+				MIC_DMA_CTRL_ABORT_DONE_STATUS;
+		spin_unlock(&sw->lock);
+		return false;
+	}
+	/* Status write back */
+	wmb();
+	desc->qw0 = qw0 & ~MIC_DMA_DESC_VALID;
+	wmb();
+	*mic_dma_sw_reg(sw, MIC_DMA_LAST_DESC_ADDR_LOW) = next;
+	*mic_dma_sw_reg(sw, MIC_DMA_LAST_DESC_XFER_SIZE) = size;
+	*mic_dma_sw_reg(sw, MIC_DMA_NEXT_DESC_ADDR_LOW) =
+		base + ((idx + 1) % nr) * sizeof(*desc);
+	if (qw0 & MIC_DMA_DESC_INTR_ENABLE)
+		intr = mic_dma_sw_set_intr(sw, MIC_DMA_DESC_DONE_INTR_STATUS);
+	spin_unlock(&sw->lock);
+	return intr;
+}
+
+static int mic_dma_sw_thread(void *data)
+{
+	struct mic_dma_device *mic_dma_dev = data;
+	struct mic_dma_sw_engine *sw = mic_dma_dev->sw;
+
+	while (!kthread_should_stop()) {
+		wait_event_interruptible(sw->wq, kthread_should_stop() ||
+					 mic_dma_sw_runnable(sw));
+		if (mic_dma_sw_step(mic_dma_dev))
+			mic_dma_sw_raise(mic_dma_dev);
+		cond_resched();
+	}
+	return 0;
+}
+
+static int mic_dma_sw_setup_irq(struct mic_dma_device *mic_dma_dev)
+{
+	struct mic_dma_sw_engine *sw = mic_dma_dev->sw;
+
+	sw->thread = kthread_run(mic_dma_sw_thread, mic_dma_dev, "%s",
+				 dev_name(mic_dma_dev->dma_dev.dev));
+	return PTR_ERR_OR_ZERO(sw->thread);
+}
+
+static void mic_dma_sw_free_irq(struct mic_dma_device *mic_dma_dev)
+{
+	kthread_stop(mic_dma_dev->sw->thread);
+}
+
+static const struct mic_dma_hw_ops mic_dma_sw_ops = {
+	.reg_read = mic_dma_sw_reg_read,
+	.reg_write = mic_dma_sw_reg_write,
+	.setup_irq = mic_dma_sw_setup_irq,
+	.free_irq = mic_dma_sw_free_irq,
+};
+
 static void mic_dma_hw_init(struct mic_dma_device *mic_dma_dev)
 {
 	struct mic_dma_chan *ch = &mic_dma_dev->mic_chan;
@@ -1052,7 +1505,7 @@ static int mic_dma_init(struct mic_dma_device *mic_dma_dev)
 
 	mic_dma_hw_init(mic_dma_dev);
 
-	rc = mic_dma_setup_irq(mic_dma_dev);
+	rc = mic_dma_dev->hw_ops->setup_irq(mic_dma_dev);
 	if (rc) {
 		dev_err(mic_dma_dev->dma_dev.dev,
 			"%s %d func error line %d\n", __func__, __LINE__, rc);
@@ -1062,6 +1515,12 @@ static int mic_dma_init(struct mic_dma_device *mic_dma_dev)
 	spin_lock_init(&ch->cleanup_lock);
 	spin_lock_init(&ch->prep_lock);
 	spin_lock_init(&ch->issue_lock);
+	ch->intr_coalesce_count = 1;
+	ch->intr_coalesce_usecs = 0;
+	ch->poll_mode = 0;
+	hrtimer_init(&ch->poll_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	ch->poll_timer.function = mic_dma_poll_timer_fn;
+	INIT_WORK(&ch->poll_work, mic_dma_poll_work);
 
 
 error:
@@ -1070,7 +1529,9 @@ error:
 
 static void mic_dma_uninit(struct mic_dma_device *mic_dma_dev)
 {
-	mic_dma_free_irq(mic_dma_dev);
+	hrtimer_cancel(&mic_dma_dev->mic_chan.poll_timer);
+	cancel_work_sync(&mic_dma_dev->mic_chan.poll_work);
+	mic_dma_dev->hw_ops->free_irq(mic_dma_dev);
 }
 
 static int mic_register_dma_device(struct mic_dma_device *mic_dma_dev)
@@ -1083,12 +1544,16 @@ static int mic_register_dma_device(struct mic_dma_device *mic_dma_dev)
 	/* MIC DMA FIX: Remove private flag from caps if running dmatest */
 	dma_cap_set(DMA_PRIVATE, dma_dev->cap_mask);
 	dma_cap_set(DMA_MEMCPY, dma_dev->cap_mask);
+	dma_cap_set(DMA_SLAVE, dma_dev->cap_mask);
 
 	dma_dev->device_alloc_chan_resources = mic_dma_alloc_chan_resources;
 	dma_dev->device_free_chan_resources = mic_dma_free_chan_resources;
 	dma_dev->device_tx_status = mic_dma_tx_status;
 	dma_dev->device_prep_dma_memcpy = mic_dma_prep_memcpy_lock;
 	dma_dev->device_prep_dma_interrupt = mic_dma_prep_interrupt_lock;
+	dma_dev->device_prep_slave_sg = mic_dma_prep_slave_sg_lock;
+	dma_dev->device_config = mic_dma_slave_config;
+	dma_dev->directions = BIT(DMA_MEM_TO_DEV) | BIT(DMA_DEV_TO_MEM);
 	dma_dev->device_issue_pending = mic_dma_issue_pending;
 	INIT_LIST_HEAD(&dma_dev->channels);
 
@@ -1106,7 +1571,6 @@ static int mic_dma_probe(struct mic_dma_device *mic_dma_dev)
 	int rc = -EINVAL;
 
 	dma_dev = &mic_dma_dev->dma_dev;
-	dma_dev->dev = &mic_dma_dev->pdev->dev;
 
 	/* MIC X200 has one DMA channel per function */
 	dma_dev->chancnt = 1;
@@ -1115,14 +1579,14 @@ static int mic_dma_probe(struct mic_dma_device *mic_dma_dev)
 
 	rc = mic_dma_init(mic_dma_dev);
 	if (rc) {
-		dev_err(&mic_dma_dev->pdev->dev,
+		dev_err(dma_dev->dev,
 			"%s %d rc %d\n", __func__, __LINE__, rc);
 		goto init_error;
 	}
 
 	rc = mic_register_dma_device(mic_dma_dev);
 	if (rc) {
-		dev_err(&mic_dma_dev->pdev->dev,
+		dev_err(dma_dev->dev,
 			"%s %d rc %d\n", __func__, __LINE__, rc);
 		goto reg_error;
 	}
@@ -1536,6 +2000,472 @@ static const struct file_operations mic_dma_cleanup_ops = {
 	.release = mic_dma_cleanup_debug_release
 };
 
+static int mic_dma_intr_stats_seq_show(struct seq_file *s, void *pos)
+{
+	struct mic_dma_device *mic_dma_dev = s->private;
+	struct mic_dma_chan *ch = &mic_dma_dev->mic_chan;
+	u64 intr = ch->stats.intr, polls = ch->stats.polls;
+
+	seq_printf(s, "Interrupts requested %llu raised %llu\n",
+		   ch->stats.intr_req, intr);
+	seq_printf(s, "Poll timer expiries %llu\n", polls);
+	seq_printf(s, "Transfers completed %llu\n", ch->stats.completed);
+	seq_printf(s, "Ring full stalls %llu\n", ch->stats.ring_full);
+	seq_printf(s, "Completions per interrupt or poll %llu\n",
+		   intr + polls ? div64_u64(ch->stats.completed, intr + polls) :
+		   0);
+	return 0;
+}
+
+static int mic_dma_intr_stats_debug_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, mic_dma_intr_stats_seq_show, inode->i_private);
+}
+
+static int
+mic_dma_intr_stats_debug_release(struct inode *inode, struct file *file)
+{
+	return single_release(inode, file);
+}
+
+static const struct file_operations mic_dma_intr_stats_ops = {
+	.owner   = THIS_MODULE,
+	.open    = mic_dma_intr_stats_debug_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = mic_dma_intr_stats_debug_release
+};
+
+/*
+ * Descriptor ring benchmark: bench_count back to back copies of bench_size
+ * bytes followed by one interrupt, then MIC_DMA_BENCH_LAT_ITERS copies
+ * with an interrupt each, waited for one at a time. Last, for each setting
+ * in mic_dma_bench_mod, MIC_DMA_BENCH_MOD_COPIES copies which each ask for
+ * an interrupt, to show completions per interrupt under moderation.
+ */
+#define MIC_DMA_BENCH_LAT_ITERS	1000
+#define MIC_DMA_BENCH_MOD_COPIES	10000
+
+static const struct {
+	u32 count;
+	u32 usecs;
+	u8 poll;
+} mic_dma_bench_mod[] = {
+	{ 1, 0, 0 },
+	{ 8, 100, 0 },
+	{ 32, 100, 0 },
+	{ 1, 0, 1 },
+};
+
+static u32 mic_dma_bench_size = 4096;
+static u32 mic_dma_bench_count = 100000;
+
+static bool mic_dma_bench_filter(struct dma_chan *chan, void *param)
+{
+	return chan->device == param;
+}
+
+static void mic_dma_bench_callback(void *arg)
+{
+	complete(arg);
+}
+
+static struct completion *mic_dma_bench_alloc_done(void)
+{
+	struct completion *done;
+
+	/* Allocated before prep, which returns with prep_lock held */
+	done = kmalloc(sizeof(*done), GFP_KERNEL);
+	if (done)
+		init_completion(done);
+	return done;
+}
+
+/* Submit tx, which completes done, and wait for it. Frees done */
+static int mic_dma_bench_sync(struct dma_chan *chan,
+			      struct dma_async_tx_descriptor *tx,
+			      struct completion *done)
+{
+	int rc = 0;
+
+	if (!tx) {
+		rc = -ENOMEM;
+		goto free;
+	}
+	tx->callback = mic_dma_bench_callback;
+	tx->callback_param = done;
+	if (dma_submit_error(tx->tx_submit(tx))) {
+		rc = -EIO;
+		goto free;
+	}
+	dma_async_issue_pending(chan);
+	/* The callback may still run after a timeout, done is leaked then */
+	if (!wait_for_completion_timeout(done,
+				msecs_to_jiffies(mic_dma_ring_timeout_ms)))
+		return -ETIMEDOUT;
+free:
+	kfree(done);
+	return rc;
+}
+
+struct mic_dma_bench_mod_done {
+	atomic_t left;
+	struct completion done;
+};
+
+static void mic_dma_bench_mod_callback(void *arg)
+{
+	struct mic_dma_bench_mod_done *m = arg;
+
+	if (atomic_dec_and_test(&m->left))
+		complete(&m->done);
+}
+
+/*
+ * MIC_DMA_BENCH_MOD_COPIES copies which each ask for an interrupt, with
+ * the moderation setting m of ch. Prints the interrupts raised, the poll
+ * timer expiries and the completions per interrupt or poll.
+ */
+static int mic_dma_bench_moderation(struct seq_file *s, struct dma_chan *chan,
+				    dma_addr_t da, size_t size, int m)
+{
+	struct mic_dma_chan *ch = to_mic_dma_chan(chan);
+	u32 count = ch->intr_coalesce_count, usecs = ch->intr_coalesce_usecs;
+	u8 poll = ch->poll_mode;
+	struct dma_async_tx_descriptor *tx;
+	struct mic_dma_bench_mod_done *done;
+	u64 intr, polls, completed, ns;
+	ktime_t start;
+	int i, rc = 0;
+
+	done = kmalloc(sizeof(*done), GFP_KERNEL);
+	if (!done)
+		return -ENOMEM;
+	atomic_set(&done->left, MIC_DMA_BENCH_MOD_COPIES);
+	init_completion(&done->done);
+
+	ch->intr_coalesce_count = mic_dma_bench_mod[m].count;
+	ch->intr_coalesce_usecs = mic_dma_bench_mod[m].usecs;
+	ch->poll_mode = mic_dma_bench_mod[m].poll;
+	intr = ch->stats.intr;
+	polls = ch->stats.polls;
+	completed = ch->stats.completed;
+	start = ktime_get();
+	for (i = 0; i < MIC_DMA_BENCH_MOD_COPIES; i++) {
+		tx = chan->device->device_prep_dma_memcpy(chan, da + size, da,
+							  size,
+							  DMA_PREP_INTERRUPT);
+		if (!tx) {
+			rc = -ENOMEM;
+			break;
+		}
+		tx->callback = mic_dma_bench_mod_callback;
+		tx->callback_param = done;
+		tx->tx_submit(tx);
+		dma_async_issue_pending(chan);
+	}
+	/* Copies which were not submitted will not call back */
+	if (!rc || atomic_sub_return(MIC_DMA_BENCH_MOD_COPIES - i,
+				     &done->left)) {
+		if (!wait_for_completion_timeout(&done->done,
+				msecs_to_jiffies(mic_dma_ring_timeout_ms)))
+			rc = -ETIMEDOUT;
+	}
+	ns = max_t(u64, ktime_to_ns(ktime_sub(ktime_get(), start)), 1);
+	intr = ch->stats.intr - intr;
+	polls = ch->stats.polls - polls;
+	completed = ch->stats.completed - completed;
+	ch->intr_coalesce_count = count;
+	ch->intr_coalesce_usecs = usecs;
+	ch->poll_mode = poll;
+	/* A callback may still run after a timeout, done is leaked then */
+	if (rc == -ETIMEDOUT)
+		return rc;
+	kfree(done);
+	if (rc)
+		return rc;
+
+	seq_printf(s, "%5u %5u %4u %10llu %10llu %10llu %8llu\n",
+		   mic_dma_bench_mod[m].count, mic_dma_bench_mod[m].usecs,
+		   mic_dma_bench_mod[m].poll, intr, polls,
+		   intr + polls ? div64_u64(completed, intr + polls) : 0,
+		   div64_u64(ns, MIC_DMA_BENCH_MOD_COPIES));
+	return 0;
+}
+
+/* Submit an interrupt after what is queued and wait for it */
+static int mic_dma_bench_wait(struct dma_chan *chan, dma_addr_t dst,
+			      dma_addr_t src, size_t len)
+{
+	struct dma_async_tx_descriptor *tx;
+	struct completion *done;
+
+	done = mic_dma_bench_alloc_done();
+	if (!done)
+		return -ENOMEM;
+	if (len)
+		tx = chan->device->device_prep_dma_memcpy(chan, dst, src, len,
+							  DMA_PREP_INTERRUPT);
+	else
+		tx = chan->device->device_prep_dma_interrupt(chan,
+							     DMA_PREP_INTERRUPT);
+	return mic_dma_bench_sync(chan, tx, done);
+}
+
+static int mic_dma_bench_seq_show(struct seq_file *s, void *pos)
+{
+	struct mic_dma_device *mic_dma_dev = s->private;
+	struct dma_device *ddev = &mic_dma_dev->dma_dev;
+	struct dma_async_tx_descriptor *tx;
+	size_t size = mic_dma_bench_size;
+	u32 count = mic_dma_bench_count;
+	u64 ns, lat, lat_min = U64_MAX, lat_max = 0, lat_sum = 0;
+	u64 ring_full, completed;
+	struct mic_dma_chan *ch;
+	struct dma_chan *chan;
+	dma_cap_mask_t mask;
+	dma_addr_t da;
+	ktime_t start;
+	void *buf;
+	int i, rc = 0;
+
+	if (!size || size > mic_dma_dev->max_xfer_size || !count) {
+		seq_puts(s, "Invalid bench_size or bench_count\n");
+		return 0;
+	}
+	dma_cap_zero(mask);
+	dma_cap_set(DMA_MEMCPY, mask);
+	chan = dma_request_channel(mask, mic_dma_bench_filter, ddev);
+	if (!chan) {
+		seq_puts(s, "DMA channel busy\n");
+		return 0;
+	}
+	ch = to_mic_dma_chan(chan);
+	buf = dma_alloc_coherent(ddev->dev, 2 * size, &da, GFP_KERNEL);
+	if (!buf) {
+		rc = -ENOMEM;
+		goto release;
+	}
+
+	ring_full = ch->stats.ring_full;
+	completed = ch->stats.completed;
+	start = ktime_get();
+	for (i = 0; i < count; i++) {
+		tx = ddev->device_prep_dma_memcpy(chan, da + size, da, size, 0);
+		if (!tx) {
+			rc = -ENOMEM;
+			goto free;
+		}
+		tx->tx_submit(tx);
+	}
+	rc = mic_dma_bench_wait(chan, 0, 0, 0);
+	if (rc)
+		goto free;
+	ns = max_t(u64, ktime_to_ns(ktime_sub(ktime_get(), start)), 1);
+	seq_printf(s, "Copies %u of %zu bytes in %llu ns\n", count, size, ns);
+	seq_printf(s, "Descriptors/s %llu MB/s %llu\n",
+		   div64_u64((u64)count * NSEC_PER_SEC, ns),
+		   div64_u64((u64)count * size * 1000, ns));
+	seq_printf(s, "Ring full stalls %llu\n",
+		   ch->stats.ring_full - ring_full);
+	seq_printf(s, "Completions reaped %llu\n",
+		   ch->stats.completed - completed);
+
+	for (i = 0; i < MIC_DMA_BENCH_LAT_ITERS; i++) {
+		start = ktime_get();
+		rc = mic_dma_bench_wait(chan, da + size, da, size);
+		if (rc)
+			goto free;
+		lat = ktime_to_ns(ktime_sub(ktime_get(), start));
+		lat_min = min(lat_min, lat);
+		lat_max = max(lat_max, lat);
+		lat_sum += lat;
+	}
+	seq_printf(s, "Submit to complete ns min %llu avg %llu max %llu\n",
+		   lat_min, div64_u64(lat_sum, MIC_DMA_BENCH_LAT_ITERS),
+		   lat_max);
+
+	seq_printf(s, "%u copies each asking for an interrupt:\n",
+		   MIC_DMA_BENCH_MOD_COPIES);
+	seq_printf(s, "%5s %5s %4s %10s %10s %10s %8s\n", "count", "usecs",
+		   "poll", "intr", "polls", "compl/intr", "ns/copy");
+	for (i = 0; i < ARRAY_SIZE(mic_dma_bench_mod); i++) {
+		rc = mic_dma_bench_moderation(s, chan, da, size, i);
+		if (rc)
+			goto free;
+	}
+free:
+	/* A timed out copy may still land in buf */
+	if (rc != -ETIMEDOUT)
+		dma_free_coherent(ddev->dev, 2 * size, buf, da);
+release:
+	if (rc)
+		seq_printf(s, "Benchmark failed %d\n", rc);
+	dma_release_channel(chan);
+	return 0;
+}
+
+static int mic_dma_bench_debug_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, mic_dma_bench_seq_show, inode->i_private);
+}
+
+/*
+ * Scatter-gather benchmark: gather bench_sg_nents pages, every other page
+ * of a buffer, into a contiguous one, MIC_DMA_BENCH_SG_ITERS times with
+ * one memcpy prep per page and then with a single slave_sg prep. Prep
+ * time covers programming and submitting the descriptors, total time
+ * lasts until the completion callback has run.
+ */
+#define MIC_DMA_BENCH_SG_ITERS	100
+
+static u32 mic_dma_bench_sg_nents = 256;
+
+static int mic_dma_bench_sg_seq_show(struct seq_file *s, void *pos)
+{
+	struct mic_dma_device *mic_dma_dev = s->private;
+	struct dma_device *ddev = &mic_dma_dev->dma_dev;
+	struct dma_async_tx_descriptor *tx;
+	struct dma_slave_config cfg = { 0 };
+	u32 nents = mic_dma_bench_sg_nents;
+	size_t src_size = 2 * nents * PAGE_SIZE;
+	size_t dst_size = nents * PAGE_SIZE;
+	u64 prep_ns[2] = { 0 }, total_ns[2] = { 0 };
+	struct completion *done;
+	struct scatterlist *sgl;
+	struct dma_chan *chan;
+	dma_cap_mask_t mask;
+	dma_addr_t src_da, dst_da;
+	void *src, *dst;
+	ktime_t start;
+	int i, j, rc = 0;
+
+	if (!nents || nents > MIC_DMA_DESC_RX_SIZE / 2) {
+		seq_puts(s, "Invalid bench_sg_nents\n");
+		return 0;
+	}
+	dma_cap_zero(mask);
+	dma_cap_set(DMA_SLAVE, mask);
+	chan = dma_request_channel(mask, mic_dma_bench_filter, ddev);
+	if (!chan) {
+		seq_puts(s, "DMA channel busy\n");
+		return 0;
+	}
+	sgl = kcalloc(nents, sizeof(*sgl), GFP_KERNEL);
+	if (!sgl) {
+		rc = -ENOMEM;
+		goto release;
+	}
+	src = dma_alloc_coherent(ddev->dev, src_size, &src_da, GFP_KERNEL);
+	if (!src) {
+		rc = -ENOMEM;
+		goto free_sgl;
+	}
+	dst = dma_alloc_coherent(ddev->dev, dst_size, &dst_da, GFP_KERNEL);
+	if (!dst) {
+		rc = -ENOMEM;
+		goto free_src;
+	}
+
+	sg_init_table(sgl, nents);
+	for (j = 0; j < nents; j++) {
+		sg_dma_address(&sgl[j]) = src_da + 2 * j * PAGE_SIZE;
+		sg_dma_len(&sgl[j]) = PAGE_SIZE;
+	}
+	cfg.direction = DMA_MEM_TO_DEV;
+	cfg.dst_addr = dst_da;
+	ddev->device_config(chan, &cfg);
+
+	for (i = 0; i < MIC_DMA_BENCH_SG_ITERS; i++) {
+		start = ktime_get();
+		for (j = 0; j < nents; j++) {
+			tx = ddev->device_prep_dma_memcpy(chan,
+							  dst_da + j * PAGE_SIZE,
+							  sg_dma_address(&sgl[j]),
+							  PAGE_SIZE, 0);
+			if (!tx) {
+				rc = -ENOMEM;
+				goto free;
+			}
+			tx->tx_submit(tx);
+		}
+		prep_ns[0] += ktime_to_ns(ktime_sub(ktime_get(), start));
+		rc = mic_dma_bench_wait(chan, 0, 0, 0);
+		if (rc)
+			goto free;
+		total_ns[0] += ktime_to_ns(ktime_sub(ktime_get(), start));
+
+		done = mic_dma_bench_alloc_done();
+		if (!done) {
+			rc = -ENOMEM;
+			goto free;
+		}
+		start = ktime_get();
+		tx = ddev->device_prep_slave_sg(chan, sgl, nents,
+						DMA_MEM_TO_DEV,
+						DMA_PREP_INTERRUPT, NULL);
+		prep_ns[1] += ktime_to_ns(ktime_sub(ktime_get(), start));
+		rc = mic_dma_bench_sync(chan, tx, done);
+		if (rc)
+			goto free;
+		total_ns[1] += ktime_to_ns(ktime_sub(ktime_get(), start));
+	}
+	seq_printf(s, "Gather %u pages, ns per batch over %u batches\n",
+		   nents, MIC_DMA_BENCH_SG_ITERS);
+	seq_printf(s, "memcpy  prep %llu total %llu\n",
+		   div64_u64(prep_ns[0], MIC_DMA_BENCH_SG_ITERS),
+		   div64_u64(total_ns[0], MIC_DMA_BENCH_SG_ITERS));
+	seq_printf(s, "sg      prep %llu total %llu\n",
+		   div64_u64(prep_ns[1], MIC_DMA_BENCH_SG_ITERS),
+		   div64_u64(total_ns[1], MIC_DMA_BENCH_SG_ITERS));
+free:
+	/* A timed out copy may still land in the buffers */
+	if (rc == -ETIMEDOUT)
+		goto free_sgl;
+	dma_free_coherent(ddev->dev, dst_size, dst, dst_da);
+free_src:
+	dma_free_coherent(ddev->dev, src_size, src, src_da);
+free_sgl:
+	kfree(sgl);
+release:
+	if (rc)
+		seq_printf(s, "Benchmark failed %d\n", rc);
+	dma_release_channel(chan);
+	return 0;
+}
+
+static int mic_dma_bench_sg_debug_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, mic_dma_bench_sg_seq_show, inode->i_private);
+}
+
+static int mic_dma_bench_sg_debug_release(struct inode *inode,
+					  struct file *file)
+{
+	return single_release(inode, file);
+}
+
+static const struct file_operations mic_dma_bench_sg_ops = {
+	.owner   = THIS_MODULE,
+	.open    = mic_dma_bench_sg_debug_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = mic_dma_bench_sg_debug_release
+};
+
+static int mic_dma_bench_debug_release(struct inode *inode, struct file *file)
+{
+	return single_release(inode, file);
+}
+
+static const struct file_operations mic_dma_bench_ops = {
+	.owner   = THIS_MODULE,
+	.open    = mic_dma_bench_debug_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = mic_dma_bench_debug_release
+};
+
 static int mic_dma_stop_dbg_show(struct seq_file *s, void *pos)
 {
 	seq_puts(s, "Write to stop DMA engine\n");
@@ -1643,6 +2573,36 @@ static void mic_dma_debugfs_init(struct mic_dma_device *mic_dma_dev)
 	debugfs_create_file("stop", 0644,
 				mic_dma_dev->dbg_dir, mic_dma_dev,
 				&mic_dma_stop_dbg_ops);
+	debugfs_create_file("intr_stats", 0444,
+				mic_dma_dev->dbg_dir, mic_dma_dev,
+				&mic_dma_intr_stats_ops);
+	debugfs_create_u32("intr_coalesce_count", 0644,
+				mic_dma_dev->dbg_dir,
+				&mic_dma_dev->mic_chan.intr_coalesce_count);
+	debugfs_create_u32("intr_coalesce_usecs", 0644,
+				mic_dma_dev->dbg_dir,
+				&mic_dma_dev->mic_chan.intr_coalesce_usecs);
+	debugfs_create_u8("poll_mode", 0644,
+				mic_dma_dev->dbg_dir,
+				&mic_dma_dev->mic_chan.poll_mode);
+	debugfs_create_u32("pending_level", 0644,
+				mic_dma_dev->dbg_dir,
+				&mic_dma_pending_level);
+	debugfs_create_file("bench", 0400,
+				mic_dma_dev->dbg_dir, mic_dma_dev,
+				&mic_dma_bench_ops);
+	debugfs_create_u32("bench_size", 0644,
+				mic_dma_dev->dbg_dir,
+				&mic_dma_bench_size);
+	debugfs_create_u32("bench_count", 0644,
+				mic_dma_dev->dbg_dir,
+				&mic_dma_bench_count);
+	debugfs_create_file("bench_sg", 0400,
+				mic_dma_dev->dbg_dir, mic_dma_dev,
+				&mic_dma_bench_sg_ops);
+	debugfs_create_u32("bench_sg_nents", 0644,
+				mic_dma_dev->dbg_dir,
+				&mic_dma_bench_sg_nents);
 }
 
 
@@ -1667,6 +2627,8 @@ mic_x200_alloc_dma(struct pci_dev *pdev, void __iomem *iobase)
 	if (!d)
 		return NULL;
 	d->pdev = pdev;
+	d->dma_dev.dev = &pdev->dev;
+	d->hw_ops = &mic_dma_pci_ops;
 	d->reg_base = iobase;
 	return d;
 }
@@ -1725,19 +2687,83 @@ static struct pci_driver mic_x200_dma_driver = {
 	.remove   = mic_x200_dma_remove
 };
 
+static struct mic_dma_device *mic_dma_sw_probe(int id)
+{
+	struct platform_device *pdev;
+	struct mic_dma_device *d;
+	int rc = -ENOMEM;
+
+	pdev = platform_device_register_simple(MIC_DMA_DRV_NAME "_sw", id,
+					       NULL, 0);
+	if (IS_ERR(pdev))
+		return ERR_CAST(pdev);
+	d = kzalloc(sizeof(*d), GFP_KERNEL);
+	if (!d)
+		goto unregister;
+	d->sw = kzalloc(sizeof(*d->sw), GFP_KERNEL);
+	if (!d->sw)
+		goto free_dev;
+	rc = dma_coerce_mask_and_coherent(&pdev->dev, DMA_BIT_MASK(48));
+	if (rc)
+		goto free_sw;
+	d->sw->pdev = pdev;
+	init_waitqueue_head(&d->sw->wq);
+	spin_lock_init(&d->sw->lock);
+	d->dma_dev.dev = &pdev->dev;
+	d->hw_ops = &mic_dma_sw_ops;
+	rc = mic_dma_probe(d);
+	if (rc)
+		goto free_sw;
+	return d;
+free_sw:
+	kfree(d->sw);
+free_dev:
+	kfree(d);
+unregister:
+	platform_device_unregister(pdev);
+	return ERR_PTR(rc);
+}
+
+static void mic_dma_sw_remove(struct mic_dma_device *d)
+{
+	struct platform_device *pdev = d->sw->pdev;
+
+	mic_dma_remove(d);
+	kfree(d->sw);
+	kfree(d);
+	platform_device_unregister(pdev);
+}
+
 static int __init mic_x200_dma_init(void)
 {
-	int rc;
+	struct mic_dma_device *d;
+	int rc, i;
 
 	mic_dma_dbg_dir = debugfs_create_dir(KBUILD_MODNAME, NULL);
 	rc = pci_register_driver(&mic_x200_dma_driver);
-	if (rc)
+	if (rc) {
 		pr_err("%s %d rc %x\n", __func__, __LINE__, rc);
-	return rc;
+		return rc;
+	}
+	for (i = 0; i < min_t(unsigned int, sw_engines, MIC_DMA_SW_MAX); i++) {
+		d = mic_dma_sw_probe(i);
+		if (IS_ERR(d)) {
+			pr_err("%s %d software engine %d rc %ld\n",
+			       __func__, __LINE__, i, PTR_ERR(d));
+			break;
+		}
+		mic_dma_sw_devs[i] = d;
+	}
+	return 0;
 }
 
 static void __exit mic_x200_dma_exit(void)
 {
+	int i;
+
+	for (i = 0; i < MIC_DMA_SW_MAX; i++)
+		if (mic_dma_sw_devs[i])
+			mic_dma_sw_remove(mic_dma_sw_devs[i]);
 	pci_unregister_driver(&mic_x200_dma_driver);
 	debugfs_remove_recursive(mic_dma_dbg_dir);
 }
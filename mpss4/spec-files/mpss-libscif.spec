@@ -67,7 +67,7 @@ items necessary for software development.
 %files
 %defattr(-,root,root,-)
 "/usr/lib64/libscif.so.0"
-"/usr/lib64/libscif.so.0.0.1"
+"/usr/lib64/libscif.so.0.2.0"
 
 %files doc
 %defattr(-,root,root,-)
@@ -93,6 +93,16 @@ items necessary for software development.
 "/usr/share/man/man3/scif_readfrom.3.gz"
 "/usr/share/man/man3/scif_vwriteto.3.gz"
 "/usr/share/man/man3/scif_listen.3.gz"
+"/usr/share/man/man3/scif_setsockopt.3.gz"
+"/usr/share/man/man3/scif_getsockopt.3.gz"
+"/usr/share/man/man3/scif_send_multi.3.gz"
+"/usr/share/man/man3/scif_recv_multi.3.gz"
+"/usr/share/man/man3/scif_rma_post.3.gz"
+"/usr/share/man/man3/scif_cq_reap.3.gz"
+"/usr/share/man/man3/scif_pollset_create.3.gz"
+"/usr/share/man/man3/scif_pollset_ctl.3.gz"
+"/usr/share/man/man3/scif_pollset_wait.3.gz"
+"/usr/share/man/man3/scif_pollset_close.3.gz"
 
 %files devel
 %defattr(-,root,root,-)